@@ -0,0 +1,458 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "BackgroundPreparation.h"
+
+//Local
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccLog.h>
+#include <ccProgressDialog.h>
+
+//Qt
+#include <QCoreApplication>
+#include <QProgressDialog>
+#include <QThread>
+#include <QtConcurrent>
+
+//system
+#include <assert.h>
+#include <set>
+
+using namespace masc;
+
+BackgroundPreparation::BackgroundPreparation()
+	: m_suspended(false)
+	, m_busy(false)
+	, m_stopped(false)
+	, m_background(true)
+{
+}
+
+BackgroundPreparation::~BackgroundPreparation()
+{
+	cancel();
+}
+
+bool BackgroundPreparation::addJob(	const CorePoints& corePoints,
+									const Feature::Set& features,
+									SFCollector* generatedScalarFields,
+									const NeighborhoodParams& neighborhoodParams,
+									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (m_future.isRunning())
+	{
+		//too late
+		assert(false);
+		return false;
+	}
+
+	if (!corePoints.cloud || features.empty())
+	{
+		assert(false);
+		return false;
+	}
+
+	//compute the octrees now (the worker can't modify the DB tree)
+	std::set<ccPointCloud*> clouds;
+	clouds.insert(corePoints.cloud);
+	for (const Feature::Shared& feature : features)
+	{
+		if (feature->cloud1)
+			clouds.insert(feature->cloud1);
+		if (feature->cloud2)
+			clouds.insert(feature->cloud2);
+	}
+	for (ccPointCloud* cloud : clouds)
+	{
+		if (!cloud->getOctree())
+		{
+			ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(cloud->getName()).arg(cloud->size()));
+			if (!cloud->computeOctree(progressCb))
+			{
+				ccLog::Warning("[BackgroundPreparation] Failed to compute octree (not enough memory?)");
+				return false;
+			}
+		}
+	}
+
+	try
+	{
+		Job job;
+		job.corePoints = corePoints;
+		job.pending = features;
+		job.generatedScalarFields = generatedScalarFields;
+		job.neighborhoodParams = neighborhoodParams;
+		m_jobs.push_back(job);
+	}
+	catch (const std::bad_alloc&)
+	{
+		ccLog::Warning("[BackgroundPreparation] Not enough memory");
+		return false;
+	}
+
+	return true;
+}
+
+void BackgroundPreparation::start(bool background/*=true*/)
+{
+	if (m_future.isRunning())
+	{
+		assert(false);
+		return;
+	}
+
+	m_stopped = false;
+	m_background = background;
+	if (m_background)
+	{
+		m_future = QtConcurrent::run([this]() { run(); });
+	}
+}
+
+bool BackgroundPreparation::isReady(const Feature::Shared& feature) const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_ready.contains(feature.data());
+}
+
+bool BackgroundPreparation::isStopped() const
+{
+	QMutexLocker locker(&m_mutex);
+	return (!m_background || m_stopped);
+}
+
+bool BackgroundPreparation::nextBatch(size_t& jobIndex, Feature::Set& batch, bool priorityOnly/*=false*/)
+{
+	batch.clear();
+
+	//first the features we are waiting for (all together, so as to share the neighborhood extractions)
+	for (jobIndex = 0; jobIndex < m_jobs.size(); ++jobIndex)
+	{
+		Feature::Set& pending = m_jobs[jobIndex].pending;
+		for (Feature::Set::iterator it = pending.begin(); it != pending.end(); )
+		{
+			if (m_priority.contains(it->data()))
+			{
+				batch.push_back(*it);
+				it = pending.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		if (!batch.empty())
+		{
+			return true;
+		}
+	}
+
+	if (priorityOnly)
+	{
+		return false;
+	}
+
+	//then the other ones, by small batches
+	for (jobIndex = 0; jobIndex < m_jobs.size(); ++jobIndex)
+	{
+		Feature::Set& pending = m_jobs[jobIndex].pending;
+		if (pending.empty())
+		{
+			continue;
+		}
+
+		Feature::Shared first = pending.front();
+		if (!first->scaled())
+		{
+			batch.push_back(first);
+			pending.erase(pending.begin());
+			return true;
+		}
+
+		//all the pending features of the same scale
+		for (Feature::Set::iterator it = pending.begin(); it != pending.end(); )
+		{
+			if ((*it)->scaled() && (*it)->scale == first->scale)
+			{
+				batch.push_back(*it);
+				it = pending.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		return true;
+	}
+
+	return false;
+}
+
+bool BackgroundPreparation::prepareBatch(const Job& job, const Feature::Set& batch, CCCoreLib::GenericProgressCallback* progressCb, QString& error)
+{
+	//remember the scalar fields that exist before this batch
+	SFCollector::Map previousSFs;
+	if (job.generatedScalarFields)
+	{
+		previousSFs = job.generatedScalarFields->scalarFields;
+	}
+
+	bool success = Tools::PrepareFeatures(job.corePoints, batch, error, progressCb, job.generatedScalarFields, job.neighborhoodParams);
+
+	if (!success && job.generatedScalarFields)
+	{
+		//the scalar fields of an incomplete batch should never be kept
+		for (SFCollector::Map::const_iterator it = job.generatedScalarFields->scalarFields.begin(); it != job.generatedScalarFields->scalarFields.end(); ++it)
+		{
+			if (!previousSFs.contains(it.key()))
+			{
+				job.generatedScalarFields->setBehavior(it.key(), SFCollector::ALWAYS_REMOVE);
+			}
+		}
+	}
+
+	return success;
+}
+
+void BackgroundPreparation::batchDone(const Feature::Set& batch, bool success, const QString& error)
+{
+	for (const Feature::Shared& feature : batch)
+	{
+		if (success)
+		{
+			m_ready.insert(feature.data());
+		}
+		else
+		{
+			m_failed.insert(feature.data(), error);
+		}
+	}
+
+	if (!success)
+	{
+		ccLog::Warning(QString("[BackgroundPreparation] Failed to prepare %1 feature(s): %2").arg(batch.size()).arg(error));
+	}
+}
+
+void BackgroundPreparation::run()
+{
+	QMutexLocker locker(&m_mutex);
+
+	while (true)
+	{
+		while (m_suspended && !m_cancelCallback.isCancelRequested())
+		{
+			m_condition.wait(&m_mutex);
+		}
+		if (m_cancelCallback.isCancelRequested())
+		{
+			break;
+		}
+
+		size_t jobIndex = 0;
+		Feature::Set batch;
+		if (!nextBatch(jobIndex, batch))
+		{
+			//nothing left to do
+			break;
+		}
+		const Job& job = m_jobs[jobIndex];
+		m_busy = true;
+		locker.unlock();
+
+		QString error;
+		bool success = prepareBatch(job, batch, &m_cancelCallback, error);
+
+		locker.relock();
+		m_busy = false;
+		if (!success && m_cancelCallback.isCancelRequested())
+		{
+			m_error = error;
+			m_condition.wakeAll();
+			break;
+		}
+		//a failed batch only concerns its own features: we keep going with the other ones
+		batchDone(batch, success, error);
+		m_condition.wakeAll();
+	}
+
+	m_stopped = true;
+	m_condition.wakeAll();
+}
+
+bool BackgroundPreparation::waitFor(const Feature::Set& features, QString& error, QWidget* parentWidget/*=nullptr*/)
+{
+	//prepare these features first
+	{
+		QMutexLocker locker(&m_mutex);
+		m_priority.clear();
+		for (const Feature::Shared& feature : features)
+		{
+			m_priority.insert(feature.data());
+		}
+		m_suspended = false;
+		m_condition.wakeAll();
+	}
+
+	if (!m_background)
+	{
+		//no worker: the features are prepared right away, in this thread
+		QScopedPointer<ccProgressDialog> pDlg;
+		if (parentWidget)
+		{
+			pDlg.reset(new ccProgressDialog(true, parentWidget));
+			pDlg->setAutoClose(false);
+		}
+
+		//features that already failed
+		{
+			QMutexLocker locker(&m_mutex);
+			for (const Feature::Shared& feature : features)
+			{
+				if (m_failed.contains(feature.data()))
+				{
+					error = m_failed.value(feature.data());
+					return false;
+				}
+			}
+		}
+
+		while (true)
+		{
+			size_t jobIndex = 0;
+			Feature::Set batch;
+			{
+				QMutexLocker locker(&m_mutex);
+				if (!nextBatch(jobIndex, batch, true))
+				{
+					break;
+				}
+			}
+
+			bool success = prepareBatch(m_jobs[jobIndex], batch, pDlg.data(), error);
+
+			QMutexLocker locker(&m_mutex);
+			batchDone(batch, success, error);
+			if (!success)
+			{
+				return false;
+			}
+		}
+
+		if (pDlg)
+		{
+			pDlg->close();
+			QCoreApplication::processEvents();
+		}
+
+		return true;
+	}
+
+	QScopedPointer<QProgressDialog> pDlg;
+	while (true)
+	{
+		int readyCount = 0;
+		bool failed = false;
+		{
+			QMutexLocker locker(&m_mutex);
+			for (const Feature::Shared& feature : features)
+			{
+				if (m_ready.contains(feature.data()))
+				{
+					++readyCount;
+				}
+				else if (m_failed.contains(feature.data()))
+				{
+					//only the failure of one of the requested features matters
+					error = m_failed.value(feature.data());
+					failed = true;
+					break;
+				}
+			}
+			if (!failed && m_stopped && readyCount != static_cast<int>(features.size()))
+			{
+				//cancelled
+				error = m_error.isEmpty() ? QString("Failed to prepare the features") : m_error;
+				failed = true;
+			}
+		}
+
+		if (failed)
+		{
+			return false;
+		}
+		if (readyCount == static_cast<int>(features.size()))
+		{
+			break;
+		}
+
+		if (parentWidget)
+		{
+			if (!pDlg)
+			{
+				pDlg.reset(new QProgressDialog(parentWidget));
+				pDlg->setRange(0, static_cast<int>(features.size()));
+				pDlg->setLabelText("Waiting for the features to be prepared");
+				pDlg->show();
+			}
+			else if (pDlg->wasCanceled())
+			{
+				cancel();
+				error = "Process cancelled by the user";
+				return false;
+			}
+			pDlg->setValue(readyCount);
+		}
+		QCoreApplication::processEvents();
+		QThread::msleep(100);
+	}
+
+	if (pDlg)
+	{
+		pDlg->close();
+		QCoreApplication::processEvents();
+	}
+
+	//suspend the worker (once it has finished its current batch)
+	QMutexLocker locker(&m_mutex);
+	m_suspended = true;
+	while (m_busy)
+	{
+		m_condition.wait(&m_mutex);
+	}
+
+	return true;
+}
+
+void BackgroundPreparation::resume()
+{
+	QMutexLocker locker(&m_mutex);
+	m_suspended = false;
+	m_condition.wakeAll();
+}
+
+void BackgroundPreparation::cancel()
+{
+	m_cancelCallback.requestCancel();
+	{
+		QMutexLocker locker(&m_mutex);
+		m_condition.wakeAll();
+	}
+	m_future.waitForFinished();
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeaturesInterface.h"
+#include "CorePoints.h"
+#include "ScalarFieldCollector.h"
+#include "Parameters.h"
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QAtomicInt>
+#include <QFuture>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QWaitCondition>
+
+class QWidget;
+
+namespace masc
+{
+	//! Prepares features in a worker thread while the user interacts with the training dialog
+	/** The features to wait for (see 'waitFor') are prepared first, all together so that
+		the neighborhood extractions are shared. The remaining ones are then prepared by
+		small batches (one unscaled feature, or all the pending features of a given scale)
+		so that the worker can be suspended quickly when the main thread needs the clouds.
+		A failed batch doesn't stop the worker: its features are marked as failed (they
+		share the same neighborhood extractions) and the other batches are still prepared.
+		\warning The worker adds scalar fields to the clouds: they must not be displayed
+		(i.e. added to the DB tree) until it has stopped (see 'isStopped'). Otherwise, the
+		features should be prepared in the calling thread (see 'start').
+	**/
+	class BackgroundPreparation
+	{
+	public:
+
+		//! Default constructor
+		BackgroundPreparation();
+
+		//! Destructor (cancels the preparation if necessary)
+		~BackgroundPreparation();
+
+		//! Adds a set of features to prepare on a given set of core points
+		/** Must be called before 'start'. The octrees of all the involved clouds are
+			computed here (i.e. in the calling thread) as they are attached to the DB tree.
+			\param corePoints core points (must be already prepared)
+			\param features features to prepare
+			\param generatedScalarFields to track the generated scalar fields
+			\param neighborhoodParams neighborhood extraction parameters
+			\param progressCb to display the octree computation progress (optional)
+			\return false if an octree couldn't be computed
+		**/
+		bool addJob(const CorePoints& corePoints,
+					const Feature::Set& features,
+					SFCollector* generatedScalarFields,
+					const NeighborhoodParams& neighborhoodParams,
+					CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Starts the worker
+		/** \param background whether the features are prepared by a worker thread, or only
+			when waiting for them (in the calling thread, e.g. if the clouds are displayed)
+		**/
+		void start(bool background = true);
+
+		//! Returns whether a feature has been prepared
+		bool isReady(const Feature::Shared& feature) const;
+
+		//! Returns whether the worker has stopped (all done, failure or cancellation)
+		/** The clouds can then be safely displayed. **/
+		bool isStopped() const;
+
+		//! Waits for a set of features to be prepared
+		/** These features are prepared in priority. A progress dialog is displayed
+			if a parent widget is provided.
+			\warning on success, the worker is suspended so that the caller can safely
+			use the clouds (call 'resume' afterwards).
+			\return false if one of these features couldn't be prepared, or if the preparation was cancelled (see 'error')
+		**/
+		bool waitFor(const Feature::Set& features, QString& error, QWidget* parentWidget = nullptr);
+
+		//! Resumes the worker (after a call to 'waitFor')
+		void resume();
+
+		//! Cancels the preparation (and waits for the worker to stop)
+		void cancel();
+
+	protected: //methods
+
+		struct Job;
+
+		//! Worker method
+		void run();
+
+		//! Extracts the next batch of features to prepare
+		/** \warning must be called with the mutex locked
+		**/
+		bool nextBatch(size_t& jobIndex, Feature::Set& batch, bool priorityOnly = false);
+
+		//! Prepares a batch of features (the scalar fields of an incomplete batch are discarded)
+		bool prepareBatch(const Job& job, const Feature::Set& batch, CCCoreLib::GenericProgressCallback* progressCb, QString& error);
+
+		//! Records the result of a batch
+		/** \warning must be called with the mutex locked
+		**/
+		void batchDone(const Feature::Set& batch, bool success, const QString& error);
+
+	protected: //members
+
+		//! Silent progress callback (only used to cancel the worker)
+		class CancelCallback : public CCCoreLib::GenericProgressCallback
+		{
+		public:
+			void update(float percent) override {}
+			void setMethodTitle(const char* methodTitle) override {}
+			void setInfo(const char* infoStr) override {}
+			void start() override {}
+			void stop() override {}
+			bool isCancelRequested() override { return m_cancelRequested.loadAcquire() != 0; }
+			bool textCanBeEdited() const override { return false; }
+
+			inline void requestCancel() { m_cancelRequested.storeRelease(1); }
+
+		protected:
+			QAtomicInt m_cancelRequested;
+		};
+
+		//! Set of features to prepare on a given set of core points
+		struct Job
+		{
+			CorePoints corePoints;
+			Feature::Set pending;
+			SFCollector* generatedScalarFields = nullptr;
+			NeighborhoodParams neighborhoodParams;
+		};
+
+		//! Jobs
+		std::vector<Job> m_jobs;
+		//! Features to prepare first
+		QSet<const Feature*> m_priority;
+		//! Prepared features
+		QSet<const Feature*> m_ready;
+		//! Features that couldn't be prepared (with the corresponding error)
+		QMap<const Feature*, QString> m_failed;
+		//! Last error (cancellation)
+		QString m_error;
+		//! Whether the worker is suspended
+		bool m_suspended;
+		//! Whether the worker is currently preparing a batch
+		bool m_busy;
+		//! Whether the worker has stopped (all done, failure or cancellation)
+		bool m_stopped;
+		//! Whether the features are prepared by the worker thread (see 'start')
+		bool m_background;
+
+		//! Mutex (for all the members above)
+		mutable QMutex m_mutex;
+		//! Wait condition (to suspend/resume the worker)
+		QWaitCondition m_condition;
+
+		//! Worker
+		QFuture<void> m_future;
+		//! Cancel callback
+		CancelCallback m_cancelCallback;
+	};
+
+}; //namespace masc
@@ -0,0 +1,187 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ColumnIndex.h"
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+//! Maximum number of cells (to avoid silly memory consumption, same as GroundRaster)
+static const size_t MaxCellCount = (static_cast<size_t>(1) << 24);
+
+bool ColumnIndex::build(CCCoreLib::GenericIndexedCloudPersist* cloud, double cellSize, QString& errorMessage, const ExecutionContext& context/*=ExecutionContext()*/)
+{
+	m_cloud = nullptr;
+	m_indexes.clear();
+	m_z.clear();
+	m_cellStart.clear();
+	m_width = m_height = 0;
+
+	if (!cloud || cloud->size() == 0 || !(cellSize > 0))
+	{
+		assert(false);
+		errorMessage = "Invalid input parameters";
+		return false;
+	}
+
+	CCVector3 bbMin, bbMax;
+	cloud->getBoundingBox(bbMin, bbMax);
+	double width = std::floor((bbMax.x - bbMin.x) / cellSize) + 1;
+	double height = std::floor((bbMax.y - bbMin.y) / cellSize) + 1;
+	if (width * height > static_cast<double>(MaxCellCount))
+	{
+		//we increase the cell size
+		cellSize *= sqrt(width * height / MaxCellCount);
+		width = std::floor((bbMax.x - bbMin.x) / cellSize) + 1;
+		height = std::floor((bbMax.y - bbMin.y) / cellSize) + 1;
+	}
+	m_cellSize = cellSize;
+	m_minX = bbMin.x;
+	m_minY = bbMin.y;
+	m_width = static_cast<unsigned>(width);
+	m_height = static_cast<unsigned>(height);
+	size_t cellCount = static_cast<size_t>(m_width) * m_height;
+
+	unsigned pointCount = cloud->size();
+	try
+	{
+		//counting sort of the points by cell
+		std::vector<unsigned> pointCells(pointCount);
+		m_cellStart.resize(cellCount + 1, 0);
+		for (unsigned i = 0; i < pointCount; ++i)
+		{
+			const CCVector3* P = cloud->getPoint(i);
+			unsigned ci = std::min(static_cast<unsigned>(std::max(0.0, (P->x - m_minX) / m_cellSize)), m_width - 1);
+			unsigned cj = std::min(static_cast<unsigned>(std::max(0.0, (P->y - m_minY) / m_cellSize)), m_height - 1);
+			pointCells[i] = static_cast<unsigned>(static_cast<size_t>(cj) * m_width + ci);
+			++m_cellStart[pointCells[i]];
+		}
+		//end of each cell
+		for (size_t c = 1; c < cellCount; ++c)
+		{
+			m_cellStart[c] += m_cellStart[c - 1];
+		}
+		m_cellStart[cellCount] = pointCount;
+
+		//the points are placed backwards, so that each cell ends up with its start position (no extra copy)
+		m_indexes.resize(pointCount);
+		for (unsigned i = pointCount; i-- > 0;)
+		{
+			m_indexes[--m_cellStart[pointCells[i]]] = i;
+		}
+
+		//sort the points of each cell by Z
+		m_z.resize(pointCount);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, 256)
+#endif
+		for (int c = 0; c < static_cast<int>(cellCount); ++c)
+		{
+			std::vector<unsigned>::iterator first = m_indexes.begin() + m_cellStart[c];
+			std::vector<unsigned>::iterator last = m_indexes.begin() + m_cellStart[c + 1];
+			std::sort(first, last, [cloud](unsigned a, unsigned b) { return cloud->getPoint(a)->z < cloud->getPoint(b)->z; });
+			for (unsigned k = m_cellStart[c]; k < m_cellStart[c + 1]; ++k)
+			{
+				m_z[k] = cloud->getPoint(m_indexes[k])->z;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		m_indexes.clear();
+		m_z.clear();
+		m_cellStart.clear();
+		return false;
+	}
+
+	m_cloud = cloud;
+	return true;
+}
+
+size_t ColumnIndex::findNeighborsInColumn(	const CCVector3& center,
+											double radius,
+											CCCoreLib::DgmOctree::NeighboursSet& neighbours,
+											bool sortByDistance,
+											double minZ/*=-inf*/,
+											double maxZ/*=inf*/) const
+{
+	neighbours.clear();
+	if (!m_cloud)
+	{
+		assert(false);
+		return 0;
+	}
+
+	double cellMinX = std::floor((center.x - radius - m_minX) / m_cellSize);
+	double cellMaxX = std::floor((center.x + radius - m_minX) / m_cellSize);
+	double cellMinY = std::floor((center.y - radius - m_minY) / m_cellSize);
+	double cellMaxY = std::floor((center.y + radius - m_minY) / m_cellSize);
+	if (cellMaxX < 0 || cellMaxY < 0 || cellMinX >= m_width || cellMinY >= m_height)
+	{
+		return 0;
+	}
+	unsigned i0 = static_cast<unsigned>(std::max(0.0, cellMinX));
+	unsigned i1 = static_cast<unsigned>(std::min(cellMaxX, m_width - 1.0));
+	unsigned j0 = static_cast<unsigned>(std::max(0.0, cellMinY));
+	unsigned j1 = static_cast<unsigned>(std::min(cellMaxY, m_height - 1.0));
+
+	double sqRadius = radius * radius;
+	for (unsigned j = j0; j <= j1; ++j)
+	{
+		for (unsigned i = i0; i <= i1; ++i)
+		{
+			size_t c = static_cast<size_t>(j) * m_width + i;
+
+			//vertical bounds (the points are sorted by Z)
+			std::vector<PointCoordinateType>::const_iterator zBegin = m_z.begin() + m_cellStart[c];
+			std::vector<PointCoordinateType>::const_iterator zEnd = m_z.begin() + m_cellStart[c + 1];
+			if (std::isfinite(minZ))
+				zBegin = std::lower_bound(zBegin, zEnd, static_cast<PointCoordinateType>(minZ));
+			if (std::isfinite(maxZ))
+				zEnd = std::upper_bound(zBegin, zEnd, static_cast<PointCoordinateType>(maxZ));
+
+			for (size_t k = zBegin - m_z.begin(); k < static_cast<size_t>(zEnd - m_z.begin()); ++k)
+			{
+				unsigned index = m_indexes[k];
+				const CCVector3* P = m_cloud->getPointPersistentPtr(index);
+				double dx = P->x - center.x;
+				double dy = P->y - center.y;
+				double squareDist = dx * dx + dy * dy;
+				if (squareDist <= sqRadius)
+				{
+					neighbours.emplace_back(P, index, squareDist);
+				}
+			}
+		}
+	}
+
+	if (sortByDistance)
+	{
+		std::sort(neighbours.begin(), neighbours.end(), CCCoreLib::DgmOctree::PointDescriptor::distComp);
+	}
+
+	return neighbours.size();
+}
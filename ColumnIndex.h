@@ -0,0 +1,89 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ExecutionContext.h"
+
+//CCLib
+#include <DgmOctree.h>
+#include <GenericIndexedCloudPersist.h>
+
+//Qt
+#include <QString>
+
+//system
+#include <limits>
+#include <vector>
+
+namespace masc
+{
+	//! 2D (XY) grid index for vertical cylindrical neighborhoods (columns)
+	/** The points of each cell are sorted by increasing Z, so that a column can
+		also be bounded vertically with a binary search.
+	**/
+	class ColumnIndex
+	{
+	public:
+
+		//! Builds the index
+		/** \param cloud input cloud
+			\param cellSize grid cell size (typically half the query radius, increased if the grid is too large)
+			\param context execution context (number of threads)
+		**/
+		bool build(CCCoreLib::GenericIndexedCloudPersist* cloud, double cellSize, QString& errorMessage, const ExecutionContext& context = ExecutionContext());
+
+		//! Extracts the points inside a vertical cylinder
+		/** The 'squareDistd' field of the output descriptors is the squared horizontal distance.
+			\param center cylinder axis position (only X and Y are considered)
+			\param radius cylinder radius
+			\param neighbours output neighbors (the vector is cleared first)
+			\param sortByDistance whether to sort the neighbors by increasing (horizontal) distance
+			\param minZ lower bound of the cylinder
+			\param maxZ upper bound of the cylinder
+			\return the number of neighbors
+		**/
+		size_t findNeighborsInColumn(	const CCVector3& center,
+										double radius,
+										CCCoreLib::DgmOctree::NeighboursSet& neighbours,
+										bool sortByDistance,
+										double minZ = -std::numeric_limits<double>::infinity(),
+										double maxZ = std::numeric_limits<double>::infinity()) const;
+
+		//! Returns the cell size
+		inline double cellSize() const { return m_cellSize; }
+
+	protected: //members
+
+		//! Associated cloud
+		CCCoreLib::GenericIndexedCloudPersist* m_cloud = nullptr;
+		//! Point indexes (sorted by cell, then by Z)
+		std::vector<unsigned> m_indexes;
+		//! Z values (same order as the indexes)
+		std::vector<PointCoordinateType> m_z;
+		//! Position of the first point of each cell (+ one extra value)
+		std::vector<unsigned> m_cellStart;
+		//! Grid size
+		unsigned m_width = 0, m_height = 0;
+		//! Grid origin (lower left corner)
+		double m_minX = 0, m_minY = 0;
+		//! Cell size
+		double m_cellSize = 0;
+	};
+
+}; //namespace masc
@@ -0,0 +1,250 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "CompiledForest.h"
+
+//Qt
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLibrary>
+#include <QObject>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTextStream>
+
+//system
+#include <assert.h>
+#include <cmath>
+
+using namespace masc;
+
+//! Exported symbols of the generated libraries
+static const char MASC_FOREST_HASH_SYMBOL[] = "masc_forest_hash";
+static const char MASC_FOREST_VAR_COUNT_SYMBOL[] = "masc_forest_var_count";
+static const char MASC_FOREST_CLASS_COUNT_SYMBOL[] = "masc_forest_class_count";
+static const char MASC_FOREST_VOTES_SYMBOL[] = "masc_forest_votes";
+
+//! Returns the C++ literal of a float value (exact round trip)
+static QString FloatLiteral(float value)
+{
+	if (std::isinf(value))
+	{
+		return (value < 0 ? "-std::numeric_limits<float>::infinity()" : "std::numeric_limits<float>::infinity()");
+	}
+
+	QString literal = QString::number(static_cast<double>(value), 'g', 9);
+	if (!literal.contains('.') && !literal.contains('e'))
+	{
+		literal += ".0";
+	}
+	return literal + "f";
+}
+
+QString CompiledForest::ModelHash(const FlatForest& forest)
+{
+	return QString("%1").arg(static_cast<qulonglong>(forest.hash()), 16, 16, QChar('0'));
+}
+
+QString CompiledForest::LibraryFilename(const FlatForest& forest, const QString& directory)
+{
+#if defined(_WIN32)
+	static const char LibrarySuffix[] = ".dll";
+#elif defined(__APPLE__)
+	static const char LibrarySuffix[] = ".dylib";
+#else
+	static const char LibrarySuffix[] = ".so";
+#endif
+	return QDir(directory).absoluteFilePath("masc_forest_" + ModelHash(forest) + LibrarySuffix);
+}
+
+void CompiledForest::WriteNode(QTextStream& stream, const FlatForest& forest, int nodeIndex, int depth)
+{
+	const FlatForest::Node& node = forest.m_nodes[nodeIndex];
+	QString indent(depth, QChar('\t'));
+	if (node.varIdx < 0)
+	{
+		stream << indent << "return " << node.le << ";\n";
+		return;
+	}
+
+	if (std::isnan(node.threshold))
+	{
+		//'value <= NaN' is always false
+		WriteNode(stream, forest, node.gt, depth);
+		return;
+	}
+
+	stream << indent << "if (x[" << node.varIdx << "] <= " << FloatLiteral(node.threshold) << ")\n";
+	stream << indent << "{\n";
+	WriteNode(stream, forest, node.le, depth + 1);
+	stream << indent << "}\n";
+	stream << indent << "else\n";
+	stream << indent << "{\n";
+	WriteNode(stream, forest, node.gt, depth + 1);
+	stream << indent << "}\n";
+}
+
+bool CompiledForest::GenerateSource(const FlatForest& forest, const QString& sourceFilename, QString& errorMessage)
+{
+	if (!forest.isValid())
+	{
+		errorMessage = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	QFile file(sourceFilename);
+	if (!file.open(QFile::WriteOnly | QFile::Text))
+	{
+		errorMessage = QObject::tr("Failed to create file %1").arg(sourceFilename);
+		return false;
+	}
+
+	QTextStream stream(&file);
+	stream << "//3DMASC compiled random forest (generated file)\n";
+	stream << "//model hash: " << ModelHash(forest) << "\n";
+	stream << "//" << forest.treeCount() << " trees, " << forest.nodeCount() << " nodes, " << forest.classCount() << " classes, " << forest.varCount() << " features\n\n";
+	stream << "#include <limits>\n\n";
+	stream << "#if defined(_WIN32)\n";
+	stream << "#define MASC_EXPORT extern \"C\" __declspec(dllexport)\n";
+	stream << "#else\n";
+	stream << "#define MASC_EXPORT extern \"C\" __attribute__((visibility(\"default\")))\n";
+	stream << "#endif\n\n";
+
+	//one function per tree (returns the class index)
+	for (int t = 0; t < forest.treeCount(); ++t)
+	{
+		stream << "static int tree" << t << "(const float* x)\n";
+		stream << "{\n";
+		WriteNode(stream, forest, forest.m_roots[t], 1);
+		stream << "}\n\n";
+	}
+
+	stream << "MASC_EXPORT const char* " << MASC_FOREST_HASH_SYMBOL << "() { return \"" << ModelHash(forest) << "\"; }\n";
+	stream << "MASC_EXPORT int " << MASC_FOREST_VAR_COUNT_SYMBOL << "() { return " << forest.varCount() << "; }\n";
+	stream << "MASC_EXPORT int " << MASC_FOREST_CLASS_COUNT_SYMBOL << "() { return " << forest.classCount() << "; }\n\n";
+
+	stream << "MASC_EXPORT void " << MASC_FOREST_VOTES_SYMBOL << "(const float* x, int* votes)\n";
+	stream << "{\n";
+	stream << "\tfor (int c = 0; c < " << forest.classCount() << "; ++c)\n";
+	stream << "\t\tvotes[c] = 0;\n";
+	for (int t = 0; t < forest.treeCount(); ++t)
+	{
+		stream << "\t++votes[tree" << t << "(x)];\n";
+	}
+	stream << "}\n";
+
+	stream.flush();
+	if (file.error() != QFile::NoError)
+	{
+		errorMessage = QObject::tr("Failed to write file %1").arg(sourceFilename);
+		return false;
+	}
+
+	return true;
+}
+
+bool CompiledForest::Build(const FlatForest& forest, const QString& directory, QString& errorMessage)
+{
+	QString libraryFilename = LibraryFilename(forest, directory);
+	QString sourceFilename = QFileInfo(libraryFilename).completeBaseName() + ".cpp";
+	if (!GenerateSource(forest, QDir(directory).absoluteFilePath(sourceFilename), errorMessage))
+	{
+		return false;
+	}
+
+	QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+#if defined(_WIN32)
+	QString compiler = environment.value("MASC_CXX", environment.value("CXX", "cl"));
+	QStringList arguments{ "/nologo", "/O2", "/LD", sourceFilename, "/Fe" + libraryFilename };
+#else
+	QString compiler = environment.value("MASC_CXX", environment.value("CXX", "c++"));
+	QStringList arguments{ "-O2", "-shared", "-fPIC", "-o", libraryFilename, sourceFilename };
+#endif
+
+	QProcess process;
+	process.setWorkingDirectory(directory);
+	process.setProcessChannelMode(QProcess::MergedChannels);
+	process.start(compiler, arguments);
+	if (!process.waitForStarted())
+	{
+		errorMessage = QObject::tr("Failed to start the compiler (%1): set the MASC_CXX environment variable").arg(compiler);
+		return false;
+	}
+	process.waitForFinished(-1); //large forests may take a while
+	if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+	{
+		errorMessage = QObject::tr("Failed to build the compiled forest: %1 %2\n%3").arg(compiler, arguments.join(' '), QString::fromLocal8Bit(process.readAll().left(4096)));
+		return false;
+	}
+
+	return true;
+}
+
+bool CompiledForest::load(const FlatForest& forest, const QString& directory, QString& errorMessage)
+{
+	unload();
+	errorMessage.clear();
+
+	QString libraryFilename = LibraryFilename(forest, directory);
+	if (!forest.isValid() || !QFileInfo::exists(libraryFilename))
+	{
+		return false;
+	}
+
+	QSharedPointer<QLibrary> library(new QLibrary(libraryFilename));
+	if (!library->load())
+	{
+		errorMessage = library->errorString();
+		return false;
+	}
+
+	typedef const char* (*HashFunction)();
+	typedef int (*CountFunction)();
+	HashFunction hashFunction = reinterpret_cast<HashFunction>(library->resolve(MASC_FOREST_HASH_SYMBOL));
+	CountFunction varCountFunction = reinterpret_cast<CountFunction>(library->resolve(MASC_FOREST_VAR_COUNT_SYMBOL));
+	CountFunction classCountFunction = reinterpret_cast<CountFunction>(library->resolve(MASC_FOREST_CLASS_COUNT_SYMBOL));
+	VotesFunction votesFunction = reinterpret_cast<VotesFunction>(library->resolve(MASC_FOREST_VOTES_SYMBOL));
+	if (!hashFunction || !varCountFunction || !classCountFunction || !votesFunction)
+	{
+		errorMessage = QObject::tr("%1 is not a compiled forest").arg(libraryFilename);
+		return false;
+	}
+
+	//the library must match the forest exactly
+	if (	ModelHash(forest) != QString(hashFunction())
+		||	varCountFunction() != forest.varCount()
+		||	classCountFunction() != forest.classCount())
+	{
+		errorMessage = QObject::tr("%1 doesn't match the classifier").arg(libraryFilename);
+		return false;
+	}
+
+	m_library = library;
+	m_votesFunction = votesFunction;
+	m_classCount = forest.classCount();
+
+	return true;
+}
+
+void CompiledForest::unload()
+{
+	//the library itself stays loaded as long as the process needs it (other copies may use it)
+	m_votesFunction = nullptr;
+	m_classCount = 0;
+	m_library.clear();
+}
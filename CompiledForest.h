@@ -0,0 +1,100 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FlatForest.h"
+
+//Qt
+#include <QSharedPointer>
+#include <QString>
+
+class QLibrary;
+class QTextStream;
+
+namespace masc
+{
+	//! Ahead-of-time compiled version of a random forest
+	/** The trees of a (fixed) forest are exported as C++ code (nested comparisons with
+		constant thresholds and feature indexes) and built as a small shared library,
+		so that no node has to be loaded from memory at prediction time. The library
+		is identified by the hash of the model and is only used if it matches the forest
+		exactly (the generic FlatForest is used otherwise). As it is native code, it is
+		only loaded on the explicit request of the user (the hash is not a signature).
+	**/
+	class CompiledForest
+	{
+	public:
+
+		//! Returns the hash of a forest (as a string)
+		static QString ModelHash(const FlatForest& forest);
+
+		//! Returns the filename of the library corresponding to a forest
+		static QString LibraryFilename(const FlatForest& forest, const QString& directory);
+
+		//! Generates the C++ source code of a forest
+		static bool GenerateSource(const FlatForest& forest, const QString& sourceFilename, QString& errorMessage);
+
+		//! Generates the source code of a forest and builds the library (next to the source)
+		/** The compiler is given by the MASC_CXX (or CXX) environment variable
+			(by default: 'c++', or 'cl' on Windows).
+		**/
+		static bool Build(const FlatForest& forest, const QString& directory, QString& errorMessage);
+
+		//! Loads the library corresponding to a forest (if it exists)
+		/** \return false if the library doesn't exist (errorMessage is then empty) or if it can't be used
+		**/
+		bool load(const FlatForest& forest, const QString& directory, QString& errorMessage);
+
+		//! Unloads the library
+		void unload();
+
+		//! Returns whether a library is loaded
+		inline bool isLoaded() const { return m_votesFunction != nullptr; }
+
+		//! Computes the votes of all the trees for a given sample (same output as FlatForest::predict)
+		inline int predict(const float* sample, int* votes) const
+		{
+			m_votesFunction(sample, votes);
+
+			int bestIndex = 0;
+			for (int c = 1; c < m_classCount; ++c)
+			{
+				if (votes[c] > votes[bestIndex])
+					bestIndex = c;
+			}
+			return bestIndex;
+		}
+
+	protected:
+
+		//! Writes the code of a (sub)tree
+		static void WriteNode(QTextStream& stream, const FlatForest& forest, int nodeIndex, int depth);
+
+		//! Generated prediction function: fills the votes (classCount values) of a sample
+		typedef void (*VotesFunction)(const float* sample, int* votes);
+
+		//! Loaded library
+		QSharedPointer<QLibrary> m_library;
+		//! Prediction function
+		VotesFunction m_votesFunction = nullptr;
+		//! Number of classes
+		int m_classCount = 0;
+	};
+
+}; //namespace masc
@@ -0,0 +1,297 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ConfusionAccumulator.h"
+
+//qCC_db
+#include <ccLog.h>
+
+//CCLib
+#include <CCConst.h>
+
+//Qt
+#include <QFile>
+#include <QTextStream>
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+using namespace masc;
+
+void ConfusionAccumulator::merge(const Chunk& chunk)
+{
+	QMutexLocker locker(&m_mutex);
+
+	for (size_t actualIdx = 0; actualIdx < chunk.m_labels.size(); ++actualIdx)
+	{
+		const std::vector<uint64_t>& row = chunk.m_counts[actualIdx];
+		for (size_t predictedIdx = 0; predictedIdx < row.size(); ++predictedIdx)
+		{
+			if (row[predictedIdx] != 0)
+			{
+				m_counts[chunk.m_labels[actualIdx]][chunk.m_labels[predictedIdx]] += row[predictedIdx];
+			}
+		}
+	}
+}
+
+void ConfusionAccumulator::add(const std::vector<ScalarType>& actual, const std::vector<ScalarType>& predicted)
+{
+	assert(actual.size() == predicted.size());
+
+	Chunk chunk;
+	for (size_t i = 0; i < actual.size(); ++i)
+	{
+		chunk.add(static_cast<int>(actual[i]), static_cast<int>(predicted[i]));
+	}
+	merge(chunk);
+}
+
+void ConfusionAccumulator::clear()
+{
+	QMutexLocker locker(&m_mutex);
+	m_counts.clear();
+}
+
+uint64_t ConfusionAccumulator::sampleCount() const
+{
+	QMutexLocker locker(&m_mutex);
+
+	uint64_t count = 0;
+	for (const auto& row : m_counts)
+	{
+		for (const auto& cell : row.second)
+		{
+			count += cell.second;
+		}
+	}
+	return count;
+}
+
+uint64_t ConfusionAccumulator::goodGuessCount() const
+{
+	QMutexLocker locker(&m_mutex);
+
+	uint64_t count = 0;
+	for (const auto& row : m_counts)
+	{
+		auto it = row.second.find(row.first);
+		if (it != row.second.end())
+		{
+			count += it->second;
+		}
+	}
+	return count;
+}
+
+std::vector<ScalarType> ConfusionAccumulator::classNumbers() const
+{
+	QMutexLocker locker(&m_mutex);
+
+	//actual and predicted classes
+	std::set<int> classes;
+	for (const auto& row : m_counts)
+	{
+		classes.insert(row.first);
+		for (const auto& cell : row.second)
+		{
+			classes.insert(cell.first);
+		}
+	}
+
+	return std::vector<ScalarType>(classes.begin(), classes.end());
+}
+
+cv::Mat ConfusionAccumulator::counts() const
+{
+	std::vector<ScalarType> classes = classNumbers();
+	int classCount = static_cast<int>(classes.size());
+	cv::Mat matrix(classCount, classCount, CV_32S, cv::Scalar(0));
+
+	QMutexLocker locker(&m_mutex);
+	for (const auto& row : m_counts)
+	{
+		int actualIdx = static_cast<int>(std::lower_bound(classes.begin(), classes.end(), static_cast<ScalarType>(row.first)) - classes.begin());
+		for (const auto& cell : row.second)
+		{
+			int predictedIdx = static_cast<int>(std::lower_bound(classes.begin(), classes.end(), static_cast<ScalarType>(cell.first)) - classes.begin());
+			matrix.at<int>(actualIdx, predictedIdx) = static_cast<int>(cell.second);
+		}
+	}
+
+	return matrix;
+}
+
+void ConfusionAccumulator::ComputePrecisionRecallF1Score(const cv::Mat& counts, cv::Mat& precisionRecallF1Score, cv::Mat* vec_TP_FN/*=nullptr*/)
+{
+	int nbClasses = counts.rows;
+	precisionRecallF1Score = cv::Mat(nbClasses, 3, CV_32F, cv::Scalar(0));
+	if (vec_TP_FN)
+	{
+		*vec_TP_FN = cv::Mat(nbClasses, 1, CV_32S, cv::Scalar(0));
+	}
+
+	// compute precision
+	for (int predictedIdx = 0; predictedIdx < nbClasses; predictedIdx++)
+	{
+		float TP = 0;
+		float FP = 0;
+		for (int realIdx = 0; realIdx < nbClasses; realIdx++)
+		{
+			if (realIdx == predictedIdx)
+				TP = counts.at<int>(realIdx, realIdx);
+			else
+				FP += counts.at<int>(realIdx, predictedIdx);
+		}
+		float TP_FP = TP + FP;
+		if (TP_FP == 0)
+			precisionRecallF1Score.at<float>(predictedIdx, PRECISION) = CCCoreLib::NAN_VALUE;
+		else
+			precisionRecallF1Score.at<float>(predictedIdx, PRECISION) = TP / TP_FP;
+	}
+
+	// compute recall
+	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
+	{
+		float TP = 0;
+		float FN = 0;
+		for (int predictedIdx = 0; predictedIdx < nbClasses; predictedIdx++)
+		{
+			if (realIdx == predictedIdx)
+				TP = counts.at<int>(realIdx, realIdx);
+			else
+				FN += counts.at<int>(realIdx, predictedIdx);
+		}
+		float TP_FN = TP + FN;
+		if (TP_FN == 0)
+			precisionRecallF1Score.at<float>(realIdx, RECALL) = CCCoreLib::NAN_VALUE;
+		else
+			precisionRecallF1Score.at<float>(realIdx, RECALL) = TP / TP_FN;
+		if (vec_TP_FN)
+			vec_TP_FN->at<int>(realIdx, 0) = static_cast<int>(TP_FN);
+	}
+
+	// compute F1-score
+	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
+	{
+		float den = precisionRecallF1Score.at<float>(realIdx, PRECISION)
+				+ precisionRecallF1Score.at<float>(realIdx, RECALL);
+		if (den == 0)
+			precisionRecallF1Score.at<float>(realIdx, F1_SCORE) = CCCoreLib::NAN_VALUE;
+		else
+			precisionRecallF1Score.at<float>(realIdx, F1_SCORE) =
+					2
+					* precisionRecallF1Score.at<float>(realIdx, PRECISION)
+					* precisionRecallF1Score.at<float>(realIdx, RECALL)
+					/ den;
+	}
+}
+
+float ConfusionAccumulator::ComputeOverallAccuracy(const cv::Mat& counts)
+{
+	int nbClasses = counts.rows;
+	float totalTrue = 0;
+	float totalFalse = 0;
+
+	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
+	{
+		for (int predictedIdx = 0; predictedIdx < nbClasses; predictedIdx++)
+		{
+			if (realIdx == predictedIdx)
+				totalTrue += counts.at<int>(realIdx, realIdx);
+			else
+				totalFalse += counts.at<int>(realIdx, predictedIdx);
+		}
+	}
+
+	if ((totalTrue + totalFalse) != 0)
+		return totalTrue / (totalTrue + totalFalse);
+	else
+		return CCCoreLib::NAN_VALUE;
+}
+
+bool ConfusionAccumulator::Save(QString filePath,
+								const std::vector<ScalarType>& classNumbers,
+								const cv::Mat& counts,
+								const cv::Mat& precisionRecallF1Score)
+{
+	QFile file(filePath);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+	{
+		ccLog::Error("impossible to open file: " + filePath);
+		return false;
+	}
+
+	QTextStream stream(&file);
+	stream << "# columns: predicted classes\n# rows: actual classes\n";
+	stream << "# last three colums: precision / recall / F1-score\n";
+	for (auto class_number : classNumbers)
+	{
+		stream << class_number << " ";
+	}
+	stream << Qt::endl;
+	for (int row = 0; row < counts.rows; row++)
+	{
+		stream << classNumbers.at(row) << " ";
+		for (int col = 0; col < counts.cols; col++)
+		{
+			stream << counts.at<int>(row, col) << " ";
+		}
+		stream << precisionRecallF1Score.at<float>(row, PRECISION) << " ";
+		stream << precisionRecallF1Score.at<float>(row, RECALL) << " ";
+		stream << precisionRecallF1Score.at<float>(row, F1_SCORE) << Qt::endl;
+	}
+
+	file.close();
+
+	return true;
+}
+
+bool ConfusionAccumulator::save(QString filePath) const
+{
+	std::vector<ScalarType> classes = classNumbers();
+	cv::Mat matrix = counts();
+	cv::Mat precisionRecallF1Score;
+	ComputePrecisionRecallF1Score(matrix, precisionRecallF1Score);
+
+	return Save(filePath, classes, matrix, precisionRecallF1Score);
+}
+
+QStringList ConfusionAccumulator::report() const
+{
+	std::vector<ScalarType> classes = classNumbers();
+	cv::Mat matrix = counts();
+	cv::Mat precisionRecallF1Score, vec_TP_FN;
+	ComputePrecisionRecallF1Score(matrix, precisionRecallF1Score, &vec_TP_FN);
+
+	QStringList lines;
+	lines << QString("Overall accuracy: %1 (%2 samples)").arg(ComputeOverallAccuracy(matrix), 0, 'g', 4).arg(sampleCount());
+	for (int i = 0; i < static_cast<int>(classes.size()); ++i)
+	{
+		lines << QString("Class %1: precision = %2 / recall = %3 / F1-score = %4 (%5 samples)")
+					.arg(classes[i])
+					.arg(precisionRecallF1Score.at<float>(i, PRECISION), 0, 'g', 4)
+					.arg(precisionRecallF1Score.at<float>(i, RECALL), 0, 'g', 4)
+					.arg(precisionRecallF1Score.at<float>(i, F1_SCORE), 0, 'g', 4)
+					.arg(vec_TP_FN.at<int>(i, 0));
+	}
+
+	return lines;
+}
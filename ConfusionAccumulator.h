@@ -0,0 +1,150 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//CCLib
+#include <CCTypes.h>
+
+//OpenCV
+#include <opencv2/core/mat.hpp>
+
+//Qt
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+//system
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace masc
+{
+	//! Streaming confusion matrix and classification metrics
+	/** Label pairs (actual, predicted) are first accumulated in local chunks (one per
+		thread, without any locking), then merged into the accumulator (thread-safe).
+		No GUI involved (see ConfusionMatrix for the display).
+	**/
+	class ConfusionAccumulator
+	{
+	public:
+
+		//! Metrics (columns of the precision/recall/F1-score matrix)
+		enum Metric
+		{
+			PRECISION = 0,
+			RECALL = 1,
+			F1_SCORE = 2
+		};
+
+		//! Partial counts filled by a single thread
+		class Chunk
+		{
+		public:
+
+			//! Adds a label pair
+			inline void add(int actualClass, int predictedClass)
+			{
+				size_t actualIdx = indexOf(actualClass);
+				size_t predictedIdx = indexOf(predictedClass);
+				++m_counts[actualIdx][predictedIdx];
+			}
+
+			//! Returns whether the chunk is empty
+			inline bool empty() const { return m_labels.empty(); }
+
+			//! Clears the chunk
+			inline void clear() { m_labels.clear(); m_counts.clear(); }
+
+		protected:
+
+			friend class ConfusionAccumulator;
+
+			//! Returns the index of a class (there are only a few classes)
+			inline size_t indexOf(int label)
+			{
+				for (size_t i = 0; i < m_labels.size(); ++i)
+				{
+					if (m_labels[i] == label)
+						return i;
+				}
+
+				//new class
+				m_labels.push_back(label);
+				for (std::vector<uint64_t>& row : m_counts)
+				{
+					row.push_back(0);
+				}
+				m_counts.emplace_back(m_labels.size(), 0);
+				return m_labels.size() - 1;
+			}
+
+			//! Classes (in order of appearance)
+			std::vector<int> m_labels;
+			//! Counts (rows: actual classes, columns: predicted classes)
+			std::vector< std::vector<uint64_t> > m_counts;
+		};
+
+		//! Merges a chunk (thread-safe)
+		void merge(const Chunk& chunk);
+
+		//! Adds a set of label pairs (thread-safe)
+		void add(const std::vector<ScalarType>& actual, const std::vector<ScalarType>& predicted);
+
+		//! Clears the accumulated counts
+		void clear();
+
+		//! Returns the number of accumulated label pairs
+		uint64_t sampleCount() const;
+		//! Returns the number of correctly predicted labels
+		uint64_t goodGuessCount() const;
+
+		//! Returns the (sorted) class labels
+		std::vector<ScalarType> classNumbers() const;
+		//! Returns the confusion matrix (CV_32S, rows: actual classes, columns: predicted classes)
+		cv::Mat counts() const;
+
+		//! Computes the precision, recall and F1-score of each class (CV_32F, one row per class)
+		/** \param vec_TP_FN if not null, the number of samples of each (actual) class (CV_32S)
+		**/
+		static void ComputePrecisionRecallF1Score(const cv::Mat& counts, cv::Mat& precisionRecallF1Score, cv::Mat* vec_TP_FN = nullptr);
+		//! Computes the overall accuracy (NaN if the matrix is empty)
+		static float ComputeOverallAccuracy(const cv::Mat& counts);
+
+		//! Saves a confusion matrix and its metrics to a text file
+		static bool Save(	QString filePath,
+							const std::vector<ScalarType>& classNumbers,
+							const cv::Mat& counts,
+							const cv::Mat& precisionRecallF1Score);
+
+		//! Saves the accumulated confusion matrix and its metrics to a text file
+		bool save(QString filePath) const;
+
+		//! Returns a short textual report (overall accuracy and metrics per class)
+		QStringList report() const;
+
+	protected:
+
+		//! Counts per (actual, predicted) class
+		std::map< int, std::map<int, uint64_t> > m_counts;
+
+		//! Mutex
+		mutable QMutex m_mutex;
+	};
+
+}; //namespace masc
@@ -76,7 +76,8 @@ bool ContextBasedFeature::checkValidity(QString corePointRole, QString &error) c
 bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 									QString& errorMessage,
 									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
-									SFCollector* generatedScalarFields/*=nullptr*/)
+									SFCollector* generatedScalarFields/*=nullptr*/,
+									const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!corePoints.cloud)
 	{
@@ -114,7 +115,7 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 	QString resultSFName = typeStr + "_" + cloud1Label + "_" + QString::number(ctxClassLabel);
 	if (scaled())
 	{
-		resultSFName += "@" + QString::number(scale);
+		resultSFName += scaleSuffix();
 	}
 	else
 	{
@@ -132,6 +133,44 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 	}
 	source.name = sf->getName();
 
+	//with a raster of the context class, we can compute the values right away (whatever the neighborhood)
+	if (groundRaster && !sfWasAlreadyExisting)
+	{
+		unsigned pointCount = corePoints.size();
+		ccLog::Print(QString("Computing %1 on cloud %2 with the raster of class %3 (cell size: %4)").arg(typeStr).arg(corePoints.cloud->getName()).arg(ctxClassLabel).arg(groundRaster->cellSize()));
+
+		if (groundRaster->isEmpty())
+		{
+			ccLog::Warning(QString("Cloud %1 has no point of class %2").arg(cloud1Label).arg(ctxClassLabel));
+		}
+		else
+		{
+			double maxDistance = (scaled() ? scale / 2 : std::numeric_limits<double>::infinity());
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+			for (int i = 0; i < static_cast<int>(pointCount); ++i)
+			{
+				const CCVector3* P = corePoints.cloud->getPoint(i);
+				double dh = groundRaster->horizontalDistance(P->x, P->y);
+
+				ScalarType s = CCCoreLib::NAN_VALUE;
+				if (dh <= maxDistance)
+				{
+					s = static_cast<ScalarType>(type == DZ ? P->z - groundRaster->height(P->x, P->y) : dh);
+				}
+				sf->setValue(i, s);
+			}
+		}
+
+		if (!scaled())
+		{
+			//scaled features are updated once they are all finished
+			sf->computeMinAndMax();
+		}
+		return true;
+	}
+
 	// NOT NECESSARY IF THE VALUE IS ALREADY COMPUTED
 	if (!scaled() && !sfWasAlreadyExisting) //with 'kNN' neighbors, we can compute the values right away
 	{
@@ -191,8 +230,7 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 			bool cancelled = false;
 #ifndef _DEBUG
 #if defined(_OPENMP)
-			omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, context.chunk(static_cast<int>(pointCount)))
 #endif
 #endif
 			for (int i = 0; i < static_cast<int>(pointCount); ++i)
@@ -326,35 +364,6 @@ bool ContextBasedFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 }
 
 
-bool ContextBasedFeature::finish(const CorePoints& corePoints, QString& error)
-{
-	if (!corePoints.cloud)
-	{
-		//invalid input
-		assert(false);
-		error = "internal error (no input core points)";
-		return false;
-	}
-
-	bool success = true;
-
-	if (sf)
-	{
-		sf->computeMinAndMax();
-
-		//update display
-		//if (corePoints.cloud->getDisplay())
-		{
-			int sfIndex = corePoints.cloud->getScalarFieldIndexByName(sf->getName());
-			corePoints.cloud->setCurrentDisplayedScalarField(sfIndex);
-			//corePoints.cloud->getDisplay()->redraw();
-			//QCoreApplication::processEvents();
-		}
-	}
-
-	return success;
-}
-
 QString ContextBasedFeature::toString() const
 {
 	//use the default keyword + number of neighbors + the scale + the context class
@@ -372,5 +381,10 @@ QString ContextBasedFeature::toString() const
 
 	str += "_" + cloud1Label + "_" + QString::number(ctxClassLabel);
 
+	if (cylindrical)
+	{
+		str += "_CYL";
+	}
+
 	return str;
 }
@@ -19,6 +19,7 @@
 
 //Local
 #include "FeaturesInterface.h"
+#include "GroundRaster.h"
 
 namespace masc
 {
@@ -83,8 +84,7 @@ namespace masc
 		//inherited from Feature
 		virtual Type getType() const override { return Type::ContextBasedFeature; }
 		virtual Feature::Shared clone() const override { return Feature::Shared(new ContextBasedFeature(*this)); }
-		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) override;
-		virtual bool finish(const CorePoints& corePoints, QString& error) override;
+		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr, const ExecutionContext& context = ExecutionContext()) override;
 		virtual bool checkValidity(QString corePointRole, QString &error) const override;
 		virtual QString toString() const override;
 
@@ -106,5 +106,9 @@ namespace masc
 		CCCoreLib::ScalarField* sf;
 		//! Whether the SF pre-exists
 		bool sfWasAlreadyExisting;
+		//! Raster of the context class (optional)
+		/** If set, the values are computed right away (see 'prepare') with the raster.
+		**/
+		GroundRaster::Shared groundRaster;
 	};
 }
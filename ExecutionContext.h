@@ -0,0 +1,75 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//system
+#include <algorithm>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace masc
+{
+	//! Execution context of the parallel loops (features computation and classification)
+	/** Passed down to the parallel code instead of changing the global OpenMP state
+		(which is shared with CloudCompare and the other plugins).
+	**/
+	struct ExecutionContext
+	{
+		//! Maximum number of threads (0 = all the available ones but 2)
+		int maxThreadCount = 0;
+
+		//! Number of iterations handed out at once to a thread by the per-point loops (0 = automatic)
+		int chunkSize = 0;
+
+		//! Whether the output pages of each chunk should be migrated to the NUMA node of the thread processing it
+		/** This only migrates the pages of the output scalar fields: the chunks are not assigned
+			to nodes, the threads are not bound, and the inputs are not partitioned per node.
+			See NumaPlacement (Linux only, ignored with a single node)
+		**/
+		bool migrateOutputPages = false;
+
+		//! Returns the number of threads to use
+		int threadCount() const
+		{
+#if defined(_OPENMP)
+			return (maxThreadCount > 0 ? maxThreadCount : std::max(1, omp_get_max_threads() - 2));
+#else
+			return 1;
+#endif
+		}
+
+		//! Returns the chunk size of a loop of a given length
+		/** By default, each thread gets about 16 chunks: enough to balance the
+			load (neighborhoods sizes vary a lot) without much scheduling overhead.
+			When the output pages are migrated, a chunk spans at least a few memory
+			pages of output values.
+		**/
+		int chunk(int iterationCount) const
+		{
+			int size = (chunkSize > 0 ? chunkSize : std::max(1, iterationCount / (16 * threadCount())));
+			if (migrateOutputPages)
+			{
+				static const int MinNumaChunkSize = 4096; //4 pages of 4 KB of float values
+				size = std::max(size, MinNumaChunkSize);
+			}
+			return size;
+		}
+	};
+
+}; //namespace masc
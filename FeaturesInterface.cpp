@@ -22,6 +22,13 @@
 
 //system
 #include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 using namespace masc;
 
@@ -105,7 +112,84 @@ ScalarType Feature::PerformMathOp(double s1, double s2, Operation op)
 	return s;
 }
 
-bool Feature::PerformMathOp(CCCoreLib::ScalarField* sf1, const CCCoreLib::ScalarField* sf2, Feature::Operation op)
+namespace
+{
+	//! Element-wise math operations (NaN values are propagated)
+	/** One type per operation, so that the combination loops have no branch
+		on the operation and can be vectorized by the compiler.
+	**/
+	struct MinusOp { template <typename T> static inline ScalarType Apply(T s1, T s2) { return static_cast<ScalarType>(s1 - s2); } };
+	struct PlusOp { template <typename T> static inline ScalarType Apply(T s1, T s2) { return static_cast<ScalarType>(s1 + s2); } };
+	struct MultiplyOp { template <typename T> static inline ScalarType Apply(T s1, T s2) { return static_cast<ScalarType>(s1 * s2); } };
+	struct DivideOp
+	{
+		template <typename T> static inline ScalarType Apply(T s1, T s2)
+		{
+			//same rule as Feature::PerformMathOp (a NaN divisor fails the test as well)
+			return (std::abs(s2) > std::numeric_limits<ScalarType>::epsilon() ? static_cast<ScalarType>(s1 / s2) : CCCoreLib::NAN_VALUE);
+		}
+	};
+
+	//! Combines two contiguous arrays of values (out may be one of the inputs)
+	template <class Op> void CombineValues(const ScalarType* in1, const ScalarType* in2, ScalarType* out, int count, const ExecutionContext& context)
+	{
+		int chunkSize = context.chunk(count);
+		int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(static)
+#endif
+		for (int c = 0; c < chunkCount; ++c)
+		{
+			int first = c * chunkSize;
+			int last = std::min(first + chunkSize, count);
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp simd
+#endif
+			for (int i = first; i < last; ++i)
+			{
+				out[i] = Op::Apply(in1[i], in2[i]);
+			}
+		}
+	}
+
+	//! Combines two generic scalar fields (virtual access, no vectorization)
+	template <class Op> void CombineValues(const IScalarFieldWrapper& sf1, const IScalarFieldWrapper& sf2, ScalarType* out, int count, const ExecutionContext& context)
+	{
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(static, context.chunk(count))
+#endif
+		for (int i = 0; i < count; ++i)
+		{
+			out[i] = Op::Apply(sf1.pointValue(i), sf2.pointValue(i));
+		}
+	}
+
+	//! Dispatches a combination to the kernel of the given operation
+	template <typename Input> bool CombineValues(const Input& in1, const Input& in2, ScalarType* out, int count, Feature::Operation op, const ExecutionContext& context)
+	{
+		switch (op)
+		{
+		case Feature::MINUS:
+			CombineValues<MinusOp>(in1, in2, out, count, context);
+			return true;
+		case Feature::PLUS:
+			CombineValues<PlusOp>(in1, in2, out, count, context);
+			return true;
+		case Feature::DIVIDE:
+			CombineValues<DivideOp>(in1, in2, out, count, context);
+			return true;
+		case Feature::MULTIPLY:
+			CombineValues<MultiplyOp>(in1, in2, out, count, context);
+			return true;
+		default:
+			assert(false);
+			return false;
+		}
+	}
+}
+
+bool Feature::PerformMathOp(CCCoreLib::ScalarField* sf1, const CCCoreLib::ScalarField* sf2, Feature::Operation op, const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!sf1 || !sf2 || sf1->size() != sf2->size() || op == Feature::NO_OPERATION)
 	{
@@ -114,19 +198,15 @@ bool Feature::PerformMathOp(CCCoreLib::ScalarField* sf1, const CCCoreLib::Scalar
 		return false;
 	}
 
-	for (unsigned i = 0; i < sf1->size(); ++i)
+	if (sf1->size() == 0)
 	{
-		ScalarType s1 = sf1->getValue(i);
-		ScalarType s2 = sf2->getValue(i);
-		ScalarType s = PerformMathOp(s1, s2, op);
-		sf1->setValue(i, s);
+		return true;
 	}
-	sf1->computeMinAndMax();
 
-	return true;
+	return CombineValues<const ScalarType*>(sf1->data(), sf2->data(), sf1->data(), static_cast<int>(sf1->size()), op, context);
 }
 
-bool Feature::PerformMathOp(const IScalarFieldWrapper& sf1, const IScalarFieldWrapper& sf2, Operation op, CCCoreLib::ScalarField* outSF)
+bool Feature::PerformMathOp(const IScalarFieldWrapper& sf1, const IScalarFieldWrapper& sf2, Operation op, CCCoreLib::ScalarField* outSF, const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!outSF || sf1.size() != sf2.size() || sf1.size() != outSF->size() || op == Feature::NO_OPERATION)
 	{
@@ -135,16 +215,54 @@ bool Feature::PerformMathOp(const IScalarFieldWrapper& sf1, const IScalarFieldWr
 		return false;
 	}
 
-	for (unsigned i = 0; i < sf1.size(); ++i)
+	if (outSF->size() == 0)
 	{
-		double s1 = sf1.pointValue(i);
-		double s2 = sf2.pointValue(i);
-		ScalarType s = PerformMathOp(s1, s2, op);
-		outSF->setValue(i, s);
+		return true;
 	}
-	outSF->computeMinAndMax();
 
-	return true;
+	int count = static_cast<int>(outSF->size());
+	bool success = false;
+
+	//plain scalar fields are combined directly from their (contiguous) values
+	const ScalarFieldWrapper* sfw1 = dynamic_cast<const ScalarFieldWrapper*>(&sf1);
+	const ScalarFieldWrapper* sfw2 = dynamic_cast<const ScalarFieldWrapper*>(&sf2);
+	if (sfw1 && sfw2 && sfw1->scalarField() && sfw2->scalarField())
+	{
+		success = CombineValues<const ScalarType*>(sfw1->scalarField()->data(), sfw2->scalarField()->data(), outSF->data(), count, op, context);
+	}
+	else
+	{
+		success = CombineValues<IScalarFieldWrapper>(sf1, sf2, outSF->data(), count, op, context);
+	}
+
+	if (success)
+	{
+		outSF->computeMinAndMax();
+	}
+
+	return success;
+}
+
+void Feature::ComputeMinAndMax(const std::vector<CCCoreLib::ScalarField*>& sfs, const ExecutionContext& context/*=ExecutionContext()*/)
+{
+	//the same scalar field may be shared by several features
+	std::vector<CCCoreLib::ScalarField*> uniqueSFs;
+	uniqueSFs.reserve(sfs.size());
+	for (CCCoreLib::ScalarField* sf : sfs)
+	{
+		if (sf && std::find(uniqueSFs.begin(), uniqueSFs.end(), sf) == uniqueSFs.end())
+		{
+			uniqueSFs.push_back(sf);
+		}
+	}
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, 1)
+#endif
+	for (int i = 0; i < static_cast<int>(uniqueSFs.size()); ++i)
+	{
+		uniqueSFs[i]->computeMinAndMax();
+	}
 }
 
 bool Feature::SaveSources(const Source::Set& sources, QString filename)
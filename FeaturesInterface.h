@@ -20,6 +20,7 @@
 
 //Local
 #include "CorePoints.h"
+#include "ExecutionContext.h"
 #include "ScalarFieldCollector.h"
 #include "ScalarFieldWrappers.h"
 
@@ -162,6 +163,7 @@ namespace masc
 			, source(p_source, p_sourceName)
 			, stat(NO_STAT)
 			, op(NO_OPERATION)
+			, cylindrical(false)
 		{}
 
 		//! Returns the type (must be reimplemented by child struct)
@@ -174,14 +176,20 @@ namespace masc
 		virtual Feature::Shared clone() const = 0;
 
 		//! Prepares the feature (compute the scalar field, etc.)
-        virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) = 0;
+        virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr, const ExecutionContext& context = ExecutionContext()) = 0;
 
 		//! Finishes the feature preparation (update the scalar field, etc.)
-		virtual bool finish(const CorePoints& corePoints, QString& error) { /* does nothing by default*/return true; }
+		/** \warning The min and max values of the output scalar field are not updated
+			(the caller should do it once all features are finished, see ComputeMinAndMax).
+		**/
+		virtual bool finish(const CorePoints& corePoints, QString& error, const ExecutionContext& context = ExecutionContext()) { /* does nothing by default*/return true; }
 
 		//! Returns whether the feature has an associated scale
 		inline bool scaled() const { return std::isfinite(scale); }
 
+		//! Returns the suffix of the scalar field names (scale and neighborhood shape)
+		inline QString scaleSuffix() const { return "@" + QString::number(scale) + (cylindrical ? "_CYL" : ""); }
+
 		//! Checks the feature definition validity
 		virtual bool checkValidity(QString corePointRole, QString &error) const
 		{
@@ -204,6 +212,20 @@ namespace masc
 				return false;
 			}
 
+			if (cylindrical)
+			{
+				if (!scaled())
+				{
+					error = "cylindrical neighborhoods (CYL) require a scale";
+					return false;
+				}
+				if (getType() == Type::DualCloudFeature)
+				{
+					error = "cylindrical neighborhoods (CYL) can't be used with dual cloud features";
+					return false;
+				}
+			}
+
 			return true;
 		}
 
@@ -219,10 +241,16 @@ namespace masc
 		static ScalarType PerformMathOp(double s1, double s2, Operation op);
 
 		//! Performs a mathematical operation between two scalar fields (they must have the same size!)
-		static bool PerformMathOp(CCCoreLib::ScalarField* sf1, const CCCoreLib::ScalarField* sf2, Operation op);
+		/** The result is stored in sf1. NaN values are propagated.
+			\warning The min and max values of sf1 are not updated.
+		**/
+		static bool PerformMathOp(CCCoreLib::ScalarField* sf1, const CCCoreLib::ScalarField* sf2, Operation op, const ExecutionContext& context = ExecutionContext());
 
 		//! Performs a mathematical operation between two scalar fields (they must have the same size!)
-		static bool PerformMathOp(const IScalarFieldWrapper& sf1, const IScalarFieldWrapper& sf2, Operation op, CCCoreLib::ScalarField* outSF);
+		static bool PerformMathOp(const IScalarFieldWrapper& sf1, const IScalarFieldWrapper& sf2, Operation op, CCCoreLib::ScalarField* outSF, const ExecutionContext& context = ExecutionContext());
+
+		//! Updates the min and max values of several scalar fields at once (one scalar field per thread)
+		static void ComputeMinAndMax(const std::vector<CCCoreLib::ScalarField*>& sfs, const ExecutionContext& context = ExecutionContext());
 
 	public: //members
 
@@ -236,5 +264,6 @@ namespace masc
 	
 		Stat stat; //only considered if a scale is defined
 		Operation op; //only considered if 2 clouds are defined
+		bool cylindrical; //vertical cylinder (column) instead of a sphere, only considered if a scale is defined
 	};
 }
@@ -0,0 +1,603 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FlatForest.h"
+
+//Qt
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+using namespace masc;
+
+void FlatForest::clear()
+{
+	m_nodes.clear();
+	m_roots.clear();
+	m_classLabels.clear();
+	m_varCount = 0;
+	m_codeNodes.clear();
+	m_varThresholds.clear();
+	m_byteCodes = false;
+}
+
+bool FlatForest::build(const cv::Ptr<cv::ml::RTrees>& rtrees, QString& errorMessage)
+{
+	std::vector< cv::Ptr<cv::ml::RTrees> > forests{ rtrees };
+	std::vector<int> treeCounts{ rtrees ? static_cast<int>(rtrees->getRoots().size()) : 0 };
+
+	return build(forests, treeCounts, errorMessage);
+}
+
+bool FlatForest::build(	const std::vector< cv::Ptr<cv::ml::RTrees> >& forests,
+						const std::vector<int>& treeCounts,
+						QString& errorMessage)
+{
+	clear();
+
+	if (forests.empty() || forests.size() != treeCounts.size())
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid classifier");
+		return false;
+	}
+
+	try
+	{
+		for (size_t i = 0; i < forests.size(); ++i)
+		{
+			const cv::Ptr<cv::ml::RTrees>& rtrees = forests[i];
+			if (!rtrees || !rtrees->isTrained() || !rtrees->isClassifier())
+			{
+				errorMessage = QObject::tr("Invalid classifier");
+				clear();
+				return false;
+			}
+
+			//the class labels are on the first row of the votes matrix
+			cv::Mat dummySample = cv::Mat::zeros(1, rtrees->getVarCount(), CV_32F);
+			cv::Mat votes;
+			rtrees->getVotes(dummySample, votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+			std::vector<float> classLabels(votes.cols);
+			for (int c = 0; c < votes.cols; ++c)
+			{
+				classLabels[c] = static_cast<float>(votes.at<int>(0, c));
+			}
+
+			if (i == 0)
+			{
+				m_varCount = rtrees->getVarCount();
+				m_classLabels = classLabels;
+			}
+			else if (rtrees->getVarCount() != m_varCount || classLabels != m_classLabels)
+			{
+				errorMessage = QObject::tr("Inconsistent forests (different features or classes)");
+				clear();
+				return false;
+			}
+
+			const std::vector<int>& roots = rtrees->getRoots();
+			int treeCount = std::min(treeCounts[i], static_cast<int>(roots.size()));
+			for (int t = 0; t < treeCount; ++t)
+			{
+				m_roots.push_back(static_cast<int>(m_nodes.size()));
+				if (!appendTree(rtrees, roots[t], errorMessage))
+				{
+					clear();
+					return false;
+				}
+			}
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		clear();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool FlatForest::appendTree(const cv::Ptr<cv::ml::RTrees>& rtrees, int root, QString& errorMessage)
+{
+	const std::vector<cv::ml::DTrees::Node>& nodes = rtrees->getNodes();
+	const std::vector<cv::ml::DTrees::Split>& splits = rtrees->getSplits();
+
+	//(OpenCV node index, flat node index)
+	std::vector< std::pair<int, int> > stack;
+	m_nodes.emplace_back();
+	stack.emplace_back(root, static_cast<int>(m_nodes.size()) - 1);
+
+	while (!stack.empty())
+	{
+		std::pair<int, int> current = stack.back();
+		stack.pop_back();
+
+		const cv::ml::DTrees::Node& node = nodes[current.first];
+		if (node.split < 0)
+		{
+			//leaf
+			if (node.classIdx < 0 || node.classIdx >= classCount())
+			{
+				errorMessage = QObject::tr("Invalid leaf class index");
+				return false;
+			}
+			Node& flatNode = m_nodes[current.second];
+			flatNode.varIdx = -1;
+			flatNode.le = node.classIdx;
+		}
+		else
+		{
+			const cv::ml::DTrees::Split& split = splits[node.split];
+			if (split.subsetOfs >= 0)
+			{
+				errorMessage = QObject::tr("Categorical splits are not supported");
+				return false;
+			}
+
+			//OpenCV: dir = (value <= c ? left : right), reversed if the split is 'inversed'
+			int leChild = split.inversed ? node.right : node.left;
+			int gtChild = split.inversed ? node.left : node.right;
+
+			int leIndex = static_cast<int>(m_nodes.size());
+			m_nodes.resize(m_nodes.size() + 2);
+
+			Node& flatNode = m_nodes[current.second];
+			flatNode.varIdx = split.varIdx;
+			flatNode.threshold = split.c;
+			flatNode.le = leIndex;
+			flatNode.gt = leIndex + 1;
+
+			stack.emplace_back(gtChild, leIndex + 1);
+			stack.emplace_back(leChild, leIndex);
+		}
+	}
+
+	return true;
+}
+
+std::vector<int> FlatForest::treesUsingVar(int varIdx) const
+{
+	std::vector<int> trees;
+
+	//the nodes of each tree are contiguous
+	for (size_t t = 0; t < m_roots.size(); ++t)
+	{
+		size_t firstNode = m_roots[t];
+		size_t lastNode = (t + 1 < m_roots.size() ? m_roots[t + 1] : m_nodes.size());
+		for (size_t n = firstNode; n < lastNode; ++n)
+		{
+			if (m_nodes[n].varIdx == varIdx)
+			{
+				trees.push_back(static_cast<int>(t));
+				break;
+			}
+		}
+	}
+
+	return trees;
+}
+
+bool FlatForest::buildQuantization(QString& errorMessage)
+{
+	m_codeNodes.clear();
+	m_varThresholds.clear();
+	m_byteCodes = false;
+
+	if (!isValid())
+	{
+		errorMessage = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	try
+	{
+		//collect the (sorted, unique) thresholds of each feature
+		m_varThresholds.resize(m_varCount);
+		for (const Node& node : m_nodes)
+		{
+			if (node.varIdx >= 0 && !std::isnan(node.threshold))
+			{
+				m_varThresholds[node.varIdx].push_back(node.threshold);
+			}
+		}
+		size_t maxThresholdCount = 0;
+		for (std::vector<float>& thresholds : m_varThresholds)
+		{
+			std::sort(thresholds.begin(), thresholds.end());
+			thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+			thresholds.shrink_to_fit();
+			maxThresholdCount = std::max(maxThresholdCount, thresholds.size());
+		}
+
+		//the maximum code is reserved for NaN values
+		if (maxThresholdCount >= std::numeric_limits<uint16_t>::max())
+		{
+			errorMessage = QObject::tr("Too many thresholds for a single feature (%1)").arg(maxThresholdCount);
+			m_varThresholds.clear();
+			return false;
+		}
+		m_byteCodes = (maxThresholdCount < std::numeric_limits<uint8_t>::max());
+
+		//'value <= threshold' <=> 'code(value) <= index of the threshold'
+		m_codeNodes.resize(m_nodes.size());
+		for (size_t n = 0; n < m_nodes.size(); ++n)
+		{
+			const Node& node = m_nodes[n];
+			CodeNode& codeNode = m_codeNodes[n];
+			codeNode.varIdx = node.varIdx;
+			codeNode.le = node.le;
+			codeNode.gt = node.gt;
+			if (node.varIdx < 0)
+			{
+				continue;
+			}
+
+			if (std::isnan(node.threshold))
+			{
+				//'value <= NaN' is always false
+				codeNode.le = node.gt;
+			}
+			else
+			{
+				const std::vector<float>& thresholds = m_varThresholds[node.varIdx];
+				codeNode.code = static_cast<uint32_t>(std::lower_bound(thresholds.begin(), thresholds.end(), node.threshold) - thresholds.begin());
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		m_codeNodes.clear();
+		m_varThresholds.clear();
+		return false;
+	}
+
+	return true;
+}
+
+//! FNV-1a hash (64 bits)
+static void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+uint64_t FlatForest::hash() const
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	HashBytes(hash, &m_varCount, sizeof(m_varCount));
+	for (float label : m_classLabels)
+	{
+		HashBytes(hash, &label, sizeof(float));
+	}
+	for (int root : m_roots)
+	{
+		HashBytes(hash, &root, sizeof(int));
+	}
+	for (const Node& node : m_nodes)
+	{
+		//field by field (no padding)
+		HashBytes(hash, &node.varIdx, sizeof(int));
+		uint32_t thresholdBits = 0;
+		std::memcpy(&thresholdBits, &node.threshold, sizeof(float));
+		HashBytes(hash, &thresholdBits, sizeof(uint32_t));
+		HashBytes(hash, &node.le, sizeof(int));
+		HashBytes(hash, &node.gt, sizeof(int));
+	}
+
+	return hash;
+}
+
+bool FlatForest::compact(QString& errorMessage)
+{
+	if (!isValid())
+	{
+		errorMessage = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	//the quantized version won't match anymore
+	m_codeNodes.clear();
+	m_varThresholds.clear();
+	m_byteCodes = false;
+
+	try
+	{
+		std::vector<Node> nodes;
+		nodes.reserve(m_nodes.size());
+		std::vector<int> roots(m_roots.size());
+
+		//compacted node of each original node (index in 'treeNodes')
+		std::vector<int> compactIndexes(m_nodes.size(), -1);
+		//(varIdx, threshold bits, le, gt) ==> compacted node
+		std::map<std::tuple<int, uint32_t, int, int>, int> uniqueNodes;
+		//compacted nodes of the current tree (the children are always created before their parent)
+		std::vector<Node> treeNodes;
+
+		for (size_t t = 0; t < m_roots.size(); ++t)
+		{
+			int firstNode = m_roots[t];
+			int lastNode = (t + 1 < m_roots.size() ? m_roots[t + 1] : static_cast<int>(m_nodes.size()));
+			uniqueNodes.clear();
+			treeNodes.clear();
+
+			//the children are stored after their parent: going backwards is enough to process them first
+			for (int n = lastNode - 1; n >= firstNode; --n)
+			{
+				Node node = m_nodes[n];
+				uint32_t thresholdBits = 0;
+				if (node.varIdx < 0)
+				{
+					node.gt = 0;
+				}
+				else
+				{
+					node.le = compactIndexes[node.le];
+					node.gt = compactIndexes[node.gt];
+					if (node.le == node.gt)
+					{
+						//both branches lead to the same predictions: the split is useless
+						compactIndexes[n] = node.le;
+						continue;
+					}
+					std::memcpy(&thresholdBits, &node.threshold, sizeof(float));
+				}
+
+				auto key = std::make_tuple(node.varIdx, thresholdBits, node.le, node.gt);
+				auto it = uniqueNodes.find(key);
+				if (it != uniqueNodes.end())
+				{
+					//identical subtree
+					compactIndexes[n] = it->second;
+				}
+				else
+				{
+					compactIndexes[n] = static_cast<int>(treeNodes.size());
+					uniqueNodes.emplace(key, compactIndexes[n]);
+					treeNodes.push_back(node);
+				}
+			}
+
+			//all the compacted nodes are reachable from the root, which is therefore the last one:
+			//we store them in reverse order so that the parents are stored before their children
+			assert(compactIndexes[firstNode] + 1 == static_cast<int>(treeNodes.size()));
+			int base = static_cast<int>(nodes.size());
+			int lastIndex = static_cast<int>(treeNodes.size()) - 1;
+			roots[t] = base;
+			for (int i = lastIndex; i >= 0; --i)
+			{
+				Node node = treeNodes[i];
+				if (node.varIdx >= 0)
+				{
+					node.le = base + lastIndex - node.le;
+					node.gt = base + lastIndex - node.gt;
+				}
+				nodes.push_back(node);
+			}
+		}
+
+		nodes.shrink_to_fit();
+		m_nodes = std::move(nodes);
+		m_roots = std::move(roots);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	return true;
+}
+
+std::vector<int> FlatForest::varSplitCounts() const
+{
+	std::vector<int> counts(m_varCount, 0);
+	for (const Node& node : m_nodes)
+	{
+		if (node.varIdx >= 0)
+		{
+			++counts[node.varIdx];
+		}
+	}
+	return counts;
+}
+
+bool FlatForest::remapVars(const std::vector<int>& newVarIndexes, int newVarCount, QString& errorMessage)
+{
+	if (static_cast<int>(newVarIndexes.size()) != m_varCount)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid feature mapping");
+		return false;
+	}
+
+	for (const Node& node : m_nodes)
+	{
+		if (node.varIdx >= 0)
+		{
+			int newVarIdx = newVarIndexes[node.varIdx];
+			if (newVarIdx < 0 || newVarIdx >= newVarCount)
+			{
+				errorMessage = QObject::tr("Feature #%1 is used by the forest").arg(node.varIdx + 1);
+				return false;
+			}
+		}
+	}
+
+	for (Node& node : m_nodes)
+	{
+		if (node.varIdx >= 0)
+		{
+			node.varIdx = newVarIndexes[node.varIdx];
+		}
+	}
+	m_varCount = newVarCount;
+
+	//the quantized version doesn't match anymore
+	m_codeNodes.clear();
+	m_varThresholds.clear();
+	m_byteCodes = false;
+
+	return true;
+}
+
+double FlatForest::expectedPathLength() const
+{
+	if (m_roots.empty())
+	{
+		return 0.0;
+	}
+
+	//the children are stored after their parent
+	std::vector<double> pathLengths(m_nodes.size(), 0.0);
+	for (size_t i = m_nodes.size(); i-- > 0; )
+	{
+		const Node& node = m_nodes[i];
+		if (node.varIdx >= 0)
+		{
+			pathLengths[i] = 1.0 + (pathLengths[node.le] + pathLengths[node.gt]) / 2;
+		}
+	}
+
+	double sum = 0.0;
+	for (int root : m_roots)
+	{
+		sum += pathLengths[root];
+	}
+	return sum / m_roots.size();
+}
+
+void FlatForest::write(cv::FileStorage& fs) const
+{
+	std::vector<int> varIdx(m_nodes.size()), le(m_nodes.size()), gt(m_nodes.size());
+	std::vector<float> thresholds(m_nodes.size());
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		varIdx[i] = m_nodes[i].varIdx;
+		thresholds[i] = m_nodes[i].threshold;
+		le[i] = m_nodes[i].le;
+		gt[i] = m_nodes[i].gt;
+	}
+
+	fs << "var_count" << m_varCount;
+	fs << "class_labels" << m_classLabels;
+	fs << "roots" << m_roots;
+	fs << "var_idx" << varIdx;
+	fs << "thresholds" << thresholds;
+	fs << "le" << le;
+	fs << "gt" << gt;
+}
+
+bool FlatForest::read(const cv::FileNode& node, QString& errorMessage)
+{
+	clear();
+
+	if (node.empty())
+	{
+		errorMessage = QObject::tr("Missing forest");
+		return false;
+	}
+
+	try
+	{
+		std::vector<int> varIdx, le, gt;
+		std::vector<float> thresholds;
+
+		node["var_count"] >> m_varCount;
+		node["class_labels"] >> m_classLabels;
+		node["roots"] >> m_roots;
+		node["var_idx"] >> varIdx;
+		node["thresholds"] >> thresholds;
+		node["le"] >> le;
+		node["gt"] >> gt;
+
+		//consistency checks (the nodes of each tree are contiguous and stored after their parent)
+		int nodeCount = static_cast<int>(varIdx.size());
+		bool valid = (		m_varCount > 0
+						&&	m_classLabels.size() > 1
+						&&	!m_roots.empty()
+						&&	m_roots.front() == 0
+						&&	thresholds.size() == varIdx.size()
+						&&	le.size() == varIdx.size()
+						&&	gt.size() == varIdx.size());
+
+		m_nodes.resize(valid ? nodeCount : 0);
+		for (size_t t = 0; t < m_roots.size() && valid; ++t)
+		{
+			int firstNode = m_roots[t];
+			int lastNode = (t + 1 < m_roots.size() ? m_roots[t + 1] : nodeCount);
+			valid = (firstNode < lastNode && lastNode <= nodeCount);
+			for (int i = firstNode; i < lastNode && valid; ++i)
+			{
+				Node& n = m_nodes[i];
+				n.varIdx = std::max(-1, varIdx[i]);
+				n.threshold = thresholds[i];
+				n.le = le[i];
+				if (n.varIdx >= 0)
+				{
+					n.gt = gt[i];
+					valid = (	n.varIdx < m_varCount
+							&&	n.le > i && n.le < lastNode
+							&&	n.gt > i && n.gt < lastNode);
+				}
+				else
+				{
+					valid = (n.le >= 0 && n.le < classCount());
+				}
+			}
+		}
+
+		if (!valid)
+		{
+			errorMessage = QObject::tr("Invalid forest");
+			clear();
+			return false;
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		clear();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		clear();
+		return false;
+	}
+
+	return true;
+}
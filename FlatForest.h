@@ -0,0 +1,264 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//Qt
+#include <QString>
+
+//system
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace masc
+{
+	//! Flat (cache friendly) version of an OpenCV random forest
+	/** Used to get the predicted class and the votes with a single traversal
+		of each tree (RTrees::predict + RTrees::getVotes traverse the forest twice).
+		The result is strictly identical to OpenCV's (including NaN values and ties).
+	**/
+	class FlatForest
+	{
+	public:
+
+		//! Builds the flat forest from a trained OpenCV classifier
+		bool build(const cv::Ptr<cv::ml::RTrees>& rtrees, QString& errorMessage);
+
+		//! Builds the flat forest from several OpenCV classifiers (trained on the same classes)
+		/** \param treeCounts number of trees to keep for each classifier (the first ones)
+		**/
+		bool build(	const std::vector< cv::Ptr<cv::ml::RTrees> >& forests,
+					const std::vector<int>& treeCounts,
+					QString& errorMessage);
+
+		//! Clears the forest
+		void clear();
+
+		//! Returns whether the forest is valid
+		inline bool isValid() const { return !m_roots.empty() && !m_classLabels.empty(); }
+
+		//! Returns the number of trees
+		inline int treeCount() const { return static_cast<int>(m_roots.size()); }
+		//! Returns the number of classes
+		inline int classCount() const { return static_cast<int>(m_classLabels.size()); }
+		//! Returns the label of a given class (index)
+		inline float classLabel(int classIndex) const { return m_classLabels[classIndex]; }
+		//! Returns the number of features (variables)
+		inline int varCount() const { return m_varCount; }
+		//! Returns the total number of nodes
+		inline size_t nodeCount() const { return m_nodes.size(); }
+
+		//! Computes the votes of all the trees for a given sample
+		/** \param sample feature values (varCount() values)
+			\param votes vote count per class (classCount() values)
+			\return the index of the winning class (the first one in case of a tie)
+		**/
+		inline int predict(const float* sample, int* votes) const
+		{
+			for (int c = 0; c < classCount(); ++c)
+			{
+				votes[c] = 0;
+			}
+			for (int root : m_roots)
+			{
+				++votes[leafClassIndex(root, sample)];
+			}
+
+			int bestIndex = 0;
+			for (int c = 1; c < classCount(); ++c)
+			{
+				if (votes[c] > votes[bestIndex])
+					bestIndex = c;
+			}
+			return bestIndex;
+		}
+
+		//! Returns the class index predicted by a single tree
+		inline int treeClassIndex(int treeIndex, const float* sample) const
+		{
+			return leafClassIndex(m_roots[treeIndex], sample);
+		}
+
+		//! Returns the indexes of the trees having at least one split on a given feature
+		std::vector<int> treesUsingVar(int varIdx) const;
+
+		//! Builds the quantized version of the forest
+		/** For each feature, the thresholds used by the trees are sorted: a feature value can
+			then be encoded as the index of its bin among them (see encode), and the trees
+			traversed with integer comparisons (see predictBatch). The predictions are identical.
+			\return false if a feature has too many thresholds (more than 65534)
+		**/
+		bool buildQuantization(QString& errorMessage);
+
+		//! Returns whether the quantized version of the forest is available
+		inline bool isQuantized() const { return !m_codeNodes.empty(); }
+		//! Returns whether the quantized codes fit on 8 bits (16 bits otherwise)
+		inline bool hasByteCodes() const { return m_byteCodes; }
+
+		//! Encodes the features of a sample (uint8_t or uint16_t codes, see hasByteCodes)
+		/** The code of a value is the number of thresholds strictly below it (NaN values get the maximum code). **/
+		template <typename Code> inline void encode(const float* sample, Code* codes) const
+		{
+			for (int v = 0; v < m_varCount; ++v)
+			{
+				float value = sample[v];
+				if (std::isnan(value))
+				{
+					codes[v] = std::numeric_limits<Code>::max();
+				}
+				else
+				{
+					const std::vector<float>& thresholds = m_varThresholds[v];
+					codes[v] = static_cast<Code>(std::lower_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin());
+				}
+			}
+		}
+
+		//! Computes the votes of a batch of encoded samples (tree by tree, for cache efficiency)
+		/** \param codes encoded samples (varCount() codes per sample)
+			\param votes vote count per class (classCount() values per sample)
+			\param classIndexes index of the winning class of each sample
+		**/
+		template <typename Code> void predictBatch(const Code* codes, int sampleCount, int* votes, int* classIndexes) const
+		{
+			int nbClasses = classCount();
+			std::fill(votes, votes + static_cast<size_t>(sampleCount) * nbClasses, 0);
+
+			for (int root : m_roots)
+			{
+				for (int s = 0; s < sampleCount; ++s)
+				{
+					const Code* row = codes + static_cast<size_t>(s) * m_varCount;
+					const CodeNode* node = &m_codeNodes[root];
+					while (node->varIdx >= 0)
+					{
+						node = &m_codeNodes[row[node->varIdx] <= node->code ? node->le : node->gt];
+					}
+					++votes[static_cast<size_t>(s) * nbClasses + node->le];
+				}
+			}
+
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				const int* sampleVotes = votes + static_cast<size_t>(s) * nbClasses;
+				int bestIndex = 0;
+				for (int c = 1; c < nbClasses; ++c)
+				{
+					if (sampleVotes[c] > sampleVotes[bestIndex])
+						bestIndex = c;
+				}
+				classIndexes[s] = bestIndex;
+			}
+		}
+
+		//! Returns a hash of the model (trees, classes and number of features)
+		/** Used to identify the compiled version of the forest (see CompiledForest). **/
+		uint64_t hash() const;
+
+		//! Compacts the forest (the predictions are strictly identical)
+		/** In each tree, the splits whose two branches lead to the same predictions (e.g. subtrees
+			whose leaves all vote for the same class) are removed, and the identical subtrees are
+			merged (their nodes are then shared). The quantized version is cleared.
+		**/
+		bool compact(QString& errorMessage);
+
+		//! Returns the number of splits on each feature
+		std::vector<int> varSplitCounts() const;
+
+		//! Removes and/or reorders the features
+		/** \param newVarIndexes new index of each feature (-1 if removed, in which case it shouldn't be used by any split)
+			\param newVarCount new number of features
+		**/
+		bool remapVars(const std::vector<int>& newVarIndexes, int newVarCount, QString& errorMessage);
+
+		//! Returns the expected number of comparisons per tree (i.e. the average path length)
+		/** Assuming that each split sends half of the samples in each branch. **/
+		double expectedPathLength() const;
+
+		//! Writes the forest (in the current node)
+		void write(cv::FileStorage& fs) const;
+		//! Reads the forest
+		bool read(const cv::FileNode& node, QString& errorMessage);
+
+	protected:
+
+		friend class CompiledForest;
+
+		//! Node
+		struct Node
+		{
+			//! Split variable index (or -1 for leaves)
+			int varIdx = -1;
+			//! Split threshold
+			float threshold = 0.0f;
+			//! Child if value <= threshold (or class index for leaves)
+			int le = 0;
+			//! Child otherwise (including NaN values)
+			int gt = 0;
+		};
+
+		//! Quantized node
+		struct CodeNode
+		{
+			//! Split variable index (or -1 for leaves)
+			int varIdx = -1;
+			//! Index of the split threshold among the thresholds of the variable
+			uint32_t code = 0;
+			//! Child if code <= threshold code (or class index for leaves)
+			int le = 0;
+			//! Child otherwise (including NaN values)
+			int gt = 0;
+		};
+
+		//! Returns the class index of the leaf reached by a sample
+		inline int leafClassIndex(int nodeIndex, const float* sample) const
+		{
+			const Node* node = &m_nodes[nodeIndex];
+			while (node->varIdx >= 0)
+			{
+				node = &m_nodes[sample[node->varIdx] <= node->threshold ? node->le : node->gt];
+			}
+			return node->le;
+		}
+
+		//! Appends a tree (depth first, siblings are stored side by side)
+		bool appendTree(const cv::Ptr<cv::ml::RTrees>& rtrees, int root, QString& errorMessage);
+
+		//! Nodes (the nodes of each tree are contiguous, and stored after their parent)
+		std::vector<Node> m_nodes;
+		//! Root node of each tree
+		std::vector<int> m_roots;
+		//! Class labels
+		std::vector<float> m_classLabels;
+		//! Number of features
+		int m_varCount = 0;
+
+		//! Quantized nodes (same layout as m_nodes)
+		std::vector<CodeNode> m_codeNodes;
+		//! Sorted thresholds of each feature
+		std::vector< std::vector<float> > m_varThresholds;
+		//! Whether the quantized codes fit on 8 bits
+		bool m_byteCodes = false;
+	};
+
+}; //namespace masc
@@ -0,0 +1,675 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "GradientBoostedTrees.h"
+
+//Local
+#include "ExecutionContext.h"
+
+//Qt
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <random>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+//! Maximum number of bins per feature (the last one is reserved for NaN values)
+static const int MaxBinCount = 256;
+//! Bin of the NaN values
+static const int NaNBin = MaxBinCount - 1;
+//! Maximum number of samples used to compute the bin edges of each feature
+static const size_t MaxBinningSampleCount = 200000;
+//! L2 regularization of the leaf values
+static const double Lambda = 1.0;
+//! Minimum gain of a split
+static const double MinGain = 1.0e-9;
+//! Minimum hessian of a sample
+static const float MinHessian = 1.0e-6f;
+//! Minimum number of samples of a node to build its histograms in parallel
+static const int MinParallelSampleCount = 4096;
+
+//! Histogram bin (sums of the gradients and hessians of the samples)
+struct HistogramBin
+{
+	double g = 0.0;
+	double h = 0.0;
+	int count = 0;
+};
+
+//! Computes the (upper) edges of the bins of a feature
+/** \param values sorted values (without NaN)
+	\param edges a value goes in bin 'b' if edges[b-1] < value <= edges[b]
+**/
+static void ComputeBinEdges(const std::vector<float>& values, std::vector<float>& edges)
+{
+	edges.clear();
+	if (values.empty())
+	{
+		return;
+	}
+
+	std::vector<float> distinctValues;
+	std::unique_copy(values.begin(), values.end(), std::back_inserter(distinctValues));
+	if (distinctValues.size() <= static_cast<size_t>(NaNBin))
+	{
+		//one bin per value
+		for (size_t i = 1; i < distinctValues.size(); ++i)
+		{
+			edges.push_back(static_cast<float>((static_cast<double>(distinctValues[i - 1]) + distinctValues[i]) / 2));
+		}
+	}
+	else
+	{
+		//quantiles
+		size_t count = values.size();
+		for (int b = 1; b < NaNBin; ++b)
+		{
+			float edge = values[(b * count) / NaNBin];
+			if (edge < values.back() && (edges.empty() || edge > edges.back()))
+			{
+				edges.push_back(edge);
+			}
+		}
+	}
+}
+
+//! Returns the bin of a value
+static inline uint8_t BinIndex(const std::vector<float>& edges, float value)
+{
+	if (std::isnan(value))
+	{
+		return static_cast<uint8_t>(NaNBin);
+	}
+	return static_cast<uint8_t>(std::lower_bound(edges.begin(), edges.end(), value) - edges.begin());
+}
+
+namespace masc
+{
+	//! Grows the trees of a gradient boosting model on the quantized training data
+	class GradientBoostedTreesBuilder
+	{
+	public:
+
+		GradientBoostedTreesBuilder(GradientBoostedTrees& model,
+									const std::vector<uint8_t>& bins,
+									const std::vector< std::vector<float> >& edges,
+									int sampleCount,
+									const RandomTreesParams& params,
+									const ExecutionContext& context)
+			: m_model(model)
+			, m_bins(bins)
+			, m_edges(edges)
+			, m_sampleCount(sampleCount)
+			, m_params(params)
+			, m_context(context)
+			, m_minLeafSampleCount(std::max(1, params.minSampleCount))
+		{
+			gradients.resize(sampleCount);
+			hessians.resize(sampleCount);
+			m_rows.resize(sampleCount);
+		}
+
+		//! Gradients of the samples (for the current tree)
+		std::vector<float> gradients;
+		//! Hessians of the samples (for the current tree)
+		std::vector<float> hessians;
+
+		//! Grows a tree and updates the scores of the training samples
+		/** \param activeVars features that can be used by the tree
+			\param classIndex class of the tree
+			\param scores scores of the training samples (classCount values per sample)
+		**/
+		void growTree(const std::vector<int>& activeVars, int classIndex, float* scores)
+		{
+			m_activeVars = activeVars;
+			std::iota(m_rows.begin(), m_rows.end(), 0);
+
+			int root = static_cast<int>(m_model.m_nodes.size());
+			m_model.m_roots.push_back(root);
+			m_model.m_nodes.emplace_back();
+
+			std::vector<HistogramBin> histogram;
+			buildHistogram(0, m_sampleCount, histogram);
+
+			//each sample lies in exactly one bin of any feature
+			double G = 0.0, H = 0.0;
+			for (int b = 0; b < MaxBinCount; ++b)
+			{
+				G += histogram[b].g;
+				H += histogram[b].h;
+			}
+
+			growNode(root, 0, m_sampleCount, 0, histogram, G, H, classIndex, scores);
+		}
+
+	protected:
+
+		//! Split candidate
+		struct Split
+		{
+			double gain = MinGain;
+			int varIdx = -1;
+			int bin = 0;
+			double GL = 0.0;
+			double HL = 0.0;
+		};
+
+		//! Builds the histograms of the active features for a range of (row) samples
+		void buildHistogram(int begin, int end, std::vector<HistogramBin>& histogram) const
+		{
+			int activeVarCount = static_cast<int>(m_activeVars.size());
+			histogram.assign(static_cast<size_t>(activeVarCount) * MaxBinCount, HistogramBin());
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(m_context.threadCount()) schedule(dynamic) if (end - begin >= MinParallelSampleCount)
+#endif
+#endif
+			for (int j = 0; j < activeVarCount; ++j)
+			{
+				const uint8_t* featureBins = m_bins.data() + static_cast<size_t>(m_activeVars[j]) * m_sampleCount;
+				HistogramBin* featureHistogram = histogram.data() + static_cast<size_t>(j) * MaxBinCount;
+				for (int r = begin; r < end; ++r)
+				{
+					int i = m_rows[r];
+					HistogramBin& bin = featureHistogram[featureBins[i]];
+					bin.g += gradients[i];
+					bin.h += hessians[i];
+					++bin.count;
+				}
+			}
+		}
+
+		//! Looks for the best split of a node
+		bool findBestSplit(const std::vector<HistogramBin>& histogram, double G, double H, int count, Split& best) const
+		{
+			double parentScore = G * G / (H + Lambda);
+			for (size_t j = 0; j < m_activeVars.size(); ++j)
+			{
+				int varIdx = m_activeVars[j];
+				const HistogramBin* featureHistogram = histogram.data() + j * MaxBinCount;
+				int binCount = static_cast<int>(m_edges[varIdx].size()) + 1; //NaN values always go to the right
+
+				double GL = 0.0, HL = 0.0;
+				int countL = 0;
+				for (int b = 0; b + 1 < binCount; ++b)
+				{
+					GL += featureHistogram[b].g;
+					HL += featureHistogram[b].h;
+					countL += featureHistogram[b].count;
+					if (countL < m_minLeafSampleCount)
+					{
+						continue;
+					}
+					if (count - countL < m_minLeafSampleCount)
+					{
+						break;
+					}
+
+					double GR = G - GL;
+					double HR = H - HL;
+					double gain = GL * GL / (HL + Lambda) + GR * GR / (HR + Lambda) - parentScore;
+					if (gain > best.gain)
+					{
+						best.gain = gain;
+						best.varIdx = varIdx;
+						best.bin = b;
+						best.GL = GL;
+						best.HL = HL;
+					}
+				}
+			}
+
+			return (best.varIdx >= 0);
+		}
+
+		//! Grows a node (depth first)
+		void growNode(int nodeIndex, int begin, int end, int depth, std::vector<HistogramBin>& histogram, double G, double H, int classIndex, float* scores)
+		{
+			int count = end - begin;
+			int classCount = m_model.classCount();
+
+			Split best;
+			if (	depth >= m_params.maxDepth
+				||	count < 2 * m_minLeafSampleCount
+				||	!findBestSplit(histogram, G, H, count, best))
+			{
+				//leaf
+				float value = static_cast<float>(-G / (H + Lambda) * m_params.learningRate);
+				GradientBoostedTrees::Node& leaf = m_model.m_nodes[nodeIndex];
+				leaf.varIdx = -1;
+				leaf.threshold = value;
+				for (int r = begin; r < end; ++r)
+				{
+					scores[static_cast<size_t>(m_rows[r]) * classCount + classIndex] += value;
+				}
+				return;
+			}
+
+			m_model.m_gains[best.varIdx] += static_cast<float>(best.gain);
+
+			//split the samples
+			const uint8_t* featureBins = m_bins.data() + static_cast<size_t>(best.varIdx) * m_sampleCount;
+			int middle = static_cast<int>(std::partition(	m_rows.begin() + begin,
+															m_rows.begin() + end,
+															[&](int i) { return featureBins[i] <= best.bin; })
+											- m_rows.begin());
+
+			//siblings are stored side by side
+			int leIndex = static_cast<int>(m_model.m_nodes.size());
+			m_model.m_nodes.resize(m_model.m_nodes.size() + 2);
+			GradientBoostedTrees::Node& node = m_model.m_nodes[nodeIndex];
+			node.varIdx = best.varIdx;
+			node.threshold = m_edges[best.varIdx][best.bin];
+			node.le = leIndex;
+			node.gt = leIndex + 1;
+
+			//only the histogram of the smallest child is built, the other one is obtained by subtraction
+			std::vector<HistogramBin> smallHistogram;
+			bool leftIsSmaller = (middle - begin <= end - middle);
+			if (leftIsSmaller)
+				buildHistogram(begin, middle, smallHistogram);
+			else
+				buildHistogram(middle, end, smallHistogram);
+			for (size_t i = 0; i < histogram.size(); ++i)
+			{
+				histogram[i].g -= smallHistogram[i].g;
+				histogram[i].h -= smallHistogram[i].h;
+				histogram[i].count -= smallHistogram[i].count;
+			}
+
+			std::vector<HistogramBin>& leftHistogram = (leftIsSmaller ? smallHistogram : histogram);
+			std::vector<HistogramBin>& rightHistogram = (leftIsSmaller ? histogram : smallHistogram);
+			growNode(leIndex, begin, middle, depth + 1, leftHistogram, best.GL, best.HL, classIndex, scores);
+			growNode(leIndex + 1, middle, end, depth + 1, rightHistogram, G - best.GL, H - best.HL, classIndex, scores);
+		}
+
+		GradientBoostedTrees& m_model;
+		//! Quantized training data (feature after feature)
+		const std::vector<uint8_t>& m_bins;
+		//! Bin edges of each feature
+		const std::vector< std::vector<float> >& m_edges;
+		int m_sampleCount;
+		const RandomTreesParams& m_params;
+		const ExecutionContext& m_context;
+		int m_minLeafSampleCount;
+		//! Training samples (sorted by node)
+		std::vector<int> m_rows;
+		//! Features used by the current tree
+		std::vector<int> m_activeVars;
+	};
+}
+
+void GradientBoostedTrees::clear()
+{
+	m_nodes.clear();
+	m_roots.clear();
+	m_classLabels.clear();
+	m_baseScores.clear();
+	m_gains.clear();
+	m_varCount = 0;
+}
+
+bool GradientBoostedTrees::train(	const RandomTreesParams& params,
+									const cv::Mat& data,
+									const cv::Mat& labels,
+									QString& errorMessage,
+									const cv::Mat& sampleIdx/*=cv::Mat()*/,
+									const ExecutionContext& context/*=ExecutionContext()*/)
+{
+	clear();
+
+	if (data.empty() || data.type() != CV_32F || data.rows != labels.rows || labels.type() != CV_32F)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid training data");
+		return false;
+	}
+	if (params.maxTreeCount < 1 || params.maxDepth < 1 || params.learningRate <= 0.0f)
+	{
+		errorMessage = QObject::tr("Invalid gradient boosting parameters");
+		return false;
+	}
+	if (!sampleIdx.empty() && sampleIdx.type() != CV_32S)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid sample indexes");
+		return false;
+	}
+
+	try
+	{
+		//training samples
+		std::vector<int> sampleRows;
+		if (sampleIdx.empty())
+		{
+			sampleRows.resize(data.rows);
+			std::iota(sampleRows.begin(), sampleRows.end(), 0);
+		}
+		else
+		{
+			cv::Mat indexes = (sampleIdx.isContinuous() ? sampleIdx : sampleIdx.clone());
+			const int* indexPtr = indexes.ptr<int>();
+			sampleRows.assign(indexPtr, indexPtr + indexes.total());
+		}
+		int sampleCount = static_cast<int>(sampleRows.size());
+		int varCount = data.cols;
+
+		//classes
+		for (int i : sampleRows)
+		{
+			m_classLabels.push_back(labels.at<float>(i));
+		}
+		std::sort(m_classLabels.begin(), m_classLabels.end());
+		m_classLabels.erase(std::unique(m_classLabels.begin(), m_classLabels.end()), m_classLabels.end());
+		int nbClasses = classCount();
+		if (nbClasses < 2)
+		{
+			errorMessage = QObject::tr("At least two classes are required");
+			clear();
+			return false;
+		}
+
+		std::vector<int> sampleClasses(sampleCount);
+		std::vector<int> classPopulation(nbClasses, 0);
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			sampleClasses[i] = static_cast<int>(std::lower_bound(m_classLabels.begin(), m_classLabels.end(), labels.at<float>(sampleRows[i])) - m_classLabels.begin());
+			++classPopulation[sampleClasses[i]];
+		}
+		m_baseScores.resize(nbClasses);
+		for (int c = 0; c < nbClasses; ++c)
+		{
+			m_baseScores[c] = static_cast<float>(std::log(static_cast<double>(classPopulation[c]) / sampleCount));
+		}
+
+		//quantization of the features
+		std::vector< std::vector<float> > edges(varCount);
+		std::vector<uint8_t> bins(static_cast<size_t>(varCount) * sampleCount);
+		size_t binningStep = std::max<size_t>(1, sampleRows.size() / MaxBinningSampleCount);
+		bool outOfMemory = false;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic)
+#endif
+#endif
+		for (int f = 0; f < varCount; ++f)
+		{
+			try
+			{
+				std::vector<float> values;
+				values.reserve(sampleRows.size() / binningStep + 1);
+				for (size_t i = 0; i < sampleRows.size(); i += binningStep)
+				{
+					float value = data.at<float>(sampleRows[i], f);
+					if (!std::isnan(value))
+						values.push_back(value);
+				}
+				std::sort(values.begin(), values.end());
+				ComputeBinEdges(values, edges[f]);
+
+				uint8_t* featureBins = bins.data() + static_cast<size_t>(f) * sampleCount;
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					featureBins[i] = BinIndex(edges[f], data.at<float>(sampleRows[i], f));
+				}
+			}
+			catch (const std::bad_alloc&)
+			{
+				outOfMemory = true;
+			}
+		}
+		if (outOfMemory)
+		{
+			throw std::bad_alloc();
+		}
+
+		m_varCount = varCount;
+		m_gains.resize(varCount, 0.0f);
+		m_learningRate = params.learningRate;
+
+		//boosting
+		std::vector<float> scores(static_cast<size_t>(sampleCount) * nbClasses);
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			std::copy(m_baseScores.begin(), m_baseScores.end(), scores.begin() + static_cast<size_t>(i) * nbClasses);
+		}
+		std::vector<float> probabilities(scores.size());
+
+		GradientBoostedTreesBuilder builder(*this, bins, edges, sampleCount, params, context);
+
+		int activeVarCount = (params.activeVarCount > 0 ? std::min(params.activeVarCount, varCount) : varCount);
+		std::vector<int> vars(varCount);
+		std::iota(vars.begin(), vars.end(), 0);
+		std::vector<int> activeVars(vars);
+		std::mt19937 generator(0x3DA5C);
+
+		for (int iteration = 0; iteration < params.maxTreeCount; ++iteration)
+		{
+			//probabilities of the training samples (before this iteration)
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+#endif
+			for (int i = 0; i < sampleCount; ++i)
+			{
+				size_t offset = static_cast<size_t>(i) * nbClasses;
+				std::copy(scores.begin() + offset, scores.begin() + offset + nbClasses, probabilities.begin() + offset);
+				Softmax(probabilities.data() + offset, nbClasses);
+			}
+
+			//features used by the trees of this iteration
+			if (activeVarCount < varCount)
+			{
+				std::shuffle(vars.begin(), vars.end(), generator);
+				activeVars.assign(vars.begin(), vars.begin() + activeVarCount);
+				std::sort(activeVars.begin(), activeVars.end());
+			}
+
+			//one tree per class
+			for (int c = 0; c < nbClasses; ++c)
+			{
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+#endif
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					float p = probabilities[static_cast<size_t>(i) * nbClasses + c];
+					builder.gradients[i] = p - (sampleClasses[i] == c ? 1.0f : 0.0f);
+					builder.hessians[i] = std::max(p * (1.0f - p), MinHessian);
+				}
+
+				builder.growTree(activeVars, c, scores.data());
+			}
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		clear();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		clear();
+		return false;
+	}
+
+	return true;
+}
+
+std::vector<int> GradientBoostedTrees::treesUsingVar(int varIdx) const
+{
+	std::vector<int> trees;
+
+	//the nodes of each tree are contiguous
+	for (size_t t = 0; t < m_roots.size(); ++t)
+	{
+		size_t firstNode = m_roots[t];
+		size_t lastNode = (t + 1 < m_roots.size() ? m_roots[t + 1] : m_nodes.size());
+		for (size_t n = firstNode; n < lastNode; ++n)
+		{
+			if (m_nodes[n].varIdx == varIdx)
+			{
+				trees.push_back(static_cast<int>(t));
+				break;
+			}
+		}
+	}
+
+	return trees;
+}
+
+cv::Mat GradientBoostedTrees::getVarImportance() const
+{
+	cv::Mat importance = cv::Mat::zeros(m_varCount, 1, CV_32F);
+
+	double totalGain = 0.0;
+	for (float gain : m_gains)
+	{
+		totalGain += gain;
+	}
+	if (totalGain > 0.0)
+	{
+		for (int f = 0; f < m_varCount && f < static_cast<int>(m_gains.size()); ++f)
+		{
+			importance.at<float>(f, 0) = static_cast<float>(m_gains[f] / totalGain);
+		}
+	}
+
+	return importance;
+}
+
+void GradientBoostedTrees::write(cv::FileStorage& fs) const
+{
+	std::vector<int> varIdx(m_nodes.size()), le(m_nodes.size()), gt(m_nodes.size());
+	std::vector<float> thresholds(m_nodes.size());
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		varIdx[i] = m_nodes[i].varIdx;
+		thresholds[i] = m_nodes[i].threshold;
+		le[i] = m_nodes[i].le;
+		gt[i] = m_nodes[i].gt;
+	}
+
+	fs << "var_count" << m_varCount;
+	fs << "learning_rate" << m_learningRate;
+	fs << "class_labels" << m_classLabels;
+	fs << "base_scores" << m_baseScores;
+	fs << "gains" << m_gains;
+	fs << "roots" << m_roots;
+	fs << "var_idx" << varIdx;
+	fs << "thresholds" << thresholds;
+	fs << "le" << le;
+	fs << "gt" << gt;
+}
+
+bool GradientBoostedTrees::read(const cv::FileNode& node, QString& errorMessage)
+{
+	clear();
+
+	if (node.empty())
+	{
+		errorMessage = QObject::tr("Missing gradient boosting model");
+		return false;
+	}
+
+	try
+	{
+		std::vector<int> varIdx, le, gt;
+		std::vector<float> thresholds;
+
+		node["var_count"] >> m_varCount;
+		node["learning_rate"] >> m_learningRate;
+		node["class_labels"] >> m_classLabels;
+		node["base_scores"] >> m_baseScores;
+		node["gains"] >> m_gains;
+		node["roots"] >> m_roots;
+		node["var_idx"] >> varIdx;
+		node["thresholds"] >> thresholds;
+		node["le"] >> le;
+		node["gt"] >> gt;
+
+		//consistency checks (the children are always stored after their parent)
+		size_t nodeCount = varIdx.size();
+		bool valid = (		m_varCount > 0
+						&&	m_classLabels.size() > 1
+						&&	m_baseScores.size() == m_classLabels.size()
+						&&	!m_roots.empty()
+						&&	m_roots.size() % m_classLabels.size() == 0
+						&&	thresholds.size() == nodeCount
+						&&	le.size() == nodeCount
+						&&	gt.size() == nodeCount);
+
+		m_nodes.resize(valid ? nodeCount : 0);
+		for (size_t i = 0; i < m_nodes.size() && valid; ++i)
+		{
+			Node& n = m_nodes[i];
+			n.varIdx = std::max(-1, varIdx[i]);
+			n.threshold = thresholds[i];
+			if (n.varIdx >= 0)
+			{
+				n.le = le[i];
+				n.gt = gt[i];
+				valid = (	n.varIdx < m_varCount
+						&&	n.le > static_cast<int>(i) && n.le < static_cast<int>(nodeCount)
+						&&	n.gt > static_cast<int>(i) && n.gt < static_cast<int>(nodeCount));
+			}
+		}
+		for (int root : m_roots)
+		{
+			valid &= (root >= 0 && root < static_cast<int>(m_nodes.size()));
+		}
+
+		if (!valid)
+		{
+			errorMessage = QObject::tr("Invalid gradient boosting model");
+			clear();
+			return false;
+		}
+
+		m_gains.resize(m_varCount, 0.0f);
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		clear();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		clear();
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "Parameters.h"
+#include "ExecutionContext.h"
+
+//OpenCV
+#include <opencv2/core.hpp>
+
+//Qt
+#include <QString>
+
+//system
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace masc
+{
+	//! Multiclass gradient boosted trees (histogram based)
+	/** Shallow regression trees are fitted on the gradients of the softmax loss
+		(one tree per class at each iteration). The feature values are first quantized
+		in at most 255 bins, so that the best splits are searched on histograms
+		(built in parallel over the features, the histogram of the biggest child
+		being obtained by subtraction). NaN values always go to the 'greater' child.
+	**/
+	class GradientBoostedTrees
+	{
+	public:
+
+		//! Trains the model
+		/** \param params	maxTreeCount = number of iterations (i.e. maxTreeCount x classCount trees)
+							maxDepth = depth of each tree
+							minSampleCount = minimum number of samples per leaf
+							activeVarCount = number of features randomly drawn at each iteration (0 = all)
+							learningRate = shrinkage of the leaf values
+			\param sampleIdx if not empty, only these rows are used (CV_32S)
+			\param context execution context (number of threads)
+		**/
+		bool train(	const RandomTreesParams& params,
+					const cv::Mat& data,
+					const cv::Mat& labels,
+					QString& errorMessage,
+					const cv::Mat& sampleIdx = cv::Mat(),
+					const ExecutionContext& context = ExecutionContext());
+
+		//! Clears the model
+		void clear();
+
+		//! Returns whether the model is valid
+		inline bool isValid() const { return !m_roots.empty() && m_classLabels.size() > 1; }
+
+		//! Returns the number of trees
+		inline int treeCount() const { return static_cast<int>(m_roots.size()); }
+		//! Returns the number of classes
+		inline int classCount() const { return static_cast<int>(m_classLabels.size()); }
+		//! Returns the label of a given class (index)
+		inline float classLabel(int classIndex) const { return m_classLabels[classIndex]; }
+		//! Returns the number of features (variables)
+		inline int varCount() const { return m_varCount; }
+		//! Returns the total number of nodes
+		inline size_t nodeCount() const { return m_nodes.size(); }
+
+		//! Computes the raw scores (one per class) of a sample
+		/** \return the index of the winning class (the first one in case of a tie)
+		**/
+		inline int decisionFunction(const float* sample, float* scores) const
+		{
+			for (int c = 0; c < classCount(); ++c)
+			{
+				scores[c] = m_baseScores[c];
+			}
+			for (int t = 0; t < treeCount(); ++t)
+			{
+				scores[treeClassIndex(t)] += leafValue(m_roots[t], sample);
+			}
+
+			int bestIndex = 0;
+			for (int c = 1; c < classCount(); ++c)
+			{
+				if (scores[c] > scores[bestIndex])
+					bestIndex = c;
+			}
+			return bestIndex;
+		}
+
+		//! Computes the class probabilities of a sample
+		/** \return the index of the winning class
+		**/
+		inline int predict(const float* sample, float* probabilities) const
+		{
+			int bestIndex = decisionFunction(sample, probabilities);
+			Softmax(probabilities, classCount());
+			return bestIndex;
+		}
+
+		//! Returns the class (index) a tree contributes to
+		inline int treeClassIndex(int treeIndex) const { return treeIndex % classCount(); }
+		//! Returns the contribution of a single tree (to the score of its class)
+		inline float treeValue(int treeIndex, const float* sample) const { return leafValue(m_roots[treeIndex], sample); }
+
+		//! Returns the indexes of the trees having at least one split on a given feature
+		std::vector<int> treesUsingVar(int varIdx) const;
+
+		//! Returns the variable importance (normalized total gain of the splits on each feature)
+		cv::Mat getVarImportance() const;
+
+		//! Writes the model (in the current node)
+		void write(cv::FileStorage& fs) const;
+		//! Reads the model
+		bool read(const cv::FileNode& node, QString& errorMessage);
+
+		//! Converts scores to probabilities (in place)
+		static inline void Softmax(float* scores, int count)
+		{
+			float maxScore = scores[0];
+			for (int c = 1; c < count; ++c)
+			{
+				maxScore = std::max(maxScore, scores[c]);
+			}
+			float sum = 0.0f;
+			for (int c = 0; c < count; ++c)
+			{
+				scores[c] = std::exp(scores[c] - maxScore);
+				sum += scores[c];
+			}
+			for (int c = 0; c < count; ++c)
+			{
+				scores[c] /= sum;
+			}
+		}
+
+	protected:
+
+		//! Node
+		struct Node
+		{
+			//! Split variable index (or -1 for leaves)
+			int varIdx = -1;
+			//! Split threshold (or output value for leaves)
+			float threshold = 0.0f;
+			//! Child if value <= threshold
+			int le = 0;
+			//! Child otherwise (including NaN values)
+			int gt = 0;
+		};
+
+		//! Returns the output value of the leaf reached by a sample
+		inline float leafValue(int nodeIndex, const float* sample) const
+		{
+			const Node* node = &m_nodes[nodeIndex];
+			while (node->varIdx >= 0)
+			{
+				node = &m_nodes[sample[node->varIdx] <= node->threshold ? node->le : node->gt];
+			}
+			return node->threshold;
+		}
+
+		friend class GradientBoostedTreesBuilder;
+
+		//! Nodes (the nodes of each tree are contiguous)
+		std::vector<Node> m_nodes;
+		//! Root node of each tree (iteration after iteration, one tree per class)
+		std::vector<int> m_roots;
+		//! Class labels
+		std::vector<float> m_classLabels;
+		//! Initial score of each class (log of the class frequency)
+		std::vector<float> m_baseScores;
+		//! Total gain of the splits on each feature
+		std::vector<float> m_gains;
+		//! Learning rate (for information)
+		float m_learningRate = 0.1f;
+		//! Number of features
+		int m_varCount = 0;
+	};
+
+}; //namespace masc
@@ -0,0 +1,405 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "GroundRaster.h"
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+//! Maximum number of cells (to avoid silly memory consumption)
+/** About 50 bytes per cell are needed during the construction (i.e. ~800 MB) **/
+static const size_t MaxCellCount = (static_cast<size_t>(1) << 24);
+
+//! Horizontal extent of a set of points
+struct Extent
+{
+	double minX = 0, minY = 0, maxX = 0, maxY = 0;
+	unsigned count = 0;
+
+	void add(double x, double y)
+	{
+		if (count == 0)
+		{
+			minX = maxX = x;
+			minY = maxY = y;
+		}
+		else
+		{
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+		}
+		++count;
+	}
+
+	void add(const Extent& e)
+	{
+		if (e.count == 0)
+			return;
+		if (count == 0)
+		{
+			*this = e;
+			return;
+		}
+		minX = std::min(minX, e.minX);
+		maxX = std::max(maxX, e.maxX);
+		minY = std::min(minY, e.minY);
+		maxY = std::max(maxY, e.maxY);
+		count += e.count;
+	}
+};
+
+bool GroundRaster::build(	CCCoreLib::GenericIndexedCloudPersist* cloud,
+							const CCCoreLib::ScalarField* classifSF,
+							int classLabel,
+							double scale,
+							int kNN,
+							bool useMinZ,
+							QString& errorMessage,
+							const ExecutionContext& context/*=ExecutionContext()*/)
+{
+	m_cells.clear();
+	m_width = m_height = 0;
+	m_pointCount = 0;
+
+	if (!cloud || !classifSF || classifSF->size() < cloud->size())
+	{
+		assert(false);
+		errorMessage = "Invalid input parameters";
+		return false;
+	}
+
+	//the points are processed by contiguous blocks (one per thread) so that the result doesn't depend on the scheduling
+	const ScalarType fClass = static_cast<ScalarType>(classLabel);
+	const unsigned pointCount = cloud->size();
+	const int blockCount = std::max(1, std::min(context.threadCount(), static_cast<int>(pointCount)));
+	auto blockStart = [&](int b) { return static_cast<unsigned>((static_cast<uint64_t>(b) * pointCount) / blockCount); };
+
+	//horizontal extent of the class points
+	Extent extent;
+	try
+	{
+		std::vector<Extent> blockExtents(blockCount);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+		for (int b = 0; b < blockCount; ++b)
+		{
+			Extent& blockExtent = blockExtents[b];
+			for (unsigned i = blockStart(b); i < blockStart(b + 1); ++i)
+			{
+				if (classifSF->getValue(i) != fClass)
+					continue;
+
+				const CCVector3* P = cloud->getPoint(i);
+				blockExtent.add(P->x, P->y);
+			}
+		}
+		for (const Extent& blockExtent : blockExtents)
+		{
+			extent.add(blockExtent);
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		return false;
+	}
+
+	m_pointCount = extent.count;
+	if (m_pointCount == 0)
+	{
+		//nothing to do
+		return true;
+	}
+
+	//cell size
+	m_cellSize = std::numeric_limits<double>::infinity();
+	if (std::isfinite(scale) && scale > 0)
+	{
+		m_cellSize = scale / 2;
+	}
+	if (kNN > 0)
+	{
+		//mean horizontal spacing of the class points
+		double spacing = sqrt(std::max((extent.maxX - extent.minX) * (extent.maxY - extent.minY), std::numeric_limits<double>::epsilon()) / m_pointCount);
+		m_cellSize = std::min(m_cellSize, spacing * sqrt(static_cast<double>(kNN)));
+	}
+	if (!std::isfinite(m_cellSize) || m_cellSize <= 0)
+	{
+		errorMessage = "Invalid raster cell size";
+		return false;
+	}
+
+	m_minX = extent.minX;
+	m_minY = extent.minY;
+	double width = std::floor((extent.maxX - extent.minX) / m_cellSize) + 1;
+	double height = std::floor((extent.maxY - extent.minY) / m_cellSize) + 1;
+	if (width * height > static_cast<double>(MaxCellCount))
+	{
+		errorMessage = QString("Raster too large (%1 x %2 cells)").arg(width).arg(height);
+		return false;
+	}
+	m_width = static_cast<unsigned>(width);
+	m_height = static_cast<unsigned>(height);
+	size_t cellCount = static_cast<size_t>(m_width) * m_height;
+
+	try
+	{
+		//sort the class points by row (counting sort: each block counts, then scatters its points)
+		std::vector<unsigned> rowOffsets(static_cast<size_t>(blockCount) * m_height, 0);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+		for (int b = 0; b < blockCount; ++b)
+		{
+			unsigned* blockRowCounts = rowOffsets.data() + static_cast<size_t>(b) * m_height;
+			for (unsigned i = blockStart(b); i < blockStart(b + 1); ++i)
+			{
+				if (classifSF->getValue(i) != fClass)
+					continue;
+
+				const CCVector3* P = cloud->getPoint(i);
+				++blockRowCounts[cellIndex(P->x, P->y) / m_width];
+			}
+		}
+
+		//row j starts at rowStarts[j] (blocks in order inside each row)
+		std::vector<unsigned> rowStarts(m_height + 1, 0);
+		{
+			unsigned offset = 0;
+			for (unsigned j = 0; j < m_height; ++j)
+			{
+				rowStarts[j] = offset;
+				for (int b = 0; b < blockCount; ++b)
+				{
+					unsigned count = rowOffsets[static_cast<size_t>(b) * m_height + j];
+					rowOffsets[static_cast<size_t>(b) * m_height + j] = offset;
+					offset += count;
+				}
+			}
+			rowStarts[m_height] = offset;
+			assert(offset == m_pointCount);
+		}
+
+		std::vector<unsigned> sortedIndexes(m_pointCount);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+		for (int b = 0; b < blockCount; ++b)
+		{
+			unsigned* blockRowOffsets = rowOffsets.data() + static_cast<size_t>(b) * m_height;
+			for (unsigned i = blockStart(b); i < blockStart(b + 1); ++i)
+			{
+				if (classifSF->getValue(i) != fClass)
+					continue;
+
+				const CCVector3* P = cloud->getPoint(i);
+				sortedIndexes[blockRowOffsets[cellIndex(P->x, P->y) / m_width]++] = i;
+			}
+		}
+		rowOffsets.clear();
+		rowOffsets.shrink_to_fit();
+
+		//accumulate the points (each thread owns whole rows)
+		std::vector<double> sumX(cellCount, 0), sumY(cellCount, 0), sumZ(cellCount, 0);
+		std::vector<unsigned> counts(cellCount, 0);
+		m_cells.resize(cellCount);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, 16)
+#endif
+		for (int j = 0; j < static_cast<int>(m_height); ++j)
+		{
+			for (unsigned k = rowStarts[j]; k < rowStarts[j + 1]; ++k)
+			{
+				const CCVector3* P = cloud->getPoint(sortedIndexes[k]);
+				size_t index = cellIndex(P->x, P->y);
+				Cell& cell = m_cells[index];
+				if (counts[index] == 0 || P->z < cell.z)
+				{
+					cell.z = P->z; //min Z
+				}
+				sumX[index] += P->x;
+				sumY[index] += P->y;
+				sumZ[index] += P->z;
+				++counts[index];
+			}
+
+			for (size_t index = static_cast<size_t>(j) * m_width; index < static_cast<size_t>(j + 1) * m_width; ++index)
+			{
+				unsigned count = counts[index];
+				if (count == 0)
+					continue;
+
+				Cell& cell = m_cells[index];
+				if (!useMinZ)
+				{
+					cell.z = static_cast<float>(sumZ[index] / count);
+				}
+				cell.srcX = static_cast<float>(sumX[index] / count);
+				cell.srcY = static_cast<float>(sumY[index] / count);
+				cell.valid = true;
+			}
+		}
+		sortedIndexes.clear();
+		sortedIndexes.shrink_to_fit();
+
+		//fill the holes with the nearest non-empty cell (two-pass distance transform)
+		{
+			static const unsigned NoSource = std::numeric_limits<unsigned>::max();
+			std::vector<unsigned> nearest(cellCount, NoSource);
+			for (size_t index = 0; index < cellCount; ++index)
+			{
+				if (m_cells[index].valid)
+					nearest[index] = static_cast<unsigned>(index);
+			}
+
+			//propagates the source of a neighbor cell if it is closer
+			auto propagate = [&](unsigned i, unsigned j, int di, int dj)
+			{
+				int ni = static_cast<int>(i) + di;
+				int nj = static_cast<int>(j) + dj;
+				if (ni < 0 || ni >= static_cast<int>(m_width) || nj < 0 || nj >= static_cast<int>(m_height))
+					return;
+
+				unsigned source = nearest[static_cast<size_t>(nj) * m_width + ni];
+				if (source == NoSource)
+					return;
+
+				size_t index = static_cast<size_t>(j) * m_width + i;
+				if (nearest[index] == source || m_cells[index].valid)
+					return;
+
+				double cellCenterX = m_minX + (i + 0.5) * m_cellSize;
+				double cellCenterY = m_minY + (j + 0.5) * m_cellSize;
+				const Cell& candidate = m_cells[source];
+				double squareDist = (candidate.srcX - cellCenterX) * (candidate.srcX - cellCenterX) + (candidate.srcY - cellCenterY) * (candidate.srcY - cellCenterY);
+				if (nearest[index] != NoSource)
+				{
+					const Cell& current = m_cells[nearest[index]];
+					double currentSquareDist = (current.srcX - cellCenterX) * (current.srcX - cellCenterX) + (current.srcY - cellCenterY) * (current.srcY - cellCenterY);
+					if (currentSquareDist <= squareDist)
+						return;
+				}
+				nearest[index] = source;
+			};
+
+			//forward pass (neighbors above and on the left)
+			for (unsigned j = 0; j < m_height; ++j)
+			{
+				for (unsigned i = 0; i < m_width; ++i)
+				{
+					propagate(i, j, -1, 0);
+					propagate(i, j, -1, -1);
+					propagate(i, j, 0, -1);
+					propagate(i, j, 1, -1);
+				}
+			}
+			//backward pass (neighbors below and on the right)
+			for (unsigned j = m_height; j-- > 0;)
+			{
+				for (unsigned i = m_width; i-- > 0;)
+				{
+					propagate(i, j, 1, 0);
+					propagate(i, j, 1, 1);
+					propagate(i, j, 0, 1);
+					propagate(i, j, -1, 1);
+				}
+			}
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount())
+#endif
+			for (int c = 0; c < static_cast<int>(cellCount); ++c)
+			{
+				Cell& cell = m_cells[c];
+				if (cell.valid || nearest[c] == NoSource)
+					continue;
+
+				const Cell& source = m_cells[nearest[c]];
+				cell.z = source.z;
+				cell.srcX = source.srcX;
+				cell.srcY = source.srcY;
+				cell.valid = true;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		m_cells.clear();
+		return false;
+	}
+
+	return true;
+}
+
+size_t GroundRaster::cellIndex(double x, double y) const
+{
+	int i = static_cast<int>(std::floor((x - m_minX) / m_cellSize));
+	int j = static_cast<int>(std::floor((y - m_minY) / m_cellSize));
+	i = std::max(0, std::min(i, static_cast<int>(m_width) - 1));
+	j = std::max(0, std::min(j, static_cast<int>(m_height) - 1));
+	return static_cast<size_t>(j) * m_width + i;
+}
+
+double GroundRaster::height(double x, double y) const
+{
+	if (m_cells.empty())
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	//bilinear interpolation between the cell centers
+	double u = (x - m_minX) / m_cellSize - 0.5;
+	double v = (y - m_minY) / m_cellSize - 0.5;
+	int i0 = std::max(0, std::min(static_cast<int>(std::floor(u)), static_cast<int>(m_width) - 1));
+	int j0 = std::max(0, std::min(static_cast<int>(std::floor(v)), static_cast<int>(m_height) - 1));
+	int i1 = std::min(i0 + 1, static_cast<int>(m_width) - 1);
+	int j1 = std::min(j0 + 1, static_cast<int>(m_height) - 1);
+	double fu = std::max(0.0, std::min(u - i0, 1.0));
+	double fv = std::max(0.0, std::min(v - j0, 1.0));
+
+	double z00 = m_cells[static_cast<size_t>(j0) * m_width + i0].z;
+	double z10 = m_cells[static_cast<size_t>(j0) * m_width + i1].z;
+	double z01 = m_cells[static_cast<size_t>(j1) * m_width + i0].z;
+	double z11 = m_cells[static_cast<size_t>(j1) * m_width + i1].z;
+
+	return (1 - fv) * ((1 - fu) * z00 + fu * z10) + fv * ((1 - fu) * z01 + fu * z11);
+}
+
+double GroundRaster::horizontalDistance(double x, double y) const
+{
+	if (m_cells.empty())
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	const Cell& cell = m_cells[cellIndex(x, y)];
+	return sqrt((x - cell.srcX) * (x - cell.srcX) + (y - cell.srcY) * (y - cell.srcY));
+}
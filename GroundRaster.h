@@ -0,0 +1,117 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ExecutionContext.h"
+
+//CCLib
+#include <GenericIndexedCloudPersist.h>
+#include <ScalarField.h>
+
+//Qt
+#include <QSharedPointer>
+#include <QString>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! 2.5D raster of the points of a given class (typically the ground)
+	/** Used to compute the DZ/DH context-based features with O(1) lookups instead of
+		looking for the nearest points of the context class. Empty cells are filled
+		with the values of the nearest non-empty cell (two-pass distance transform).
+	**/
+	class GroundRaster
+	{
+	public:
+
+		typedef QSharedPointer<GroundRaster> Shared;
+
+		//! Builds the raster
+		/** The cell size is derived from the smallest scale (scale / 2) and/or from the
+			smallest number of neighbors (so that a cell holds roughly kNN points).
+			\param cloud context cloud
+			\param classifSF classification field of the context cloud
+			\param classLabel context class
+			\param scale smallest scale (or NaN if none)
+			\param kNN smallest number of neighbors (or 0 if none)
+			\param useMinZ whether to use the min Z of each cell (mean Z otherwise)
+			\param context execution context (number of threads)
+			\return false if an error occurred (a raster without any point of the class is valid but empty)
+		**/
+		bool build(	CCCoreLib::GenericIndexedCloudPersist* cloud,
+					const CCCoreLib::ScalarField* classifSF,
+					int classLabel,
+					double scale,
+					int kNN,
+					bool useMinZ,
+					QString& errorMessage,
+					const ExecutionContext& context = ExecutionContext());
+
+		//! Returns whether the raster is empty
+		inline bool isEmpty() const { return m_cells.empty(); }
+
+		//! Returns the cell size
+		inline double cellSize() const { return m_cellSize; }
+
+		//! Returns the number of points of the class
+		inline unsigned pointCount() const { return m_pointCount; }
+
+		//! Returns the (bilinearly interpolated) height of the raster at a given position
+		/** \return NaN if the raster is empty
+		**/
+		double height(double x, double y) const;
+
+		//! Returns the horizontal distance between a position and the nearest non-empty cell centroid
+		/** \return NaN if the raster is empty
+		**/
+		double horizontalDistance(double x, double y) const;
+
+	protected: //methods
+
+		//! Returns the index of the cell including a given position (clamped to the grid)
+		size_t cellIndex(double x, double y) const;
+
+	protected: //members
+
+		//! Raster cell
+		struct Cell
+		{
+			//! Height (min or mean Z)
+			float z = 0;
+			//! Centroid of the (nearest) non-empty cell
+			float srcX = 0, srcY = 0;
+			//! Whether the cell holds a value (either computed or filled)
+			bool valid = false;
+		};
+
+		//! Cells (row major)
+		std::vector<Cell> m_cells;
+		//! Grid size
+		unsigned m_width = 0, m_height = 0;
+		//! Grid origin (lower left corner)
+		double m_minX = 0, m_minY = 0;
+		//! Cell size
+		double m_cellSize = 0;
+		//! Number of points of the class
+		unsigned m_pointCount = 0;
+	};
+
+}; //namespace masc
@@ -62,7 +62,8 @@ bool NeighborhoodFeature::checkValidity(QString corePointRole, QString &error) c
 bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 									QString& error,
 									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
-									SFCollector* generatedScalarFields/*=nullptr*/)
+									SFCollector* generatedScalarFields/*=nullptr*/,
+									const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!cloud1 || !corePoints.cloud)
 	{
@@ -85,7 +86,7 @@ bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 		//include the math operation as well if necessary!
 		resultSFName += "_" + Feature::OpToString(op) + "_" + cloud2Label;
 	}
-	resultSFName += "@" + QString::number(scale);
+	resultSFName += scaleSuffix();
 
 	//and the scalar field
 	assert(!sf1);
@@ -110,7 +111,7 @@ bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 	// sf2 is not needed if sf1 was already existing!
 	if (cloud2 && op != Feature::NO_OPERATION && !sf1WasAlreadyExisting)
 	{
-		QString resultSFName2 = ToString(type) + "_" + cloud2Label + "@" + QString::number(scale);
+		QString resultSFName2 = ToString(type) + "_" + cloud2Label + scaleSuffix();
 		keepSF2 = (corePoints.cloud->getScalarFieldIndexByName(qPrintable(resultSFName2)) >= 0); //we remember that the scalar field was already existing!
 
 		assert(!sf2);
@@ -128,7 +129,7 @@ bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 	return true;
 }
 
-bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error)
+bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error, const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!corePoints.cloud)
 	{
@@ -140,26 +141,12 @@ bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error)
 
 	bool success = true;
 
-	if (sf1)
-	{
-		sf1->computeMinAndMax();
-
-		//update display
-		//if (corePoints.cloud->getDisplay())
-		{
-			int sfIndex1 = corePoints.cloud->getScalarFieldIndexByName(sf1->getName());
-			corePoints.cloud->setCurrentDisplayedScalarField(sfIndex1);
-			//corePoints.cloud->getDisplay()->redraw();
-			//QCoreApplication::processEvents();
-		}
-	}
-
 	if (sf2 && !sf1WasAlreadyExisting)
 	{
 		//now perform the math operation
 		if (op != Feature::NO_OPERATION)
 		{
-			if (!PerformMathOp(sf1, sf2, op))
+			if (!PerformMathOp(sf1, sf2, op, context))
 			{
 				error = "Failed to perform the MATH operation";
 				success = false;
@@ -206,6 +193,11 @@ QString NeighborhoodFeature::toString() const
 		}
 	}
 
+	if (cylindrical)
+	{
+		description += "_CYL";
+	}
+
 	return description;
 }
 
@@ -342,6 +334,7 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 			assert(false);
 		}
 	}
+	break; //these features used to fall through to ANISO (and be overwritten by it)
 
 	case ANISO:
 	if (kNN >= 3)
@@ -160,8 +160,8 @@ namespace masc
 		//inherited from Feature
 		virtual Type getType() const override { return Type::NeighborhoodFeature; }
 		virtual Feature::Shared clone() const override { return Feature::Shared(new NeighborhoodFeature(*this)); }
-		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) override;
-		virtual bool finish(const CorePoints& corePoints, QString& error) override;
+		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr, const ExecutionContext& context = ExecutionContext()) override;
+		virtual bool finish(const CorePoints& corePoints, QString& error, const ExecutionContext& context = ExecutionContext()) override;
 		virtual bool checkValidity(QString corePointRole, QString &error) const override;
 		virtual QString toString() const override;
 
@@ -0,0 +1,181 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "NumaPlacement.h"
+
+//system
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace masc;
+
+#if defined(__linux__) && defined(SYS_move_pages) && defined(SYS_getcpu)
+#define MASC_NUMA_SUPPORT
+//! Move the pages (see numaif.h, we don't want to depend on libnuma)
+static const int MoveFlag = (1 << 1); //MPOL_MF_MOVE
+#endif
+
+//! Maximum number of pages processed by a single system call
+static const size_t MaxPagesPerCall = 256;
+
+NumaPlacement::NumaPlacement(bool enabled)
+	: m_enabled(enabled && NodeCount() > 1)
+	, m_localPageCount(0)
+	, m_migratedPageCount(0)
+	, m_failedPageCount(0)
+{
+}
+
+int NumaPlacement::NodeCount()
+{
+#if defined(MASC_NUMA_SUPPORT)
+	static const int s_nodeCount = []()
+	{
+		int nodeCount = 0;
+		while (true)
+		{
+			char path[64];
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodeCount);
+			if (access(path, F_OK) != 0)
+			{
+				break;
+			}
+			++nodeCount;
+		}
+		return std::max(1, nodeCount);
+	}();
+	return s_nodeCount;
+#else
+	return 1;
+#endif
+}
+
+int NumaPlacement::CurrentNode()
+{
+#if defined(MASC_NUMA_SUPPORT)
+	unsigned cpu = 0;
+	unsigned node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+	{
+		return static_cast<int>(node);
+	}
+#endif
+	return 0;
+}
+
+void NumaPlacement::claim(const void* begin, const void* end)
+{
+	if (!m_enabled || begin >= end)
+	{
+		return;
+	}
+
+#if defined(MASC_NUMA_SUPPORT)
+	static const uintptr_t s_pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	if (s_pageSize == 0)
+	{
+		return;
+	}
+
+	//only the pages starting in the range (the boundary pages are shared with the neighboring chunks)
+	uintptr_t firstPage = (reinterpret_cast<uintptr_t>(begin) + s_pageSize - 1) / s_pageSize * s_pageSize;
+	uintptr_t endAddress = reinterpret_cast<uintptr_t>(end);
+	int node = CurrentNode();
+
+	void* pages[MaxPagesPerCall];
+	int nodes[MaxPagesPerCall];
+	int status[MaxPagesPerCall];
+	void* remotePages[MaxPagesPerCall];
+
+	for (uintptr_t page = firstPage; page < endAddress; )
+	{
+		size_t pageCount = 0;
+		for (; pageCount < MaxPagesPerCall && page < endAddress; ++pageCount, page += s_pageSize)
+		{
+			pages[pageCount] = reinterpret_cast<void*>(page);
+		}
+
+		//query the current location of the pages
+		if (syscall(SYS_move_pages, 0, pageCount, pages, nullptr, status, 0) != 0)
+		{
+			m_failedPageCount += pageCount;
+			continue;
+		}
+
+		size_t remoteCount = 0;
+		for (size_t i = 0; i < pageCount; ++i)
+		{
+			if (status[i] < 0)
+			{
+				//not allocated yet (the thread will touch it first)
+				continue;
+			}
+			if (status[i] == node)
+			{
+				++m_localPageCount;
+			}
+			else
+			{
+				remotePages[remoteCount] = pages[i];
+				nodes[remoteCount] = node;
+				++remoteCount;
+			}
+		}
+		if (remoteCount == 0)
+		{
+			continue;
+		}
+		m_migratedPageCount += remoteCount;
+
+		if (syscall(SYS_move_pages, 0, remoteCount, remotePages, nodes, status, MoveFlag) != 0)
+		{
+			m_failedPageCount += remoteCount;
+		}
+	}
+#endif
+}
+
+double NumaPlacement::migratedRatio() const
+{
+	size_t pageCount = m_localPageCount + m_migratedPageCount;
+	return (pageCount != 0 ? static_cast<double>(m_migratedPageCount) / pageCount : 0.0);
+}
+
+QString NumaPlacement::report() const
+{
+	if (!m_enabled)
+	{
+		return QString("Output page migration disabled (%1 node(s))").arg(NodeCount());
+	}
+
+	QString report = QString("Output page migration: %1 output pages on %2 nodes, output pages migrated: %3 (%4%)")
+						.arg(m_localPageCount + m_migratedPageCount)
+						.arg(NodeCount())
+						.arg(m_migratedPageCount.load())
+						.arg(100.0 * migratedRatio(), 0, 'f', 1);
+	if (m_failedPageCount != 0)
+	{
+		report += QString(" (%1 pages couldn't be moved)").arg(m_failedPageCount.load());
+	}
+	return report;
+}
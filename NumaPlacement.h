@@ -0,0 +1,89 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QString>
+
+//system
+#include <atomic>
+#include <cstddef>
+
+namespace masc
+{
+	//! Migration of the output arrays of the parallel loops to the NUMA node of the writing thread
+	/** The scalar fields are allocated (and therefore first-touched) by the calling thread,
+		so that all their pages end up on a single node. Before writing a chunk of values,
+		a thread can 'claim' the corresponding pages: the ones located on another node are
+		moved to its own node. The number of migrated pages is recorded along the way.
+
+		This is not NUMA-aware scheduling: the chunks are not assigned to nodes, the threads
+		are not bound, the inputs (points, octree, feature values) are not partitioned per
+		node, and the actual memory accesses are not measured.
+
+		Linux only (the methods do nothing on the other systems or with a single node).
+	**/
+	class NumaPlacement
+	{
+	public:
+
+		//! Default constructor
+		/** \param enabled whether the placement should be done (ignored with a single node)
+		**/
+		explicit NumaPlacement(bool enabled);
+
+		//! Returns the number of NUMA nodes (1 if unknown)
+		static int NodeCount();
+
+		//! Returns the node of the calling thread (0 if unknown)
+		static int CurrentNode();
+
+		//! Returns whether the placement is active
+		inline bool isEnabled() const { return m_enabled; }
+
+		//! Moves the pages starting in [begin, end) to the node of the calling thread (if necessary)
+		void claim(const void* begin, const void* end);
+
+		//! Moves the pages of the elements [first, last) of an array to the node of the calling thread
+		template <typename T> inline void claim(const T* data, size_t first, size_t last)
+		{
+			if (m_enabled && data && first < last)
+			{
+				claim(data + first, data + last);
+			}
+		}
+
+		//! Returns the share of the claimed output pages that had to be migrated (i.e. were located on another node)
+		double migratedRatio() const;
+
+		//! Returns a one-line report (number of output pages, share of migrated pages)
+		QString report() const;
+
+	protected:
+
+		//! Whether the placement is active
+		bool m_enabled;
+		//! Number of pages already on the right node
+		std::atomic<size_t> m_localPageCount;
+		//! Number of pages located on another node (migrated)
+		std::atomic<size_t> m_migratedPageCount;
+		//! Number of pages that couldn't be moved
+		std::atomic<size_t> m_failedPageCount;
+	};
+
+}; //namespace masc
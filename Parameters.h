@@ -17,21 +17,101 @@
 //#                                                                        #
 //##########################################################################
 
+//system
+#include <algorithm>
+#include <cmath>
+#include <map>
 
 namespace masc
 {
+	//! Classifier model type
+	enum class ModelType
+	{
+		RandomForest,		//Random trees (OpenCV)
+		GradientBoosting	//Histogram based gradient boosted trees
+	};
+
 	struct RandomTreesParams
 	{
+		ModelType model = ModelType::RandomForest;
 		int maxDepth = 25;			//To be left as a parameter of the training plugin (default 25)
 		int minSampleCount = 1;		//To be left as a parameter of the training plugin (default 1)
 		//int maxCategories = 0;		//Normally not important as theres no categorical variable
 		int activeVarCount = 0;		//Use 0 as the default parameter (works best)
-		int maxTreeCount = 100;		//Left as a parameter of the training plugin (default: 100)
+		int maxTreeCount = 100;		//Left as a parameter of the training plugin (default: 100) - number of iterations for gradient boosting
+		float learningRate = 0.1f;	//Gradient boosting only (default: 0.1)
+	};
+
+	//! Ground raster mode (for the DZ/DH context-based features)
+	enum class GroundRasterMode
+	{
+		None,	//Nearest points of the context class (exact)
+		MeanZ,	//2.5D raster of the context class (mean Z per cell)
+		MinZ	//2.5D raster of the context class (min Z per cell)
+	};
+
+	//! Neighborhood extraction parameters
+	/** Saved in the classifier file, as the features must be computed the same way for training and classification.
+	**/
+	struct NeighborhoodParams
+	{
+		//! Target number of neighbors at large scales (0 = always use the full density clouds)
+		/** The neighborhoods of a scale are then extracted from a spatially subsampled version
+			of the source cloud (spacing proportional to the scale) holding roughly this number
+			of points per neighborhood.
+		**/
+		unsigned targetNeighborCount = 0;
+		//! Per-scale target number of neighbors (overrides 'targetNeighborCount')
+		std::map<double, unsigned> targetNeighborCountPerScale;
+
+		//! Approximate moments mode: boundary voxel size relative to the scale (0 = disabled)
+		/** The scales whose features can all be derived from moments (MEAN, STD and RANGE
+			statistics, PCA-based features, ZRANGE, Zmax, Zmin and NBPTS) are then computed with a voxel pyramid
+			instead of extracting the neighborhoods. The smaller the ratio, the more accurate.
+		**/
+		float approximateMomentsCellRatio = 0.0f;
+
+		//! Maximum number of neighbors used to compute the features (0 = no limit)
+		/** Above this count, a deterministic stratified subset of the (sorted) neighborhood
+			is used instead. NBPTS is always computed on the full neighborhood.
+		**/
+		unsigned maxNeighbors = 0;
+		//! Per-scale maximum number of neighbors (overrides 'maxNeighbors')
+		std::map<double, unsigned> maxNeighborsPerScale;
+
+		//! Whether the DZ/DH context-based features should use a 2.5D raster of the context class
+		GroundRasterMode groundRaster = GroundRasterMode::None;
+
+		//! Returns the target number of neighbors for a given scale (0 = full density)
+		unsigned targetNeighborCountAt(double scale) const
+		{
+			return CountAt(targetNeighborCountPerScale, scale, targetNeighborCount);
+		}
+
+		//! Returns the maximum number of neighbors for a given scale (0 = no limit)
+		unsigned maxNeighborsAt(double scale) const
+		{
+			return CountAt(maxNeighborsPerScale, scale, maxNeighbors);
+		}
+
+		//! Returns the count of a given scale, or the default count if the scale is not listed
+		static unsigned CountAt(const std::map<double, unsigned>& countPerScale, double scale, unsigned defaultCount)
+		{
+			for (const auto& it : countPerScale)
+			{
+				if (std::abs(it.first - scale) <= 1.0e-6 * std::max(1.0, std::abs(scale)))
+				{
+					return it.second;
+				}
+			}
+			return defaultCount;
+		}
 	};
 
 	struct TrainParameters
 	{
 		RandomTreesParams rt;
+		NeighborhoodParams neighborhood;
 		float testDataRatio = 0.2f; //percentage of test data
 	};
 
@@ -383,7 +383,8 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 												const IScalarFieldWrapper& field2,
 												masc::Feature::Operation op,
 												QString& error,
-												CCCoreLib::GenericProgressCallback* progressCb = nullptr)
+												CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+												const masc::ExecutionContext& context = masc::ExecutionContext())
 {
 	if (op == masc::Feature::NO_OPERATION || !outSF || outSF->size() != corePoints.size())
 	{
@@ -424,8 +425,7 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 	error.clear();
 #ifndef _DEBUG
 #if defined(_OPENMP)
-	omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, context.chunk(static_cast<int>(pointCount)))
 #endif
 #endif
 	for (int i = 0; i < static_cast<int>(pointCount); ++i)
@@ -496,7 +496,8 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 bool PointFeature::prepare(	const CorePoints& corePoints,
 							QString& error,
 							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
-							SFCollector* generatedScalarFields/*=nullptr*/)
+							SFCollector* generatedScalarFields/*=nullptr*/,
+							const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!cloud1 || !corePoints.cloud)
 	{
@@ -579,7 +580,7 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 
 	if (isScaled)
 	{
-		resultSF1Name += "@" + QString::number(scale);
+		resultSF1Name += scaleSuffix();
 
 		//prepare the corresponding scalar field
 		statSF1WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSF1Name));
@@ -601,7 +602,7 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 
 		if (field2 && op != Feature::NO_OPERATION && !statSF1WasAlreadyExisting) // nothing to do if statSF1 was already there
 		{
-			QString resultSF2Name = field2->getName() + QString("_") + cloud2Label + "_" + Feature::StatToString(stat) + "@" + QString::number(scale);
+			QString resultSF2Name = field2->getName() + QString("_") + cloud2Label + "_" + Feature::StatToString(stat) + scaleSuffix();
 			//keepStatSF2 = (corePoints.cloud->getScalarFieldIndexByName(qPrintable(resultSFName2)) >= 0); //we remember that the scalar field was already existing!
 
 			assert(!statSF2);
@@ -661,7 +662,8 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 														*field2,
 														op,
 														error,
-														progressCb)
+														progressCb,
+														context)
 					)
 				{
 					error = "Failed to perform the MATH operation (" + error + ")";
@@ -829,7 +831,7 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 	return true;
 }
 
-bool PointFeature::finish(const CorePoints& corePoints, QString& error)
+bool PointFeature::finish(const CorePoints& corePoints, QString& error, const ExecutionContext& context/*=ExecutionContext()*/)
 {
 	if (!scaled())
 	{
@@ -847,26 +849,12 @@ bool PointFeature::finish(const CorePoints& corePoints, QString& error)
 
 	bool success = true;
 
-	if (statSF1)
-	{
-		statSF1->computeMinAndMax();
-
-		//update display
-		//if (corePoints.cloud->getDisplay())
-		{
-			int sfIndex1 = corePoints.cloud->getScalarFieldIndexByName(statSF1->getName());
-			corePoints.cloud->setCurrentDisplayedScalarField(sfIndex1);
-			//corePoints.cloud->getDisplay()->redraw();
-			//QCoreApplication::processEvents();
-		}
-	}
-
 	if (statSF2 && !statSF1WasAlreadyExisting)
 	{
 		//now perform the math operation
 		if (op != Feature::NO_OPERATION)
 		{
-			if (!PerformMathOp(statSF1, statSF2, op))
+			if (!PerformMathOp(statSF1, statSF2, op, context))
 			{
 				error = "Failed to perform the MATH operation";
 				success = false;
@@ -927,6 +915,11 @@ QString PointFeature::toString() const
 		}
 	}
 
+	if (cylindrical)
+	{
+		description += "_CYL";
+	}
+
 	//Point features always have a scale equal to 0 by definition
 	return description;
 }
@@ -182,8 +182,8 @@ namespace masc
 		//inherited from Feature
 		virtual Type getType() const override { return Type::PointFeature; }
 		virtual Feature::Shared clone() const override { return Feature::Shared(new PointFeature(*this)); }
-		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) override;
-		virtual bool finish(const CorePoints& corePoints, QString& error) override;
+		virtual bool prepare(const CorePoints& corePoints, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr, const ExecutionContext& context = ExecutionContext()) override;
+		virtual bool finish(const CorePoints& corePoints, QString& error, const ExecutionContext& context = ExecutionContext()) override;
 		virtual bool checkValidity(QString corePointRole, QString &error) const override;
 		virtual QString toString() const override;
 
@@ -17,6 +17,9 @@
 //#                                                                        #
 //##########################################################################
 
+//Local
+#include "ExecutionContext.h"
+
 //qCC_db
 #include <ccPointCloud.h>
 //CCLib
@@ -25,6 +28,9 @@
 //Qt
 #include <QSharedPointer>
 
+//system
+#include <vector>
+
 class IScalarFieldWrapper
 {
 public:
@@ -33,6 +39,8 @@ public:
 	virtual bool isValid() const = 0;
 	virtual QString getName() const = 0;
 	virtual size_t size() const = 0;
+	//! Returns whether the values are derived on the fly from other attributes (see MaterializedFieldWrapper)
+	virtual bool isDerived() const { return false; }
 };
 
 class ScalarFieldWrapper : public IScalarFieldWrapper
@@ -47,6 +55,9 @@ public:
 	virtual inline QString getName() const { return m_sf->getName(); }
 	virtual size_t size() const override { return m_sf->size(); }
 
+	//! Returns the wrapped scalar field
+	inline const CCCoreLib::ScalarField* scalarField() const { return m_sf; }
+
 protected:
 	CCCoreLib::ScalarField* m_sf;
 };
@@ -70,6 +81,7 @@ public:
 	virtual inline bool isValid() const { return (m_sfp != nullptr && m_sfq != nullptr); }
 	virtual inline QString getName() const { return m_name; }
 	virtual inline size_t size() const override { return std::min(m_sfp->size(), m_sfq->size()); }
+	virtual inline bool isDerived() const override { return true; }
 
 protected:
 	CCCoreLib::ScalarField *m_sfp, *m_sfq;
@@ -96,6 +108,7 @@ public:
 	virtual inline bool isValid() const { return m_cloud != nullptr && m_cloud->hasNormals(); }
 	virtual inline QString getName() const { static const char s_names[][14] = { "Norm dip", "Norm dip dir." }; return s_names[m_mode]; }
 	virtual inline size_t size() const override { return m_cloud->size(); }
+	virtual inline bool isDerived() const override { return true; }
 
 protected:
 	const ccPointCloud* m_cloud;
@@ -141,3 +154,58 @@ protected:
 	const ccPointCloud* m_cloud;
 	Band m_band;
 };
+
+//! Stores the values of a derived field (EchoRat, normal dip, etc.) so that they are computed only once
+/** The values are computed by 'materialize', then the wrapper can be shared by all the features
+	reading the same field (instead of recomputing the value for each neighbor, at each scale).
+**/
+class MaterializedFieldWrapper : public IScalarFieldWrapper
+{
+public:
+	MaterializedFieldWrapper(IScalarFieldWrapper::Shared source)
+		: m_source(source)
+	{}
+
+	//! Computes and stores the values of the source field
+	bool materialize(const masc::ExecutionContext& context, QString& error)
+	{
+		if (!m_source || !m_source->isValid())
+		{
+			error = "Invalid source field";
+			return false;
+		}
+
+		try
+		{
+			m_values.resize(m_source->size());
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = "Not enough memory to store field " + m_source->getName();
+			return false;
+		}
+
+		int count = static_cast<int>(m_values.size());
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(static, context.chunk(count))
+#endif
+		for (int i = 0; i < count; ++i)
+		{
+			m_values[i] = static_cast<ScalarType>(m_source->pointValue(static_cast<unsigned>(i)));
+		}
+
+		return true;
+	}
+
+	//! Returns the source field
+	inline const IScalarFieldWrapper::Shared& source() const { return m_source; }
+
+	virtual inline double pointValue(unsigned index) const override { return m_values[index]; }
+	virtual inline bool isValid() const { return m_values.size() == m_source->size(); }
+	virtual inline QString getName() const { return m_source->getName(); }
+	virtual inline size_t size() const override { return m_values.size(); }
+
+protected:
+	IScalarFieldWrapper::Shared m_source;
+	std::vector<ScalarType> m_values;
+};
@@ -0,0 +1,372 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "StageGraph.h"
+
+//Qt
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QObject>
+#include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent>
+
+//system
+#include <algorithm>
+#include <assert.h>
+
+using namespace masc;
+
+//! Averages the progress of several stages running concurrently
+/** Only the progress updates and the cancel requests are forwarded from the stages threads
+	(as they already are from the OpenMP threads). The other calls (which may update a dialog)
+	are deferred to the thread running the graph (see flush).
+**/
+class StageProgressAggregator
+{
+public:
+
+	StageProgressAggregator(CCCoreLib::GenericProgressCallback* progressCb, size_t stageCount)
+		: m_progressCb(progressCb)
+		, m_percents(stageCount, 0.0f)
+		, m_startRequested(false)
+		, m_started(false)
+	{}
+
+	void update(size_t stageIndex, float percent)
+	{
+		QMutexLocker locker(&m_mutex);
+		m_percents[stageIndex] = percent;
+		float sum = 0.0f;
+		for (float p : m_percents)
+		{
+			sum += p;
+		}
+		m_progressCb->update(sum / m_percents.size());
+	}
+
+	void setMethodTitle(const char* methodTitle)
+	{
+		QMutexLocker locker(&m_mutex);
+		m_methodTitle = methodTitle;
+	}
+
+	void setInfo(const char* infoStr)
+	{
+		QMutexLocker locker(&m_mutex);
+		m_info = infoStr;
+	}
+
+	void start()
+	{
+		QMutexLocker locker(&m_mutex);
+		m_startRequested = true;
+	}
+
+	//! Forwards the deferred calls (must be called by the thread running the graph)
+	void flush()
+	{
+		QMutexLocker locker(&m_mutex);
+		if (!m_methodTitle.isNull())
+		{
+			m_progressCb->setMethodTitle(qPrintable(m_methodTitle));
+			m_methodTitle.clear();
+		}
+		if (!m_info.isNull())
+		{
+			m_progressCb->setInfo(qPrintable(m_info));
+			m_info.clear();
+		}
+		if (m_startRequested && !m_started)
+		{
+			m_progressCb->start();
+			m_started = true;
+		}
+	}
+
+	inline bool isCancelRequested() { return m_progressCb->isCancelRequested(); }
+	inline bool textCanBeEdited() const { return m_progressCb->textCanBeEdited(); }
+
+protected:
+
+	CCCoreLib::GenericProgressCallback* m_progressCb;
+	std::vector<float> m_percents;
+	QString m_methodTitle;
+	QString m_info;
+	bool m_startRequested;
+	bool m_started;
+	QMutex m_mutex;
+};
+
+//! Progress callback of a single stage
+class StageProgress : public CCCoreLib::GenericProgressCallback
+{
+public:
+
+	StageProgress(StageProgressAggregator& aggregator, size_t stageIndex)
+		: m_aggregator(aggregator)
+		, m_stageIndex(stageIndex)
+	{}
+
+	void update(float percent) override { m_aggregator.update(m_stageIndex, percent); }
+	void setMethodTitle(const char* methodTitle) override { m_aggregator.setMethodTitle(methodTitle); }
+	void setInfo(const char* infoStr) override { m_aggregator.setInfo(infoStr); }
+	void start() override { m_aggregator.start(); }
+	void stop() override {}
+	bool isCancelRequested() override { return m_aggregator.isCancelRequested(); }
+	bool textCanBeEdited() const override { return m_aggregator.textCanBeEdited(); }
+
+protected:
+
+	StageProgressAggregator& m_aggregator;
+	size_t m_stageIndex;
+};
+
+int StageGraph::addStage(const QString& name, const Task& task, const std::vector<int>& dependencies/*=std::vector<int>()*/, bool parallel/*=true*/)
+{
+	Stage stage;
+	stage.name = name;
+	stage.task = task;
+	stage.parallel = parallel;
+	for (int dependency : dependencies)
+	{
+		//dependencies are added first (so that the graph has no cycle)
+		if (dependency >= 0 && dependency < static_cast<int>(m_stages.size()))
+		{
+			stage.dependencies.push_back(dependency);
+		}
+		else
+		{
+			assert(false);
+		}
+	}
+	m_stages.push_back(stage);
+
+	return static_cast<int>(m_stages.size()) - 1;
+}
+
+bool StageGraph::run(const ExecutionContext& context, QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	m_elapsed = 0.0;
+	if (m_stages.empty())
+	{
+		return true;
+	}
+
+	//number of stages each stage is waiting for, and the stages waiting for each stage
+	std::vector<size_t> pendingDependencyCounts(m_stages.size());
+	std::vector< std::vector<int> > dependentStages(m_stages.size());
+	std::vector<int> readyStages;
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		Stage& stage = m_stages[i];
+		stage.threadCount = 0;
+		stage.duration = 0.0;
+		pendingDependencyCounts[i] = stage.dependencies.size();
+		for (int dependency : stage.dependencies)
+		{
+			dependentStages[dependency].push_back(static_cast<int>(i));
+		}
+		if (stage.dependencies.empty())
+		{
+			readyStages.push_back(static_cast<int>(i));
+		}
+	}
+
+	int threadCount = context.threadCount();
+	bool isGuiThread = (QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread());
+	//the pool threads only host the stages (each stage uses its own share of the context threads)
+	QThreadPool pool;
+	pool.setMaxThreadCount(threadCount);
+	StageProgressAggregator aggregator(progressCb, m_stages.size());
+
+	QMutex mutex;
+	QWaitCondition stageCompleted;
+	int runningCount = 0;
+	int runningParallelCount = 0;
+	size_t completedCount = 0;
+	bool failed = false;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	mutex.lock();
+	while (true)
+	{
+		//start the ready stages (in the order they were added)
+		while (!failed && !readyStages.empty() && runningCount < threadCount)
+		{
+			//the threads are shared between the parallel stages that can run at the same time
+			int parallelCount = runningParallelCount;
+			for (int readyStage : readyStages)
+			{
+				if (m_stages[readyStage].parallel)
+					++parallelCount;
+			}
+			int stageIndex = readyStages.front();
+			readyStages.erase(readyStages.begin());
+			bool parallel = m_stages[stageIndex].parallel;
+
+			ExecutionContext stageContext = context;
+			stageContext.maxThreadCount = (parallel ? std::max(1, threadCount / std::min(threadCount, parallelCount)) : 1);
+			m_stages[stageIndex].threadCount = stageContext.maxThreadCount;
+			++runningCount;
+			if (parallel)
+				++runningParallelCount;
+
+			QtConcurrent::run(&pool, [&, stageIndex, stageContext, parallel]()
+				{
+					QElapsedTimer stageTimer;
+					stageTimer.start();
+
+					QString stageError;
+					StageProgress stageProgress(aggregator, stageIndex);
+					bool success = m_stages[stageIndex].task(stageContext, stageError, progressCb ? &stageProgress : nullptr);
+
+					QMutexLocker locker(&mutex);
+					m_stages[stageIndex].duration = stageTimer.elapsed() / 1000.0;
+					--runningCount;
+					if (parallel)
+						--runningParallelCount;
+					++completedCount;
+					if (!success)
+					{
+						if (!failed)
+						{
+							failed = true;
+							error = m_stages[stageIndex].name + ": " + stageError;
+						}
+					}
+					else
+					{
+						for (int dependentStage : dependentStages[stageIndex])
+						{
+							if (--pendingDependencyCounts[dependentStage] == 0)
+							{
+								readyStages.insert(std::upper_bound(readyStages.begin(), readyStages.end(), dependentStage), dependentStage);
+							}
+						}
+					}
+					stageCompleted.wakeAll();
+				});
+		}
+
+		if (runningCount == 0)
+		{
+			//all the stages are completed (or nothing can be started anymore)
+			break;
+		}
+		stageCompleted.wait(&mutex, 100);
+
+		if (progressCb)
+		{
+			mutex.unlock();
+			aggregator.flush();
+			if (isGuiThread)
+			{
+				//keep the progress dialog alive
+				QCoreApplication::processEvents();
+			}
+			mutex.lock();
+		}
+	}
+	mutex.unlock();
+	pool.waitForDone();
+	if (progressCb)
+	{
+		aggregator.flush();
+	}
+
+	m_elapsed = timer.elapsed() / 1000.0;
+
+	if (!failed && completedCount != m_stages.size())
+	{
+		assert(false);
+		error = QObject::tr("Invalid stage dependencies");
+		return false;
+	}
+
+	return !failed;
+}
+
+std::vector<int> StageGraph::criticalPath() const
+{
+	if (m_stages.empty())
+	{
+		return {};
+	}
+
+	//the dependencies of a stage are always added before it
+	std::vector<double> endTimes(m_stages.size(), 0.0);
+	std::vector<int> previousStages(m_stages.size(), -1);
+	size_t lastStage = 0;
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		const Stage& stage = m_stages[i];
+		for (int dependency : stage.dependencies)
+		{
+			if (previousStages[i] < 0 || endTimes[dependency] > endTimes[previousStages[i]])
+			{
+				previousStages[i] = dependency;
+			}
+		}
+		endTimes[i] = stage.duration + (previousStages[i] >= 0 ? endTimes[previousStages[i]] : 0.0);
+		if (endTimes[i] > endTimes[lastStage])
+		{
+			lastStage = i;
+		}
+	}
+
+	std::vector<int> path;
+	for (int stageIndex = static_cast<int>(lastStage); stageIndex >= 0; stageIndex = previousStages[stageIndex])
+	{
+		path.push_back(stageIndex);
+	}
+	std::reverse(path.begin(), path.end());
+
+	return path;
+}
+
+QString StageGraph::report() const
+{
+	double totalDuration = 0.0;
+	for (const Stage& stage : m_stages)
+	{
+		totalDuration += stage.duration;
+	}
+
+	std::vector<int> path = criticalPath();
+	double pathDuration = 0.0;
+	QStringList pathStages;
+	for (int stageIndex : path)
+	{
+		const Stage& stage = m_stages[stageIndex];
+		pathDuration += stage.duration;
+		pathStages << QString("%1 (%2 s, %3 threads)").arg(stage.name).arg(stage.duration, 0, 'f', 2).arg(stage.threadCount);
+	}
+
+	return QString("%1 stages completed in %2 s (%3 s of stage time), critical path: %4 s = %5")
+		.arg(m_stages.size())
+		.arg(m_elapsed, 0, 'f', 2)
+		.arg(totalDuration, 0, 'f', 2)
+		.arg(pathDuration, 0, 'f', 2)
+		.arg(pathStages.join(" -> "));
+}
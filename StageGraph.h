@@ -0,0 +1,97 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ExecutionContext.h"
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QString>
+
+//system
+#include <functional>
+#include <vector>
+
+namespace masc
+{
+	//! Graph of dependent processing stages, executed concurrently when possible
+	/** Each stage is started as soon as all the stages it depends on are completed.
+		The threads of the execution context are shared between the stages running
+		at the same time (each stage gets its own execution context).
+	**/
+	class StageGraph
+	{
+	public:
+
+		//! Stage task
+		/** \param context execution context of the stage (its share of the threads)
+			\param error error message (to be set in case of failure)
+			\param progressCb progress callback of the stage (may be null)
+		**/
+		typedef std::function<bool(const ExecutionContext& context, QString& error, CCCoreLib::GenericProgressCallback* progressCb)> Task;
+
+		//! Adds a stage
+		/** \param dependencies stages that must be completed first (they must have been added already)
+			\param parallel whether the stage uses the threads of its execution context (otherwise
+			it gets a single thread, and doesn't reduce the share of the other stages)
+			\return the index of the stage
+		**/
+		int addStage(const QString& name, const Task& task, const std::vector<int>& dependencies = std::vector<int>(), bool parallel = true);
+
+		//! Returns the number of stages
+		inline size_t stageCount() const { return m_stages.size(); }
+
+		//! Executes all the stages
+		/** The ready stages are started in the order they were added. In case of failure,
+			no other stage is started (the running ones are completed).
+			\param progressCb progress callback (the progress of the running stages is averaged)
+		**/
+		bool run(const ExecutionContext& context, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Returns the critical path of the last run (the longest chain of dependent stages)
+		std::vector<int> criticalPath() const;
+
+		//! Returns a one-line report of the last run (elapsed time and critical path)
+		QString report() const;
+
+	protected:
+
+		//! Stage
+		struct Stage
+		{
+			QString name;
+			Task task;
+			std::vector<int> dependencies;
+			//! Whether the stage uses the threads of its execution context
+			bool parallel = true;
+			//! Number of threads given to the stage (last run)
+			int threadCount = 0;
+			//! Duration of the stage in seconds (last run)
+			double duration = 0.0;
+		};
+
+		//! Stages (in the order they were added)
+		std::vector<Stage> m_stages;
+		//! Elapsed time of the last run (in seconds)
+		double m_elapsed = 0.0;
+	};
+
+}; //namespace masc
@@ -0,0 +1,414 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "VoxelMomentPyramid.h"
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+
+using namespace masc;
+
+//! Maximum number of cells along each dimension (21 bits per index)
+static const uint64_t MaxGridSize = (static_cast<uint64_t>(1) << 21);
+static const uint64_t IndexMask = MaxGridSize - 1;
+
+void VoxelMomentPyramid::GeometricMoments::add(const GeometricMoments& m)
+{
+	if (m.count == 0)
+	{
+		return;
+	}
+	if (count == 0)
+	{
+		minZ = m.minZ;
+		maxZ = m.maxZ;
+	}
+	else
+	{
+		minZ = std::min(minZ, m.minZ);
+		maxZ = std::max(maxZ, m.maxZ);
+	}
+
+	count += m.count;
+	for (unsigned d = 0; d < 3; ++d)
+	{
+		sum[d] += m.sum[d];
+	}
+	for (unsigned d = 0; d < 6; ++d)
+	{
+		sum2[d] += m.sum2[d];
+	}
+}
+
+void VoxelMomentPyramid::FieldMoments::add(const FieldMoments& m, bool first)
+{
+	if (first)
+	{
+		*this = m;
+		return;
+	}
+
+	sum += m.sum;
+	sum2 += m.sum2;
+	minValue = std::min(minValue, m.minValue);
+	maxValue = std::max(maxValue, m.maxValue);
+}
+
+bool VoxelMomentPyramid::Moments::eigenValues(double& l1, double& l2, double& l3) const
+{
+	if (geom.count < 3)
+	{
+		return false;
+	}
+
+	//covariance matrix
+	double n = static_cast<double>(geom.count);
+	double m[3] = { geom.sum[0] / n, geom.sum[1] / n, geom.sum[2] / n };
+	double a00 = geom.sum2[0] / n - m[0] * m[0];
+	double a01 = geom.sum2[1] / n - m[0] * m[1];
+	double a02 = geom.sum2[2] / n - m[0] * m[2];
+	double a11 = geom.sum2[3] / n - m[1] * m[1];
+	double a12 = geom.sum2[4] / n - m[1] * m[2];
+	double a22 = geom.sum2[5] / n - m[2] * m[2];
+
+	//closed form eigenvalues of a symmetric 3x3 matrix
+	double e[3];
+	double p1 = a01 * a01 + a02 * a02 + a12 * a12;
+	if (p1 == 0)
+	{
+		e[0] = a00;
+		e[1] = a11;
+		e[2] = a22;
+	}
+	else
+	{
+		double q = (a00 + a11 + a22) / 3;
+		double p2 = (a00 - q) * (a00 - q) + (a11 - q) * (a11 - q) + (a22 - q) * (a22 - q) + 2 * p1;
+		double p = sqrt(p2 / 6);
+		double b00 = (a00 - q) / p, b11 = (a11 - q) / p, b22 = (a22 - q) / p;
+		double b01 = a01 / p, b02 = a02 / p, b12 = a12 / p;
+		double r = (b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02)) / 2;
+		double phi = acos(std::max(-1.0, std::min(1.0, r))) / 3;
+		e[0] = q + 2 * p * cos(phi);
+		e[2] = q + 2 * p * cos(phi + (2 * M_PI / 3));
+		e[1] = 3 * q - e[0] - e[2];
+	}
+
+	//same convention as CCCoreLib::Neighbourhood (absolute values, decreasing order)
+	for (double& v : e)
+	{
+		v = std::abs(v);
+	}
+	std::sort(e, e + 3, [](double a, double b) { return a > b; });
+
+	l1 = e[0];
+	l2 = e[1];
+	l3 = e[2];
+	return true;
+}
+
+void VoxelMomentPyramid::clear()
+{
+	m_levels.clear();
+	m_fieldCount = 0;
+	m_gridSize[0] = m_gridSize[1] = m_gridSize[2] = 0;
+}
+
+bool VoxelMomentPyramid::build(	CCCoreLib::GenericIndexedCloudPersist* cloud,
+								const std::vector<IScalarFieldWrapper::Shared>& fields,
+								double finestCellSize,
+								double largestRadius,
+								QString& errorMessage,
+								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	clear();
+
+	if (!cloud || cloud->size() == 0 || !(finestCellSize > 0))
+	{
+		assert(false);
+		errorMessage = "Invalid input parameters";
+		return false;
+	}
+
+	CCVector3 bbMin, bbMax;
+	cloud->getBoundingBox(bbMin, bbMax);
+	m_origin = CCVector3d::fromArray(bbMin.u);
+	CCVector3d diag = CCVector3d::fromArray(bbMax.u) - m_origin;
+	for (unsigned d = 0; d < 3; ++d)
+	{
+		double cellCount = std::floor(diag.u[d] / finestCellSize) + 1;
+		if (cellCount >= static_cast<double>(MaxGridSize))
+		{
+			errorMessage = "Voxel size too small compared to the cloud extent";
+			return false;
+		}
+		m_gridSize[d] = static_cast<uint64_t>(cellCount);
+	}
+	m_fieldCount = fields.size();
+
+	unsigned pointCount = cloud->size();
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Voxel moments");
+		progressCb->setInfo(qPrintable(QString("Points: %1").arg(pointCount)));
+		progressCb->start();
+	}
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	try
+	{
+		//finest level
+		m_levels.resize(1);
+		{
+			Level& level = m_levels.front();
+			level.cellSize = finestCellSize;
+
+			std::vector<FieldMoments> pointFieldMoments(m_fieldCount);
+			for (unsigned i = 0; i < pointCount; ++i)
+			{
+				CCVector3d P = CCVector3d::fromArray(cloud->getPoint(i)->u) - m_origin;
+
+				uint64_t cellPos[3];
+				for (unsigned d = 0; d < 3; ++d)
+				{
+					cellPos[d] = std::min(static_cast<uint64_t>(std::max(0.0, P.u[d] / finestCellSize)), m_gridSize[d] - 1);
+				}
+				uint64_t key = CellKey(cellPos[0], cellPos[1], cellPos[2]);
+
+				std::pair<std::unordered_map<uint64_t, unsigned>::iterator, bool> inserted = level.cellIndexes.emplace(key, static_cast<unsigned>(level.cells.size()));
+				unsigned cellIndex = inserted.first->second;
+				bool newCell = inserted.second;
+				if (newCell)
+				{
+					level.cells.emplace_back();
+					level.cellKeys.push_back(key);
+					level.fieldMoments.resize(level.fieldMoments.size() + m_fieldCount);
+				}
+
+				GeometricMoments& cell = level.cells[cellIndex];
+				if (cell.count == 0)
+				{
+					cell.minZ = cell.maxZ = P.z;
+				}
+				else
+				{
+					cell.minZ = std::min(cell.minZ, P.z);
+					cell.maxZ = std::max(cell.maxZ, P.z);
+				}
+				++cell.count;
+				cell.sum[0] += P.x;
+				cell.sum[1] += P.y;
+				cell.sum[2] += P.z;
+				cell.sum2[0] += P.x * P.x;
+				cell.sum2[1] += P.x * P.y;
+				cell.sum2[2] += P.x * P.z;
+				cell.sum2[3] += P.y * P.y;
+				cell.sum2[4] += P.y * P.z;
+				cell.sum2[5] += P.z * P.z;
+
+				for (size_t f = 0; f < m_fieldCount; ++f)
+				{
+					double v = fields[f]->pointValue(i);
+					FieldMoments& fm = pointFieldMoments[f];
+					fm.sum = v;
+					fm.sum2 = v * v;
+					fm.minValue = fm.maxValue = v;
+					level.fieldMoments[cellIndex * m_fieldCount + f].add(fm, newCell);
+				}
+
+				if (progressCb && !nProgress.oneStep())
+				{
+					errorMessage = "Process cancelled";
+					clear();
+					return false;
+				}
+			}
+		}
+
+		//coarser levels (each cell merges 2x2x2 cells of the previous level)
+		while (m_levels.back().cellSize < largestRadius && m_levels.back().cells.size() > 1)
+		{
+			Level coarse;
+			coarse.cellSize = 2 * m_levels.back().cellSize;
+
+			const Level& fine = m_levels.back();
+			for (size_t c = 0; c < fine.cells.size(); ++c)
+			{
+				uint64_t fineKey = fine.cellKeys[c];
+				uint64_t key = CellKey(((fineKey >> 42) & IndexMask) >> 1, ((fineKey >> 21) & IndexMask) >> 1, (fineKey & IndexMask) >> 1);
+
+				std::pair<std::unordered_map<uint64_t, unsigned>::iterator, bool> inserted = coarse.cellIndexes.emplace(key, static_cast<unsigned>(coarse.cells.size()));
+				unsigned cellIndex = inserted.first->second;
+				bool newCell = inserted.second;
+				if (newCell)
+				{
+					coarse.cells.emplace_back();
+					coarse.cellKeys.push_back(key);
+					coarse.fieldMoments.resize(coarse.fieldMoments.size() + m_fieldCount);
+				}
+
+				coarse.cells[cellIndex].add(fine.cells[c]);
+				for (size_t f = 0; f < m_fieldCount; ++f)
+				{
+					coarse.fieldMoments[cellIndex * m_fieldCount + f].add(fine.fieldMoments[c * m_fieldCount + f], newCell);
+				}
+			}
+
+			m_levels.push_back(std::move(coarse));
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		clear();
+		return false;
+	}
+
+	return true;
+}
+
+void VoxelMomentPyramid::addCell(size_t levelIndex, unsigned cellIndex, Moments& moments) const
+{
+	const Level& level = m_levels[levelIndex];
+	bool first = (moments.geom.count == 0);
+	moments.geom.add(level.cells[cellIndex]);
+	for (size_t f = 0; f < m_fieldCount; ++f)
+	{
+		moments.fields[f].add(level.fieldMoments[cellIndex * m_fieldCount + f], first);
+	}
+}
+
+void VoxelMomentPyramid::query(const CCVector3& center, double radius, double boundaryCellSize, Moments& moments) const
+{
+	moments.geom = GeometricMoments();
+	moments.fields.assign(m_fieldCount, FieldMoments());
+
+	if (m_levels.empty())
+	{
+		return;
+	}
+
+	//the cells crossing the sphere boundary are not subdivided below this level
+	size_t boundaryLevel = 0;
+	while (boundaryLevel + 1 < m_levels.size() && m_levels[boundaryLevel + 1].cellSize <= boundaryCellSize)
+	{
+		++boundaryLevel;
+	}
+	//we start at the first level with cells as large as the radius (at most 3 cells along each dimension)
+	size_t startLevel = boundaryLevel;
+	while (startLevel + 1 < m_levels.size() && m_levels[startLevel].cellSize < radius)
+	{
+		++startLevel;
+	}
+
+	CCVector3d C = CCVector3d::fromArray(center.u) - m_origin;
+	double sqRadius = radius * radius;
+
+	//(level, cell index)
+	std::vector< std::pair<size_t, unsigned> > stack;
+	{
+		const Level& level = m_levels[startLevel];
+		uint64_t minPos[3], maxPos[3];
+		for (unsigned d = 0; d < 3; ++d)
+		{
+			double cellMin = std::floor((C.u[d] - radius) / level.cellSize);
+			double cellMax = std::floor((C.u[d] + radius) / level.cellSize);
+			double gridMax = static_cast<double>((m_gridSize[d] - 1) >> startLevel);
+			if (cellMax < 0 || cellMin > gridMax)
+			{
+				//the sphere doesn't intersect the grid
+				return;
+			}
+			minPos[d] = static_cast<uint64_t>(std::max(0.0, cellMin));
+			maxPos[d] = static_cast<uint64_t>(std::min(gridMax, cellMax));
+		}
+
+		for (uint64_t i = minPos[0]; i <= maxPos[0]; ++i)
+			for (uint64_t j = minPos[1]; j <= maxPos[1]; ++j)
+				for (uint64_t k = minPos[2]; k <= maxPos[2]; ++k)
+				{
+					std::unordered_map<uint64_t, unsigned>::const_iterator it = level.cellIndexes.find(CellKey(i, j, k));
+					if (it != level.cellIndexes.end())
+					{
+						stack.emplace_back(startLevel, it->second);
+					}
+				}
+	}
+
+	while (!stack.empty())
+	{
+		std::pair<size_t, unsigned> current = stack.back();
+		stack.pop_back();
+
+		const Level& level = m_levels[current.first];
+		uint64_t key = level.cellKeys[current.second];
+		uint64_t cellPos[3] = { (key >> 42) & IndexMask, (key >> 21) & IndexMask, key & IndexMask };
+
+		//distances between the sphere center and the cell
+		double minSqDist = 0;
+		double maxSqDist = 0;
+		for (unsigned d = 0; d < 3; ++d)
+		{
+			double cellMin = cellPos[d] * level.cellSize;
+			double cellMax = cellMin + level.cellSize;
+			double dMin = (C.u[d] < cellMin ? cellMin - C.u[d] : (C.u[d] > cellMax ? C.u[d] - cellMax : 0));
+			double dMax = std::max(std::abs(C.u[d] - cellMin), std::abs(C.u[d] - cellMax));
+			minSqDist += dMin * dMin;
+			maxSqDist += dMax * dMax;
+		}
+
+		if (minSqDist > sqRadius)
+		{
+			//outside
+			continue;
+		}
+
+		if (maxSqDist <= sqRadius)
+		{
+			//inside
+			addCell(current.first, current.second, moments);
+			continue;
+		}
+
+		if (current.first == boundaryLevel)
+		{
+			//crossing the boundary: we use the cell centroid
+			const GeometricMoments& cell = level.cells[current.second];
+			CCVector3d G(cell.sum[0] / cell.count, cell.sum[1] / cell.count, cell.sum[2] / cell.count);
+			if ((G - C).norm2() <= sqRadius)
+			{
+				addCell(current.first, current.second, moments);
+			}
+			continue;
+		}
+
+		//crossing the boundary: we look at the children cells
+		const Level& finerLevel = m_levels[current.first - 1];
+		for (uint64_t i = 2 * cellPos[0]; i <= 2 * cellPos[0] + 1; ++i)
+			for (uint64_t j = 2 * cellPos[1]; j <= 2 * cellPos[1] + 1; ++j)
+				for (uint64_t k = 2 * cellPos[2]; k <= 2 * cellPos[2] + 1; ++k)
+				{
+					std::unordered_map<uint64_t, unsigned>::const_iterator it = finerLevel.cellIndexes.find(CellKey(i, j, k));
+					if (it != finerLevel.cellIndexes.end())
+					{
+						stack.emplace_back(current.first - 1, it->second);
+					}
+				}
+	}
+}
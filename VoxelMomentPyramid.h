@@ -0,0 +1,149 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ScalarFieldWrappers.h"
+
+//CCLib
+#include <GenericIndexedCloudPersist.h>
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QString>
+
+//system
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace masc
+{
+	//! Multi-level voxel grid storing the moments of the points (and of some scalar fields) of a cloud
+	/** Used to compute approximate statistics on large spherical neighborhoods without
+		visiting all the points: the cells entirely inside the sphere are aggregated as is,
+		the cells crossing its boundary are subdivided down to a given cell size, at which
+		point they are kept or rejected depending on the position of their centroid.
+	**/
+	class VoxelMomentPyramid
+	{
+	public:
+
+		//! Moments of the point coordinates
+		struct GeometricMoments
+		{
+			unsigned count = 0;
+			double sum[3] = { 0, 0, 0 };
+			//! Second order moments (xx, xy, xz, yy, yz, zz)
+			double sum2[6] = { 0, 0, 0, 0, 0, 0 };
+			//! Z range of the points (relatively to the pyramid origin)
+			double minZ = 0;
+			double maxZ = 0;
+
+			void add(const GeometricMoments& m);
+		};
+
+		//! Moments of a scalar field
+		struct FieldMoments
+		{
+			double sum = 0;
+			double sum2 = 0;
+			double minValue = 0;
+			double maxValue = 0;
+
+			//! Merges the moments of another set of points (not empty)
+			void add(const FieldMoments& m, bool first);
+		};
+
+		//! Aggregated moments of a neighborhood
+		struct Moments
+		{
+			GeometricMoments geom;
+			std::vector<FieldMoments> fields;
+
+			//! Returns the covariance matrix eigenvalues (absolute values, in decreasing order)
+			/** \return false if there are less than 3 points
+			**/
+			bool eigenValues(double& l1, double& l2, double& l3) const;
+		};
+
+		//! Builds the pyramid
+		/** \param cloud input cloud
+			\param fields scalar fields whose moments should be stored as well
+			\param finestCellSize cell size of the finest level
+			\param largestRadius largest query radius (to determine the number of levels)
+		**/
+		bool build(	CCCoreLib::GenericIndexedCloudPersist* cloud,
+					const std::vector<IScalarFieldWrapper::Shared>& fields,
+					double finestCellSize,
+					double largestRadius,
+					QString& errorMessage,
+					CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Clears the pyramid
+		void clear();
+
+		//! Returns the number of levels
+		inline size_t levelCount() const { return m_levels.size(); }
+
+		//! Aggregates the moments of the points inside a sphere
+		/** \param center sphere center
+			\param radius sphere radius
+			\param boundaryCellSize the cells crossing the sphere boundary are subdivided down to this size
+			\param moments output moments (the 'fields' vector must have the right size)
+		**/
+		void query(const CCVector3& center, double radius, double boundaryCellSize, Moments& moments) const;
+
+		//! Returns the number of fields
+		inline size_t fieldCount() const { return m_fieldCount; }
+
+		//! Returns the origin of the grid (the moments are expressed relatively to it)
+		inline const CCVector3d& origin() const { return m_origin; }
+
+	protected: //methods
+
+		//! Returns the key of a given cell
+		static inline uint64_t CellKey(uint64_t i, uint64_t j, uint64_t k) { return (i << 42) | (j << 21) | k; }
+
+		//! Aggregates the moments of a given cell
+		void addCell(size_t levelIndex, unsigned cellIndex, Moments& moments) const;
+
+	protected: //members
+
+		//! Pyramid level
+		struct Level
+		{
+			double cellSize = 0;
+			std::unordered_map<uint64_t, unsigned> cellIndexes;
+			std::vector<uint64_t> cellKeys;
+			std::vector<GeometricMoments> cells;
+			//! Field moments (fieldCount per cell)
+			std::vector<FieldMoments> fieldMoments;
+		};
+
+		//! Levels (from the finest to the coarsest)
+		std::vector<Level> m_levels;
+		//! Origin of the grid (the moments are expressed relatively to it)
+		CCVector3d m_origin;
+		//! Number of cells of the finest level along each dimension
+		uint64_t m_gridSize[3] = { 0, 0, 0 };
+		//! Number of scalar fields
+		size_t m_fieldCount = 0;
+	};
+
+}; //namespace masc
@@ -41,6 +41,23 @@ ConfusionMatrix::ConfusionMatrix(const std::vector<ScalarType> &actual, const st
 
 	compute(actual, predicted);
 
+	showAndResize();
+}
+
+ConfusionMatrix::ConfusionMatrix(const masc::ConfusionAccumulator& accumulator, QWidget* parent) :
+	QWidget(parent),
+	ui(new Ui::ConfusionMatrix)
+{
+	ui->setupUi(this);
+	this->setWindowFlag(Qt::WindowStaysOnTopHint);
+
+	setCounts(accumulator);
+
+	showAndResize();
+}
+
+void ConfusionMatrix::showAndResize()
+{
 	this->show();
 	this->ui->tableWidget->resizeColumnsToContents();
 	this->ui->tableWidget->setSizeAdjustPolicy(QAbstractScrollArea::AdjustToContents);
@@ -57,113 +74,31 @@ ConfusionMatrix::~ConfusionMatrix()
 
 void ConfusionMatrix::computePrecisionRecallF1Score(cv::Mat& matrix, cv::Mat& precisionRecallF1Score, cv::Mat& vec_TP_FN)
 {
-	int nbClasses = matrix.rows;
-
-	// compute precision
-	for (int predictedIdx = 0; predictedIdx < nbClasses; predictedIdx++)
-	{
-		float TP = 0;
-		float FP = 0;
-		for (int realIdx = 0; realIdx < nbClasses; realIdx++)
-		{
-			if (realIdx == predictedIdx)
-				TP = matrix.at<int>(realIdx, realIdx);
-			else
-				FP += matrix.at<int>(realIdx, predictedIdx);
-		}
-		float TP_FP = TP + FP;
-		if (TP_FP == 0)
-			precisionRecallF1Score.at<float>(predictedIdx, PRECISION) = CCCoreLib::NAN_VALUE;
-		else
-			precisionRecallF1Score.at<float>(predictedIdx, PRECISION) = TP / TP_FP;
-	}
-
-	// compute recall
-	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
-	{
-		float TP = 0;
-		float FN = 0;
-		for (int predictedIdx = 0; predictedIdx< nbClasses; predictedIdx++)
-		{
-			if (realIdx == predictedIdx)
-				TP = matrix.at<int>(realIdx, realIdx);
-			else
-				FN += matrix.at<int>(realIdx, predictedIdx);
-		}
-		float TP_FN = TP + FN;
-		if (TP_FN == 0)
-			precisionRecallF1Score.at<float>(realIdx, RECALL) = CCCoreLib::NAN_VALUE;
-		else
-			precisionRecallF1Score.at<float>(realIdx, RECALL) = TP / TP_FN;
-		vec_TP_FN.at<int>(realIdx, 0) = TP_FN;
-	}
-
-	// compute F1-score
-	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
-	{
-		float den = precisionRecallF1Score.at<float>(realIdx, PRECISION)
-				+ precisionRecallF1Score.at<float>(realIdx, RECALL);
-		if (den == 0)
-			precisionRecallF1Score.at<float>(realIdx, F1_SCORE) = CCCoreLib::NAN_VALUE;
-		else
-			precisionRecallF1Score.at<float>(realIdx, F1_SCORE) =
-					2
-					* precisionRecallF1Score.at<float>(realIdx, PRECISION)
-					* precisionRecallF1Score.at<float>(realIdx, RECALL)
-					/ den;
-	}
-
+	masc::ConfusionAccumulator::ComputePrecisionRecallF1Score(matrix, precisionRecallF1Score, &vec_TP_FN);
 }
 
 float ConfusionMatrix::computeOverallAccuracy(cv::Mat& matrix)
 {
-	int nbClasses = matrix.rows;
-	float totalTrue = 0;
-	float totalFalse = 0;
-
-	m_overallAccuracy = 0.0;
-
-	for (int realIdx = 0; realIdx < nbClasses; realIdx++)
-	{
-		for (int predictedIdx = 0; predictedIdx< nbClasses; predictedIdx++)
-		{
-			if (realIdx == predictedIdx)
-				totalTrue += matrix.at<int>(realIdx, realIdx);
-			else
-				totalFalse += matrix.at<int>(realIdx, predictedIdx);
-		}
-	}
-	if ((totalTrue + totalFalse) != 0)
-		m_overallAccuracy = totalTrue / (totalTrue + totalFalse);
-	else
-		m_overallAccuracy = CCCoreLib::NAN_VALUE;
+	m_overallAccuracy = masc::ConfusionAccumulator::ComputeOverallAccuracy(matrix);
 
 	return m_overallAccuracy;
 }
 
 void ConfusionMatrix::compute(const std::vector<ScalarType>& actual, const std::vector<ScalarType>& predicted)
 {
-	int idxActual;
-	int idxPredicted;
-	int actualClass;
-	int predictedClass;
-
-	// get the set of classes with the contents of the actual classes
-	std::set<ScalarType> classes(actual.begin(), actual.end());
-	int nbClasses = static_cast<int>(classes.size());
-	confusionMatrix = cv::Mat(nbClasses, nbClasses, CV_32S, cv::Scalar(0));
-	precisionRecallF1Score = cv::Mat(nbClasses, 3, CV_32F, cv::Scalar(0));
-	cv::Mat vec_TP_FN(nbClasses, 1, CV_32S, cv::Scalar(0));
-
-	// fill the confusion matrix
-	for (int i = 0; i < actual.size(); i++)
-	{
-		actualClass = actual.at(i);
-		idxActual = std::distance(classes.begin(), classes.find(actualClass));
-		predictedClass = predicted.at(i);
-		idxPredicted = std::distance(classes.begin(), classes.find(predictedClass));
-		confusionMatrix.at<int>(idxActual, idxPredicted)++;
-	}
+	masc::ConfusionAccumulator accumulator;
+	accumulator.add(actual, predicted);
+
+	setCounts(accumulator);
+}
+
+void ConfusionMatrix::setCounts(const masc::ConfusionAccumulator& accumulator)
+{
+	class_numbers = accumulator.classNumbers();
+	classes = std::set<ScalarType>(class_numbers.begin(), class_numbers.end());
+	nbClasses = static_cast<int>(class_numbers.size());
+	confusionMatrix = accumulator.counts();
+	cv::Mat vec_TP_FN;
 
 	// compute precision recall F1-score
 	computePrecisionRecallF1Score(confusionMatrix, precisionRecallF1Score, vec_TP_FN);
@@ -172,10 +107,6 @@ void ConfusionMatrix::compute(const std::vector<ScalarType>& actual, const std::
 	// display the overall accuracy
 	this->ui->label_overallAccuracy->setText(QString::number(overallAccuracy, 'g', 2));
 
-	std::set<ScalarType>::iterator itB = classes.begin();
-	std::set<ScalarType>::iterator itE = classes.end();
-	class_numbers.assign(itB, itE);
-
 	// BUILD THE QTABLEWIDGET
 
 	this->ui->tableWidget->setColumnCount(2+ nbClasses + 3); // +2 for titles, +3 for precision / recall / F1-score
@@ -266,38 +197,7 @@ void ConfusionMatrix::setSessionRun(QString session, int run)
 
 bool ConfusionMatrix::save(QString filePath)
 {
-	QFile file(filePath);
-
-	if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
-	{
-		ccLog::Error("impossible to open file: " + filePath);
-		return false;
-	}
-
-	QTextStream stream(&file);
-	stream << "# columns: predicted classes\n# rows: actual classes\n";
-	stream << "# last three colums: precision / recall / F1-score\n";
-	for (auto class_number : class_numbers)
-	{
-		stream << class_number << " ";
-	}
-	stream << Qt::endl;
-	for (int row = 0; row < confusionMatrix.rows; row++)
-	{
-		stream << class_numbers.at(row) << " ";
-		for (int col = 0; col < confusionMatrix.cols; col++)
-		{
-			stream << confusionMatrix.at<int>(row, col) << " ";
-		}
-		stream << precisionRecallF1Score.at<float>(row, PRECISION) << " ";
-		stream << precisionRecallF1Score.at<float>(row, RECALL) << " ";
-		stream << precisionRecallF1Score.at<float>(row, F1_SCORE) << Qt::endl;
-	}
-
-	file.close();
-
-	return true;
-
+	return masc::ConfusionAccumulator::Save(filePath, class_numbers, confusionMatrix, precisionRecallF1Score);
 }
 
 float ConfusionMatrix::getOverallAccuracy()
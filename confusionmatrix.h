@@ -4,6 +4,7 @@
 #include <set>
 
 #include "CCTypes.h"
+#include "ConfusionAccumulator.h"
 
 #include <opencv2/core/mat.hpp>
 
@@ -24,6 +25,8 @@ public:
 	};
 
 	explicit ConfusionMatrix(const std::vector<ScalarType>& actual, const std::vector<ScalarType>& predicted, QWidget *parent = nullptr);
+	//! Displays already accumulated counts
+	explicit ConfusionMatrix(const masc::ConfusionAccumulator& accumulator, QWidget *parent = nullptr);
 	~ConfusionMatrix() override;
 
 	void computePrecisionRecallF1Score(cv::Mat& matrix, cv::Mat& precisionRecallF1Score, cv::Mat &vec_TP_FN);
@@ -34,6 +37,9 @@ public:
 	float getOverallAccuracy();
 
 private:
+	void setCounts(const masc::ConfusionAccumulator& accumulator);
+	void showAndResize();
+
 	std::set<ScalarType> classes;
 	int nbClasses;
 	Ui::ConfusionMatrix *ui;
@@ -24,6 +24,8 @@
 #include "qClassify3DMASCDialog.h"
 #include "qTrain3DMASCDialog.h"
 #include "q3DMASCCommands.h"
+#include "BackgroundPreparation.h"
+#include "q3DMASCModelSelection.h"
 
 //qCC_db
 #include <ccPointCloud.h>
@@ -36,6 +38,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QSettings>
+#include <QTimer>
 
 q3DMASCPlugin::q3DMASCPlugin(QObject* parent/*=0*/)
 	: QObject(parent)
@@ -149,6 +152,12 @@ void q3DMASCPlugin::doClassifyAction()
 		return;
 	}
 	static bool s_keepAttributes = classifDlg.keepAttributesCheckBox->isChecked();
+	int probabilityOutputs = masc::Classifier::NoProbability;
+	if (classifDlg.classProbabilitiesCheckBox->isChecked())
+		probabilityOutputs |= masc::Classifier::ClassProbabilities;
+	if (classifDlg.top2ProbabilitiesCheckBox->isChecked())
+		probabilityOutputs |= masc::Classifier::Top2Probabilities;
+	masc::ExecutionContext context = classifDlg.getExecutionContext();
 
 	masc::Tools::NamedClouds clouds;
 	QString mainCloudLabel = corePointsLabel;
@@ -156,7 +165,8 @@ void q3DMASCPlugin::doClassifyAction()
 
 	masc::Feature::Set features;
 	masc::Classifier classifier;
-	if (!masc::Tools::LoadClassifier(inputFilename, clouds, features, classifier, m_app->getMainWindow()))
+	masc::NeighborhoodParams neighborhoodParams;
+	if (!masc::Tools::LoadClassifier(inputFilename, clouds, features, classifier, &neighborhoodParams, m_app->getMainWindow()))
 	{
 		return;
 	}
@@ -165,6 +175,7 @@ void q3DMASCPlugin::doClassifyAction()
 		m_app->dispToConsole("No classifier or invalid classifier", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 		return;
 	}
+	classifier.setExecutionContext(context);
 
 	if (clouds.contains("TEST"))
 	{
@@ -183,7 +194,7 @@ void q3DMASCPlugin::doClassifyAction()
 	progressDlg.setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
 	QString error;
 	SFCollector generatedScalarFields;
-    if (!masc::Tools::PrepareFeatures(corePoints, features, error, &progressDlg, &generatedScalarFields))
+    if (!masc::Tools::PrepareFeatures(corePoints, features, error, &progressDlg, &generatedScalarFields, neighborhoodParams, context))
 	{
 		m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 		generatedScalarFields.releaseSFs(false);
@@ -197,7 +208,7 @@ void q3DMASCPlugin::doClassifyAction()
 		QString errorMessage;
 		masc::Feature::Source::Set featureSources;
 		masc::Feature::ExtractSources(features, featureSources);
-		if (!classifier.classify(featureSources, corePoints.cloud, errorMessage, m_app->getMainWindow()))
+		if (!classifier.classify(featureSources, corePoints.cloud, errorMessage, m_app->getMainWindow(), nullptr, probabilityOutputs))
 		{
 			m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 			generatedScalarFields.releaseSFs(false);
@@ -215,6 +226,7 @@ struct FeatureSelection
 	bool selected = true;
 	bool prepared = false;
 	float importance = std::numeric_limits<float>::quiet_NaN();
+	float permutationImportance = std::numeric_limits<float>::quiet_NaN();
 };
 
 void q3DMASCPlugin::saveTrainParameters(const masc::TrainParameters& params)
@@ -224,6 +236,8 @@ void q3DMASCPlugin::saveTrainParameters(const masc::TrainParameters& params)
 	settings.setValue("TrainParameters/minSampleCount", params.rt.minSampleCount);
 	settings.setValue("TrainParameters/activeVarCount", params.rt.activeVarCount);
 	settings.setValue("TrainParameters/maxTreeCount", params.rt.maxTreeCount);
+	settings.setValue("TrainParameters/model", static_cast<int>(params.rt.model));
+	settings.setValue("TrainParameters/learningRate", params.rt.learningRate);
 }
 
 void q3DMASCPlugin::loadTrainParameters(masc::TrainParameters& params)
@@ -233,6 +247,9 @@ void q3DMASCPlugin::loadTrainParameters(masc::TrainParameters& params)
 	params.rt.minSampleCount = settings.value("TrainParameters/minSampleCount", 10).toInt();
 	params.rt.activeVarCount = settings.value("TrainParameters/activeVarCount", 0).toInt();
 	params.rt.maxTreeCount = settings.value("TrainParameters/maxTreeCount", 100).toInt();
+	params.rt.model = (settings.value("TrainParameters/model", 0).toInt() == static_cast<int>(masc::ModelType::GradientBoosting) ? masc::ModelType::GradientBoosting : masc::ModelType::RandomForest);
+	params.rt.learningRate = settings.value("TrainParameters/learningRate", 0.1).toFloat();
+	params.neighborhood = masc::NeighborhoodParams(); //defined in the training file
 }
 
 void q3DMASCPlugin::doTrainAction()
@@ -381,7 +398,9 @@ void q3DMASCPlugin::doTrainAction()
 	//show the training dialog for the first time
 	Train3DMASCDialog trainDlg(m_app->getMainWindow());
 	trainDlg.setWindowModality(Qt::WindowModal); // to be able to move the confusion matrix window
+	trainDlg.setModelType(s_params.rt.model);
 	trainDlg.maxDepthSpinBox->setValue(s_params.rt.maxDepth);
+	trainDlg.learningRateDoubleSpinBox->setValue(s_params.rt.learningRate);
 	trainDlg.maxTreeCountSpinBox->setValue(s_params.rt.maxTreeCount);
 	trainDlg.activeVarCountSpinBox->setValue(s_params.rt.activeVarCount);
 	trainDlg.minSampleCountSpinBox->setValue(s_params.rt.minSampleCount);
@@ -412,14 +431,6 @@ void q3DMASCPlugin::doTrainAction()
 		}
 	}
 
-	static bool s_keepAttributes = trainDlg.keepAttributesCheckBox->isChecked();
-	if (!trainDlg.exec())
-	{
-		delete group;
-		return;
-	}
-	assert(!trainDlg.shouldSaveClassifier()); //the save button should be disabled at this point
-
 	//compute the core points (if necessary)
 	ccProgressDialog progressDlg(true, m_app->getMainWindow());
 	progressDlg.setAutoClose(false);
@@ -456,10 +467,27 @@ void q3DMASCPlugin::doTrainAction()
 		group->addChild(corePoints.cloud);
 	}
 	
+	//the features can only be prepared in the background if the clouds are not displayed
+	//(the worker adds scalar fields to them): the loaded clouds are only added to the DB
+	//once the worker has stopped, while the clouds of the DB are processed in this thread
+	bool backgroundPreparation = !useCloudsFromDB;
+	bool groupInDB = false;
+	auto addGroupToDB = [&]()
+	{
+		if (group && !groupInDB)
+		{
+			m_app->addToDB(group);
+			groupInDB = true;
+		}
+	};
+
 	if (group->getChildrenNumber() != 0)
 	{
-		m_app->addToDB(group);
-		QCoreApplication::processEvents();
+		if (!backgroundPreparation)
+		{
+			addGroupToDB();
+			QCoreApplication::processEvents();
+		}
 	}
 	else
 	{
@@ -467,10 +495,90 @@ void q3DMASCPlugin::doTrainAction()
 		group = nullptr;
 	}
 
+	//start preparing all the features (on both clouds) while the user makes his choices
+	SFCollector generatedScalarFields, generatedScalarFieldsTest;
+	masc::BackgroundPreparation preparation;
+	auto releaseGeneratedSFs = [&](bool keep)
+	{
+		//the worker must be stopped first
+		preparation.cancel();
+		generatedScalarFields.releaseSFs(keep);
+		generatedScalarFieldsTest.releaseSFs(keep);
+		addGroupToDB();
+	};
+	{
+		progressDlg.show();
+		bool success = preparation.addJob(corePoints, features, &generatedScalarFields, s_params.neighborhood, &progressDlg);
+		if (success && needTestSuite)
+		{
+			masc::CorePoints corePointsTest;
+			corePointsTest.cloud = corePointsTest.origin = testCloud;
+			corePointsTest.role = mainCloudLabel;
+			success = preparation.addJob(corePointsTest, featuresTest, &generatedScalarFieldsTest, s_params.neighborhood, &progressDlg);
+		}
+		progressDlg.close();
+		QCoreApplication::processEvents();
+
+		if (!success)
+		{
+			m_app->dispToConsole("Failed to start the features preparation (see Console)", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+			addGroupToDB();
+			return;
+		}
+		preparation.start(backgroundPreparation);
+	}
+
+	//display the preparation status of each feature
+	QTimer statusTimer;
+	QObject::connect(&statusTimer, &QTimer::timeout, [&]()
+	{
+		for (size_t i = 0; i < originalFeatures.size(); ++i)
+		{
+			bool ready = preparation.isReady(originalFeatures[i].feature);
+			if (ready && needTestSuite)
+			{
+				ready = preparation.isReady(originalFeaturesTest[i].feature);
+			}
+			if (ready != originalFeatures[i].prepared)
+			{
+				originalFeatures[i].prepared = ready;
+				trainDlg.setFeatureReady(originalFeatures[i].feature->toString(), ready);
+			}
+		}
+
+		//the clouds can be displayed once all the features are prepared
+		if (!groupInDB && preparation.isStopped())
+		{
+			addGroupToDB();
+		}
+	});
+	statusTimer.start(500);
+
+	static bool s_keepAttributes = trainDlg.keepAttributesCheckBox->isChecked();
+	if (!trainDlg.exec())
+	{
+		preparation.cancel();
+		generatedScalarFields.releaseSFs(false);
+		generatedScalarFieldsTest.releaseSFs(false);
+		if (group)
+		{
+			if (groupInDB)
+				m_app->removeFromDB(group);
+			else
+				delete group;
+		}
+		return;
+	}
+	assert(!trainDlg.shouldSaveClassifier()); //the save button should be disabled at this point
+
 	//train / test subsets
 	QSharedPointer<CCCoreLib::ReferenceCloud> trainSubset, testSubset;
 	float previousTestSubsetRatio = -1.0f;
-	SFCollector generatedScalarFields, generatedScalarFieldsTest;
+	int trainSubsetVersion = 0;
+
+	//the classifier is kept from one iteration to the next (see the warm start below)
+	masc::Classifier classifier;
+	QString previousTrainingSignature;
 
 	//we will train + evaluate the classifier, then display the results
 	//then let the user change parameters and (potentially) start again
@@ -478,7 +586,7 @@ void q3DMASCPlugin::doTrainAction()
 	{
 		//look for selected features
 		features.clear();
-		masc::Feature::Set toPrepare;
+		featuresTest.clear();
 		for (size_t i = 0; i < originalFeatures.size(); ++i)
 		{
 			originalFeatures[i].selected = trainDlg.isFeatureSelected(originalFeatures[i].feature->toString());
@@ -486,47 +594,45 @@ void q3DMASCPlugin::doTrainAction()
 			//if the feature is selected
 			if (originalFeatures[i].selected)
 			{
-				if (!originalFeatures[i].prepared)
+				features.push_back(originalFeatures[i].feature);
+				if (needTestSuite)
 				{
-					//we should prepare it first!
-					toPrepare.push_back(originalFeatures[i].feature);
+					originalFeaturesTest[i].selected = true;
+					featuresTest.push_back(originalFeaturesTest[i].feature);
 				}
-				features.push_back(originalFeatures[i].feature);
+			}
+			else if (needTestSuite)
+			{
+				originalFeaturesTest[i].selected = false;
 			}
 		}
 
-		masc::Classifier classifier;
 		if (features.empty())
 		{
 			m_app->dispToConsole("No feature selected!", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+			classifier = masc::Classifier();
+			previousTrainingSignature.clear();
 		}
 		else
 		{
-			//prepare the features (should be done once)
-			if (!toPrepare.empty())
+			//wait for the selected features to be prepared (on both clouds)
+			//(the worker is then suspended until the end of this iteration)
 			{
-				progressDlg.show();
+				masc::Feature::Set toWaitFor = features;
+				toWaitFor.insert(toWaitFor.end(), featuresTest.begin(), featuresTest.end());
 				QString error;
-				if (!masc::Tools::PrepareFeatures(corePoints, toPrepare, error, &progressDlg, &generatedScalarFields))
+				if (!preparation.waitFor(toWaitFor, error, m_app->getMainWindow()))
 				{
 					m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-					generatedScalarFields.releaseSFs(false);
-					generatedScalarFieldsTest.releaseSFs(false);
+					releaseGeneratedSFs(false);
 					return;
 				}
-				progressDlg.close();
-				QCoreApplication::processEvents();
 				m_app->redrawAll();
-
-				//flag the prepared features as 'prepared' ;)
-				for (FeatureSelection& fs : originalFeatures)
-				{
-					if (fs.selected && !fs.prepared)
-						fs.prepared = true;
-				}
 			}
 
 			//retrieve parameters
+			s_params.rt.model = trainDlg.getModelType();
+			s_params.rt.learningRate = static_cast<float>(trainDlg.learningRateDoubleSpinBox->value());
 			s_params.rt.maxDepth = trainDlg.maxDepthSpinBox->value();
 			s_params.rt.maxTreeCount = trainDlg.maxTreeCountSpinBox->value();
 			s_params.rt.activeVarCount = trainDlg.activeVarCountSpinBox->value();
@@ -543,6 +649,7 @@ void q3DMASCPlugin::doTrainAction()
 					m_app->dispToConsole("Invalid test data ratio", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 					trainSubset.clear();
 					testSubset.clear();
+					++trainSubsetVersion;
 				}
 				else if (previousTestSubsetRatio != testDataRatio)
 				{
@@ -558,11 +665,207 @@ void q3DMASCPlugin::doTrainAction()
 					if (!masc::Tools::RandomSubset(corePoints.cloud, testDataRatio, testSubset.data(), trainSubset.data()))
 					{
 						m_app->dispToConsole("Not enough memory to generate the test subsets", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-						generatedScalarFields.releaseSFs(false);
-						generatedScalarFieldsTest.releaseSFs(false);
+						releaseGeneratedSFs(false);
 						return;
 					}
 					previousTestSubsetRatio = testDataRatio;
+					++trainSubsetVersion;
+				}
+			}
+
+			//builds the training and test matrices (for the model selection tools)
+			auto buildDataMatrices = [&](cv::Mat& trainData, cv::Mat& trainLabels, cv::Mat& testData, cv::Mat& testLabels, QString& errorMessage)
+			{
+				if (testCloud == nullptr && (!testSubset || testSubset->size() == 0))
+				{
+					errorMessage = "Test data is required (set a test data ratio or a TEST cloud)";
+					return false;
+				}
+
+				masc::Feature::Source::Set candidateSources;
+				masc::Feature::ExtractSources(features, candidateSources);
+				if (	!masc::Classifier::BuildDataMatrix(candidateSources, corePoints.cloud, trainData, &trainLabels, errorMessage, trainSubset.data())
+					||	!masc::Classifier::BuildDataMatrix(candidateSources, testCloud ? testCloud : corePoints.cloud, testData, &testLabels, errorMessage, testCloud ? nullptr : testSubset.data()))
+				{
+					errorMessage = "Failed to build the data matrices: " + errorMessage;
+					return false;
+				}
+
+				return true;
+			};
+
+			//automatic feature selection (among the selected features)
+			if (trainDlg.shouldSelectFeatures())
+			{
+				trainDlg.setFeatureSelectionDone();
+
+				cv::Mat trainData, trainLabels, testData, testLabels;
+				QString errorMessage;
+				if (buildDataMatrices(trainData, trainLabels, testData, testLabels, errorMessage))
+				{
+					masc::FeatureSelectionParams fsParams;
+					fsParams.method = (trainDlg.featureSelectionComboBox->currentIndex() == 0 ? masc::FeatureSelectionParams::RECURSIVE_ELIMINATION : masc::FeatureSelectionParams::FORWARD_SELECTION);
+					fsParams.tolerance = static_cast<float>(trainDlg.featureSelectionToleranceSpinBox->value() / 100.0);
+
+					masc::FeatureSelectionResult fsResult;
+					progressDlg.show();
+					bool success = masc::ModelSelection::SelectFeatures(trainData, trainLabels, testData, testLabels, s_params.rt, fsParams, fsResult, errorMessage, &progressDlg);
+					progressDlg.close();
+					QCoreApplication::processEvents();
+
+					if (success)
+					{
+						m_app->dispToConsole(QString("[3DMASC] Feature selection: best accuracy = %1 with %2 features, %3 features selected (accuracy = %4)")
+												.arg(fsResult.best.accuracy)
+												.arg(fsResult.best.features.size())
+												.arg(fsResult.selected.features.size())
+												.arg(fsResult.selected.accuracy),
+											ccMainAppInterface::STD_CONSOLE_MESSAGE);
+
+						//update the feature selection
+						std::vector<bool> keep(features.size(), false);
+						for (int index : fsResult.selected.features)
+						{
+							keep[index] = true;
+						}
+						int selectedIndex = 0;
+						features.clear();
+						featuresTest.clear();
+						for (size_t i = 0; i < originalFeatures.size(); ++i)
+						{
+							if (!originalFeatures[i].selected)
+								continue;
+
+							originalFeatures[i].selected = keep[selectedIndex++];
+							trainDlg.setFeatureSelected(originalFeatures[i].feature->toString(), originalFeatures[i].selected);
+							if (originalFeatures[i].selected)
+							{
+								features.push_back(originalFeatures[i].feature);
+							}
+							if (needTestSuite)
+							{
+								originalFeaturesTest[i].selected = originalFeatures[i].selected;
+								if (originalFeaturesTest[i].selected)
+									featuresTest.push_back(originalFeaturesTest[i].feature);
+							}
+						}
+						errorMessage.clear();
+					}
+				}
+
+				if (!errorMessage.isEmpty())
+				{
+					//we can still train the classifier with the current selection
+					m_app->dispToConsole(errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+				}
+			}
+
+			//hyperparameter search (with the selected features)
+			if (trainDlg.shouldSearchHyperParameters())
+			{
+				trainDlg.setHyperParameterSearchDone();
+
+				masc::HyperParameterSearchParams hpParams;
+				hpParams.baseParams = s_params.rt;
+				cv::Mat trainData, trainLabels, testData, testLabels;
+				QString errorMessage;
+				if (	trainDlg.getHyperParameterSearchParams(hpParams, errorMessage)
+					&&	buildDataMatrices(trainData, trainLabels, testData, testLabels, errorMessage))
+				{
+					std::vector<masc::HyperParameterCandidate> candidates;
+					size_t bestIndex = 0;
+					progressDlg.show();
+					bool success = masc::ModelSelection::SearchHyperParameters(trainData, trainLabels, testData, testLabels, hpParams, candidates, bestIndex, errorMessage, &progressDlg);
+					progressDlg.close();
+					QCoreApplication::processEvents();
+
+					if (success)
+					{
+						//report the accuracy vs. model size and inference cost of each configuration
+						m_app->dispToConsole("[3DMASC] Hyperparameter search: max_depth max_tree_count active_var_count min_sample_count accuracy node_count inference_time(us/point)", ccMainAppInterface::STD_CONSOLE_MESSAGE);
+						for (const masc::HyperParameterCandidate& candidate : candidates)
+						{
+							m_app->dispToConsole(QString("[3DMASC] %1 %2 %3 %4 %5 %6 %7")
+													.arg(candidate.params.maxDepth)
+													.arg(candidate.params.maxTreeCount)
+													.arg(candidate.params.activeVarCount)
+													.arg(candidate.params.minSampleCount)
+													.arg(candidate.accuracy)
+													.arg(candidate.nodeCount)
+													.arg(candidate.inferenceTime_us),
+												ccMainAppInterface::STD_CONSOLE_MESSAGE);
+						}
+
+						//use the best configuration
+						const masc::RandomTreesParams& best = candidates[bestIndex].params;
+						m_app->dispToConsole(QString("[3DMASC] Best configuration: max depth = %1, max tree count = %2, active var count = %3, min sample count = %4 (accuracy = %5)")
+												.arg(best.maxDepth)
+												.arg(best.maxTreeCount)
+												.arg(best.activeVarCount)
+												.arg(best.minSampleCount)
+												.arg(candidates[bestIndex].accuracy),
+											ccMainAppInterface::STD_CONSOLE_MESSAGE);
+						s_params.rt = best;
+						trainDlg.maxDepthSpinBox->setValue(best.maxDepth);
+						trainDlg.maxTreeCountSpinBox->setValue(best.maxTreeCount);
+						trainDlg.activeVarCountSpinBox->setValue(best.activeVarCount);
+						trainDlg.minSampleCountSpinBox->setValue(best.minSampleCount);
+						errorMessage.clear();
+					}
+				}
+
+				if (!errorMessage.isEmpty())
+				{
+					//we can still train the classifier with the current parameters
+					m_app->dispToConsole(errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+				}
+			}
+
+			//spatially blocked cross-validation (on all the core points)
+			if (trainDlg.shouldCrossValidate())
+			{
+				trainDlg.setCrossValidationDone();
+
+				masc::Feature::Source::Set cvSources;
+				masc::Feature::ExtractSources(features, cvSources);
+				masc::CrossValidationParams cvParams;
+				cvParams.foldCount = trainDlg.cvFoldCountSpinBox->value();
+				cvParams.tileSize = trainDlg.cvTileSizeSpinBox->value();
+				cv::Mat data, labels;
+				std::vector<int> folds;
+				masc::CrossValidationResult cvResult;
+				QString errorMessage;
+				bool success = masc::Classifier::BuildDataMatrix(cvSources, corePoints.cloud, data, &labels, errorMessage)
+							&& masc::ModelSelection::AssignSpatialFolds(corePoints.cloud, cvParams.foldCount, cvParams.tileSize, folds, errorMessage);
+				if (success)
+				{
+					progressDlg.show();
+					success = masc::ModelSelection::CrossValidate(data, labels, folds, cvParams, s_params.rt, cvResult, errorMessage, &progressDlg);
+					progressDlg.close();
+					QCoreApplication::processEvents();
+				}
+
+				if (success)
+				{
+					QString foldAccuracies;
+					for (float accuracy : cvResult.foldAccuracies)
+					{
+						foldAccuracies += " " + QString::number(accuracy);
+					}
+					m_app->dispToConsole(QString("[3DMASC] %1-fold spatial cross-validation: accuracy = %2 +/- %3 (folds:%4)")
+											.arg(cvParams.foldCount)
+											.arg(cvResult.meanAccuracy)
+											.arg(cvResult.stdDevAccuracy)
+											.arg(foldAccuracies),
+										ccMainAppInterface::STD_CONSOLE_MESSAGE);
+
+					//display the aggregated confusion matrix
+					trainDlg.addConfusionMatrixAndSaveTraces(new ConfusionMatrix(cvResult.confusion));
+				}
+				else
+				{
+					//we can still train the classifier
+					m_app->dispToConsole(errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
 				}
 			}
 
@@ -572,6 +875,15 @@ void q3DMASCPlugin::doTrainAction()
 
 			//train the classifier
 			{
+				//warm start: if only the number of trees has changed, the previous trees are kept
+				QString trainingSignature = QString("%1/%2/%3/%4/%5/%6/").arg(static_cast<int>(s_params.rt.model)).arg(s_params.rt.learningRate).arg(s_params.rt.maxDepth).arg(s_params.rt.minSampleCount).arg(s_params.rt.activeVarCount).arg(trainSubsetVersion);
+				for (const masc::Feature::Source& source : featureSources)
+				{
+					trainingSignature += QString("%1:%2;").arg(static_cast<int>(source.type)).arg(source.name);
+				}
+				bool warmStart = (trainingSignature == previousTrainingSignature && classifier.isValid());
+				previousTrainingSignature.clear();
+
 				QString errorMessage;
 				if (!classifier.train(	corePoints.cloud,
 										s_params.rt,
@@ -579,71 +891,21 @@ void q3DMASCPlugin::doTrainAction()
 										errorMessage,
 										trainSubset.data(),
 										m_app,
-										m_app->getMainWindow()
+										m_app->getMainWindow(),
+										warmStart
 									))
 				{
 					m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-					generatedScalarFields.releaseSFs(false);
-					generatedScalarFieldsTest.releaseSFs(false);
+					releaseGeneratedSFs(false);
 					return;
 				}
+				previousTrainingSignature = trainingSignature;
 				trainDlg.setFirstRunDone();
 //				trainDlg.shouldSaveClassifier(); // useless?
 			}
 
 			//test the trained classifier
 			{
-				if (testCloud)
-				{
-					//look for selected features
-					if (needTestSuite)
-					{
-						featuresTest.clear();
-						masc::Feature::Set toPrepareTest;
-						for (size_t i = 0; i < originalFeaturesTest.size(); ++i)
-						{
-							originalFeaturesTest[i].selected = trainDlg.isFeatureSelected(originalFeatures[i].feature->toString());
-							//if the feature is selected
-							if (originalFeaturesTest[i].selected)
-							{
-								if (!originalFeaturesTest[i].prepared)
-								{
-									//we should prepare it first!
-									toPrepareTest.push_back(originalFeaturesTest[i].feature);
-								}
-								featuresTest.push_back(originalFeaturesTest[i].feature);
-							}
-						}
-
-						//prepare the features and the test cloud
-						if (!toPrepareTest.empty())
-						{
-							progressDlg.show();
-							QString error;
-							masc::CorePoints corePointsTest;
-							corePointsTest.cloud = corePointsTest.origin = testCloud;
-							corePointsTest.role = mainCloudLabel;
-							if (!masc::Tools::PrepareFeatures(corePointsTest, toPrepareTest, error, &progressDlg, &generatedScalarFieldsTest))
-							{
-								m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-								generatedScalarFields.releaseSFs(false);
-								generatedScalarFieldsTest.releaseSFs(false);
-								return;
-							}
-							progressDlg.close();
-							QCoreApplication::processEvents();
-							m_app->redrawAll();
-
-							//flag the prepared features as 'prepared' ;)
-							for (FeatureSelection& fs : originalFeaturesTest)
-							{
-								if (fs.selected && !fs.prepared)
-									fs.prepared = true;
-							}
-						}
-					}
-				}
-
 				masc::Classifier::AccuracyMetrics metrics;
 				QString errorMessage;
 				if (!classifier.evaluate(	featureSources,
@@ -656,8 +918,7 @@ void q3DMASCPlugin::doTrainAction()
 											m_app->getMainWindow()))
 				{
 					m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-					generatedScalarFields.releaseSFs(false);
-					generatedScalarFieldsTest.releaseSFs(false);
+					releaseGeneratedSFs(false);
 					return;
 				}
 
@@ -685,6 +946,46 @@ void q3DMASCPlugin::doTrainAction()
 					trainDlg.setFeatureImportance(originalFeatures[i].feature->toString(), originalFeatures[i].importance);
 				}
 
+				//permutation importance (accuracy drop on the test data)
+				std::vector<float> permutationImportances;
+				if (trainDlg.permutationImportanceCheckBox->isChecked())
+				{
+					cv::Mat testData, testLabels;
+					QString piErrorMessage;
+					bool success = masc::Classifier::BuildDataMatrix(	featureSources,
+																		testCloud ? testCloud : corePoints.cloud,
+																		testData,
+																		&testLabels,
+																		piErrorMessage,
+																		testCloud ? nullptr : testSubset.data());
+					if (success)
+					{
+						progressDlg.show();
+						success = masc::ModelSelection::PermutationImportance(classifier, testData, testLabels, permutationImportances, piErrorMessage, &progressDlg);
+						progressDlg.close();
+						QCoreApplication::processEvents();
+					}
+					if (!success)
+					{
+						m_app->dispToConsole("[3DMASC] Failed to compute the permutation importance: " + piErrorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+						permutationImportances.clear();
+					}
+				}
+				selectedFeatureIndex = 0;
+				for (size_t i = 0; i < originalFeatures.size(); ++i)
+				{
+					originalFeatures[i].permutationImportance = std::numeric_limits<float>::quiet_NaN();
+					if (originalFeatures[i].selected)
+					{
+						if (selectedFeatureIndex < static_cast<int>(permutationImportances.size()))
+						{
+							originalFeatures[i].permutationImportance = permutationImportances[selectedFeatureIndex];
+						}
+						++selectedFeatureIndex;
+					}
+					trainDlg.setFeaturePermutationImportance(originalFeatures[i].feature->toString(), originalFeatures[i].permutationImportance);
+				}
+
 				trainDlg.sortByFeatureImportance();
 
 				// if the checkbox "Save traces" is checked
@@ -695,7 +996,7 @@ void q3DMASCPlugin::doTrainAction()
 					if (!tracePath.isEmpty())
 					{
 						QString outputFilePath = tracePath + "/run_" + QString::number(trainDlg.getRun()) + ".txt";
-						if (masc::Tools::SaveClassifier(outputFilePath, features, mainCloudLabel, classifier, m_app->getMainWindow()))
+						if (masc::Tools::SaveClassifier(outputFilePath, features, mainCloudLabel, classifier, &s_params, m_app->getMainWindow()))
 						{
 							m_app->dispToConsole("Classifier succesfully saved to " + outputFilePath, ccMainAppInterface::STD_CONSOLE_MESSAGE);
 							trainDlg.setClassifierSaved();
@@ -713,12 +1014,15 @@ void q3DMASCPlugin::doTrainAction()
 							ccLog::Warning(QString("Can't open file '%1' for writing").arg(filename));
 						}
 						QTextStream stream(&file);
-						stream << "# feature importance" << endl;
+						stream << "# feature importance" << (permutationImportances.empty() ? "" : " / permutation importance") << endl;
 						for (size_t i = 0; i < originalFeatures.size(); ++i)
 						{
 							if (originalFeatures[i].selected)
 							{
-								stream << originalFeatures[i].feature->toString() << " " << originalFeatures[i].importance << endl;
+								stream << originalFeatures[i].feature->toString() << " " << originalFeatures[i].importance;
+								if (!permutationImportances.empty())
+									stream << " " << originalFeatures[i].permutationImportance;
+								stream << endl;
 							}
 						}
 					}
@@ -726,6 +1030,9 @@ void q3DMASCPlugin::doTrainAction()
 			}
 		}
 
+		//the remaining features can be prepared while the user is looking at the results
+		preparation.resume();
+
 		//now wait for the user input
 		while (true) // ew!
 		{
@@ -737,8 +1044,7 @@ void q3DMASCPlugin::doTrainAction()
 					s_keepAttributes = true;
 				else
 					s_keepAttributes = false;
-				generatedScalarFields.releaseSFs(s_keepAttributes);
-				generatedScalarFieldsTest.releaseSFs(s_keepAttributes);
+				releaseGeneratedSFs(s_keepAttributes);
 				return;
 			}
 
@@ -762,7 +1068,7 @@ void q3DMASCPlugin::doTrainAction()
 				}
 
 				//save the classifier
-				if (masc::Tools::SaveClassifier(outputFilename, features, mainCloudLabel, classifier, m_app->getMainWindow()))
+				if (masc::Tools::SaveClassifier(outputFilename, features, mainCloudLabel, classifier, &s_params, m_app->getMainWindow()))
 				{
 					m_app->dispToConsole("Classifier succesfully saved to " + outputFilename, ccMainAppInterface::STD_CONSOLE_MESSAGE);
 					trainDlg.setClassifierSaved();
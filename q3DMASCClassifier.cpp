@@ -20,6 +20,9 @@
 //Local
 #include "ScalarFieldWrappers.h"
 #include "q3DMASCTools.h"
+#include "FlatForest.h"
+#include "ConfusionAccumulator.h"
+#include "NumaPlacement.h"
 
 //qCC_db
 #include <ccPointCloud.h>
@@ -38,10 +41,17 @@
 #include <QProgressDialog>
 #include <QtConcurrent>
 #include <QMessageBox>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QFileInfo>
 
 #include "qTrain3DMASCDialog.h"
 #include "confusionmatrix.h"
 
+//system
+#include <atomic>
+#include <cmath>
+
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
@@ -54,7 +64,19 @@ Classifier::Classifier()
 
 bool Classifier::isValid() const
 {
-	return (m_rtrees && m_rtrees->isClassifier() && m_rtrees->isTrained());
+	if (m_modelType == ModelType::GradientBoosting)
+	{
+		return m_boostedTrees.isValid();
+	}
+	if (isCompacted())
+	{
+		return true;
+	}
+
+	return (	!m_forests.empty()
+			&&	m_forests.front()->isClassifier()
+			&&	m_forests.front()->isTrained()
+			&&	m_flatForest.isValid());
 }
 
 static IScalarFieldWrapper::Shared GetSource(const Feature::Source& fs, const ccPointCloud* cloud)
@@ -103,10 +125,31 @@ static IScalarFieldWrapper::Shared GetSource(const Feature::Source& fs, const cc
 	return source;
 }
 
+//! Number of samples processed at once by a thread (classification/evaluation)
+static const unsigned BlockSize = 4096;
+
+int Classifier::predictProbabilities(const float* sample, float* probabilities, int* votes) const
+{
+	if (m_modelType == ModelType::GradientBoosting)
+	{
+		return m_boostedTrees.predict(sample, probabilities);
+	}
+
+	int classIndex = (m_compiledForest.isLoaded() ? m_compiledForest.predict(sample, votes) : m_flatForest.predict(sample, votes));
+	int treeCount = m_flatForest.treeCount();
+	for (int c = 0; c < m_flatForest.classCount(); ++c)
+	{
+		probabilities[c] = static_cast<float>(votes[c]) / treeCount;
+	}
+	return classIndex;
+}
+
 bool Classifier::classify(	const Feature::Source::Set& featureSources,
 							ccPointCloud* cloud,
 							QString& errorMessage,
-							QWidget* parentWidget/*=nullptr*/
+							QWidget* parentWidget/*=nullptr*/,
+							ConfusionAccumulator* confusion/*=nullptr*/,
+							int probabilityOutputs/*=NoProbability*/
 						)
 {
 	if (!cloud)
@@ -128,47 +171,17 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 		return false;
 	}
 
-	// add a ccConfidence value if needed
-	int cvConfidenceIdx = cloud->getScalarFieldIndexByName("Classification_confidence");
-	if (cvConfidenceIdx >= 0) // if the scalar field exists, delete it
-		cloud->deleteScalarField(cvConfidenceIdx);
-	cvConfidenceIdx = cloud->addScalarField("Classification_confidence");
-	ccScalarField* cvConfidenceSF = static_cast<ccScalarField*>(cloud->getScalarField(cvConfidenceIdx));
-
-	//look for the classification field
-	CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud);
-	ccScalarField* classifSFBackup = nullptr;
-
-	if (classificationSF) //save classification field (if any) by renaming it "Classification_backup"
-	{
-		ccLog::Warning("Classification SF found: copy it in Classification_backup, a confusion matrix will be generated");
-		// delete Classification_backup field (if any)
-		int sfIdx = cloud->getScalarFieldIndexByName("Classification_backup");
-		if (sfIdx >= 0)
-			cloud->deleteScalarField(sfIdx);
+	int sampleCount = static_cast<int>(cloud->size());
+	int attributesPerSample = static_cast<int>(featureSources.size());
 
-		classificationSF->setName("Classification_backup"); // rename the classification field
-		classifSFBackup = static_cast<ccScalarField*>(classificationSF);
-	}
+	ccLog::Print(QObject::tr("[3DMASC] Classifying %1 points with %2 feature(s)").arg(sampleCount).arg(attributesPerSample));
 
-	//create the classification SF
-	ccScalarField* _classificationSF = new ccScalarField(LAS_FIELD_NAMES[LAS_CLASSIFICATION]);
-	if (!_classificationSF->resizeSafe(cloud->size()))
+	//check the inputs before touching the cloud scalar fields
+	if (getVarCount() != attributesPerSample)
 	{
-		_classificationSF->release();
-		errorMessage = QObject::tr("Not enough memory");
+		errorMessage = QObject::tr("The classifier expects %1 feature(s) (%2 provided)").arg(getVarCount()).arg(attributesPerSample);
 		return false;
 	}
-	cloud->addScalarField(_classificationSF);
-	classificationSF = _classificationSF;
-
-	assert(classificationSF);
-	classificationSF->fill(0); //0 = no classification?
-
-	int sampleCount = static_cast<int>(cloud->size());
-	int attributesPerSample = static_cast<int>(featureSources.size());
-
-	ccLog::Print(QObject::tr("[3DMASC] Classifying %1 points with %2 feature(s)").arg(sampleCount).arg(attributesPerSample));
 
 	//create the field wrappers
 	std::vector< IScalarFieldWrapper::Shared > wrappers;
@@ -190,6 +203,83 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 		}
 	}
 
+	int classCount = getClassCount();
+
+	//allocate all the output fields before modifying the cloud
+	std::vector<ccScalarField*> newSFs;
+	auto createSF = [&](QString name) -> ccScalarField*
+	{
+		ccScalarField* sf = new ccScalarField(qPrintable(name));
+		newSFs.push_back(sf);
+		return (sf->resizeSafe(cloud->size()) ? sf : nullptr);
+	};
+
+	ccScalarField* _classificationSF = createSF(LAS_FIELD_NAMES[LAS_CLASSIFICATION]);
+	ccScalarField* cvConfidenceSF = createSF("Classification_confidence");
+	bool sfError = (!_classificationSF || !cvConfidenceSF);
+
+	//optional probability fields
+	std::vector<ccScalarField*> probabilitySFs;
+	ccScalarField* secondClassSF = nullptr;
+	ccScalarField* secondConfidenceSF = nullptr;
+	ccScalarField* entropySF = nullptr;
+	ccScalarField* marginSF = nullptr;
+	if (!sfError && (probabilityOutputs & ClassProbabilities))
+	{
+		for (int c = 0; c < classCount && !sfError; ++c)
+		{
+			ccScalarField* sf = createSF(QString("Probability_class_%1").arg(static_cast<int>(getClassLabel(c))));
+			sfError |= (sf == nullptr);
+			probabilitySFs.push_back(sf);
+		}
+	}
+	if (!sfError && (probabilityOutputs & Top2Probabilities))
+	{
+		secondClassSF = createSF("Classification_2nd");
+		secondConfidenceSF = createSF("Classification_2nd_confidence");
+		entropySF = createSF("Classification_entropy");
+		marginSF = createSF("Classification_margin");
+		sfError |= (!secondClassSF || !secondConfidenceSF || !entropySF || !marginSF);
+	}
+	if (sfError)
+	{
+		for (ccScalarField* sf : newSFs)
+		{
+			sf->release();
+		}
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	//look for the classification field
+	CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud);
+	ccScalarField* classifSFBackup = nullptr;
+
+	if (classificationSF) //save classification field (if any) by renaming it "Classification_backup"
+	{
+		ccLog::Warning("Classification SF found: copy it in Classification_backup, a confusion matrix will be generated");
+		// delete Classification_backup field (if any)
+		int sfIdx = cloud->getScalarFieldIndexByName("Classification_backup");
+		if (sfIdx >= 0)
+			cloud->deleteScalarField(sfIdx);
+
+		classificationSF->setName("Classification_backup"); // rename the classification field
+		classifSFBackup = static_cast<ccScalarField*>(classificationSF);
+	}
+
+	//now replace the existing output fields (if any) by the new ones
+	for (ccScalarField* sf : newSFs)
+	{
+		int sfIdx = cloud->getScalarFieldIndexByName(sf->getName());
+		if (sfIdx >= 0) // if the scalar field exists, delete it
+			cloud->deleteScalarField(sfIdx);
+		cloud->addScalarField(sf);
+	}
+	classificationSF = _classificationSF;
+
+	assert(classificationSF);
+	classificationSF->fill(0); //0 = no classification?
+
 	QScopedPointer<ccProgressDialog> pDlg;
 	if (parentWidget)
 	{
@@ -198,67 +288,194 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 		pDlg->show();
 		QCoreApplication::processEvents();
 	}
-	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), cloud->size());
 
-	bool success = true;
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
+	//to normalize the entropy
+	double maxEntropy = (classCount > 1 ? std::log2(static_cast<double>(classCount)) : 1.0);
+
+	//if the cloud was already classified, we compare the new classification with the previous one
+	ConfusionAccumulator localConfusion;
+	if (!confusion)
+	{
+		confusion = &localConfusion;
+	}
+	confusion->clear();
+
+	unsigned pointCount = cloud->size();
+	int blockCount = static_cast<int>((pointCount + BlockSize - 1) / BlockSize);
+	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), blockCount);
+	QMutex progressMutex;
+
+	//the output pages of each block are moved to the node of the thread classifying it
+	NumaPlacement placement(m_executionContext.migrateOutputPages);
+	std::vector<CCCoreLib::ScalarField*> outputSFs{ classificationSF, cvConfidenceSF };
+	outputSFs.insert(outputSFs.end(), probabilitySFs.begin(), probabilitySFs.end());
+	for (ccScalarField* sf : { secondClassSF, secondConfidenceSF, entropySF, marginSF })
+		if (sf)
+			outputSFs.push_back(sf);
+
+	//quantized inference (random trees only)
+	bool quantized = false;
+	if (m_quantizedInference && m_modelType == ModelType::RandomForest && !m_compiledForest.isLoaded())
+	{
+		QString quantizationError;
+		if (m_flatForest.isQuantized() || m_flatForest.buildQuantization(quantizationError))
+		{
+			quantized = true;
+			ccLog::Print(QObject::tr("[3DMASC] Quantized inference (%1-bit feature codes)").arg(m_flatForest.hasByteCodes() ? 8 : 16));
+		}
+		else
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] Quantized inference not available (%1)").arg(quantizationError));
+		}
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	std::atomic<bool> success(true); //read and written by the worker threads
 #ifndef _DEBUG
 #if defined(_OPENMP)
-	omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel for num_threads(m_executionContext.threadCount()) schedule(dynamic)
 #endif
 #endif
-	for (int i = 0; i < static_cast<int>(cloud->size()); ++i)
+	for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
 	{
-		//allocate the data matrix
-		cv::Mat test_data;
-		try
+		if (!success)
 		{
-			test_data.create(1, attributesPerSample, CV_32FC1);
+			//process cancelled by the user
+			continue;
 		}
-		catch (const cv::Exception& cvex)
+
+		std::vector<float> sample(attributesPerSample);
+		std::vector<float> probabilities(classCount);
+		std::vector<int> votes(classCount);
+		ConfusionAccumulator::Chunk chunk;
+
+		unsigned firstIndex = static_cast<unsigned>(blockIndex) * BlockSize;
+		unsigned lastIndex = std::min(firstIndex + BlockSize, pointCount);
+		if (placement.isEnabled())
 		{
-			errorMessage = cvex.msg.c_str();
-			success = false;
-			break;
+			for (CCCoreLib::ScalarField* sf : outputSFs)
+			{
+				placement.claim(sf->data(), firstIndex, lastIndex);
+			}
 		}
 
-		for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+		//quantized inference: the whole block is encoded, then traversed tree by tree
+		std::vector<uint8_t> byteCodes;
+		std::vector<uint16_t> wordCodes;
+		std::vector<int> blockVotes;
+		std::vector<int> blockClassIndexes;
+		if (quantized)
 		{
-			double value = wrappers[fIndex]->pointValue(i);
-			test_data.at<float>(0, fIndex) = static_cast<float>(value);
+			int blockSampleCount = static_cast<int>(lastIndex - firstIndex);
+			size_t codeCount = static_cast<size_t>(blockSampleCount) * attributesPerSample;
+			if (m_flatForest.hasByteCodes())
+				byteCodes.resize(codeCount);
+			else
+				wordCodes.resize(codeCount);
+			for (unsigned i = firstIndex; i < lastIndex; ++i)
+			{
+				for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+				{
+					sample[fIndex] = static_cast<float>(wrappers[fIndex]->pointValue(i));
+				}
+				size_t rowOffset = static_cast<size_t>(i - firstIndex) * attributesPerSample;
+				if (m_flatForest.hasByteCodes())
+					m_flatForest.encode(sample.data(), byteCodes.data() + rowOffset);
+				else
+					m_flatForest.encode(sample.data(), wordCodes.data() + rowOffset);
+			}
+
+			blockVotes.resize(static_cast<size_t>(blockSampleCount) * classCount);
+			blockClassIndexes.resize(blockSampleCount);
+			if (m_flatForest.hasByteCodes())
+				m_flatForest.predictBatch(byteCodes.data(), blockSampleCount, blockVotes.data(), blockClassIndexes.data());
+			else
+				m_flatForest.predictBatch(wordCodes.data(), blockSampleCount, blockVotes.data(), blockClassIndexes.data());
 		}
 
-		float predictedClass = m_rtrees->predict(test_data.row(0), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-		classificationSF->setValue(i, static_cast<int>(predictedClass));
-		// compute the confidence
-		cv::Mat result;
-		m_rtrees->getVotes(test_data, result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-		int classIndex = -1;
-		for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-			if (predictedClass == result.at<int>(0, col))
+		for (unsigned i = firstIndex; i < lastIndex; ++i)
+		{
+			int classIndex = 0;
+			if (quantized)
 			{
-				classIndex = col;
-				break;
+				const int* sampleVotes = blockVotes.data() + static_cast<size_t>(i - firstIndex) * classCount;
+				for (int c = 0; c < classCount; ++c)
+				{
+					probabilities[c] = static_cast<float>(sampleVotes[c]) / m_flatForest.treeCount();
+				}
+				classIndex = blockClassIndexes[i - firstIndex];
+			}
+			else
+			{
+				for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+				{
+					sample[fIndex] = static_cast<float>(wrappers[fIndex]->pointValue(i));
+				}
+				classIndex = predictProbabilities(sample.data(), probabilities.data(), votes.data());
+			}
+
+			int predictedClass = static_cast<int>(getClassLabel(classIndex));
+			classificationSF->setValue(i, predictedClass);
+			cvConfidenceSF->setValue(i, static_cast<ScalarType>(probabilities[classIndex])); // compute the confidence
+			if (classifSFBackup)
+			{
+				chunk.add(static_cast<int>(classifSFBackup->getValue(i)), predictedClass);
+			}
+
+			//probabilities (from the same traversal)
+			for (size_t c = 0; c < probabilitySFs.size(); ++c)
+			{
+				probabilitySFs[c]->setValue(i, static_cast<ScalarType>(probabilities[c]));
+			}
+			if (secondClassSF)
+			{
+				int secondIndex = -1;
+				double entropy = 0.0;
+				for (int c = 0; c < classCount; ++c)
+				{
+					if (probabilities[c] > 0.0f)
+					{
+						double p = probabilities[c];
+						entropy -= p * std::log2(p);
+					}
+					if (c != classIndex && (secondIndex < 0 || probabilities[c] > probabilities[secondIndex]))
+					{
+						secondIndex = c;
+					}
+				}
+				float secondConfidence = (secondIndex >= 0 ? probabilities[secondIndex] : 0.0f);
+				secondClassSF->setValue(i, secondConfidence > 0 ? static_cast<ScalarType>(static_cast<int>(getClassLabel(secondIndex))) : CCCoreLib::NAN_VALUE);
+				secondConfidenceSF->setValue(i, static_cast<ScalarType>(secondConfidence));
+				entropySF->setValue(i, static_cast<ScalarType>(entropy / maxEntropy));
+				marginSF->setValue(i, static_cast<ScalarType>(probabilities[classIndex] - secondConfidence));
 			}
-		if (classIndex != -1)
-		{
-			float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-			cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
 		}
-		else
-			cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
+		confusion->merge(chunk);
 
-		if (pDlg && !nProgress.oneStep())
+		if (pDlg)
 		{
-			//process cancelled by the user
-			success = false;
-			break;
+			QMutexLocker locker(&progressMutex);
+			if (!nProgress.oneStep())
+			{
+				//process cancelled by the user
+				success = false;
+			}
 		}
 	}
 
-	classificationSF->computeMinAndMax();
-	cvConfidenceSF->computeMinAndMax();
+	ccLog::Print(QObject::tr("[3DMASC] %1 points classified in %2 s").arg(pointCount).arg(timer.elapsed() / 1000.0, 0, 'f', 1));
+	if (placement.isEnabled())
+	{
+		ccLog::Print("[3DMASC] " + placement.report());
+	}
+
+	{
+		//update the min and max values of all the output scalar fields in parallel
+		std::vector<CCCoreLib::ScalarField*> outputSFs{ classificationSF, cvConfidenceSF, secondClassSF, secondConfidenceSF, entropySF, marginSF };
+		outputSFs.insert(outputSFs.end(), probabilitySFs.begin(), probabilitySFs.end());
+		Feature::ComputeMinAndMax(outputSFs, m_executionContext);
+	}
 
 	//show the classification field by default
 	{
@@ -273,9 +490,22 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 		QCoreApplication::processEvents();
 	}
 
-	if (classifSFBackup != nullptr)
-		ConfusionMatrix *confusionMatrix = new ConfusionMatrix(*classifSFBackup, *classificationSF);
+	if (classifSFBackup != nullptr && success)
+	{
+		for (const QString& line : confusion->report())
+		{
+			ccLog::Print("[3DMASC] " + line);
+		}
+		if (parentWidget)
+		{
+			new ConfusionMatrix(*confusion);
+		}
+	}
 
+	if (!success)
+	{
+		errorMessage = QObject::tr("Process cancelled by the user");
+	}
 	return success;
 }
 
@@ -298,7 +528,7 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 	metrics.sampleCount = metrics.goodGuess = 0;
 	metrics.ratio = 0.0f;
 
-	if (!m_rtrees || !m_rtrees->isTrained())
+	if (!isValid())
 	{
 		errorMessage = QObject::tr("Classifier hasn't been trained yet");
 		return false;
@@ -314,6 +544,11 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		errorMessage = QObject::tr("Invalid test subset (associated point cloud is different)");
 		return false;
 	}
+	if (getVarCount() != static_cast<int>(featureSources.size()))
+	{
+		errorMessage = QObject::tr("The classifier expects %1 feature(s) (%2 provided)").arg(getVarCount()).arg(featureSources.size());
+		return false;
+	}
 
 	//look for the classification field
 	CCCoreLib::ScalarField* classifSF = Tools::GetClassificationSF(testCloud);
@@ -354,15 +589,10 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 
 	ccLog::Print(QObject::tr("[3DMASC] Testing data: %1 samples with %2 feature(s)").arg(testSampleCount).arg(attributesPerSample));
 
-	//allocate the data matrix
+	//fill the data matrix
 	cv::Mat test_data;
-	try
+	if (!BuildDataMatrix(featureSources, testCloud, test_data, nullptr, errorMessage, testSubset))
 	{
-		test_data.create(static_cast<int>(testSampleCount), attributesPerSample, CV_32FC1);
-	}
-	catch (const cv::Exception& cvex)
-	{
-		errorMessage = cvex.msg.c_str();
 		return false;
 	}
 
@@ -374,97 +604,78 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		pDlg->show();
 		QCoreApplication::processEvents();
 	}
-	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), testSampleCount);
+	int classCount = getClassCount();
 
-	//fill the data matrix
-	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+	int blockCount = static_cast<int>((testSampleCount + BlockSize - 1) / BlockSize);
+	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), blockCount);
+	QMutex progressMutex;
+
+	//estimate the efficiency of the classifier
+	//(each block of samples is accumulated locally, then merged)
+	ConfusionAccumulator confusion;
+	std::atomic<bool> cancelled(false); //read and written by the worker threads
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(m_executionContext.threadCount()) schedule(dynamic)
+#endif
+#endif
+	for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
 	{
-		const Feature::Source& fs = featureSources[fIndex];
-		IScalarFieldWrapper::Shared source = GetSource(fs, testCloud);
-		if (!source || !source->isValid())
+		if (cancelled)
 		{
-			assert(false);
-			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
-			return false;
+			continue;
 		}
 
-		for (unsigned i = 0; i < testSampleCount; ++i)
+		ConfusionAccumulator::Chunk chunk;
+		std::vector<float> probabilities(classCount);
+		std::vector<int> votes(classCount);
+
+		unsigned firstIndex = static_cast<unsigned>(blockIndex) * BlockSize;
+		unsigned lastIndex = std::min(firstIndex + BlockSize, testSampleCount);
+		for (unsigned i = firstIndex; i < lastIndex; ++i)
 		{
 			unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(i) : i);
-			double value = source->pointValue(pointIndex);
-			test_data.at<float>(i, fIndex) = static_cast<float>(value);
-		}
-	}
-
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
+			int iClass = static_cast<int>(classifSF->getValue(pointIndex));
 
-	//estimate the efficiency of the classifier
-	std::vector<ScalarType> actualClass(testSampleCount);
-	std::vector<ScalarType> predictectedClass(testSampleCount);
-	{
-		metrics.sampleCount = testSampleCount;
-		metrics.goodGuess = 0;
+			int classIndex = predictProbabilities(test_data.ptr<float>(i), probabilities.data(), votes.data());
+			int iPredictedClass = static_cast<int>(getClassLabel(classIndex));
+			chunk.add(iClass, iPredictedClass);
 
-		for (unsigned i = 0; i < testSampleCount; ++i)
-		{
-			unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(i) : i);
-			ScalarType pointClass = classifSF->getValue(pointIndex);
-			int iClass = static_cast<int>(pointClass);
-			//if (iClass < 0 || iClass > 255)
-			//{
-			//	errorMessage = QObject::tr("Classification values out of range (0-255)");
-			//	return false;
-			//}
-
-			float fPredictedClass = m_rtrees->predict(test_data.row(i), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-			int iPredictedClass = static_cast<int>(fPredictedClass);
-			actualClass.at(i) = iClass;
-			predictectedClass.at(i) = iPredictedClass;
-			if (iPredictedClass == iClass)
-			{
-				++metrics.goodGuess;
-			}
 			if (outSF)
 			{
 				outSF->setValue(pointIndex, static_cast<ScalarType>(iPredictedClass));
 				if (cvConfidenceSF)
 				{
-					// compute the confidence
-					cv::Mat result;
-					m_rtrees->getVotes(test_data.row(i), result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-					int classIndex = -1;
-					for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-						if (iPredictedClass == result.at<int>(0, col))
-						{
-							classIndex = col;
-							break;
-						}
-					if (classIndex != -1)
-					{
-						float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-						cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
-					}
-					else
-						cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
+					cvConfidenceSF->setValue(pointIndex, static_cast<ScalarType>(probabilities[classIndex])); // compute the confidence
 				}
 			}
+		}
+		confusion.merge(chunk);
 
-			if (pDlg && !nProgress.oneStep())
+		if (pDlg)
+		{
+			QMutexLocker locker(&progressMutex);
+			if (!nProgress.oneStep())
 			{
 				//process cancelled by the user
-				return false;
+				cancelled = true;
 			}
 		}
+	}
 
-		if (outSF)
-			outSF->computeMinAndMax();
-		if (cvConfidenceSF)
-			cvConfidenceSF->computeMinAndMax();
-
-		metrics.ratio = static_cast<float>(metrics.goodGuess) / metrics.sampleCount;
+	if (cancelled)
+	{
+		errorMessage = QObject::tr("Process cancelled by the user");
+		return false;
 	}
 
-	train3DMASCDialog.addConfusionMatrixAndSaveTraces(new ConfusionMatrix(actualClass, predictectedClass));
+	Feature::ComputeMinAndMax({ outSF, cvConfidenceSF }, m_executionContext);
+
+	metrics.sampleCount = testSampleCount;
+	metrics.goodGuess = static_cast<unsigned>(confusion.goodGuessCount());
+	metrics.ratio = static_cast<float>(metrics.goodGuess) / metrics.sampleCount;
+
+	train3DMASCDialog.addConfusionMatrixAndSaveTraces(new ConfusionMatrix(confusion));
 
 	//show the Classification_prediction field by default
 	if (outSF)
@@ -489,7 +700,8 @@ bool Classifier::train(	const ccPointCloud* cloud,
 						QString& errorMessage,
 						CCCoreLib::ReferenceCloud* trainSubset/*=nullptr*/,
 						ccMainAppInterface* app/*=nullptr*/,
-						QWidget* parentWidget/*=nullptr*/)
+						QWidget* parentWidget/*=nullptr*/,
+						bool warmStart/*=false*/)
 {
 	if (featureSources.empty())
 	{
@@ -517,6 +729,30 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		return false;
 	}
 
+	if (warmStart && (params.model != ModelType::RandomForest || m_modelType != ModelType::RandomForest))
+	{
+		//boosted trees can't be grown or truncated
+		warmStart = false;
+	}
+
+	if (warmStart && isValid())
+	{
+		int trainedTreeCount = getTrainedTreeCount();
+		if (params.maxTreeCount <= trainedTreeCount)
+		{
+			//no need to extract the training data, the forest only has to be truncated
+			if (app)
+			{
+				app->dispToConsole(QString("[3DMASC] Warm start: %1 tree(s) kept out of %2").arg(params.maxTreeCount).arg(trainedTreeCount));
+			}
+			return trainOnMatrix(params, cv::Mat(), cv::Mat(), errorMessage, cv::Mat(), true);
+		}
+		else if (app)
+		{
+			app->dispToConsole(QString("[3DMASC] Warm start: training %1 additional tree(s)").arg(params.maxTreeCount - trainedTreeCount));
+		}
+	}
+
 	int sampleCount = static_cast<int>(trainSubset ? trainSubset->size() : cloud->size());
 	int attributesPerSample = static_cast<int>(featureSources.size());
 
@@ -526,55 +762,11 @@ bool Classifier::train(	const ccPointCloud* cloud,
 	}
 
 	cv::Mat training_data, train_labels;
-	try
-	{
-		training_data.create(sampleCount, attributesPerSample, CV_32FC1);
-		train_labels.create(sampleCount, 1, CV_32FC1);
-	}
-	catch (const cv::Exception& cvex)
+	if (!BuildDataMatrix(featureSources, cloud, training_data, &train_labels, errorMessage, trainSubset))
 	{
-		errorMessage = cvex.msg.c_str();
 		return false;
 	}
 
-	//fill the classification labels vector
-	{
-		for (int i = 0; i < sampleCount; ++i)
-		{
-			int pointIndex = (trainSubset ? static_cast<int>(trainSubset->getPointGlobalIndex(i)) : i);
-			ScalarType pointClass = classifSF->getValue(pointIndex);
-			int iClass = static_cast<int>(pointClass);
-			//if (iClass < 0 || iClass > 255)
-			//{
-			//	errorMessage = QObject::tr("Classification values out of range (0-255)");
-			//	return false;
-			//}
-
-			train_labels.at<float>(i) = static_cast<unsigned char>(iClass);
-		}
-	}
-
-	//fill the training data matrix
-	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
-	{
-		const Feature::Source& fs = featureSources[fIndex];
-
-		IScalarFieldWrapper::Shared source = GetSource(fs, cloud);
-		if (!source || !source->isValid())
-		{
-			assert(false);
-			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
-			return false;
-		}
-
-		for (int i = 0; i < sampleCount; ++i)
-		{
-			int pointIndex = (trainSubset ? static_cast<int>(trainSubset->getPointGlobalIndex(i)) : i);
-			double value = source->pointValue(pointIndex);
-			training_data.at<float>(i, fIndex) = static_cast<float>(value);
-		}
-	}
-
 	QScopedPointer<QProgressDialog> pDlg;
 	if (parentWidget)
 	{
@@ -585,61 +777,10 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		QCoreApplication::processEvents();
 	}
 
-	m_rtrees = cv::ml::RTrees::create();
-	m_rtrees->setMaxDepth(params.maxDepth);
-	m_rtrees->setMinSampleCount(params.minSampleCount);
-	m_rtrees->setRegressionAccuracy(0);
-    // If true then surrogate splits will be built. These splits allow to work with missing data and compute variable importance correctly. Default value is false.
-	m_rtrees->setUseSurrogates(false);
-	m_rtrees->setPriors(cv::Mat());
-	//m_rtrees->setMaxCategories(params.maxCategories); //not important?
-	m_rtrees->setCalculateVarImportance(true);
-	m_rtrees->setActiveVarCount(params.activeVarCount);
-	cv::TermCriteria terminationCriteria(cv::TermCriteria::MAX_ITER, params.maxTreeCount, std::numeric_limits<double>::epsilon());
-	m_rtrees->setTermCriteria(terminationCriteria);
-
 	QFuture<bool> future = QtConcurrent::run([&]()
 	{
 		// Code in this block will run in another thread
-		try
-		{
-			cv::Mat sampleIndexes = cv::Mat::zeros(1, training_data.rows, CV_8U);
-//			cv::Mat trainSamples = sampleIndexes.colRange(0, sampleCount);
-//			trainSamples.setTo(cv::Scalar::all(1));
-			
-			cv::Mat varTypes(training_data.cols + 1, 1, CV_8U);
-			varTypes.setTo(cv::Scalar::all(cv::ml::VAR_ORDERED));
-			varTypes.at<uchar>(training_data.cols) = cv::ml::VAR_CATEGORICAL;
-			
-			cv::Ptr<cv::ml::TrainData> trainData = cv::ml::TrainData::create(training_data, cv::ml::ROW_SAMPLE, train_labels,  /* samples layout responses */
-																			 cv::noArray(), sampleIndexes, /* varIdx sampleIdx */
-																			 cv::noArray(), varTypes); // sampleWeights varType
-
-			bool success = m_rtrees->train(trainData);
-			if (!success || !m_rtrees->isClassifier())
-			{
-				errorMessage = "Training failed";
-				return false;
-			}
-		}
-		catch (const cv::Exception& cvex)
-		{
-			m_rtrees.release();
-			errorMessage = cvex.msg.c_str();
-			return false;
-		}
-		catch (const std::exception& stdex)
-		{
-			errorMessage = stdex.what();
-			return false;
-		}
-		catch (...)
-		{
-			errorMessage = QObject::tr("Unknown error");
-			return false;
-		}
-
-		return true;
+		return trainOnMatrix(params, training_data, train_labels, errorMessage, cv::Mat(), warmStart);
 	});
 
 	while (!future.isFinished())
@@ -672,19 +813,369 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		QCoreApplication::processEvents();
 	}
 
-	if (future.isCanceled() || !future.result() || !m_rtrees->isTrained())
+	if (future.isCanceled() || !future.result() || !isValid())
 	{
-		errorMessage = QObject::tr("Training failed for an unknown reason...");
-		m_rtrees.release();
+		if (errorMessage.isEmpty())
+			errorMessage = QObject::tr("Training failed for an unknown reason...");
+		reset();
 		return false;
 	}
 
 	return true;
 }
 
-bool Classifier::toFile(QString filename, QWidget* parentWidget/*=nullptr*/) const
+bool Classifier::BuildDataMatrix(	const Feature::Source::Set& featureSources,
+									const ccPointCloud* cloud,
+									cv::Mat& data,
+									cv::Mat* labels,
+									QString& errorMessage,
+									const CCCoreLib::ReferenceCloud* subset/*=nullptr*/)
 {
-	if (!m_rtrees)
+	if (!cloud)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid input cloud");
+		return false;
+	}
+	if (featureSources.empty())
+	{
+		errorMessage = QObject::tr("Can't build a data matrix without any feature (source)");
+		return false;
+	}
+	if (subset && subset->getAssociatedCloud() != cloud)
+	{
+		errorMessage = QObject::tr("Invalid subset (associated point cloud is different)");
+		return false;
+	}
+
+	//look for the classification field
+	CCCoreLib::ScalarField* classifSF = nullptr;
+	if (labels)
+	{
+		classifSF = Tools::GetClassificationSF(cloud);
+		if (!classifSF || classifSF->size() < cloud->size())
+		{
+			assert(false);
+			errorMessage = QObject::tr("Missing/invalid 'Classification' field on input cloud");
+			return false;
+		}
+	}
+
+	int sampleCount = static_cast<int>(subset ? subset->size() : cloud->size());
+	int attributesPerSample = static_cast<int>(featureSources.size());
+
+	try
+	{
+		data.create(sampleCount, attributesPerSample, CV_32FC1);
+		if (labels)
+		{
+			labels->create(sampleCount, 1, CV_32FC1);
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		return false;
+	}
+
+	//fill the classification labels vector
+	if (labels)
+	{
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			int pointIndex = (subset ? static_cast<int>(subset->getPointGlobalIndex(i)) : i);
+			ScalarType pointClass = classifSF->getValue(pointIndex);
+			int iClass = static_cast<int>(pointClass);
+			labels->at<float>(i) = static_cast<unsigned char>(iClass);
+		}
+	}
+
+	//fill the data matrix
+	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+	{
+		const Feature::Source& fs = featureSources[fIndex];
+		IScalarFieldWrapper::Shared source = GetSource(fs, cloud);
+		if (!source || !source->isValid())
+		{
+			assert(false);
+			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
+			return false;
+		}
+
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			int pointIndex = (subset ? static_cast<int>(subset->getPointGlobalIndex(i)) : i);
+			double value = source->pointValue(pointIndex);
+			data.at<float>(i, fIndex) = static_cast<float>(value);
+		}
+	}
+
+	return true;
+}
+
+bool Classifier::trainOnMatrix(	const RandomTreesParams& params,
+								const cv::Mat& data,
+								const cv::Mat& labels,
+								QString& errorMessage,
+								const cv::Mat& sampleIdx/*=cv::Mat()*/,
+								bool warmStart/*=false*/)
+{
+	if (params.model == ModelType::GradientBoosting)
+	{
+		if (data.empty() || data.rows != labels.rows)
+		{
+			assert(false);
+			errorMessage = QObject::tr("Invalid training data");
+			return false;
+		}
+
+		//no warm start: each iteration depends on all the previous ones
+		GradientBoostedTrees boostedTrees;
+		if (!boostedTrees.train(params, data, labels, errorMessage, sampleIdx, m_executionContext))
+		{
+			return false;
+		}
+
+		reset();
+		m_modelType = ModelType::GradientBoosting;
+		m_boostedTrees = std::move(boostedTrees);
+		return true;
+	}
+
+	int trainedTreeCount = 0;
+	if (warmStart && isValid() && m_modelType == ModelType::RandomForest && !isCompacted())
+	{
+		trainedTreeCount = getTrainedTreeCount();
+		if (params.maxTreeCount <= trainedTreeCount)
+		{
+			//we simply keep the first trees
+			int remainingTreeCount = params.maxTreeCount;
+			for (size_t i = 0; i < m_forests.size(); ++i)
+			{
+				m_treeCounts[i] = std::min(static_cast<int>(m_forests[i]->getRoots().size()), remainingTreeCount);
+				remainingTreeCount -= m_treeCounts[i];
+			}
+			return updateFlatForest(errorMessage);
+		}
+	}
+	else
+	{
+		warmStart = false;
+	}
+
+	if (data.empty() || data.rows != labels.rows)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid training data");
+		return false;
+	}
+
+	try
+	{
+		cv::Ptr<cv::ml::RTrees> rtrees = cv::ml::RTrees::create();
+		rtrees->setMaxDepth(params.maxDepth);
+		rtrees->setMinSampleCount(params.minSampleCount);
+		rtrees->setRegressionAccuracy(0);
+		// If true then surrogate splits will be built. These splits allow to work with missing data and compute variable importance correctly. Default value is false.
+		rtrees->setUseSurrogates(false);
+		rtrees->setPriors(cv::Mat());
+		//rtrees->setMaxCategories(params.maxCategories); //not important?
+		rtrees->setCalculateVarImportance(true);
+		rtrees->setActiveVarCount(params.activeVarCount);
+		int treeCount = params.maxTreeCount - trainedTreeCount; //only the missing trees in case of a warm start
+		cv::TermCriteria terminationCriteria(cv::TermCriteria::MAX_ITER, treeCount, std::numeric_limits<double>::epsilon());
+		rtrees->setTermCriteria(terminationCriteria);
+
+		if (warmStart)
+		{
+			//OpenCV draws the bootstrap samples and the active variables with the default (per-thread) RNG:
+			//we must make sure that the new trees won't simply replicate the previous ones
+			cv::theRNG().state = static_cast<uint64>(0x3DA5C) + static_cast<uint64>(trainedTreeCount);
+		}
+
+		cv::Mat sampleIndexes = sampleIdx.empty() ? cv::Mat::zeros(1, data.rows, CV_8U) : sampleIdx;
+
+		cv::Mat varTypes(data.cols + 1, 1, CV_8U);
+		varTypes.setTo(cv::Scalar::all(cv::ml::VAR_ORDERED));
+		varTypes.at<uchar>(data.cols) = cv::ml::VAR_CATEGORICAL;
+
+		cv::Ptr<cv::ml::TrainData> trainData = cv::ml::TrainData::create(data, cv::ml::ROW_SAMPLE, labels,  /* samples layout responses */
+																		 cv::noArray(), sampleIndexes, /* varIdx sampleIdx */
+																		 cv::noArray(), varTypes); // sampleWeights varType
+
+		bool success = rtrees->train(trainData);
+		if (!success || !rtrees->isClassifier())
+		{
+			errorMessage = "Training failed";
+			return false;
+		}
+
+		if (warmStart)
+		{
+			//all the trees are used again
+			for (size_t i = 0; i < m_forests.size(); ++i)
+			{
+				m_treeCounts[i] = static_cast<int>(m_forests[i]->getRoots().size());
+			}
+		}
+		else
+		{
+			reset();
+		}
+		m_forests.push_back(rtrees);
+		m_treeCounts.push_back(static_cast<int>(rtrees->getRoots().size()));
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		return false;
+	}
+	catch (const std::exception& stdex)
+	{
+		errorMessage = stdex.what();
+		return false;
+	}
+	catch (...)
+	{
+		errorMessage = QObject::tr("Unknown error");
+		return false;
+	}
+
+	return updateFlatForest(errorMessage);
+}
+
+bool Classifier::updateFlatForest(QString& errorMessage)
+{
+	//the compiled forest doesn't match the model anymore
+	m_compiledForest.unload();
+
+	if (!m_flatForest.build(m_forests, m_treeCounts, errorMessage))
+	{
+		m_flatForest.clear();
+		return false;
+	}
+	return true;
+}
+
+void Classifier::reset()
+{
+	m_modelType = ModelType::RandomForest;
+	m_forests.clear();
+	m_treeCounts.clear();
+	m_flatForest.clear();
+	m_compiledForest.unload();
+	m_compactedVarImportance.release();
+	m_boostedTrees.clear();
+}
+
+int Classifier::getTrainedTreeCount() const
+{
+	if (m_modelType == ModelType::GradientBoosting)
+	{
+		return m_boostedTrees.treeCount();
+	}
+	if (isCompacted())
+	{
+		return m_flatForest.treeCount();
+	}
+
+	int treeCount = 0;
+	for (const cv::Ptr<cv::ml::RTrees>& rtrees : m_forests)
+	{
+		treeCount += static_cast<int>(rtrees->getRoots().size());
+	}
+	return treeCount;
+}
+
+cv::Mat Classifier::getVarImportance() const
+{
+	if (m_modelType == ModelType::GradientBoosting)
+	{
+		return m_boostedTrees.getVarImportance();
+	}
+	if (isCompacted())
+	{
+		return m_compactedVarImportance;
+	}
+
+	if (m_forests.size() == 1)
+	{
+		return m_forests.front()->getVarImportance();
+	}
+
+	//weighted average (by the number of used trees)
+	cv::Mat importance;
+	int totalTreeCount = 0;
+	for (size_t i = 0; i < m_forests.size(); ++i)
+	{
+		if (m_treeCounts[i] == 0)
+			continue;
+
+		cv::Mat forestImportance;
+		m_forests[i]->getVarImportance().convertTo(forestImportance, CV_32F, m_treeCounts[i]);
+		if (importance.empty())
+			importance = forestImportance;
+		else
+			importance += forestImportance;
+		totalTreeCount += m_treeCounts[i];
+	}
+	if (totalTreeCount != 0)
+	{
+		importance /= totalTreeCount;
+	}
+
+	return importance;
+}
+
+float Classifier::predict(const cv::Mat& sample) const
+{
+	assert(sample.type() == CV_32F && sample.cols == getVarCount());
+
+	std::vector<float> probabilities(getClassCount());
+	std::vector<int> votes(getClassCount());
+	int classIndex = predictProbabilities(sample.ptr<float>(0), probabilities.data(), votes.data());
+
+	return getClassLabel(classIndex);
+}
+
+float Classifier::computeAccuracy(const cv::Mat& data, const cv::Mat& labels) const
+{
+	if (!isValid() || data.empty() || data.rows != labels.rows || data.cols != getVarCount())
+	{
+		assert(false);
+		return 0.0f;
+	}
+
+	std::vector<float> probabilities(getClassCount());
+	std::vector<int> votes(getClassCount());
+	int goodGuess = 0;
+	for (int i = 0; i < data.rows; ++i)
+	{
+		int classIndex = predictProbabilities(data.ptr<float>(i), probabilities.data(), votes.data());
+		if (static_cast<int>(getClassLabel(classIndex)) == static_cast<int>(labels.at<float>(i)))
+		{
+			++goodGuess;
+		}
+	}
+
+	return static_cast<float>(goodGuess) / data.rows;
+}
+
+//! Name of the nodes of the (incrementally grown) forests in a classifier file
+static std::string ForestNodeName(size_t index)
+{
+	return "masc_forest_" + std::to_string(index);
+}
+//! Name of the node storing the number of used trees of each forest in a classifier file
+static const char MASC_TREE_COUNTS_NODE[] = "masc_tree_counts";
+//! Name of the node storing the gradient boosted trees in a classifier file
+static const char MASC_GBT_NODE[] = "masc_gbt";
+//! Name of the node storing the compacted forest in a classifier file
+static const char MASC_COMPACT_FOREST_NODE[] = "masc_compact_forest";
+
+bool Classifier::toFile(QString filename, QWidget* parentWidget/*=nullptr*/) const
+{
+	if (!isValid())
 	{
 		ccLog::Warning(QObject::tr("Classifier hasn't been trained, can't save it"));
 		return false;
@@ -698,7 +1189,56 @@ bool Classifier::toFile(QString filename, QWidget* parentWidget/*=nullptr*/) con
 	QCoreApplication::processEvents();
 
 	cv::String cvFilename = filename.toStdString();
-	m_rtrees->save(cvFilename);
+	try
+	{
+		if (m_modelType == ModelType::GradientBoosting)
+		{
+			cv::FileStorage fs(cvFilename, cv::FileStorage::WRITE);
+			fs << MASC_GBT_NODE << "{";
+			m_boostedTrees.write(fs);
+			fs << "}";
+			fs.release();
+		}
+		else if (isCompacted())
+		{
+			cv::FileStorage fs(cvFilename, cv::FileStorage::WRITE);
+			fs << MASC_COMPACT_FOREST_NODE << "{";
+			m_flatForest.write(fs);
+			if (!m_compactedVarImportance.empty())
+			{
+				fs << "var_importance" << m_compactedVarImportance;
+			}
+			fs << "}";
+			fs.release();
+		}
+		else if (m_forests.size() == 1 && m_treeCounts.front() == static_cast<int>(m_forests.front()->getRoots().size()))
+		{
+			//standard OpenCV format
+			m_forests.front()->save(cvFilename);
+		}
+		else
+		{
+			//grown or truncated forest: all the (used) forests are saved in the same file
+			cv::FileStorage fs(cvFilename, cv::FileStorage::WRITE);
+			std::vector<int> treeCounts;
+			for (size_t i = 0; i < m_forests.size(); ++i)
+			{
+				if (m_treeCounts[i] == 0)
+					continue;
+				fs << ForestNodeName(treeCounts.size()) << "{";
+				m_forests[i]->write(fs);
+				fs << "}";
+				treeCounts.push_back(m_treeCounts[i]);
+			}
+			fs << MASC_TREE_COUNTS_NODE << treeCounts;
+			fs.release();
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		ccLog::Warning(cvex.msg.c_str());
+		return false;
+	}
 	
 	pDlg.close();
 	QCoreApplication::processEvents();
@@ -720,9 +1260,54 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		QCoreApplication::processEvents();
 	}
 	
+	reset();
+
+	QString errorMessage;
 	try
 	{
-		m_rtrees = cv::ml::RTrees::load(filename.toStdString());
+		cv::FileStorage fs(filename.toStdString(), cv::FileStorage::READ);
+		cv::FileNode gbtNode = fs[MASC_GBT_NODE];
+		cv::FileNode treeCountsNode = fs[MASC_TREE_COUNTS_NODE];
+		cv::FileNode compactForestNode = fs[MASC_COMPACT_FOREST_NODE];
+		if (!gbtNode.empty())
+		{
+			//gradient boosted trees
+			if (!m_boostedTrees.read(gbtNode, errorMessage))
+			{
+				ccLog::Error(QObject::tr("Loaded classifier is invalid") + " (" + errorMessage + ")");
+				return false;
+			}
+			m_modelType = ModelType::GradientBoosting;
+		}
+		else if (!compactForestNode.empty())
+		{
+			//compacted forest
+			if (!m_flatForest.read(compactForestNode, errorMessage))
+			{
+				ccLog::Error(QObject::tr("Loaded classifier is invalid") + " (" + errorMessage + ")");
+				return false;
+			}
+			compactForestNode["var_importance"] >> m_compactedVarImportance;
+		}
+		else if (treeCountsNode.empty())
+		{
+			//standard OpenCV format
+			cv::Ptr<cv::ml::RTrees> rtrees = cv::ml::RTrees::create();
+			rtrees->read(fs.getFirstTopLevelNode());
+			m_forests.push_back(rtrees);
+			m_treeCounts.push_back(static_cast<int>(rtrees->getRoots().size()));
+		}
+		else
+		{
+			//grown or truncated forest
+			treeCountsNode >> m_treeCounts;
+			for (size_t i = 0; i < m_treeCounts.size(); ++i)
+			{
+				cv::Ptr<cv::ml::RTrees> rtrees = cv::ml::RTrees::create();
+				rtrees->read(fs[ForestNodeName(i)]);
+				m_forests.push_back(rtrees);
+			}
+		}
 	}
 	catch (const cv::Exception& cvex)
 	{
@@ -737,15 +1322,171 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		QCoreApplication::processEvents();
 	}
 
-	if (m_rtrees->empty() || !m_rtrees->isClassifier())
+	if (m_modelType == ModelType::GradientBoosting)
+	{
+		return true;
+	}
+
+	if (!isCompacted())
+	{
+		for (const cv::Ptr<cv::ml::RTrees>& rtrees : m_forests)
+		{
+			if (rtrees->empty() || !rtrees->isClassifier())
+			{
+				ccLog::Error(QObject::tr("Loaded classifier is invalid"));
+				return false;
+			}
+			else if (!rtrees->isTrained())
+			{
+				ccLog::Warning(QObject::tr("Loaded classifier doesn't seem to be trained"));
+				return true;
+			}
+		}
+
+		if (m_forests.empty() || !updateFlatForest(errorMessage))
+		{
+			ccLog::Error(QObject::tr("Loaded classifier is invalid") + (errorMessage.isEmpty() ? QString() : " (" + errorMessage + ")"));
+			return false;
+		}
+	}
+
+	//the compiled version of the forest (if any) is only loaded on demand (see loadCompiled)
+	m_modelDirectory = QFileInfo(filename).absolutePath();
+
+	return true;
+}
+
+bool Classifier::loadCompiled(QString& errorMessage)
+{
+	if (m_modelType != ModelType::RandomForest || !m_flatForest.isValid())
+	{
+		errorMessage = QObject::tr("Only trained random forests can be compiled");
+		return false;
+	}
+	if (m_modelDirectory.isEmpty())
+	{
+		errorMessage = QObject::tr("The classifier must be loaded from a file first");
+		return false;
+	}
+	if (m_compiledForest.isLoaded())
+	{
+		//already loaded
+		return true;
+	}
+
+	if (!m_compiledForest.load(m_flatForest, m_modelDirectory, errorMessage))
+	{
+		if (errorMessage.isEmpty())
+		{
+			errorMessage = QObject::tr("Compiled forest not found (%1)").arg(CompiledForest::LibraryFilename(m_flatForest, m_modelDirectory));
+		}
+		return false;
+	}
+
+	ccLog::Print(QObject::tr("[3DMASC] Compiled forest loaded: %1").arg(CompiledForest::LibraryFilename(m_flatForest, m_modelDirectory)));
+	return true;
+}
+
+bool Classifier::compact(std::vector<int>& keptVarIndexes, CompactionReport& report, QString& errorMessage)
+{
+	keptVarIndexes.clear();
+
+	if (m_modelType != ModelType::RandomForest || !isValid())
 	{
-		ccLog::Error(QObject::tr("Loaded classifier is invalid"));
+		errorMessage = QObject::tr("Only trained random forests can be compacted");
 		return false;
 	}
-	else if (!m_rtrees->isTrained())
+
+	FlatForest forest = m_flatForest;
+	report.nodeCountBefore = forest.nodeCount();
+	report.varCountBefore = forest.varCount();
+	report.pathLengthBefore = forest.expectedPathLength();
+
+	if (!forest.compact(errorMessage))
 	{
-		ccLog::Warning(QObject::tr("Loaded classifier doesn't seem to be trained"));
+		return false;
+	}
+
+	//remove the features that are not used anymore
+	std::vector<int> splitCounts = forest.varSplitCounts();
+	std::vector<int> newVarIndexes(splitCounts.size(), -1);
+	for (size_t v = 0; v < splitCounts.size(); ++v)
+	{
+		if (splitCounts[v] != 0)
+		{
+			newVarIndexes[v] = static_cast<int>(keptVarIndexes.size());
+			keptVarIndexes.push_back(static_cast<int>(v));
+		}
+	}
+	if (keptVarIndexes.empty())
+	{
+		errorMessage = QObject::tr("The forest doesn't use any feature");
+		return false;
+	}
+	if (!forest.remapVars(newVarIndexes, static_cast<int>(keptVarIndexes.size()), errorMessage))
+	{
+		keptVarIndexes.clear();
+		return false;
+	}
+
+	//the variable importance must be kept as the OpenCV trees are released
+	cv::Mat importance = getVarImportance();
+	cv::Mat compactedImportance;
+	if (importance.total() == splitCounts.size())
+	{
+		importance.convertTo(importance, CV_32F);
+		compactedImportance.create(static_cast<int>(keptVarIndexes.size()), 1, CV_32F);
+		for (size_t i = 0; i < keptVarIndexes.size(); ++i)
+		{
+			compactedImportance.at<float>(static_cast<int>(i)) = importance.at<float>(keptVarIndexes[i]);
+		}
+	}
+
+	m_forests.clear();
+	m_treeCounts.clear();
+	m_compiledForest.unload();
+	m_flatForest = std::move(forest);
+	m_compactedVarImportance = compactedImportance;
+
+	report.nodeCountAfter = m_flatForest.nodeCount();
+	report.varCountAfter = m_flatForest.varCount();
+	report.pathLengthAfter = m_flatForest.expectedPathLength();
+
+	return true;
+}
+
+bool Classifier::compile(QString& errorMessage)
+{
+	if (m_modelType != ModelType::RandomForest || !m_flatForest.isValid())
+	{
+		errorMessage = QObject::tr("Only trained random forests can be compiled");
+		return false;
+	}
+	if (m_modelDirectory.isEmpty())
+	{
+		errorMessage = QObject::tr("The classifier must be loaded from a file first");
+		return false;
+	}
+	if (m_compiledForest.isLoaded())
+	{
+		//already compiled
+		return true;
+	}
+
+	ccLog::Print(QObject::tr("[3DMASC] Compiling the forest (%1 trees, %2 nodes)").arg(m_flatForest.treeCount()).arg(m_flatForest.nodeCount()));
+	if (!CompiledForest::Build(m_flatForest, m_modelDirectory, errorMessage))
+	{
+		return false;
+	}
+	if (!m_compiledForest.load(m_flatForest, m_modelDirectory, errorMessage))
+	{
+		if (errorMessage.isEmpty())
+		{
+			errorMessage = QObject::tr("Compiled forest not found");
+		}
+		return false;
 	}
 
+	ccLog::Print(QObject::tr("[3DMASC] Compiled forest: %1").arg(CompiledForest::LibraryFilename(m_flatForest, m_modelDirectory)));
 	return true;
 }
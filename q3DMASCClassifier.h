@@ -19,7 +19,11 @@
 
 //Local
 #include "Parameters.h"
+#include "ExecutionContext.h"
 #include "FeaturesInterface.h"
+#include "FlatForest.h"
+#include "CompiledForest.h"
+#include "GradientBoostedTrees.h"
 
 //Qt
 #include <QString>
@@ -38,6 +42,8 @@ class Train3DMASCDialog;
 //! 3DMASC classifier
 namespace masc
 {
+	class ConfusionAccumulator;
+
 	class Classifier
 	{
 	public:
@@ -46,13 +52,19 @@ namespace masc
 		Classifier();
 
 		//! Train the classifier
+		/** The model type is given by params.model.
+			\param warmStart if true (and if the classifier is already trained with the same features,
+			samples and parameters, except the number of trees), the existing trees are kept and only
+			the missing ones are trained (or the forest is simply truncated). Random trees only.
+		**/
 		bool train(	const ccPointCloud* cloud,
 					const RandomTreesParams& params,
 					const Feature::Source::Set& featureSources,
 					QString& errorMessage,
 					CCCoreLib::ReferenceCloud* trainSubset = nullptr,
 					ccMainAppInterface* app = nullptr,
-					QWidget* parentWidget = nullptr);
+					QWidget* parentWidget = nullptr,
+					bool warmStart = false);
 
 		//! Classifier accuracy metrics
 		struct AccuracyMetrics
@@ -72,26 +84,182 @@ namespace masc
 						QString outputSFName = QString(),
 						QWidget* parentWidget = nullptr);
 
+		//! Optional probability outputs (can be combined)
+		enum ProbabilityOutput
+		{
+			NoProbability		= 0,
+			ClassProbabilities	= 1,	//!< one scalar field per class (fraction of the votes, or softmax of the scores for boosted trees)
+			Top2Probabilities	= 2,	//!< second best class and its probability, entropy and margin
+		};
+
 		//! Applies the classifier
+		/** If the cloud already has a classification field, it is compared with the new one.
+			The probabilities are computed from the same single traversal of the trees as the classification.
+			\param confusion if not null, receives the corresponding confusion counts
+			\param probabilityOutputs optional probability scalar fields (see ProbabilityOutput)
+		**/
 		bool classify(	const Feature::Source::Set& featureSources,
 						ccPointCloud* cloud,
 						QString& errorMessage,
-						QWidget* parentWidget = nullptr);
+						QWidget* parentWidget = nullptr,
+						ConfusionAccumulator* confusion = nullptr,
+						int probabilityOutputs = NoProbability);
 
 		//! Returns whether the classifier is valid or not
 		bool isValid() const;
 
+		//! Sets the execution context of the classification/evaluation loops
+		inline void setExecutionContext(const ExecutionContext& context) { m_executionContext = context; }
+		//! Returns the execution context of the classification/evaluation loops
+		inline const ExecutionContext& getExecutionContext() const { return m_executionContext; }
+
+		//! Sets whether the random forests should be applied in quantized mode (see FlatForest::buildQuantization)
+		/** The feature values are encoded as 8 or 16 bits codes and the trees are traversed with
+			integer comparisons, block by block. The predictions are identical.
+		**/
+		inline void setQuantizedInference(bool state) { m_quantizedInference = state; }
+
 		//! Saves the classifier to file
 		bool toFile(QString filename, QWidget* parentWidget = nullptr) const;
 		//! Loads the classifier from file
+		/** The compiled version of the forest is never loaded automatically (see loadCompiled).
+		**/
 		bool fromFile(QString filename, QWidget* parentWidget = nullptr);
 
-		inline cv::Mat getVarImportance() const { return m_rtrees->getVarImportance(); }
+		//! Generates, builds and loads the compiled version of the forest (random trees only)
+		/** The library is written in the directory of the classifier file, and can be
+			loaded again later with loadCompiled (as long as the model doesn't change).
+		**/
+		bool compile(QString& errorMessage);
+
+		//! Loads the compiled version of the forest previously built next to the classifier file (see compile)
+		/** \warning The library is native code: it should only be loaded on the explicit request
+			of the user, from a trusted directory (the model hash doesn't authenticate it).
+		**/
+		bool loadCompiled(QString& errorMessage);
+
+		//! Returns whether the compiled version of the forest is used for prediction
+		inline bool isCompiled() const { return m_modelType == ModelType::RandomForest && m_compiledForest.isLoaded(); }
+
+		//! Compaction report (see compact)
+		struct CompactionReport
+		{
+			size_t nodeCountBefore = 0;
+			size_t nodeCountAfter = 0;
+			int varCountBefore = 0;
+			int varCountAfter = 0;
+			//! Expected number of comparisons per tree before compaction
+			double pathLengthBefore = 0.0;
+			//! Expected number of comparisons per tree after compaction
+			double pathLengthAfter = 0.0;
+
+			//! Returns the predicted speedup of the prediction
+			inline double speedup() const { return pathLengthAfter > 0.0 ? pathLengthBefore / pathLengthAfter : 1.0; }
+		};
+
+		//! Compacts the random forest (typically before saving it)
+		/** The redundant nodes are removed (see FlatForest::compact), as well as the features that
+			are never used by the trees. The OpenCV trees are released: a compacted classifier can't
+			be grown anymore (warm start).
+			\param keptVarIndexes original indexes of the remaining features (in order)
+		**/
+		bool compact(std::vector<int>& keptVarIndexes, CompactionReport& report, QString& errorMessage);
+
+		//! Returns whether the classifier is a compacted random forest
+		inline bool isCompacted() const { return m_modelType == ModelType::RandomForest && m_forests.empty() && m_flatForest.isValid(); }
+
+		//! Returns the model type
+		inline ModelType getModelType() const { return m_modelType; }
+
+		//! Returns the variable importance (weighted by the number of trees if the forest has been grown several times)
+		cv::Mat getVarImportance() const;
+
+		//! Returns the total number of nodes of the model
+		inline size_t getNodeCount() const { return m_modelType == ModelType::GradientBoosting ? m_boostedTrees.nodeCount() : m_flatForest.nodeCount(); }
+
+		//! Returns the flat version of the forest (used for prediction, random trees only)
+		inline const FlatForest& getFlatForest() const { return m_flatForest; }
+		//! Returns the gradient boosted trees (gradient boosting only)
+		inline const GradientBoostedTrees& getBoostedTrees() const { return m_boostedTrees; }
+
+		//! Returns the number of trees used for prediction
+		inline int getTreeCount() const { return m_modelType == ModelType::GradientBoosting ? m_boostedTrees.treeCount() : m_flatForest.treeCount(); }
+		//! Returns the number of trained trees (some may have been left out after a truncation)
+		int getTrainedTreeCount() const;
+
+		//! Returns the number of classes
+		inline int getClassCount() const { return m_modelType == ModelType::GradientBoosting ? m_boostedTrees.classCount() : m_flatForest.classCount(); }
+		//! Returns the label of a given class (index)
+		inline float getClassLabel(int classIndex) const { return m_modelType == ModelType::GradientBoosting ? m_boostedTrees.classLabel(classIndex) : m_flatForest.classLabel(classIndex); }
+		//! Returns the number of features expected by the classifier
+		inline int getVarCount() const { return m_modelType == ModelType::GradientBoosting ? m_boostedTrees.varCount() : m_flatForest.varCount(); }
+
+		//! Fills a data matrix (one row per sample, one column per feature source)
+		/** \param labels if not null, the classification labels are extracted as well
+			\param subset if not null, only the points of this subset are considered
+		**/
+		static bool BuildDataMatrix(const Feature::Source::Set& featureSources,
+									const ccPointCloud* cloud,
+									cv::Mat& data,
+									cv::Mat* labels,
+									QString& errorMessage,
+									const CCCoreLib::ReferenceCloud* subset = nullptr);
+
+		//! Trains the classifier on an already built data matrix
+		/** No GUI interaction (can be called from any thread).
+			\param sampleIdx if not empty, only these rows are used (CV_32S, the data matrix is not copied)
+		**/
+		bool trainOnMatrix(	const RandomTreesParams& params,
+							const cv::Mat& data,
+							const cv::Mat& labels,
+							QString& errorMessage,
+							const cv::Mat& sampleIdx = cv::Mat(),
+							bool warmStart = false);
+
+		//! Predicts the class of a single sample (row)
+		float predict(const cv::Mat& sample) const;
+
+		//! Returns the ratio of correctly classified samples of a data matrix
+		float computeAccuracy(const cv::Mat& data, const cv::Mat& labels) const;
 
 	protected:
 
+		//! Updates the flat version of the forest (after training or loading)
+		bool updateFlatForest(QString& errorMessage);
+
+		//! Computes the class probabilities of a single sample
+		/** Fraction of the votes for random trees, softmax of the scores for boosted trees.
+			\param votes working buffer (getClassCount() values)
+			\return the index of the predicted class
+		**/
+		int predictProbabilities(const float* sample, float* probabilities, int* votes) const;
+
+		//! Resets the classifier
+		void reset();
+
+		//! Model type
+		ModelType m_modelType = ModelType::RandomForest;
+
 		//! Random trees (OpenCV)
-		cv::Ptr<cv::ml::RTrees> m_rtrees;
+		/** Several forests if the classifier has been grown incrementally (warm start) **/
+		std::vector< cv::Ptr<cv::ml::RTrees> > m_forests;
+		//! Number of trees used for each forest (the last ones may be truncated)
+		std::vector<int> m_treeCounts;
+		//! Flat version of the (used) trees, for prediction
+		FlatForest m_flatForest;
+		//! Compiled version of the flat forest (if any)
+		CompiledForest m_compiledForest;
+		//! Directory of the classifier file (where the compiled forest is stored)
+		QString m_modelDirectory;
+		//! Variable importance of the compacted forest (the OpenCV trees are released)
+		cv::Mat m_compactedVarImportance;
+		//! Gradient boosted trees
+		GradientBoostedTrees m_boostedTrees;
+
+		//! Execution context (threads, etc.)
+		ExecutionContext m_executionContext;
+		//! Whether the random forests should be applied in quantized mode
+		bool m_quantizedInference = false;
 	};
 
 }; //namespace masc
@@ -22,6 +22,8 @@
 
 //Local
 #include "q3DMASCTools.h"
+#include "ConfusionAccumulator.h"
+#include "NumaPlacement.h"
 
 //qCC_db
 #include <ccProgressDialog.h>
@@ -34,6 +36,15 @@ static const char COMMAND_3DMASC_CLASSIFY[] = "3DMASC_CLASSIFY";
 static const char COMMAND_3DMASC_KEEP_ATTRIBS[] = "KEEP_ATTRIBUTES";
 static const char COMMAND_3DMASC_ONLY_FEATURES[] = "ONLY_FEATURES";
 static const char COMMAND_3DMASC_SKIP_FEATURES[] = "SKIP_FEATURES";
+static const char COMMAND_3DMASC_CONFUSION_MATRIX[] = "CONFUSION_MATRIX";
+static const char COMMAND_3DMASC_CLASS_PROBABILITIES[] = "CLASS_PROBABILITIES";
+static const char COMMAND_3DMASC_TOP2_PROBABILITIES[] = "TOP2_PROBABILITIES";
+static const char COMMAND_3DMASC_THREADS[] = "THREADS";
+static const char COMMAND_3DMASC_CHUNK_SIZE[] = "CHUNK_SIZE";
+static const char COMMAND_3DMASC_MIGRATE_OUTPUT_PAGES[] = "MIGRATE_OUTPUT_PAGES";
+static const char COMMAND_3DMASC_COMPILE_MODEL[] = "COMPILE_MODEL";
+static const char COMMAND_3DMASC_COMPILED_MODEL[] = "COMPILED_MODEL";
+static const char COMMAND_3DMASC_QUANTIZED[] = "QUANTIZED";
 
 struct Command3DMASCClassif : public ccCommandLineInterface::Command
 {
@@ -58,6 +69,12 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		bool onlyFeatures = false;
 		bool skipFeatures = false;
 		QString featureSourceFilename;
+		QString confusionMatrixFilename;
+		int probabilityOutputs = masc::Classifier::NoProbability;
+		masc::ExecutionContext context;
+		bool compileModel = false;
+		bool useCompiledModel = false;
+		bool quantizedInference = false;
 		while (true)
 		{
 			QString argument = cmd.arguments().front();
@@ -95,6 +112,89 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				//we only expect the classifier filename now
 				--minArgumentCount;
 			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_CLASS_PROBABILITIES))
+			{
+				probabilityOutputs |= masc::Classifier::ClassProbabilities;
+				cmd.print("Will output the probability of each class");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_TOP2_PROBABILITIES))
+			{
+				probabilityOutputs |= masc::Classifier::Top2Probabilities;
+				cmd.print("Will output the second best class, the entropy and the margin");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_THREADS))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				bool ok = false;
+				context.maxThreadCount = (cmd.arguments().empty() ? 0 : cmd.arguments().front().toInt(&ok));
+				if (!ok || context.maxThreadCount < 0)
+				{
+					return cmd.error(QString("Missing or invalid parameter: number of threads after \"-%1\" (0 = all the available ones but 2)").arg(COMMAND_3DMASC_THREADS));
+				}
+				cmd.arguments().pop_front();
+				cmd.print(QString("Number of threads: %1").arg(context.threadCount()));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_CHUNK_SIZE))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				bool ok = false;
+				context.chunkSize = (cmd.arguments().empty() ? 0 : cmd.arguments().front().toInt(&ok));
+				if (!ok || context.chunkSize < 0)
+				{
+					return cmd.error(QString("Missing or invalid parameter: chunk size after \"-%1\" (0 = automatic)").arg(COMMAND_3DMASC_CHUNK_SIZE));
+				}
+				cmd.arguments().pop_front();
+				cmd.print(QString("Chunk size: %1").arg(context.chunkSize));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_MIGRATE_OUTPUT_PAGES))
+			{
+				context.migrateOutputPages = true;
+				cmd.print(QString("Output pages migrated to the NUMA node of the writing thread (%1 node(s))").arg(masc::NumaPlacement::NodeCount()));
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_COMPILE_MODEL))
+			{
+				compileModel = true;
+				cmd.print("Will compile the random forest");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_COMPILED_MODEL))
+			{
+				useCompiledModel = true;
+				cmd.print("Will use the random forest previously compiled next to the classifier file");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_QUANTIZED))
+			{
+				quantizedInference = true;
+				cmd.print("Will use the quantized inference (random trees)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_CONFUSION_MATRIX))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().empty())
+				{
+					return cmd.error(QString("Missing parameter(s): output filename after \"-%1\"").arg(COMMAND_3DMASC_CONFUSION_MATRIX));
+				}
+				confusionMatrixFilename = cmd.arguments().front();
+				cmd.arguments().pop_front();
+				cmd.print("Will compare the classification with the reference one and save the confusion matrix: " + confusionMatrixFilename);
+			}
 			else
 			{
 				//urecognized option
@@ -194,7 +294,8 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			//load features
 			masc::Feature::Set features;
 			std::vector<double> scales;
-			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, nullptr, nullptr, cmd.widgetParent()))
+			masc::NeighborhoodParams neighborhoodParams;
+			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, nullptr, nullptr, &neighborhoodParams, cmd.widgetParent()))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
@@ -226,7 +327,7 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			}
 
 			QString errorMessage;
-			if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields))
+			if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields, neighborhoodParams, context))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
@@ -273,18 +374,62 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		if (!onlyFeatures)
 		{
 			masc::Classifier classifier;
-			if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
+			if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, nullptr, cmd.widgetParent()))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
+			classifier.setExecutionContext(context);
+			classifier.setQuantizedInference(quantizedInference);
+
+			//the compiled forest is native code: it is only used on explicit request
+			if (compileModel)
+			{
+				QString compileError;
+				if (!classifier.compile(compileError))
+				{
+					cmd.warning("Failed to compile the classifier (the generic engine will be used): " + compileError);
+				}
+			}
+			else if (useCompiledModel)
+			{
+				QString loadError;
+				if (!classifier.loadCompiled(loadError))
+				{
+					cmd.warning("Failed to load the compiled classifier (the generic engine will be used): " + loadError);
+				}
+			}
 
 			QString errorMessage;
-			if (!classifier.classify(featureSources, classifiedCloud, errorMessage, cmd.widgetParent()))
+			masc::ConfusionAccumulator confusion;
+			if (!classifier.classify(featureSources, classifiedCloud, errorMessage, cmd.widgetParent(), &confusion, probabilityOutputs))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
 			}
 
+			if (!confusionMatrixFilename.isEmpty())
+			{
+				if (confusion.sampleCount() == 0)
+				{
+					cmd.warning("No reference classification on the classified cloud: no confusion matrix to save");
+				}
+				else
+				{
+					for (const QString& line : confusion.report())
+					{
+						cmd.print(line);
+					}
+					if (confusion.save(confusionMatrixFilename))
+					{
+						cmd.print("Confusion matrix saved: " + confusionMatrixFilename);
+					}
+					else
+					{
+						cmd.warning("Failed to save the confusion matrix: " + confusionMatrixFilename);
+					}
+				}
+			}
+
 			generatedScalarFields.releaseSFs(keepAttributes);
 		}
 
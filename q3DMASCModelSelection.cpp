@@ -0,0 +1,910 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "q3DMASCModelSelection.h"
+
+//Local
+#include "q3DMASCClassifier.h"
+
+//qCC_db
+#include <ccLog.h>
+#include <ccPointCloud.h>
+
+//Qt
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <map>
+#include <random>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+bool ModelSelection::ExtractColumns(const cv::Mat& data, const std::vector<int>& columns, cv::Mat& output)
+{
+	try
+	{
+		output.create(data.rows, static_cast<int>(columns.size()), data.type());
+		for (size_t j = 0; j < columns.size(); ++j)
+		{
+			data.col(columns[j]).copyTo(output.col(static_cast<int>(j)));
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		ccLog::Warning(cvex.msg.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+//! Candidate model (for feature selection)
+struct Candidate
+{
+	std::vector<int> features;
+	float accuracy = -1.0f;
+	//! Importance of each feature (same order as 'features')
+	std::vector<float> importance;
+	QString errorMessage;
+};
+
+static bool TrainCandidate(	Candidate& candidate,
+							const cv::Mat& trainData,
+							const cv::Mat& trainLabels,
+							const cv::Mat& testData,
+							const cv::Mat& testLabels,
+							RandomTreesParams rtParams)
+{
+	//each candidate works on its own copy of the selected columns
+	cv::Mat candidateTrainData, candidateTestData;
+	if (	!ModelSelection::ExtractColumns(trainData, candidate.features, candidateTrainData)
+		||	!ModelSelection::ExtractColumns(testData, candidate.features, candidateTestData))
+	{
+		candidate.errorMessage = "Not enough memory";
+		return false;
+	}
+
+	//the number of active variables can't exceed the number of features
+	rtParams.activeVarCount = std::min(rtParams.activeVarCount, static_cast<int>(candidate.features.size()));
+
+	Classifier classifier;
+	if (!classifier.trainOnMatrix(rtParams, candidateTrainData, trainLabels, candidate.errorMessage))
+	{
+		return false;
+	}
+	candidate.accuracy = classifier.computeAccuracy(candidateTestData, testLabels);
+
+	cv::Mat importanceMat = classifier.getVarImportance();
+	candidate.importance.resize(candidate.features.size(), 0.0f);
+	for (int i = 0; i < importanceMat.rows && i < static_cast<int>(candidate.importance.size()); ++i)
+	{
+		candidate.importance[i] = importanceMat.at<float>(i, 0);
+	}
+
+	return true;
+}
+
+static bool TrainCandidates(std::vector<Candidate>& candidates,
+							const cv::Mat& trainData,
+							const cv::Mat& trainLabels,
+							const cv::Mat& testData,
+							const cv::Mat& testLabels,
+							const RandomTreesParams& rtParams,
+							const ExecutionContext& context,
+							QString& errorMessage)
+{
+	bool success = true;
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic)
+#endif
+#endif
+	for (int c = 0; c < static_cast<int>(candidates.size()); ++c)
+	{
+		if (!TrainCandidate(candidates[c], trainData, trainLabels, testData, testLabels, rtParams))
+		{
+			mutex.lock();
+			success = false;
+			errorMessage = candidates[c].errorMessage;
+			mutex.unlock();
+		}
+	}
+
+	return success;
+}
+
+//! Returns the indexes of the features sorted by increasing importance
+static std::vector<size_t> SortByImportance(const std::vector<float>& importance)
+{
+	std::vector<size_t> order(importance.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return importance[a] < importance[b]; });
+	return order;
+}
+
+bool ModelSelection::SelectFeatures(const cv::Mat& trainData,
+									const cv::Mat& trainLabels,
+									const cv::Mat& testData,
+									const cv::Mat& testLabels,
+									const RandomTreesParams& rtParams,
+									const FeatureSelectionParams& params,
+									FeatureSelectionResult& result,
+									QString& errorMessage,
+									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	result = FeatureSelectionResult();
+
+	if (trainData.empty() || testData.empty() || trainData.cols != testData.cols)
+	{
+		errorMessage = "Invalid training/test data";
+		return false;
+	}
+
+	int featureCount = trainData.cols;
+	int candidateCount = params.candidateCount > 0 ? params.candidateCount : std::max(1, QThread::idealThreadCount() - 2);
+	ExecutionContext context;
+	context.maxThreadCount = params.maxThreadCount;
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Feature selection");
+		progressCb->setInfo(qPrintable(QString("Selecting among %1 features").arg(featureCount)));
+		progressCb->start();
+	}
+
+	bool outOfMemory = false;
+	try
+	{
+		//start with the full model
+		std::vector<Candidate> candidates(1);
+		for (int i = 0; i < featureCount; ++i)
+		{
+			candidates.front().features.push_back(i);
+		}
+		if (!TrainCandidates(candidates, trainData, trainLabels, testData, testLabels, rtParams, context, errorMessage))
+		{
+			if (progressCb)
+				progressCb->stop();
+			return false;
+		}
+		Candidate current = candidates.front();
+		std::vector<float> fullModelImportance = current.importance;
+
+		float bestAccuracy = current.accuracy;
+		result.steps.push_back({ current.features, current.accuracy });
+		ccLog::Print(QString("[3DMASC] Feature selection: %1 features --> accuracy = %2").arg(featureCount).arg(current.accuracy));
+
+		//forward selection starts from an empty set
+		std::vector<int> remaining;
+		if (params.method == FeatureSelectionParams::FORWARD_SELECTION)
+		{
+			std::vector<size_t> order = SortByImportance(fullModelImportance);
+			for (std::vector<size_t>::const_reverse_iterator it = order.rbegin(); it != order.rend(); ++it)
+			{
+				remaining.push_back(static_cast<int>(*it)); //most important first
+			}
+			current = Candidate();
+		}
+
+		int stepsWithoutImprovement = 0;
+		for (int step = 1; step < featureCount; ++step)
+		{
+			//build the candidates for this step
+			candidates.clear();
+			if (params.method == FeatureSelectionParams::RECURSIVE_ELIMINATION)
+			{
+				//remove one of the least important features of the current model
+				std::vector<size_t> order = SortByImportance(current.importance);
+				for (size_t k = 0; k < order.size() && static_cast<int>(k) < candidateCount; ++k)
+				{
+					Candidate candidate;
+					for (size_t i = 0; i < current.features.size(); ++i)
+					{
+						if (i != order[k])
+							candidate.features.push_back(current.features[i]);
+					}
+					candidates.push_back(candidate);
+				}
+			}
+			else
+			{
+				//add one of the most important remaining features
+				for (size_t k = 0; k < remaining.size() && static_cast<int>(k) < candidateCount; ++k)
+				{
+					Candidate candidate;
+					candidate.features = current.features;
+					candidate.features.push_back(remaining[k]);
+					candidates.push_back(candidate);
+				}
+			}
+
+			if (!TrainCandidates(candidates, trainData, trainLabels, testData, testLabels, rtParams, context, errorMessage))
+			{
+				if (progressCb)
+					progressCb->stop();
+				return false;
+			}
+
+			//keep the best candidate
+			size_t bestCandidateIndex = 0;
+			for (size_t c = 1; c < candidates.size(); ++c)
+			{
+				if (candidates[c].accuracy > candidates[bestCandidateIndex].accuracy)
+					bestCandidateIndex = c;
+			}
+			current = candidates[bestCandidateIndex];
+			if (params.method == FeatureSelectionParams::FORWARD_SELECTION)
+			{
+				remaining.erase(remaining.begin() + bestCandidateIndex);
+			}
+			result.steps.push_back({ current.features, current.accuracy });
+			ccLog::Print(QString("[3DMASC] Feature selection: %1 features --> accuracy = %2").arg(current.features.size()).arg(current.accuracy));
+
+			if (progressCb)
+			{
+				progressCb->update((100.0f * step) / featureCount);
+				if (progressCb->isCancelRequested())
+				{
+					progressCb->stop();
+					errorMessage = "Process cancelled by the user";
+					return false;
+				}
+			}
+
+			//stopping criteria
+			if (current.accuracy > bestAccuracy)
+			{
+				bestAccuracy = current.accuracy;
+				stepsWithoutImprovement = 0;
+			}
+			else
+			{
+				++stepsWithoutImprovement;
+			}
+
+			if (params.method == FeatureSelectionParams::RECURSIVE_ELIMINATION)
+			{
+				if (current.accuracy < bestAccuracy - params.tolerance)
+				{
+					//removing more features won't help
+					break;
+				}
+			}
+			else if (stepsWithoutImprovement >= params.patience)
+			{
+				break;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		outOfMemory = true;
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+	if (outOfMemory)
+	{
+		return false;
+	}
+
+	//look for the best step and for the smallest set within the tolerance
+	result.best = result.steps.front();
+	for (const FeatureSelectionResult::Step& step : result.steps)
+	{
+		if (step.accuracy > result.best.accuracy)
+			result.best = step;
+	}
+	result.selected = result.best;
+	for (const FeatureSelectionResult::Step& step : result.steps)
+	{
+		if (step.accuracy >= result.best.accuracy - params.tolerance)
+		{
+			if (	step.features.size() < result.selected.features.size()
+				||	(step.features.size() == result.selected.features.size() && step.accuracy > result.selected.accuracy))
+			{
+				result.selected = step;
+			}
+		}
+	}
+	std::sort(result.best.features.begin(), result.best.features.end());
+	std::sort(result.selected.features.begin(), result.selected.features.end());
+
+	return true;
+}
+
+bool ModelSelection::SearchHyperParameters(	const cv::Mat& trainData,
+											const cv::Mat& trainLabels,
+											const cv::Mat& testData,
+											const cv::Mat& testLabels,
+											const HyperParameterSearchParams& params,
+											std::vector<HyperParameterCandidate>& candidates,
+											size_t& bestIndex,
+											QString& errorMessage,
+											CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	candidates.clear();
+	bestIndex = 0;
+
+	if (trainData.empty() || testData.empty() || trainData.cols != testData.cols)
+	{
+		errorMessage = "Invalid training/test data";
+		return false;
+	}
+
+	if (	params.maxDepthValues.empty()
+		||	params.maxTreeCountValues.empty()
+		||	params.activeVarCountValues.empty()
+		||	params.minSampleCountValues.empty())
+	{
+		errorMessage = "At least one value is required for each parameter";
+		return false;
+	}
+	if (params.gridSize() > static_cast<double>(HyperParameterSearchParams::MaxGridSize))
+	{
+		errorMessage = QString("Too many configurations (%1, max %2)").arg(params.gridSize()).arg(HyperParameterSearchParams::MaxGridSize);
+		return false;
+	}
+
+	std::vector<Classifier> models;
+	try
+	{
+		//build the grid
+		for (int maxDepth : params.maxDepthValues)
+			for (int maxTreeCount : params.maxTreeCountValues)
+				for (int activeVarCount : params.activeVarCountValues)
+					for (int minSampleCount : params.minSampleCountValues)
+					{
+						HyperParameterCandidate candidate;
+						candidate.params = params.baseParams;
+						candidate.params.maxDepth = maxDepth;
+						candidate.params.maxTreeCount = maxTreeCount;
+						candidate.params.activeVarCount = std::min(activeVarCount, trainData.cols);
+						candidate.params.minSampleCount = minSampleCount;
+						candidates.push_back(candidate);
+					}
+
+		//or a random subset of it
+		if (params.method == HyperParameterSearchParams::RANDOM_SEARCH && params.randomCandidateCount < static_cast<int>(candidates.size()))
+		{
+			std::mt19937 generator(std::random_device{}());
+			std::shuffle(candidates.begin(), candidates.end(), generator);
+			candidates.resize(std::max(1, params.randomCandidateCount));
+		}
+
+		models.resize(candidates.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		return false;
+	}
+
+	int candidateCount = static_cast<int>(candidates.size());
+	ccLog::Print(QString("[3DMASC] Hyperparameter search: %1 configuration(s)").arg(candidateCount));
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Hyperparameter search");
+		progressCb->setInfo(qPrintable(QString("Training %1 configurations").arg(candidateCount)));
+		progressCb->start();
+	}
+	CCCoreLib::NormalizedProgress nProgress(progressCb, static_cast<unsigned>(candidateCount));
+
+	ExecutionContext context;
+	context.maxThreadCount = params.maxThreadCount;
+	bool success = true;
+	bool cancelled = false;
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic)
+#endif
+#endif
+	for (int c = 0; c < candidateCount; ++c)
+	{
+		if (!success || cancelled)
+		{
+			//no need to go further
+			continue;
+		}
+
+		QString error;
+		if (models[c].trainOnMatrix(candidates[c].params, trainData, trainLabels, error))
+		{
+			candidates[c].accuracy = models[c].computeAccuracy(testData, testLabels);
+			candidates[c].nodeCount = models[c].getNodeCount();
+		}
+		else
+		{
+			mutex.lock();
+			success = false;
+			errorMessage = error;
+			mutex.unlock();
+		}
+
+		if (progressCb)
+		{
+			mutex.lock();
+			cancelled = !nProgress.oneStep();
+			mutex.unlock();
+		}
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	if (cancelled)
+	{
+		errorMessage = "Process cancelled by the user";
+		return false;
+	}
+	if (!success)
+	{
+		return false;
+	}
+
+	//measure the inference cost sequentially (so that the models don't compete with each other)
+	for (int c = 0; c < candidateCount; ++c)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		models[c].computeAccuracy(testData, testLabels);
+		candidates[c].inferenceTime_us = static_cast<double>(timer.nsecsElapsed()) / (1000.0 * testData.rows);
+
+		if (	candidates[c].accuracy > candidates[bestIndex].accuracy
+			||	(candidates[c].accuracy == candidates[bestIndex].accuracy && candidates[c].nodeCount < candidates[bestIndex].nodeCount))
+		{
+			bestIndex = static_cast<size_t>(c);
+		}
+	}
+
+	return true;
+}
+
+bool ModelSelection::AssignSpatialFolds(ccPointCloud* cloud, int foldCount, double tileSize, std::vector<int>& folds, QString& errorMessage)
+{
+	if (!cloud || cloud->size() == 0)
+	{
+		errorMessage = "Invalid input cloud";
+		return false;
+	}
+	if (foldCount < 2)
+	{
+		errorMessage = "At least 2 folds are required";
+		return false;
+	}
+
+	CCVector3 bbMin, bbMax;
+	cloud->getBoundingBox(bbMin, bbMax);
+	CCVector3 diag = bbMax - bbMin;
+
+	if (tileSize <= 0.0)
+	{
+		//about 10 tiles per fold
+		double area = std::max(static_cast<double>(diag.x) * diag.y, 1.0e-12);
+		tileSize = std::sqrt(area / (10.0 * foldCount));
+	}
+
+	try
+	{
+		//tile of each point
+		unsigned pointCount = cloud->size();
+		int tileCountX = static_cast<int>(std::floor(diag.x / tileSize)) + 1;
+		std::vector<int> tileIndexes(pointCount);
+		std::map<int, unsigned> tilePopulations;
+		for (unsigned i = 0; i < pointCount; ++i)
+		{
+			const CCVector3* P = cloud->getPoint(i);
+			int tx = static_cast<int>(std::floor((P->x - bbMin.x) / tileSize));
+			int ty = static_cast<int>(std::floor((P->y - bbMin.y) / tileSize));
+			tileIndexes[i] = ty * tileCountX + tx;
+			++tilePopulations[tileIndexes[i]];
+		}
+
+		if (static_cast<int>(tilePopulations.size()) < foldCount)
+		{
+			errorMessage = QString("Not enough tiles (%1) for %2 folds: reduce the tile size").arg(tilePopulations.size()).arg(foldCount);
+			return false;
+		}
+
+		//distribute the tiles (in a random order) to the least populated fold
+		std::vector<int> tiles;
+		tiles.reserve(tilePopulations.size());
+		for (const auto& tile : tilePopulations)
+		{
+			tiles.push_back(tile.first);
+		}
+		std::mt19937 generator(std::random_device{}());
+		std::shuffle(tiles.begin(), tiles.end(), generator);
+
+		std::vector<unsigned> foldPopulations(foldCount, 0);
+		std::map<int, int> tileFolds;
+		for (int tile : tiles)
+		{
+			int fold = static_cast<int>(std::min_element(foldPopulations.begin(), foldPopulations.end()) - foldPopulations.begin());
+			tileFolds[tile] = fold;
+			foldPopulations[fold] += tilePopulations[tile];
+		}
+
+		folds.resize(pointCount);
+		for (unsigned i = 0; i < pointCount; ++i)
+		{
+			folds[i] = tileFolds[tileIndexes[i]];
+		}
+
+		ccLog::Print(QString("[3DMASC] Cross-validation: %1 tiles of %2 x %2 distributed among %3 folds").arg(tiles.size()).arg(tileSize).arg(foldCount));
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		return false;
+	}
+
+	return true;
+}
+
+bool ModelSelection::CrossValidate(	const cv::Mat& data,
+									const cv::Mat& labels,
+									const std::vector<int>& folds,
+									const CrossValidationParams& params,
+									const RandomTreesParams& rtParams,
+									CrossValidationResult& result,
+									QString& errorMessage,
+									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	result.foldAccuracies.clear();
+	result.meanAccuracy = result.stdDevAccuracy = 0.0f;
+	result.confusion.clear();
+
+	int foldCount = params.foldCount;
+	if (data.empty() || data.rows != labels.rows || static_cast<int>(folds.size()) != data.rows || foldCount < 2)
+	{
+		errorMessage = "Invalid cross-validation data";
+		return false;
+	}
+
+	try
+	{
+		result.foldAccuracies.resize(foldCount, 0.0f);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		return false;
+	}
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Cross-validation");
+		progressCb->setInfo(qPrintable(QString("Training %1 folds").arg(foldCount)));
+		progressCb->start();
+	}
+	CCCoreLib::NormalizedProgress nProgress(progressCb, static_cast<unsigned>(foldCount));
+
+	ExecutionContext context;
+	context.maxThreadCount = params.maxThreadCount;
+	bool success = true;
+	bool cancelled = false;
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic)
+#endif
+#endif
+	for (int f = 0; f < foldCount; ++f)
+	{
+		if (!success || cancelled)
+		{
+			//no need to go further
+			continue;
+		}
+
+		QString error;
+		try
+		{
+			//the training rows of this fold (the data matrix itself is shared)
+			std::vector<int> trainIndexes, testIndexes;
+			for (int i = 0; i < data.rows; ++i)
+			{
+				if (folds[i] == f)
+					testIndexes.push_back(i);
+				else
+					trainIndexes.push_back(i);
+			}
+
+			Classifier classifier;
+			if (testIndexes.empty() || !classifier.trainOnMatrix(rtParams, data, labels, error, cv::Mat(trainIndexes, false).reshape(1, 1)))
+			{
+				if (error.isEmpty())
+					error = QString("Fold #%1 is empty").arg(f + 1);
+				mutex.lock();
+				success = false;
+				errorMessage = error;
+				mutex.unlock();
+			}
+			else
+			{
+				int goodGuess = 0;
+				ConfusionAccumulator::Chunk chunk;
+				for (int i : testIndexes)
+				{
+					int predictedClass = static_cast<int>(classifier.predict(data.row(i)));
+					int actualClass = static_cast<int>(labels.at<float>(i));
+					chunk.add(actualClass, predictedClass);
+					if (predictedClass == actualClass)
+						++goodGuess;
+				}
+				result.foldAccuracies[f] = static_cast<float>(goodGuess) / testIndexes.size();
+				result.confusion.merge(chunk);
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			mutex.lock();
+			success = false;
+			errorMessage = "Not enough memory";
+			mutex.unlock();
+		}
+
+		if (progressCb)
+		{
+			mutex.lock();
+			cancelled = !nProgress.oneStep();
+			mutex.unlock();
+		}
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	if (cancelled)
+	{
+		errorMessage = "Process cancelled by the user";
+		return false;
+	}
+	if (!success)
+	{
+		return false;
+	}
+
+	//statistics
+	double sum = 0.0, sum2 = 0.0;
+	for (float accuracy : result.foldAccuracies)
+	{
+		sum += accuracy;
+		sum2 += static_cast<double>(accuracy) * accuracy;
+	}
+	double mean = sum / foldCount;
+	result.meanAccuracy = static_cast<float>(mean);
+	result.stdDevAccuracy = static_cast<float>(std::sqrt(std::max(0.0, sum2 / foldCount - mean * mean)));
+
+	return true;
+}
+
+//! Unpermuted prediction of a random forest (votes)
+static inline int BasePrediction(const FlatForest& forest, const float* sample, int* votes)
+{
+	return forest.predict(sample, votes);
+}
+//! Unpermuted prediction of gradient boosted trees (raw scores)
+static inline int BasePrediction(const GradientBoostedTrees& trees, const float* sample, float* scores)
+{
+	return trees.decisionFunction(sample, scores);
+}
+
+//! Replaces the vote of a tree for a row by its vote for the permuted sample
+static inline void UpdatePrediction(const FlatForest& forest, int treeIndex, const float* row, const float* sample, int* votes)
+{
+	--votes[forest.treeClassIndex(treeIndex, row)];
+	++votes[forest.treeClassIndex(treeIndex, sample)];
+}
+//! Replaces the contribution of a tree for a row by its contribution for the permuted sample
+static inline void UpdatePrediction(const GradientBoostedTrees& trees, int treeIndex, const float* row, const float* sample, float* scores)
+{
+	scores[trees.treeClassIndex(treeIndex)] += trees.treeValue(treeIndex, sample) - trees.treeValue(treeIndex, row);
+}
+
+//! Permutation importance for an additive tree model
+/** \tparam Score per class prediction type (votes or raw scores)
+**/
+template <class Model, typename Score> static bool ComputePermutationImportance(const Model& forest,
+																				const cv::Mat& testData,
+																				const cv::Mat& testLabels,
+																				std::vector<float>& importances,
+																				QString& errorMessage,
+																				CCCoreLib::GenericProgressCallback* progressCb,
+																				const ExecutionContext& context)
+{
+	if (!forest.isValid() || testData.empty() || testData.rows != testLabels.rows || testData.cols != forest.varCount() || testData.type() != CV_32F)
+	{
+		errorMessage = "Invalid classifier or test data";
+		return false;
+	}
+
+	int featureCount = testData.cols;
+	int classCount = forest.classCount();
+	static const int BlockSize = 4096;
+	int blockCount = (testData.rows + BlockSize - 1) / BlockSize;
+
+	//the same random permutation of the rows is used for all the features
+	std::vector<int> permutation;
+	//trees that split on each feature
+	std::vector< std::vector<int> > treesPerFeature;
+	//number of correct guesses for each permuted feature
+	std::vector<int> goodGuessCount;
+	try
+	{
+		permutation.resize(testData.rows);
+		for (int i = 0; i < testData.rows; ++i)
+		{
+			permutation[i] = i;
+		}
+		std::mt19937 generator(std::random_device{}());
+		std::shuffle(permutation.begin(), permutation.end(), generator);
+
+		treesPerFeature.resize(featureCount);
+		for (int f = 0; f < featureCount; ++f)
+		{
+			treesPerFeature[f] = forest.treesUsingVar(f);
+		}
+
+		goodGuessCount.resize(featureCount, 0);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = "Not enough memory";
+		return false;
+	}
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Permutation importance");
+		progressCb->setInfo(qPrintable(QString("%1 features / %2 samples").arg(featureCount).arg(testData.rows)));
+		progressCb->start();
+	}
+	CCCoreLib::NormalizedProgress nProgress(progressCb, static_cast<unsigned>(blockCount));
+
+	int baseGoodGuessCount = 0;
+	std::vector<Score> baseVotes;
+	std::vector<int> basePrediction;
+	for (int b = 0; b < blockCount; ++b)
+	{
+		int firstRow = b * BlockSize;
+		int rowCount = std::min(BlockSize, testData.rows - firstRow);
+
+		//unpermuted votes (computed once for all the features)
+		baseVotes.resize(static_cast<size_t>(rowCount) * classCount);
+		basePrediction.resize(rowCount);
+		for (int i = 0; i < rowCount; ++i)
+		{
+			Score* votes = baseVotes.data() + static_cast<size_t>(i) * classCount;
+			int classIndex = BasePrediction(forest, testData.ptr<float>(firstRow + i), votes);
+			basePrediction[i] = static_cast<int>(forest.classLabel(classIndex));
+			if (basePrediction[i] == static_cast<int>(testLabels.at<float>(firstRow + i)))
+			{
+				++baseGoodGuessCount;
+			}
+		}
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic)
+#endif
+#endif
+		for (int f = 0; f < featureCount; ++f)
+		{
+			//each feature is handled by a single thread per block (no concurrent writes)
+			const std::vector<int>& trees = treesPerFeature[f];
+			if (trees.empty())
+			{
+				//the feature is not used: same predictions
+				for (int i = 0; i < rowCount; ++i)
+				{
+					if (basePrediction[i] == static_cast<int>(testLabels.at<float>(firstRow + i)))
+						++goodGuessCount[f];
+				}
+				continue;
+			}
+
+			std::vector<float> sample(featureCount);
+			std::vector<Score> votes(classCount);
+			for (int i = 0; i < rowCount; ++i)
+			{
+				const float* row = testData.ptr<float>(firstRow + i);
+				std::copy(row, row + featureCount, sample.begin());
+				sample[f] = testData.at<float>(permutation[firstRow + i], f);
+
+				//only the trees using this feature may vote differently
+				std::copy(baseVotes.begin() + static_cast<size_t>(i) * classCount, baseVotes.begin() + static_cast<size_t>(i + 1) * classCount, votes.begin());
+				for (int t : trees)
+				{
+					UpdatePrediction(forest, t, row, sample.data(), votes.data());
+				}
+
+				int classIndex = 0;
+				for (int c = 1; c < classCount; ++c)
+				{
+					if (votes[c] > votes[classIndex])
+						classIndex = c;
+				}
+				if (static_cast<int>(forest.classLabel(classIndex)) == static_cast<int>(testLabels.at<float>(firstRow + i)))
+				{
+					++goodGuessCount[f];
+				}
+			}
+		}
+
+		if (progressCb && !nProgress.oneStep())
+		{
+			progressCb->stop();
+			errorMessage = "Process cancelled by the user";
+			return false;
+		}
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	float baseAccuracy = static_cast<float>(baseGoodGuessCount) / testData.rows;
+	importances.resize(featureCount);
+	for (int f = 0; f < featureCount; ++f)
+	{
+		importances[f] = baseAccuracy - static_cast<float>(goodGuessCount[f]) / testData.rows;
+	}
+
+	return true;
+}
+
+bool ModelSelection::PermutationImportance(	const Classifier& classifier,
+											const cv::Mat& testData,
+											const cv::Mat& testLabels,
+											std::vector<float>& importances,
+											QString& errorMessage,
+											CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (classifier.getModelType() == ModelType::GradientBoosting)
+	{
+		return ComputePermutationImportance<GradientBoostedTrees, float>(classifier.getBoostedTrees(), testData, testLabels, importances, errorMessage, progressCb, classifier.getExecutionContext());
+	}
+	else
+	{
+		return ComputePermutationImportance<FlatForest, int>(classifier.getFlatForest(), testData, testLabels, importances, errorMessage, progressCb, classifier.getExecutionContext());
+	}
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "Parameters.h"
+#include "ConfusionAccumulator.h"
+
+//CCLib
+#include <GenericProgressCallback.h>
+#include <CCTypes.h>
+
+//Qt
+#include <QString>
+
+//OpenCV
+#include <opencv2/core.hpp>
+
+//system
+#include <vector>
+
+class ccPointCloud;
+
+namespace masc
+{
+	//! Automatic feature selection parameters
+	struct FeatureSelectionParams
+	{
+		enum Method { RECURSIVE_ELIMINATION, FORWARD_SELECTION };
+
+		//! Selection method
+		Method method = RECURSIVE_ELIMINATION;
+		//! Accuracy tolerance
+		/** The smallest feature set with an accuracy above (best accuracy - tolerance) is selected.
+		**/
+		float tolerance = 0.005f;
+		//! Number of candidate models trained concurrently at each step (0 = auto)
+		int candidateCount = 0;
+		//! Number of steps without improvement before stopping (forward selection only)
+		int patience = 3;
+		//! Maximum number of models trained concurrently (0 = auto)
+		int maxThreadCount = 0;
+	};
+
+	//! Automatic feature selection result
+	struct FeatureSelectionResult
+	{
+		//! Feature set retained at each step
+		struct Step
+		{
+			std::vector<int> features;
+			float accuracy = 0.0f;
+		};
+
+		//! All the steps
+		std::vector<Step> steps;
+		//! Step with the best accuracy
+		Step best;
+		//! Smallest set within the tolerance of the best accuracy
+		Step selected;
+	};
+
+	//! Hyperparameter search parameters
+	struct HyperParameterSearchParams
+	{
+		enum Method { GRID_SEARCH, RANDOM_SEARCH };
+
+		//! Maximum number of configurations of the grid (product of the numbers of candidate values)
+		static const size_t MaxGridSize = 1000;
+
+		//! Search method
+		Method method = GRID_SEARCH;
+		//! Candidate values of each parameter
+		std::vector<int> maxDepthValues, maxTreeCountValues, activeVarCountValues, minSampleCountValues;
+
+		//! Returns the number of configurations of the grid
+		inline double gridSize() const
+		{
+			return static_cast<double>(maxDepthValues.size()) * maxTreeCountValues.size() * activeVarCountValues.size() * minSampleCountValues.size();
+		}
+
+		//! Other parameters (model type, learning rate), shared by all the candidates
+		RandomTreesParams baseParams;
+		//! Number of configurations randomly drawn among the grid (random search only)
+		int randomCandidateCount = 20;
+		//! Maximum number of models trained concurrently (0 = auto)
+		int maxThreadCount = 0;
+	};
+
+	//! Evaluated hyperparameter configuration
+	struct HyperParameterCandidate
+	{
+		RandomTreesParams params;
+		//! Test accuracy
+		float accuracy = 0.0f;
+		//! Model size (total number of nodes)
+		size_t nodeCount = 0;
+		//! Inference cost (in microseconds per sample, measured sequentially)
+		double inferenceTime_us = 0.0;
+	};
+
+	//! Spatially blocked cross-validation parameters
+	struct CrossValidationParams
+	{
+		//! Number of folds
+		int foldCount = 5;
+		//! Size of the XY tiles (0 = auto)
+		double tileSize = 0.0;
+		//! Maximum number of folds trained concurrently (0 = auto)
+		int maxThreadCount = 0;
+	};
+
+	//! Cross-validation result
+	struct CrossValidationResult
+	{
+		//! Accuracy of each fold
+		std::vector<float> foldAccuracies;
+		float meanAccuracy = 0.0f;
+		float stdDevAccuracy = 0.0f;
+		//! Confusion counts (all folds aggregated)
+		ConfusionAccumulator confusion;
+	};
+
+	class Classifier;
+
+	//! Model selection tools
+	/** The models are trained on already built data matrices (see Classifier::BuildDataMatrix)
+		so that the features are never extracted twice.
+	**/
+	class ModelSelection
+	{
+	public:
+
+		//! Automatic feature selection
+		/** Several candidate models are trained concurrently at each step:
+			- recursive elimination: the least important features of the current model are removed one at a time
+			- forward selection: the most important features of the full model are added one at a time
+			The features are referenced by their column index in the data matrices.
+		**/
+		static bool SelectFeatures(	const cv::Mat& trainData,
+									const cv::Mat& trainLabels,
+									const cv::Mat& testData,
+									const cv::Mat& testLabels,
+									const RandomTreesParams& rtParams,
+									const FeatureSelectionParams& params,
+									FeatureSelectionResult& result,
+									QString& errorMessage,
+									CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Hyperparameter search (grid or random)
+		/** The candidate configurations are trained concurrently (within the thread budget).
+			\param candidates evaluated configurations
+			\param bestIndex index of the best configuration (highest accuracy, then smallest model)
+		**/
+		static bool SearchHyperParameters(	const cv::Mat& trainData,
+											const cv::Mat& trainLabels,
+											const cv::Mat& testData,
+											const cv::Mat& testLabels,
+											const HyperParameterSearchParams& params,
+											std::vector<HyperParameterCandidate>& candidates,
+											size_t& bestIndex,
+											QString& errorMessage,
+											CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Assigns each point of a cloud to a fold, by XY tiles
+		/** All the points of a given tile belong to the same fold, so that neighboring
+			points are never split between the training and the test sets. Tiles are
+			randomly distributed among the folds while balancing the number of points.
+			\param tileSize tile size (0 = auto: about 10 tiles per fold)
+			\param folds output fold index of each point
+		**/
+		static bool AssignSpatialFolds(ccPointCloud* cloud, int foldCount, double tileSize, std::vector<int>& folds, QString& errorMessage);
+
+		//! k-fold cross-validation
+		/** The folds are trained concurrently on the same (read-only) data matrix:
+			each fold only references its training rows, no data is copied.
+			\param folds fold index of each row (see AssignSpatialFolds, called with the same parameters)
+		**/
+		static bool CrossValidate(	const cv::Mat& data,
+									const cv::Mat& labels,
+									const std::vector<int>& folds,
+									const CrossValidationParams& params,
+									const RandomTreesParams& rtParams,
+									CrossValidationResult& result,
+									QString& errorMessage,
+									CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Permutation importance of each feature
+		/** The importance of a feature is the accuracy drop when its column of the test matrix
+			is randomly shuffled. The features are processed concurrently, by blocks of rows.
+			Only the trees that actually split on the shuffled feature are traversed again (the
+			votes, or scores for boosted trees, of the other trees are taken from the unpermuted prediction).
+			\param importances output importance of each feature (column)
+		**/
+		static bool PermutationImportance(	const Classifier& classifier,
+											const cv::Mat& testData,
+											const cv::Mat& testLabels,
+											std::vector<float>& importances,
+											QString& errorMessage,
+											CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Extracts a subset of columns of a data matrix
+		static bool ExtractColumns(const cv::Mat& data, const std::vector<int>& columns, cv::Mat& output);
+	};
+
+}; //namespace masc
@@ -22,6 +22,10 @@
 #include "NeighborhoodFeature.h"
 #include "DualCloudFeature.h"
 #include "ContextBasedFeature.h"
+#include "VoxelMomentPyramid.h"
+#include "ColumnIndex.h"
+#include "NumaPlacement.h"
+#include "StageGraph.h"
 #include "ccMainAppInterface.h"
 
 //qCC_io
@@ -30,6 +34,10 @@
 #include <ccScalarField.h>
 #include <ccPointCloud.h>
 
+//CCLib
+#include <CloudSamplingTools.h>
+#include <ReferenceCloud.h>
+
 //qPDALIO
 #include "../../../core/IO/qPDALIO/include/LASFields.h"
 
@@ -39,33 +47,136 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QMutex>
+#include <QPair>
 #include <QCoreApplication>
+#include <QElapsedTimer>
 
 //system
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <iostream>
+#include <map>
 
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
 using namespace masc;
 
+//! Formats a default count and per-scale counts ('count' and 'scale=count' tokens separated by ';')
+static QString CountsPerScaleToString(unsigned defaultCount, const std::map<double, unsigned>& countPerScale)
+{
+	QStringList tokens;
+	if (defaultCount != 0)
+	{
+		tokens << QString::number(defaultCount);
+	}
+	for (const auto& it : countPerScale)
+	{
+		tokens << QString("%1=%2").arg(it.first).arg(it.second);
+	}
+	return tokens.join(';');
+}
+
+//! Reads a default count and per-scale counts (see CountsPerScaleToString)
+static bool ReadCountsPerScale(const QString& text, unsigned& defaultCount, std::map<double, unsigned>& countPerScale)
+{
+	defaultCount = 0;
+	countPerScale.clear();
+
+	for (const QString& token : text.split(';'))
+	{
+		if (token.trimmed().isEmpty())
+		{
+			continue;
+		}
+		QStringList subTokens = token.split('=');
+		bool ok = (subTokens.size() <= 2);
+		unsigned count = (ok ? subTokens.back().trimmed().toUInt(&ok) : 0);
+		if (!ok)
+		{
+			return false;
+		}
+		if (subTokens.size() == 2)
+		{
+			double scale = subTokens.front().trimmed().toDouble(&ok);
+			if (!ok)
+			{
+				return false;
+			}
+			countPerScale[scale] = count;
+		}
+		else
+		{
+			defaultCount = count;
+		}
+	}
+
+	return true;
+}
+
 bool Tools::SaveClassifier(	QString filename,
 							const Feature::Set& features,
 							const QString corePointsRole,
 							const masc::Classifier& classifier,
+							const TrainParameters* parameters/*=nullptr*/,
 							QWidget* parent/*=nullptr*/)
 {
+	//compact the random forests (the features that are never used are removed from the file as well)
+	const Classifier* savedClassifier = &classifier;
+	Feature::Set savedFeatures = features;
+	Classifier compactedClassifier;
+	Classifier::CompactionReport compactionReport;
+	if (classifier.getModelType() == ModelType::RandomForest && classifier.isValid() && static_cast<int>(features.size()) == classifier.getVarCount())
+	{
+		compactedClassifier = classifier;
+		std::vector<int> keptVarIndexes;
+		QString errorMessage;
+		if (compactedClassifier.compact(keptVarIndexes, compactionReport, errorMessage))
+		{
+			savedFeatures.clear();
+			for (int varIndex : keptVarIndexes)
+			{
+				savedFeatures.push_back(features[varIndex]);
+			}
+			for (Feature::Shared f : features)
+			{
+				if (std::find(savedFeatures.begin(), savedFeatures.end(), f) == savedFeatures.end())
+				{
+					ccLog::Print("[3DMASC] Unused feature removed: " + f->toString());
+				}
+			}
+			savedClassifier = &compactedClassifier;
+		}
+		else
+		{
+			ccLog::Warning("[3DMASC] Failed to compact the forest (" + errorMessage + "), the full model will be saved");
+		}
+	}
+
 	//first save the classifier data (same base filename but with the yaml extension)
 	QFileInfo fi(filename);
 	QString yamlFilename = fi.baseName() + ".yaml";
 	QString yamlAbsoluteFilename = fi.absoluteDir().absoluteFilePath(yamlFilename);
-	if (!classifier.toFile(yamlAbsoluteFilename, parent))
+	if (!savedClassifier->toFile(yamlAbsoluteFilename, parent))
 	{
 		ccLog::Error("Failed to save the classifier data");
 		return false;
 	}
 
+	if (savedClassifier == &compactedClassifier)
+	{
+		ccLog::Print(QString("[3DMASC] Compacted forest: %1 -> %2 nodes, %3 -> %4 features, %5 -> %6 comparisons per tree (predicted speedup: x%7), file size: %8 KB")
+			.arg(compactionReport.nodeCountBefore)
+			.arg(compactionReport.nodeCountAfter)
+			.arg(compactionReport.varCountBefore)
+			.arg(compactionReport.varCountAfter)
+			.arg(compactionReport.pathLengthBefore, 0, 'f', 2)
+			.arg(compactionReport.pathLengthAfter, 0, 'f', 2)
+			.arg(compactionReport.speedup(), 0, 'f', 2)
+			.arg(QFileInfo(yamlAbsoluteFilename).size() / 1024));
+	}
+
 	QFile file(filename);
 	if (!file.open(QFile::Text | QFile::WriteOnly))
 	{
@@ -80,7 +191,7 @@ bool Tools::SaveClassifier(	QString filename,
 
 	//look for all clouds (labels)
 	QList<QString> cloudLabels;
-	for (Feature::Shared f : features)
+	for (Feature::Shared f : savedFeatures)
 	{
 		if (f->cloud1 && !cloudLabels.contains(f->cloud1Label))
 			cloudLabels.push_back(f->cloud1Label);
@@ -104,12 +215,48 @@ bool Tools::SaveClassifier(	QString filename,
 		stream << "core_points: " << corePointsRole << endl;
 	}
 
+	if (parameters && (parameters->neighborhood.targetNeighborCount != 0 || !parameters->neighborhood.targetNeighborCountPerScale.empty()))
+	{
+		stream << "# Neighborhood extraction (target number of neighbors at large scales: all scales and/or scale=count)" << endl;
+		stream << "target_neighbors: " << CountsPerScaleToString(parameters->neighborhood.targetNeighborCount, parameters->neighborhood.targetNeighborCountPerScale) << endl;
+	}
+	if (parameters && parameters->neighborhood.approximateMomentsCellRatio > 0)
+	{
+		stream << "# Approximate moments (boundary voxel size relative to the scale)" << endl;
+		stream << "approximate_moments: " << parameters->neighborhood.approximateMomentsCellRatio << endl;
+	}
+	if (parameters && (parameters->neighborhood.maxNeighbors != 0 || !parameters->neighborhood.maxNeighborsPerScale.empty()))
+	{
+		stream << "# Maximum number of neighbors (all scales and/or scale=count)" << endl;
+		stream << "max_neighbors: " << CountsPerScaleToString(parameters->neighborhood.maxNeighbors, parameters->neighborhood.maxNeighborsPerScale) << endl;
+	}
+	if (parameters && parameters->neighborhood.groundRaster != GroundRasterMode::None)
+	{
+		stream << "# Ground raster for the context-based features (MEAN or MIN)" << endl;
+		stream << "ground_raster: " << (parameters->neighborhood.groundRaster == GroundRasterMode::MinZ ? "MIN" : "MEAN") << endl;
+	}
+
 	stream << "# Features" << endl;
-	for (Feature::Shared f : features)
+	for (Feature::Shared f : savedFeatures)
 	{
 		stream << "feature: " << f->toString() << endl;
 	}
 
+	if (parameters)
+	{
+		stream << "# Training parameters" << endl;
+		stream << "PARAM_MODEL=" << (parameters->rt.model == ModelType::GradientBoosting ? "GBT" : "RF") << endl;
+		stream << "PARAM_MAX_DEPTH=" << parameters->rt.maxDepth << endl;
+		stream << "PARAM_MAX_TREE_COUNT=" << parameters->rt.maxTreeCount << endl;
+		stream << "PARAM_ACTIVE_VAR_COUNT=" << parameters->rt.activeVarCount << endl;
+		stream << "PARAM_MIN_SAMPLE_COUNT=" << parameters->rt.minSampleCount << endl;
+		if (parameters->rt.model == ModelType::GradientBoosting)
+		{
+			stream << "PARAM_LEARNING_RATE=" << parameters->rt.learningRate << endl;
+		}
+		stream << "PARAM_TEST_DATA_RATIO=" << parameters->testDataRatio << endl;
+	}
+
 	return true;
 }
 
@@ -493,6 +640,13 @@ static bool CreateFeaturesFromCommand(const QString& command, QString corePoints
 			}
 		}
 
+		//is the token a neighborhood shape descriptor?
+		if (token == "CYL")
+		{
+			feature->cylindrical = true;
+			continue;
+		}
+
 		//is the token a 'context' descriptor?
 		//if (feature->getType() == Feature::Type::ContextBasedFeature && token.startsWith("CTX"))
 		//{
@@ -745,8 +899,14 @@ bool Tools::LoadFile(	const QString& filename,
 						masc::CorePoints* corePoints/*=nullptr*/,				//requires 'clouds'
 						masc::Classifier* classifier/*=nullptr*/,
 						TrainParameters* parameters/*=nullptr*/,
+						NeighborhoodParams* neighborhoodParams/*=nullptr*/,
 						QWidget* parent/*=nullptr*/)
 {
+	if (!neighborhoodParams && parameters)
+	{
+		neighborhoodParams = &parameters->neighborhood;
+	}
+
 	QFileInfo fi(filename);
 	if (!fi.exists())
 	{
@@ -891,6 +1051,72 @@ bool Tools::LoadFile(	const QString& filename,
 							rawScales->push_back(scale);
 				}
 			}
+			else if (upperLine.startsWith("TARGET_NEIGHBORS:")) //neighborhood extraction
+			{
+				unsigned targetNeighborCount = 0;
+				std::map<double, unsigned> targetNeighborCountPerScale;
+				if (!ReadCountsPerScale(line.mid(17), targetNeighborCount, targetNeighborCountPerScale))
+				{
+					ccLog::Warning(QString("Line #%1: invalid target number of neighbors (expecting 'count' or 'scale=count' tokens separated by ';')").arg(lineNumber));
+					return false;
+				}
+				if (neighborhoodParams)
+				{
+					neighborhoodParams->targetNeighborCount = targetNeighborCount;
+					neighborhoodParams->targetNeighborCountPerScale = targetNeighborCountPerScale;
+				}
+			}
+			else if (upperLine.startsWith("APPROXIMATE_MOMENTS:")) //approximate moments mode
+			{
+				bool ok = false;
+				float cellRatio = line.mid(20).trimmed().toFloat(&ok);
+				if (!ok || cellRatio < 0 || cellRatio > 1)
+				{
+					ccLog::Warning(QString("Line #%1: invalid approximate moments ratio (expecting a value between 0 and 1)").arg(lineNumber));
+					return false;
+				}
+				if (neighborhoodParams)
+				{
+					neighborhoodParams->approximateMomentsCellRatio = cellRatio;
+				}
+			}
+			else if (upperLine.startsWith("GROUND_RASTER:")) //ground raster mode
+			{
+				QString mode = upperLine.mid(14).trimmed();
+				GroundRasterMode groundRaster = GroundRasterMode::None;
+				if (mode == "MEAN")
+				{
+					groundRaster = GroundRasterMode::MeanZ;
+				}
+				else if (mode == "MIN")
+				{
+					groundRaster = GroundRasterMode::MinZ;
+				}
+				else if (mode != "NONE")
+				{
+					ccLog::Warning(QString("Line #%1: invalid ground raster mode (expecting MEAN, MIN or NONE)").arg(lineNumber));
+					return false;
+				}
+				if (neighborhoodParams)
+				{
+					neighborhoodParams->groundRaster = groundRaster;
+				}
+			}
+			else if (upperLine.startsWith("MAX_NEIGHBORS:")) //maximum number of neighbors
+			{
+				unsigned maxNeighbors = 0;
+				std::map<double, unsigned> maxNeighborsPerScale;
+				if (!ReadCountsPerScale(line.mid(14), maxNeighbors, maxNeighborsPerScale))
+				{
+					ccLog::Warning(QString("Line #%1: invalid maximum number of neighbors (expecting 'count' or 'scale=count' tokens separated by ';')").arg(lineNumber));
+					return false;
+				}
+				if (neighborhoodParams)
+				{
+					neighborhoodParams->maxNeighbors = maxNeighbors;
+					neighborhoodParams->maxNeighborsPerScale = maxNeighborsPerScale;
+				}
+			}
 			else if (upperLine.startsWith("FEATURE:")) //feature
 			{
 				QString command = line.mid(8);
@@ -916,7 +1142,22 @@ bool Tools::LoadFile(	const QString& filename,
 						return false;
 					}
 					bool ok = false;
-					if (tokens[0] == "PARAM_MAX_DEPTH")
+					if (tokens[0] == "PARAM_MODEL")
+					{
+						//RF = random forest (default), GBT = gradient boosted trees
+						QString model = tokens[1].trimmed();
+						if (model == "RF")
+						{
+							parameters->rt.model = ModelType::RandomForest;
+							ok = true;
+						}
+						else if (model == "GBT")
+						{
+							parameters->rt.model = ModelType::GradientBoosting;
+							ok = true;
+						}
+					}
+					else if (tokens[0] == "PARAM_MAX_DEPTH")
 					{
 						parameters->rt.maxDepth = tokens[1].toInt(&ok);
 					}
@@ -932,6 +1173,10 @@ bool Tools::LoadFile(	const QString& filename,
 					{
 						parameters->rt.minSampleCount = tokens[1].toInt(&ok);
 					}
+					else if (tokens[0] == "PARAM_LEARNING_RATE")
+					{
+						parameters->rt.learningRate = tokens[1].toFloat(&ok);
+					}
 					else if (tokens[0] == "PARAM_TEST_DATA_RATIO")
 					{
 						parameters->testDataRatio = tokens[1].toFloat(&ok);
@@ -970,9 +1215,9 @@ bool Tools::LoadFile(	const QString& filename,
 	return true;
 }
 
-bool Tools::LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent/*=nullptr*/)
+bool Tools::LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, NeighborhoodParams* neighborhoodParams/*=nullptr*/, QWidget* parent/*=nullptr*/)
 {
-	return LoadFile(filename, &clouds, true, &rawFeatures, nullptr, nullptr, &classifier, nullptr, parent);
+	return LoadFile(filename, &clouds, true, &rawFeatures, nullptr, nullptr, &classifier, nullptr, neighborhoodParams, parent);
 }
 
 bool Tools::LoadTrainingFile(	QString filename,
@@ -984,7 +1229,7 @@ bool Tools::LoadTrainingFile(	QString filename,
 								QWidget* parentWidget/*=nullptr*/)
 {
 	bool cloudsWereProvided = !loadedClouds.empty();
-	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, parentWidget))
+	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, nullptr, parentWidget))
 	{
 		return true;
 	}
@@ -1035,373 +1280,1608 @@ CCCoreLib::ScalarField* Tools::RetrieveSF(const ccPointCloud* cloud, const QStri
 	}
 }
 
+//! Statistical measure of a source field, shared by all the point features that need it (at a given scale)
+struct PointStatTerm
+{
+	//! Source field
+	IScalarFieldWrapper::Shared field;
+	//! Feature used to compute the statistical measure (any of the dependent features)
+	const PointFeature* feature = nullptr;
+	//! Scalar fields receiving the value (a single one if the dependent features share it)
+	std::vector<CCCoreLib::ScalarField*> outputs;
+};
+
 struct FeaturesAndScales
 {
 	std::vector<double> scales;
 	size_t featureCount = 0;
 	QMap<double, std::vector<PointFeature::Shared> > pointFeaturesPerScale;
+	//! Deduplicated statistical measures of the point features (see BuildPointStatTerms)
+	QMap<double, std::vector<PointStatTerm> > pointStatTermsPerScale;
 	QMap<double, std::vector<NeighborhoodFeature::Shared> > neighborhoodFeaturesPerScale;
 	QMap<double, std::vector<ContextBasedFeature::Shared> > contextBasedFeaturesPerScale;
 };
 
-bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& errorStr,
-							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/)
+//! Neighborhood extraction level (either the full density source cloud or a subsampled version of it)
+struct ExtractionLevel
 {
-	if (features.empty() || !corePoints.origin)
+	//! Octree used for the extraction
+	CCCoreLib::DgmOctree* octree = nullptr;
+	//! Subsampled cloud (null for the full density level)
+	QSharedPointer<CCCoreLib::ReferenceCloud> subset;
+	//! Octree of the subsampled cloud (if any)
+	QSharedPointer<CCCoreLib::DgmOctree> subsetOctree;
+	//! Scales extracted at this level (sorted)
+	std::vector<double> scales;
+	//! Largest extraction radius
+	PointCoordinateType largestRadius = 0;
+	//! Octree level for the extraction
+	unsigned char octreeLevel = 0;
+};
+
+static bool RequiresFullDensity(const FeaturesAndScales& fas, double scale)
+{
+	//the number of points can't be estimated on a subsampled cloud
+	QMap<double, std::vector<NeighborhoodFeature::Shared> >::const_iterator it = fas.neighborhoodFeaturesPerScale.constFind(scale);
+	if (it != fas.neighborhoodFeaturesPerScale.constEnd())
 	{
-		//invalid input parameters
-		assert(false);
-		return false;
+		for (const NeighborhoodFeature::Shared& feature : it.value())
+		{
+			if (feature->type == NeighborhoodFeature::NBPTS)
+			{
+				return true;
+			}
+		}
 	}
+	return false;
+}
 
-	//gather all the scales that need to be extracted
-	QMap<ccPointCloud*, FeaturesAndScales> cloudsWithScaledFeatures;
-	//and prepare the features (scalar fields, etc.) at the same time
-	for (const Feature::Shared& feature : features)
+static bool BuildExtractionLevels(	ccPointCloud* sourceCloud,
+									ccOctree::Shared octree,
+									const FeaturesAndScales& fas,
+									const std::vector<double>& scales,
+									const NeighborhoodParams& neighborhoodParams,
+									std::vector<ExtractionLevel>& levels,
+									QString& errorStr,
+									CCCoreLib::GenericProgressCallback* progressCb)
+{
+	levels.clear();
+
+	//the full density level always comes first
+	levels.resize(1);
+	levels.front().octree = octree.data();
+
+	//scales per subsampling spacing (as a power of 2, so that close scales share the same subsampled cloud)
+	std::map<int, std::vector<double>> scalesPerSpacingExp;
+	for (double scale : scales)
 	{
-		QString errorMessage("invalid pointer");
-		assert(!corePoints.role.isEmpty());
-		if (!feature || !feature->checkValidity(corePoints.role, errorMessage))
+		unsigned targetNeighborCount = neighborhoodParams.targetNeighborCountAt(scale);
+		if (targetNeighborCount == 0 || RequiresFullDensity(fas, scale))
 		{
-			errorStr = "Invalid rule/feature: " + errorMessage;
+			levels.front().scales.push_back(scale);
+			continue;
+		}
+
+		//we want roughly 'targetNeighborCount' points in a (planar) neighborhood of radius scale/2
+		double spacing = (scale / 2) * sqrt(M_PI / targetNeighborCount);
+		int spacingExp = static_cast<int>(std::floor(std::log2(spacing)));
+		scalesPerSpacingExp[spacingExp].push_back(scale);
+	}
+
+	CCCoreLib::CloudSamplingTools::SFModulationParams modParams;
+	modParams.enabled = false;
+
+	for (std::map<int, std::vector<double>>::const_iterator it = scalesPerSpacingExp.begin(); it != scalesPerSpacingExp.end(); ++it)
+	{
+		PointCoordinateType spacing = static_cast<PointCoordinateType>(std::ldexp(1.0, it->first));
+
+		QSharedPointer<CCCoreLib::ReferenceCloud> subset(CCCoreLib::CloudSamplingTools::resampleCloudSpatially(sourceCloud, spacing, modParams, octree.data(), progressCb));
+		if (!subset)
+		{
+			errorStr = "Failed to subsample the source cloud (not enough memory?)";
 			return false;
 		}
 
-		//prepare the feature
-		if (!feature->prepare(corePoints, errorStr, progressCb, generatedScalarFields))
+		if (subset->size() * 2 > sourceCloud->size())
 		{
-			//something failed (error should be up to date)
+			//not worth it: we keep the full density cloud
+			levels.front().scales.insert(levels.front().scales.end(), it->second.begin(), it->second.end());
+			continue;
+		}
+
+		QSharedPointer<CCCoreLib::DgmOctree> subsetOctree(new CCCoreLib::DgmOctree(subset.data()));
+		if (subsetOctree->build(progressCb) <= 0)
+		{
+			errorStr = "Failed to compute the octree of the subsampled cloud (not enough memory?)";
 			return false;
 		}
 
-		if (feature->scaled())
+		ccLog::Print(QString("Cloud %1 subsampled for scales %2 to %3: %4 points (spacing = %5)")
+						.arg(sourceCloud->getName())
+						.arg(it->second.front())
+						.arg(it->second.back())
+						.arg(subset->size())
+						.arg(spacing));
+
+		ExtractionLevel level;
+		level.octree = subsetOctree.data();
+		level.subset = subset;
+		level.subsetOctree = subsetOctree;
+		level.scales = it->second;
+		levels.push_back(level);
+	}
+
+	for (ExtractionLevel& level : levels)
+	{
+		if (level.scales.empty())
 		{
-			try
+			continue;
+		}
+		std::sort(level.scales.begin(), level.scales.end());
+		level.largestRadius = static_cast<PointCoordinateType>(level.scales.back() / 2); //scale is the diameter!
+		level.octreeLevel = level.octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(level.largestRadius);
+	}
+
+	return true;
+}
+
+//! Extracts a deterministic stratified subset of a sorted neighborhood (one point per stratum)
+static void StratifiedSubset(const CCCoreLib::DgmOctree::NeighboursSet& neighbours, unsigned count, unsigned seed, CCCoreLib::DgmOctree::NeighboursSet& subset)
+{
+	uint64_t neighbourCount = neighbours.size();
+	assert(count != 0 && neighbourCount > count);
+
+	subset.resize(count);
+	for (unsigned s = 0; s < count; ++s)
+	{
+		uint64_t first = (s * neighbourCount) / count;
+		uint64_t last = ((s + 1) * neighbourCount) / count;
+
+		//integer hash of (seed, stratum), so that the result doesn't depend on the threads
+		uint64_t h = (static_cast<uint64_t>(seed) << 32) | s;
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+
+		subset[s] = neighbours[first + h % (last - first)];
+	}
+}
+
+//! Gathers the statistical measures required by the point features on a given source cloud
+/** Each (source field, stat, scale) term is computed once, whatever the number of features depending on it
+	(e.g. 'INT_PC1-PC2 MEAN' and 'INT_PC1/PC2 MEAN' share both the PC1 and the PC2 terms).
+	\return the number of feature terms
+**/
+static size_t BuildPointStatTerms(FeaturesAndScales& fas, const ccPointCloud* sourceCloud)
+{
+	size_t featureTermCount = 0;
+	fas.pointStatTermsPerScale.clear();
+
+	for (QMap<double, std::vector<PointFeature::Shared> >::const_iterator itPF = fas.pointFeaturesPerScale.constBegin(); itPF != fas.pointFeaturesPerScale.constEnd(); ++itPF)
+	{
+		std::vector<PointStatTerm>& terms = fas.pointStatTermsPerScale[itPF.key()];
+		for (const PointFeature::Shared& feature : itPF.value())
+		{
+			for (int i = 0; i < 2; ++i)
 			{
-				switch (feature->getType())
-				{
-				//Point features
-				case Feature::Type::PointFeature:
+				bool second = (i != 0);
+				const ccPointCloud* cloud = (second ? feature->cloud2 : feature->cloud1);
+				CCCoreLib::ScalarField* statSF = (second ? feature->statSF2 : feature->statSF1);
+				const IScalarFieldWrapper::Shared& field = (second ? feature->field2 : feature->field1);
+				if (cloud != sourceCloud || !statSF || !field)
 				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
-					{
-						if(!static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!static_cast<PointFeature*>(feature.data())->statSF2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								++fas.featureCount;
-								fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
+					continue;
 				}
-				break;
-
-				//Neighborhood features
-				case Feature::Type::NeighborhoodFeature:
-				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
+				assert(!second || feature->op != Feature::NO_OPERATION);
+				++featureTermCount;
 
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
+				//the fields of a given cloud are identified by their name
+				QString fieldName = field->getName();
+				std::vector<PointStatTerm>::iterator itTerm = std::find_if(terms.begin(), terms.end(), [&](const PointStatTerm& term)
 					{
-						if (!static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!static_cast<NeighborhoodFeature*>(feature.data())->sf2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-								++fas.featureCount;
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
-				}
-				break;
+						return term.feature->stat == feature->stat && term.field->getName() == fieldName;
+					});
 
-				//Context-based features
-				case Feature::Type::ContextBasedFeature:
+				if (itTerm == terms.end())
 				{
-					//build the scaled feature list attached to the context cloud
-					if (feature->cloud1
-						&& !static_cast<ContextBasedFeature*>(feature.data())->sfWasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.contextBasedFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<ContextBasedFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
+					PointStatTerm term;
+					term.field = field;
+					term.feature = feature.data();
+					term.outputs.push_back(statSF);
+					terms.push_back(term);
 				}
-				break;
-
-				default:
-					assert(false);
-					break;
+				else if (std::find(itTerm->outputs.begin(), itTerm->outputs.end(), statSF) == itTerm->outputs.end())
+				{
+					itTerm->outputs.push_back(statSF);
 				}
 			}
-			catch (const std::bad_alloc&)
+		}
+	}
+
+	return featureTermCount;
+}
+
+static bool ComputeScaledFeatures(	const FeaturesAndScales& fas,
+									double currentScale,
+									ccPointCloud* sourceCloud,
+									CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood,
+									size_t exactNeighborCount, //pointsInNeighbourhood may be a subset
+									const CCVector3& queryPoint,
+									unsigned pointIndex,
+									QString& errorStr)
+{
+	//Point features (deduplicated statistical measures, see BuildPointStatTerms)
+	QMap<double, std::vector<PointStatTerm> >::const_iterator itPT = fas.pointStatTermsPerScale.constFind(currentScale);
+	if (itPT != fas.pointStatTermsPerScale.constEnd())
+	{
+		for (const PointStatTerm& term : itPT.value())
+		{
+			double outputValue = 0;
+			if (!term.feature->computeStat(pointsInNeighbourhood, term.field, outputValue))
+			{
+				//an error occurred
+				errorStr = "An error occurred during the computation of feature " + term.feature->toString() + " on cloud " + sourceCloud->getName();
+				return false;
+			}
+
+			ScalarType v = static_cast<ScalarType>(outputValue);
+			for (CCCoreLib::ScalarField* sf : term.outputs)
+			{
+				sf->setValue(pointIndex, v);
+			}
+		}
+	}
+
+	//Neighborhood features
+	QMap<double, std::vector<NeighborhoodFeature::Shared> >::const_iterator itNF = fas.neighborhoodFeaturesPerScale.constFind(currentScale);
+	if (itNF != fas.neighborhoodFeaturesPerScale.constEnd())
+	{
+		for (const NeighborhoodFeature::Shared& feature : itNF.value())
+		{
+			if (feature->cloud1 == sourceCloud && feature->sf1)
+			{
+				double outputValue = 0;
+				if (feature->type == NeighborhoodFeature::NBPTS)
+				{
+					outputValue = static_cast<double>(exactNeighborCount);
+				}
+				else if (!feature->computeValue(pointsInNeighbourhood, queryPoint, outputValue))
+				{
+					//an error occurred
+					errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
+					return false;
+				}
+
+				ScalarType v1 = static_cast<ScalarType>(outputValue);
+				feature->sf1->setValue(pointIndex, v1);
+			}
+
+			if (feature->cloud2 == sourceCloud && feature->sf2)
+			{
+				assert(feature->op != Feature::NO_OPERATION);
+				double outputValue = 0;
+				if (feature->type == NeighborhoodFeature::NBPTS)
+				{
+					outputValue = static_cast<double>(exactNeighborCount);
+				}
+				else if (!feature->computeValue(pointsInNeighbourhood, queryPoint, outputValue))
+				{
+					//an error occurred
+					errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud2->getName();
+					return false;
+				}
+
+				ScalarType v2 = static_cast<ScalarType>(outputValue);
+				feature->sf2->setValue(pointIndex, v2);
+			}
+		}
+	}
+
+	//Context-based features
+	QMap<double, std::vector<ContextBasedFeature::Shared> >::const_iterator itCF = fas.contextBasedFeaturesPerScale.constFind(currentScale);
+	if (itCF != fas.contextBasedFeaturesPerScale.constEnd())
+	{
+		for (const ContextBasedFeature::Shared& feature : itCF.value())
+		{
+			if (feature->cloud1 == sourceCloud && feature->sf)
+			{
+				ScalarType outputValue = 0;
+				if (!feature->computeValue(pointsInNeighbourhood, queryPoint, outputValue))
+				{
+					//an error occurred
+					errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
+					return false;
+				}
+
+				feature->sf->setValue(pointIndex, outputValue);
+			}
+		}
+	}
+
+	return true;
+}
+
+//! Lists the scalar fields written by ComputeScaledFeatures for a given source cloud
+static void GetScaledFeatureSFs(const FeaturesAndScales& fas, const ccPointCloud* sourceCloud, std::vector<CCCoreLib::ScalarField*>& sfs)
+{
+	for (const std::vector<PointStatTerm>& terms : fas.pointStatTermsPerScale)
+	{
+		for (const PointStatTerm& term : terms)
+		{
+			sfs.insert(sfs.end(), term.outputs.begin(), term.outputs.end());
+		}
+	}
+	for (const std::vector<NeighborhoodFeature::Shared>& neighborhoodFeatures : fas.neighborhoodFeaturesPerScale)
+	{
+		for (const NeighborhoodFeature::Shared& feature : neighborhoodFeatures)
+		{
+			if (feature->cloud1 == sourceCloud && feature->sf1)
+				sfs.push_back(feature->sf1);
+			if (feature->cloud2 == sourceCloud && feature->sf2)
+				sfs.push_back(feature->sf2);
+		}
+	}
+	for (const std::vector<ContextBasedFeature::Shared>& contextBasedFeatures : fas.contextBasedFeaturesPerScale)
+	{
+		for (const ContextBasedFeature::Shared& feature : contextBasedFeatures)
+		{
+			if (feature->cloud1 == sourceCloud && feature->sf)
+				sfs.push_back(feature->sf);
+		}
+	}
+}
+
+static bool SupportsApproximateMoments(const FeaturesAndScales& fas, double scale)
+{
+	//the context-based features only consider the points of a given class
+	QMap<double, std::vector<ContextBasedFeature::Shared> >::const_iterator itCF = fas.contextBasedFeaturesPerScale.constFind(scale);
+	if (itCF != fas.contextBasedFeaturesPerScale.constEnd() && !itCF.value().empty())
+	{
+		return false;
+	}
+
+	QMap<double, std::vector<PointFeature::Shared> >::const_iterator itPF = fas.pointFeaturesPerScale.constFind(scale);
+	if (itPF != fas.pointFeaturesPerScale.constEnd())
+	{
+		for (const PointFeature::Shared& feature : itPF.value())
+		{
+			if (feature->stat != Feature::MEAN && feature->stat != Feature::STD && feature->stat != Feature::RANGE)
+			{
+				return false;
+			}
+		}
+	}
+
+	QMap<double, std::vector<NeighborhoodFeature::Shared> >::const_iterator itNF = fas.neighborhoodFeaturesPerScale.constFind(scale);
+	if (itNF != fas.neighborhoodFeaturesPerScale.constEnd())
+	{
+		for (const NeighborhoodFeature::Shared& feature : itNF.value())
+		{
+			switch (feature->type)
+			{
+			case NeighborhoodFeature::PCA1:
+			case NeighborhoodFeature::PCA2:
+			case NeighborhoodFeature::PCA3:
+			case NeighborhoodFeature::SPHER:
+			case NeighborhoodFeature::LINEA:
+			case NeighborhoodFeature::PLANA:
+			case NeighborhoodFeature::NBPTS:
+			case NeighborhoodFeature::ZRANGE:
+			case NeighborhoodFeature::Zmax:
+			case NeighborhoodFeature::Zmin:
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+//! Scalar field computed with the approximate moments
+struct MomentOutput
+{
+	double scale = 0;
+	PointFeature* pointFeature = nullptr;
+	NeighborhoodFeature* neighborhoodFeature = nullptr;
+	//! Whether the output is the second scalar field of the feature
+	bool second = false;
+	//! Index of the source field in the pyramid (point features only)
+	size_t fieldIndex = 0;
+
+	inline CCCoreLib::ScalarField* sf() const
+	{
+		if (pointFeature)
+			return (second ? pointFeature->statSF2 : pointFeature->statSF1);
+		else
+			return (second ? neighborhoodFeature->sf2 : neighborhoodFeature->sf1);
+	}
+
+	inline QString name() const
+	{
+		return (pointFeature ? pointFeature->toString() : neighborhoodFeature->toString()) + (second ? " (2)" : "");
+	}
+};
+
+//! Computes the value of a feature from the moments of the neighborhood (returns false if there's no neighbor)
+/** \param queryZ Z coordinate of the core point (relatively to the pyramid origin)
+**/
+static bool ComputeMomentValue(const MomentOutput& output, const VoxelMomentPyramid::Moments& moments, double queryZ, double& outputValue)
+{
+	if (moments.geom.count == 0)
+	{
+		return false;
+	}
+	double n = static_cast<double>(moments.geom.count);
+
+	outputValue = std::numeric_limits<double>::quiet_NaN();
+	if (output.pointFeature)
+	{
+		const VoxelMomentPyramid::FieldMoments& fm = moments.fields[output.fieldIndex];
+		switch (output.pointFeature->stat)
+		{
+		case Feature::MEAN:
+			outputValue = fm.sum / n;
+			break;
+		case Feature::STD:
+			outputValue = sqrt(std::abs(fm.sum2 * n - fm.sum * fm.sum)) / n;
+			break;
+		case Feature::RANGE:
+			outputValue = fm.maxValue - fm.minValue;
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		return true;
+	}
+
+	switch (output.neighborhoodFeature->type)
+	{
+	case NeighborhoodFeature::NBPTS:
+		outputValue = n;
+		return true;
+
+	case NeighborhoodFeature::ZRANGE:
+	case NeighborhoodFeature::Zmax:
+	case NeighborhoodFeature::Zmin:
+		//same as the exact version: at least 2 points
+		if (moments.geom.count >= 2)
+		{
+			if (output.neighborhoodFeature->type == NeighborhoodFeature::ZRANGE)
+				outputValue = moments.geom.maxZ - moments.geom.minZ;
+			else if (output.neighborhoodFeature->type == NeighborhoodFeature::Zmax)
+				outputValue = moments.geom.maxZ - queryZ;
+			else
+				outputValue = queryZ - moments.geom.minZ;
+		}
+		return true;
+
+	default:
+		break;
+	}
+
+	//PCA-based features
+	double l1 = 0, l2 = 0, l3 = 0;
+	if (!moments.eigenValues(l1, l2, l3))
+	{
+		return true;
+	}
+	double sum = l1 + l2 + l3;
+	double epsilon = std::numeric_limits<double>::epsilon();
+	switch (output.neighborhoodFeature->type)
+	{
+	case NeighborhoodFeature::PCA1:
+		if (sum > epsilon)
+			outputValue = l1 / sum;
+		break;
+	case NeighborhoodFeature::PCA2:
+		if (sum > epsilon)
+			outputValue = l2 / sum;
+		break;
+	case NeighborhoodFeature::PCA3:
+		if (sum > epsilon)
+			outputValue = l3 / sum;
+		break;
+	case NeighborhoodFeature::SPHER:
+		if (l1 > epsilon)
+			outputValue = l3 / l1;
+		break;
+	case NeighborhoodFeature::LINEA:
+		if (l1 > epsilon)
+			outputValue = (l1 - l2) / l1;
+		break;
+	case NeighborhoodFeature::PLANA:
+		if (l1 > epsilon)
+			outputValue = (l2 - l3) / l1;
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	return true;
+}
+
+//! Maximum number of core points used to measure the error of the approximate moments
+static const unsigned s_momentValidationSampleSize = 1000;
+
+static bool ComputeApproximateMomentFeatures(	const CorePoints& corePoints,
+												ccPointCloud* sourceCloud,
+												ccOctree::Shared octree,
+												const FeaturesAndScales& fas,
+												const std::vector<double>& momentScales,
+												double cellRatio,
+												const ExecutionContext& context,
+												QString& errorStr,
+												CCCoreLib::GenericProgressCallback* progressCb)
+{
+	assert(!momentScales.empty() && cellRatio > 0);
+
+	//list the outputs and the source fields
+	std::vector<MomentOutput> outputs;
+	std::vector<IScalarFieldWrapper::Shared> fields;
+	try
+	{
+		for (double scale : momentScales)
+		{
+			QMap<double, std::vector<PointFeature::Shared> >::const_iterator itPF = fas.pointFeaturesPerScale.constFind(scale);
+			if (itPF != fas.pointFeaturesPerScale.constEnd())
+			{
+				for (const PointFeature::Shared& feature : itPF.value())
+				{
+					for (int i = 0; i < 2; ++i)
+					{
+						bool second = (i != 0);
+						ccPointCloud* cloud = (second ? feature->cloud2 : feature->cloud1);
+						CCCoreLib::ScalarField* statSF = (second ? feature->statSF2 : feature->statSF1);
+						const IScalarFieldWrapper::Shared& field = (second ? feature->field2 : feature->field1);
+						if (cloud != sourceCloud || !statSF || !field)
+						{
+							continue;
+						}
+
+						MomentOutput output;
+						output.scale = scale;
+						output.pointFeature = feature.data();
+						output.second = second;
+						output.fieldIndex = std::find(fields.begin(), fields.end(), field) - fields.begin();
+						if (output.fieldIndex == fields.size())
+						{
+							fields.push_back(field);
+						}
+						outputs.push_back(output);
+					}
+				}
+			}
+
+			QMap<double, std::vector<NeighborhoodFeature::Shared> >::const_iterator itNF = fas.neighborhoodFeaturesPerScale.constFind(scale);
+			if (itNF != fas.neighborhoodFeaturesPerScale.constEnd())
+			{
+				for (const NeighborhoodFeature::Shared& feature : itNF.value())
+				{
+					for (int i = 0; i < 2; ++i)
+					{
+						bool second = (i != 0);
+						ccPointCloud* cloud = (second ? feature->cloud2 : feature->cloud1);
+						CCCoreLib::ScalarField* sf = (second ? feature->sf2 : feature->sf1);
+						if (cloud != sourceCloud || !sf)
+						{
+							continue;
+						}
+
+						MomentOutput output;
+						output.scale = scale;
+						output.neighborhoodFeature = feature.data();
+						output.second = second;
+						outputs.push_back(output);
+					}
+				}
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorStr = "Not enough memory";
+		return false;
+	}
+
+	if (outputs.empty())
+	{
+		return true;
+	}
+
+	//build the pyramid
+	VoxelMomentPyramid pyramid;
+	double finestCellSize = cellRatio * momentScales.front();
+	if (!pyramid.build(sourceCloud, fields, finestCellSize, momentScales.back() / 2, errorStr, progressCb))
+	{
+		return false;
+	}
+	ccLog::Print(QString("Voxel moments of cloud %1: %2 levels (finest voxel size = %3)").arg(sourceCloud->getName()).arg(pyramid.levelCount()).arg(finestCellSize));
+
+	unsigned pointCount = corePoints.size();
+	QString logMessage = QString("Computing %1 approximate features on cloud %2\n(core points: %3)").arg(outputs.size()).arg(sourceCloud->getName()).arg(pointCount);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute features");
+		progressCb->setInfo(qPrintable(logMessage));
+		progressCb->start();
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	bool cancelled = false;
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, context.chunk(static_cast<int>(pointCount)))
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+		if (cancelled)
+		{
+			continue;
+		}
+
+		const CCVector3* corePoint = corePoints.cloud->getPoint(i);
+		double queryZ = corePoint->z - pyramid.origin().z;
+		VoxelMomentPyramid::Moments moments;
+		double currentScale = -1.0;
+		for (const MomentOutput& output : outputs)
+		{
+			if (output.scale != currentScale)
+			{
+				//outputs are sorted by scale
+				currentScale = output.scale;
+				pyramid.query(*corePoint, currentScale / 2, cellRatio * currentScale, moments); //scale is the diameter!
+			}
+
+			double outputValue = 0;
+			if (ComputeMomentValue(output, moments, queryZ, outputValue))
+			{
+				output.sf()->setValue(i, static_cast<ScalarType>(outputValue));
+			}
+		}
+
+		if (progressCb)
+		{
+			mutex.lock();
+			if (!nProgress.oneStep())
+			{
+				cancelled = true;
+			}
+			mutex.unlock();
+		}
+	}
+
+	if (cancelled)
+	{
+		ccLog::Warning("Process cancelled");
+		errorStr = "Process cancelled";
+		return false;
+	}
+
+	//measure the error on a subset of the core points
+	unsigned sampleCount = std::min(pointCount, s_momentValidationSampleSize);
+	if (sampleCount == 0)
+	{
+		return true;
+	}
+	std::vector<double> maxError(outputs.size(), 0.0);
+	std::vector<double> sumError(outputs.size(), 0.0);
+	std::vector<unsigned> errorCount(outputs.size(), 0);
+	PointCoordinateType largestRadius = static_cast<PointCoordinateType>(momentScales.back() / 2);
+	unsigned char octreeLevel = octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(largestRadius);
+	for (unsigned s = 0; s < sampleCount; ++s)
+	{
+		unsigned i = static_cast<unsigned>((static_cast<uint64_t>(s) * pointCount) / sampleCount);
+
+		CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+		nNSS.level = octreeLevel;
+		nNSS.queryPoint = *corePoints.cloud->getPoint(i);
+		octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+		octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+		unsigned kNN = octree->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, true);
+		nNSS.pointsInNeighbourhood.resize(kNN);
+
+		//from the biggest to the smallest scale
+		for (size_t o = outputs.size(); o > 0; --o)
+		{
+			const MomentOutput& output = outputs[o - 1];
+			double sqRadius = (output.scale / 2) * (output.scale / 2);
+			for (; kNN > 0 && nNSS.pointsInNeighbourhood[kNN - 1].squareDistd > sqRadius; --kNN)
+			{
+			}
+			if (kNN == 0)
+			{
+				break;
+			}
+			nNSS.pointsInNeighbourhood.resize(kNN);
+
+			double exactValue = 0;
+			bool valid = false;
+			if (output.pointFeature)
+				valid = output.pointFeature->computeStat(nNSS.pointsInNeighbourhood, output.second ? output.pointFeature->field2 : output.pointFeature->field1, exactValue);
+			else
+				valid = output.neighborhoodFeature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, exactValue);
+
+			double approxValue = output.sf()->getValue(i);
+			if (valid && std::isfinite(exactValue) && std::isfinite(approxValue))
+			{
+				double error = std::abs(approxValue - exactValue);
+				maxError[o - 1] = std::max(maxError[o - 1], error);
+				sumError[o - 1] += error;
+				++errorCount[o - 1];
+			}
+		}
+	}
+
+	for (size_t o = 0; o < outputs.size(); ++o)
+	{
+		if (errorCount[o] != 0)
+		{
+			ccLog::Print(QString("[3DMASC] Approximate feature %1: max error = %2 / mean error = %3 (measured on %4 core points)")
+							.arg(outputs[o].name())
+							.arg(maxError[o])
+							.arg(sumError[o] / errorCount[o])
+							.arg(errorCount[o]));
+		}
+	}
+
+	return true;
+}
+
+//! Computes the scaled features with vertical cylindrical neighborhoods (columns)
+static bool ComputeCylindricalFeatures(	const CorePoints& corePoints,
+										ccPointCloud* sourceCloud,
+										const FeaturesAndScales& fas,
+										const NeighborhoodParams& neighborhoodParams,
+										const ExecutionContext& context,
+										QString& errorStr,
+										CCCoreLib::GenericProgressCallback* progressCb)
+{
+	assert(!fas.scales.empty());
+
+	//the columns are only extracted at the largest radius (the smaller scales are derived from them),
+	//so the index cells are sized on this radius (half of it, i.e. about 5x5 cells per query)
+	double largestRadius = fas.scales.back() / 2; //scale is the diameter!
+	ColumnIndex columnIndex;
+	if (!columnIndex.build(sourceCloud, largestRadius / 2, errorStr, context))
+	{
+		return false;
+	}
+
+	unsigned pointCount = corePoints.size();
+	QString logMessage = QString("Computing %1 features on cloud %2 with cylindrical neighborhoods\n(core points: %3)").arg(fas.featureCount).arg(sourceCloud->getName()).arg(pointCount);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute features");
+		progressCb->setInfo(qPrintable(logMessage));
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	bool success = true;
+	bool cancelled = false;
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, context.chunk(static_cast<int>(pointCount)))
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+		if (!success || cancelled)
+		{
+			continue;
+		}
+
+		const CCVector3* corePoint = corePoints.cloud->getPoint(i);
+		CCCoreLib::DgmOctree::NeighboursSet neighbours;
+		CCCoreLib::DgmOctree::NeighboursSet sampledNeighbourhood;
+
+		size_t kNN = columnIndex.findNeighborsInColumn(*corePoint, largestRadius, neighbours, true);
+
+		//for each scale (from the largest to the smallest)
+		for (size_t scaleIndex = 0; kNN != 0 && scaleIndex < fas.scales.size(); ++scaleIndex)
+		{
+			double currentScale = fas.scales[fas.scales.size() - 1 - scaleIndex]; //from the biggest to the smallest!
+
+			if (scaleIndex != 0)
+			{
+				double radius = currentScale / 2; //scale is the diameter!
+				double sqRadius = radius * radius;
+				//remove the farthest points
+				for (; kNN > 0 && neighbours[kNN - 1].squareDistd > sqRadius; --kNN)
+				{
+				}
+
+				if (kNN == 0)
+				{
+					//no need to go further
+					break;
+				}
+				neighbours.resize(kNN);
+			}
+
+			//bounded neighborhood
+			CCCoreLib::DgmOctree::NeighboursSet* neighbourhood = &neighbours;
+			unsigned maxNeighbors = neighborhoodParams.maxNeighborsAt(currentScale);
+			if (maxNeighbors != 0 && kNN > maxNeighbors)
+			{
+				StratifiedSubset(neighbours, maxNeighbors, static_cast<unsigned>(i), sampledNeighbourhood);
+				neighbourhood = &sampledNeighbourhood;
+			}
+
+			if (!ComputeScaledFeatures(fas, currentScale, sourceCloud, *neighbourhood, kNN, *corePoint, static_cast<unsigned>(i), errorStr))
+			{
+				success = false;
+				break;
+			}
+		}
+
+		if (progressCb)
+		{
+			mutex.lock();
+			if (!nProgress.oneStep())
+			{
+				cancelled = true;
+			}
+			mutex.unlock();
+		}
+	}
+
+	if (cancelled)
+	{
+		ccLog::Warning("Process cancelled");
+		errorStr = "Process cancelled";
+		return false;
+	}
+
+	return success;
+}
+
+//! Builds the rasters of the context classes (one per context cloud and class) and attaches them to the context-based features
+static bool PrepareGroundRasters(const Feature::Set& features, bool useMinZ, const ExecutionContext& context, QString& errorStr)
+{
+	struct RasterRequest
+	{
+		ccPointCloud* cloud = nullptr;
+		int classLabel = 0;
+		double scale = std::numeric_limits<double>::quiet_NaN();
+		int kNN = 0;
+		std::vector<ContextBasedFeature*> features;
+		GroundRaster::Shared raster;
+		QString error;
+	};
+
+	std::vector<RasterRequest> requests;
+	try
+	{
+		for (const Feature::Shared& feature : features)
+		{
+			if (!feature || feature->getType() != Feature::Type::ContextBasedFeature || !feature->cloud1)
+			{
+				continue;
+			}
+			ContextBasedFeature* contextFeature = static_cast<ContextBasedFeature*>(feature.data());
+
+			size_t r = 0;
+			for (; r < requests.size(); ++r)
+			{
+				if (requests[r].cloud == contextFeature->cloud1 && requests[r].classLabel == contextFeature->ctxClassLabel)
+					break;
+			}
+			if (r == requests.size())
+			{
+				requests.emplace_back();
+				requests.back().cloud = contextFeature->cloud1;
+				requests.back().classLabel = contextFeature->ctxClassLabel;
+			}
+
+			RasterRequest& request = requests[r];
+			if (contextFeature->scaled())
+			{
+				if (std::isnan(request.scale) || contextFeature->scale < request.scale)
+					request.scale = contextFeature->scale;
+			}
+			else
+			{
+				if (request.kNN == 0 || contextFeature->kNN < request.kNN)
+					request.kNN = contextFeature->kNN;
+			}
+			request.features.push_back(contextFeature);
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorStr = "Not enough memory";
+		return false;
+	}
+
+	if (requests.empty())
+	{
+		return true;
+	}
+
+	//the rasters are built concurrently, each with its share of the threads
+	int concurrentRequestCount = std::min(context.threadCount(), static_cast<int>(requests.size()));
+	ExecutionContext rasterContext = context;
+	rasterContext.maxThreadCount = std::max(1, context.threadCount() / concurrentRequestCount);
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(concurrentRequestCount)
+#endif
+#endif
+	for (int r = 0; r < static_cast<int>(requests.size()); ++r)
+	{
+		RasterRequest& request = requests[r];
+		CCCoreLib::ScalarField* classifSF = Tools::GetClassificationSF(request.cloud);
+		if (!classifSF)
+		{
+			//the features will complain themselves
+			continue;
+		}
+
+		GroundRaster::Shared raster(new GroundRaster);
+		if (raster->build(request.cloud, classifSF, request.classLabel, request.scale, request.kNN, useMinZ, request.error, rasterContext))
+		{
+			request.raster = raster;
+		}
+	}
+
+	for (const RasterRequest& request : requests)
+	{
+		if (!request.error.isEmpty())
+		{
+			errorStr = QString("Failed to build the raster of class %1 (cloud %2): %3").arg(request.classLabel).arg(request.cloud->getName()).arg(request.error);
+			return false;
+		}
+		if (request.raster)
+		{
+			ccLog::Print(QString("Raster of class %1 (cloud %2): %3 points, cell size = %4").arg(request.classLabel).arg(request.cloud->getName()).arg(request.raster->pointCount()).arg(request.raster->cellSize()));
+		}
+		for (ContextBasedFeature* feature : request.features)
+		{
+			feature->groundRaster = request.raster;
+		}
+	}
+
+	return true;
+}
+
+//! Computes the scaled features on a given source cloud (see PrepareFeatures)
+/** \param octree octree of the source cloud (spherical neighborhoods only)
+**/
+static bool ComputeScaledFeaturesOnCloud(	const CorePoints& corePoints,
+											ccPointCloud* sourceCloud,
+											bool cylindrical,
+											FeaturesAndScales& fas,
+											ccOctree::Shared octree,
+											const NeighborhoodParams& neighborhoodParams,
+											const ExecutionContext& context,
+											QString& errorStr,
+											CCCoreLib::GenericProgressCallback* progressCb)
+{
+	//cylindrical neighborhoods
+	if (cylindrical)
+	{
+		return ComputeCylindricalFeatures(corePoints, sourceCloud, fas, neighborhoodParams, context, errorStr, progressCb);
+	}
+
+	if (!octree)
+	{
+		assert(false);
+		errorStr = "Missing octree";
+		return false;
+	}
+
+	//the scales that can be computed with the approximate moments don't need any extraction
+	std::vector<double> extractionScales = fas.scales;
+	if (neighborhoodParams.approximateMomentsCellRatio > 0)
+	{
+		std::vector<double> momentScales;
+		extractionScales.clear();
+		for (double scale : fas.scales)
+		{
+			if (SupportsApproximateMoments(fas, scale))
+				momentScales.push_back(scale);
+			else
+				extractionScales.push_back(scale);
+		}
+
+		if (!momentScales.empty() && !ComputeApproximateMomentFeatures(corePoints, sourceCloud, octree, fas, momentScales, neighborhoodParams.approximateMomentsCellRatio, context, errorStr, progressCb))
+		{
+			return false;
+		}
+
+		if (extractionScales.empty())
+		{
+			return true;
+		}
+	}
+
+	//prepare the extraction levels (full density and subsampled clouds)
+	std::vector<ExtractionLevel> levels;
+	try
+	{
+		if (!BuildExtractionLevels(sourceCloud, octree, fas, extractionScales, neighborhoodParams, levels, errorStr, progressCb))
+		{
+			return false;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorStr = "Not enough memory";
+		return false;
+	}
+
+	unsigned pointCount = corePoints.size();
+	QString logMessage = QString("Computing %1 features on cloud %2\n(core points: %3)").arg(fas.featureCount).arg(sourceCloud->getName()).arg(pointCount);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute features");
+		progressCb->setInfo(qPrintable(logMessage));
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	//the output pages of each chunk are moved to the node of the thread computing it
+	NumaPlacement placement(context.migrateOutputPages);
+	std::vector<CCCoreLib::ScalarField*> outputSFs;
+	if (placement.isEnabled())
+	{
+		try
+		{
+			GetScaledFeatureSFs(fas, sourceCloud, outputSFs);
+		}
+		catch (const std::bad_alloc&)
+		{
+			errorStr = "Not enough memory";
+			return false;
+		}
+	}
+	int chunkSize = context.chunk(static_cast<int>(pointCount));
+
+	bool success = true;
+	QElapsedTimer timer;
+	timer.start();
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(context.threadCount()) schedule(dynamic, chunkSize)
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+		if (placement.isEnabled() && (i % chunkSize) == 0)
+		{
+			//first iteration of a chunk
+			size_t lastIndex = std::min(static_cast<size_t>(i) + chunkSize, static_cast<size_t>(pointCount));
+			for (CCCoreLib::ScalarField* sf : outputSFs)
+			{
+				placement.claim(sf->data(), static_cast<size_t>(i), lastIndex);
+			}
+		}
+
+		const CCVector3* corePoint = corePoints.cloud->getPoint(i);
+		CCCoreLib::DgmOctree::NeighboursSet sampledNeighbourhood;
+
+		for (const ExtractionLevel& level : levels)
+		{
+			if (level.scales.empty())
+			{
+				continue;
+			}
+
+			//spherical neighborhood extraction structure
+			CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+			{
+				nNSS.level = level.octreeLevel;
+				nNSS.queryPoint = *corePoint;
+				level.octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+				level.octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+			}
+
+			//we extract the point's neighbors
+			unsigned kNN = level.octree->findNeighborsInASphereStartingFromCell(nNSS, level.largestRadius, true);
+			if (kNN == 0)
+			{
+				continue;
+			}
+			nNSS.pointsInNeighbourhood.resize(kNN);
+
+			if (level.subset)
+			{
+				//the features expect indexes in the source cloud
+				for (CCCoreLib::DgmOctree::PointDescriptor& Pd : nNSS.pointsInNeighbourhood)
+				{
+					Pd.pointIndex = level.subset->getPointGlobalIndex(Pd.pointIndex);
+				}
+			}
+
+			//for each scale (from the largest to the smallest)
+			for (size_t scaleIndex = 0; scaleIndex < level.scales.size(); ++scaleIndex)
+			{
+				double currentScale = level.scales[level.scales.size() - 1 - scaleIndex]; //from the biggest to the smallest!
+
+				if (scaleIndex != 0)
+				{
+					double radius = currentScale / 2; //scale is the diameter!
+					double sqRadius = radius * radius;
+					//remove the farthest points
+					for (; kNN > 0; --kNN)
+					{
+						if (nNSS.pointsInNeighbourhood[kNN - 1].squareDistd <= sqRadius)
+						{
+							break;
+						}
+					}
+
+					if (kNN == 0)
+					{
+						//no need to go further
+						break;
+					}
+					nNSS.pointsInNeighbourhood.resize(kNN);
+				}
+
+				//bounded neighborhood
+				CCCoreLib::DgmOctree::NeighboursSet* neighbourhood = &nNSS.pointsInNeighbourhood;
+				unsigned maxNeighbors = neighborhoodParams.maxNeighborsAt(currentScale);
+				if (maxNeighbors != 0 && kNN > maxNeighbors)
+				{
+					StratifiedSubset(nNSS.pointsInNeighbourhood, maxNeighbors, static_cast<unsigned>(i), sampledNeighbourhood);
+					neighbourhood = &sampledNeighbourhood;
+				}
+
+				if (!ComputeScaledFeatures(fas, currentScale, sourceCloud, *neighbourhood, kNN, nNSS.queryPoint, static_cast<unsigned>(i), errorStr))
+				{
+					success = false;
+					break;
+				}
+			} //for each scale
+
+			if (!success)
 			{
-				errorStr = "Not enough memory";
-				return false;
+				break;
+			}
+		} //for each level
+	
+		if (progressCb)
+		{
+			mutex.lock();
+			bool cancelled = !nProgress.oneStep();
+			mutex.unlock();
+			if (cancelled)
+			{
+				//process cancelled by the user
+				ccLog::Warning("Process cancelled");
+				errorStr = "Process cancelled";
+				success = false;
+				break;
 			}
 		}
 
+	} //for each point
+
+	ccLog::Print(QString("[3DMASC] Features computed on cloud %1 in %2 s").arg(sourceCloud->getName()).arg(timer.elapsed() / 1000.0, 0, 'f', 1));
+	if (placement.isEnabled())
+	{
+		ccLog::Print("[3DMASC] " + placement.report());
 	}
 
-	bool success = true;
+	return success;
+}
 
-	//if we have scaled features
-	if (!cloudsWithScaledFeatures.empty())
+//! Gives back their original (derived) fields to the point features, instead of the materialized ones
+static void RestoreDerivedFields(const Feature::Set& features)
+{
+	for (const Feature::Shared& feature : features)
 	{
-		//for each cloud
-		for (QMap<ccPointCloud*, FeaturesAndScales>::iterator it = cloudsWithScaledFeatures.begin(); success && it != cloudsWithScaledFeatures.end(); ++it)
+		if (feature->getType() == Feature::Type::PointFeature)
 		{
-			FeaturesAndScales& fas = it.value();
-			ccPointCloud* sourceCloud = it.key();
-
-			//sort the scales
-			std::sort(fas.scales.begin(), fas.scales.end());
-
-			//get the octree
-			ccOctree::Shared octree = sourceCloud->getOctree();
-			if (!octree)
+			PointFeature* pointFeature = static_cast<PointFeature*>(feature.data());
+			for (IScalarFieldWrapper::Shared* field : { &pointFeature->field1, &pointFeature->field2 })
 			{
-				ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(sourceCloud->getName()).arg(sourceCloud->size()));
-				if (progressCb)
-					progressCb->start();
-				QCoreApplication::processEvents();
-				octree = sourceCloud->computeOctree(progressCb);
-				if (!octree)
+				QSharedPointer<MaterializedFieldWrapper> materializedField = field->dynamicCast<MaterializedFieldWrapper>();
+				if (materializedField)
 				{
-					errorStr = "Failed to compute octree (not enough memory?)";
-					return false;
+					*field = materializedField->source();
 				}
 			}
+		}
+	}
+}
+
+bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& errorStr,
+							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/,
+							const NeighborhoodParams& neighborhoodParams/*=NeighborhoodParams()*/,
+							const ExecutionContext& context/*=ExecutionContext()*/)
+{
+	if (features.empty() || !corePoints.origin)
+	{
+		//invalid input parameters
+		assert(false);
+		return false;
+	}
 
-			//now extract the neighborhoods from the biggest to the smallest scale
-			double largetScale = fas.scales.back();
-			PointCoordinateType largestRadius = static_cast<PointCoordinateType>(largetScale / 2); //scale is the diameter!
-			unsigned char octreeLevel = octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(largestRadius);
+	//rasters of the context classes (if any)
+	if (	neighborhoodParams.groundRaster != GroundRasterMode::None
+		&&	!PrepareGroundRasters(features, neighborhoodParams.groundRaster == GroundRasterMode::MinZ, context, errorStr))
+	{
+		return false;
+	}
 
-			unsigned pointCount = corePoints.size();
-			QString logMessage = QString("Computing %1 features on cloud %2\n(core points: %3)").arg(fas.featureCount).arg(sourceCloud->getName()).arg(pointCount);
-			if (progressCb)
-			{
-				progressCb->setMethodTitle("Compute features");
-				progressCb->setInfo(qPrintable(logMessage));
-			}
-			ccLog::Print(logMessage);
-			CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+	//gather all the scales that need to be extracted
+	typedef QPair<ccPointCloud*, bool> SourceKey; //(source cloud, cylindrical neighborhoods)
+	QMap<SourceKey, FeaturesAndScales> cloudsWithScaledFeatures;
+	//and prepare the features (scalar fields, etc.) at the same time
+	for (const Feature::Shared& feature : features)
+	{
+		QString errorMessage("invalid pointer");
+		assert(!corePoints.role.isEmpty());
+		if (!feature || !feature->checkValidity(corePoints.role, errorMessage))
+		{
+			errorStr = "Invalid rule/feature: " + errorMessage;
+			return false;
+		}
 
-			QMutex mutex;
-#ifndef _DEBUG
-#if defined(_OPENMP)
-			omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
-#endif
-#endif
-			for (int i = 0; i < static_cast<int>(pointCount); ++i)
+		//prepare the feature
+		if (!feature->prepare(corePoints, errorStr, progressCb, generatedScalarFields, context))
+		{
+			//something failed (error should be up to date)
+			return false;
+		}
+
+		if (feature->scaled())
+		{
+			try
 			{
-				//spherical neighborhood extraction structure
-				CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+				switch (feature->getType())
 				{
-					nNSS.level = octreeLevel;
-					nNSS.queryPoint = *corePoints.cloud->getPoint(i);
-					octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
-					octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
-				}
-
-				//we extract the point's neighbors
-				unsigned kNN = octree->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, true);
-				if (kNN != 0)
+				//Point features
+				case Feature::Type::PointFeature:
 				{
-					nNSS.pointsInNeighbourhood.resize(kNN);
-
-					//for each scale (from the largest to the smallest)
-					for (size_t scaleIndex = 0; scaleIndex < fas.scales.size(); ++scaleIndex)
+					//build the scaled feature list attached to the first cloud
+					if (feature->cloud1
+						&& !static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
 					{
-						double currentScale = fas.scales[fas.scales.size() - 1 - scaleIndex]; //from the biggest to the smallest!
-
-						if (scaleIndex != 0)
+						FeaturesAndScales& fas = cloudsWithScaledFeatures[SourceKey(feature->cloud1, feature->cylindrical)];
+						fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
+						++fas.featureCount;
+						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
+						{
+							fas.scales.push_back(feature->scale);
+						}
+					}
+					//build the scaled feature list attached to the second cloud (if any)
+					if (feature->cloud2
+						&& feature->cloud2 != feature->cloud1
+						&& feature->op != Feature::NO_OPERATION)
+					{
+						if(!static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
 						{
-							double radius = currentScale / 2; //scale is the diameter!
-							double sqRadius = radius * radius;
-							//remove the farthest points
-							for (; kNN > 0; --kNN)
+							if (!static_cast<PointFeature*>(feature.data())->statSF2WasAlreadyExisting)
 							{
-								if (nNSS.pointsInNeighbourhood[kNN - 1].squareDistd <= sqRadius)
+								FeaturesAndScales& fas = cloudsWithScaledFeatures[SourceKey(feature->cloud2, feature->cylindrical)];
+								++fas.featureCount;
+								fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
+								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
 								{
-									break;
+									fas.scales.push_back(feature->scale);
 								}
 							}
-
-							if (kNN == 0)
-							{
-								//no need to go further
-								break;
-							}
-							nNSS.pointsInNeighbourhood.resize(kNN);
 						}
+					}
+				}
+				break;
 
-						//Point features
-						for (PointFeature::Shared& feature : fas.pointFeaturesPerScale[currentScale])
+				//Neighborhood features
+				case Feature::Type::NeighborhoodFeature:
+				{
+					//build the scaled feature list attached to the first cloud
+					if (feature->cloud1
+						&& !static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
+					{
+						FeaturesAndScales& fas = cloudsWithScaledFeatures[SourceKey(feature->cloud1, feature->cylindrical)];
+						fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
+						++fas.featureCount;
+						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
 						{
-							if (feature->cloud1 == sourceCloud && feature->statSF1 && feature->field1)
-							{
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field1, outputValue))
-								{
-									//an error occurred
-									success = false;
-									break;
-								}
-
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->statSF1->setValue(i, v1);
-							}
+							fas.scales.push_back(feature->scale);
+						}
+					}
 
-							if (feature->cloud2 == sourceCloud && feature->statSF2 && feature->field2)
+					//build the scaled feature list attached to the second cloud (if any)
+					if (feature->cloud2
+						&& feature->cloud2 != feature->cloud1
+						&& feature->op != Feature::NO_OPERATION)
+					{
+						if (!static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
+						{
+							if (!static_cast<NeighborhoodFeature*>(feature.data())->sf2WasAlreadyExisting)
 							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field2, outputValue))
+								FeaturesAndScales& fas = cloudsWithScaledFeatures[SourceKey(feature->cloud2, feature->cylindrical)];
+								fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
+								++fas.featureCount;
+								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
 								{
-									//an error occurred
-									success = false;
-									break;
+									fas.scales.push_back(feature->scale);
 								}
-
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->statSF2->setValue(i, v2);
 							}
 						}
+					}
+				}
+				break;
 
-						//Neighborhood features
-						for (NeighborhoodFeature::Shared& feature : fas.neighborhoodFeaturesPerScale[currentScale])
+				//Context-based features
+				case Feature::Type::ContextBasedFeature:
+				{
+					//build the scaled feature list attached to the context cloud
+					if (feature->cloud1
+						&& !static_cast<ContextBasedFeature*>(feature.data())->sfWasAlreadyExisting // nothing to compute if the scalar field was already there
+						&& !static_cast<ContextBasedFeature*>(feature.data())->groundRaster) // already computed with the raster
+					{
+						FeaturesAndScales& fas = cloudsWithScaledFeatures[SourceKey(feature->cloud1, feature->cylindrical)];
+						fas.contextBasedFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<ContextBasedFeature>(feature));
+						++fas.featureCount;
+						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
 						{
-							if (feature->cloud1 == sourceCloud && feature->sf1)
-							{
-								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
-									success = false;
-									break;
-								}
+							fas.scales.push_back(feature->scale);
+						}
+					}
+				}
+				break;
 
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->sf1->setValue(i, v1);
-							}
+				default:
+					assert(false);
+					break;
+				}
+			}
+			catch (const std::bad_alloc&)
+			{
+				errorStr = "Not enough memory";
+				return false;
+			}
+		}
 
-							if (feature->cloud2 == sourceCloud && feature->sf2)
-							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud2->getName();
-									success = false;
-									break;
-								}
+	}
 
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->sf2->setValue(i, v2);
-							}
-						}
+	//the remaining work is modeled as a graph of stages (octrees, scaled features computation
+	//on each source cloud, finalization of the features), so that the independent ones can run
+	//concurrently. The features preparation above stays sequential as it creates the scalar fields.
+	StageGraph graph;
+	//octree of each source cloud (spherical neighborhoods)
+	std::map<ccPointCloud*, ccOctree::Shared> octrees;
+	//octrees built by the graph (to be attached to their cloud afterwards)
+	std::vector<ccPointCloud*> builtOctreeClouds;
+	//scaled features computation stages of each source cloud
+	std::map<ccPointCloud*, std::vector<int> > cloudStages;
+	//derived fields (EchoRat, normal dip, etc.) of each source cloud, computed once and shared by the point features
+	std::map<std::pair<const ccPointCloud*, QString>, std::pair<QSharedPointer<MaterializedFieldWrapper>, int> > derivedFields;
+	QMutex finishMutex;
 
-						//Context-based features
-						for (ContextBasedFeature::Shared& feature : fas.contextBasedFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->sf)
-							{
-								ScalarType outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
-									success = false;
-									break;
-								}
+	try
+	{
+		//for each cloud
+		for (QMap<SourceKey, FeaturesAndScales>::iterator it = cloudsWithScaledFeatures.begin(); it != cloudsWithScaledFeatures.end(); ++it)
+		{
+			FeaturesAndScales& fas = it.value();
+			ccPointCloud* sourceCloud = it.key().first;
+			bool cylindrical = it.key().second;
 
-								feature->sf->setValue(i, outputValue);
-							}
-						}
+			//sort the scales
+			std::sort(fas.scales.begin(), fas.scales.end());
+
+			std::vector<int> dependencies;
 
-						if (!success)
+			//the derived fields read by the point features are computed beforehand (once per cloud)
+			for (QMap<double, std::vector<PointFeature::Shared> >::iterator itPF = fas.pointFeaturesPerScale.begin(); itPF != fas.pointFeaturesPerScale.end(); ++itPF)
+			{
+				for (const PointFeature::Shared& feature : itPF.value())
+				{
+					for (int i = 0; i < 2; ++i)
+					{
+						bool second = (i != 0);
+						const ccPointCloud* cloud = (second ? feature->cloud2 : feature->cloud1);
+						IScalarFieldWrapper::Shared& field = (second ? feature->field2 : feature->field1);
+						if (cloud != sourceCloud || !field || !field->isDerived())
 						{
-							break;
+							continue;
 						}
-					} //for each scale
 
+						std::pair<QSharedPointer<MaterializedFieldWrapper>, int>& derivedField = derivedFields[{ cloud, field->getName() }];
+						if (!derivedField.first)
+						{
+							QSharedPointer<MaterializedFieldWrapper> materializedField(new MaterializedFieldWrapper(field));
+							derivedField.first = materializedField;
+							derivedField.second = graph.addStage(	QString("%1 of %2").arg(field->getName()).arg(sourceCloud->getName()),
+																	[materializedField](const ExecutionContext& stageContext, QString& error, CCCoreLib::GenericProgressCallback*)
+																	{
+																		return materializedField->materialize(stageContext, error);
+																	});
+						}
+						field = derivedField.first;
+						if (std::find(dependencies.begin(), dependencies.end(), derivedField.second) == dependencies.end())
+						{
+							dependencies.push_back(derivedField.second);
+						}
+					}
 				}
-			
-				if (progressCb)
+			}
+
+			//each statistical measure required by the point features is computed only once
+			size_t featureTermCount = BuildPointStatTerms(fas, sourceCloud);
+			size_t termCount = 0;
+			for (const std::vector<PointStatTerm>& terms : fas.pointStatTermsPerScale)
+			{
+				termCount += terms.size();
+			}
+			if (termCount < featureTermCount)
+			{
+				ccLog::Print(QString("[3DMASC] %1 point feature terms share %2 statistical measures on cloud %3").arg(featureTermCount).arg(termCount).arg(sourceCloud->getName()));
+			}
+
+			ccOctree::Shared* octree = nullptr;
+			if (!cylindrical)
+			{
+				octree = &octrees[sourceCloud];
+				*octree = sourceCloud->getOctree();
+				if (!*octree)
 				{
-					mutex.lock();
-					bool cancelled = !nProgress.oneStep();
-					mutex.unlock();
-					if (cancelled)
-					{
-						//process cancelled by the user
-						ccLog::Warning("Process cancelled");
-						errorStr = "Process cancelled";
-						success = false;
-						break;
-					}
+					//the octree is built in a stage, and attached to the cloud afterwards (in this thread)
+					builtOctreeClouds.push_back(sourceCloud);
+					dependencies.push_back(graph.addStage(	QString("Octree of %1").arg(sourceCloud->getName()),
+															[sourceCloud, octree](const ExecutionContext&, QString& error, CCCoreLib::GenericProgressCallback* stageProgressCb)
+															{
+																ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(sourceCloud->getName()).arg(sourceCloud->size()));
+																ccOctree::Shared cloudOctree(new ccOctree(sourceCloud));
+																if (cloudOctree->build(stageProgressCb) <= 0)
+																{
+																	error = "Failed to compute octree (not enough memory?)";
+																	return false;
+																}
+																*octree = cloudOctree;
+																return true;
+															},
+															std::vector<int>(),
+															false));
 				}
+			}
 
-			} //for each point
-		
+			int stageIndex = graph.addStage(QString("Features on %1%2").arg(sourceCloud->getName()).arg(cylindrical ? " (cylindrical)" : ""),
+											[&corePoints, &neighborhoodParams, sourceCloud, cylindrical, &fas, octree](const ExecutionContext& stageContext, QString& error, CCCoreLib::GenericProgressCallback* stageProgressCb)
+											{
+												return ComputeScaledFeaturesOnCloud(corePoints, sourceCloud, cylindrical, fas, octree ? *octree : ccOctree::Shared(), neighborhoodParams, stageContext, error, stageProgressCb);
+											},
+											dependencies);
+			cloudStages[sourceCloud].push_back(stageIndex);
 		} //for each cloud
+
+		//the scaled features are finalized (math operations, min/max) as soon as their source clouds are processed
+		std::map<std::vector<int>, Feature::Set> featuresToFinish;
+		for (const Feature::Shared& feature : features)
+		{
+			if (!feature->scaled())
+			{
+				continue;
+			}
+
+			std::vector<int> dependencies;
+			for (ccPointCloud* cloud : { feature->cloud1, feature->cloud2 })
+			{
+				std::map<ccPointCloud*, std::vector<int> >::const_iterator itStages = cloudStages.find(cloud);
+				if (cloud && itStages != cloudStages.end())
+				{
+					dependencies.insert(dependencies.end(), itStages->second.begin(), itStages->second.end());
+				}
+			}
+			std::sort(dependencies.begin(), dependencies.end());
+			dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+			featuresToFinish[dependencies].push_back(feature);
+		}
+
+		//the features are finalized one at a time (several features may share the same output
+		//scalar field), but the math operations of each feature use the threads of its stage
+		std::vector<int> finishStages;
+		for (const auto& it : featuresToFinish)
+		{
+			const Feature::Set& featureSet = it.second;
+			finishStages.push_back(graph.addStage(	QString("Finalization of %1 feature(s)").arg(featureSet.size()),
+							[&corePoints, &finishMutex, featureSet](const ExecutionContext& stageContext, QString& error, CCCoreLib::GenericProgressCallback*)
+							{
+								QMutexLocker locker(&finishMutex);
+								for (const Feature::Shared& feature : featureSet)
+								{
+									if (!feature->finish(corePoints, error, stageContext))
+									{
+										return false;
+									}
+								}
+								return true;
+							},
+							it.first));
+		}
+
+		//the min and max values of all the output scalar fields are updated at once, in parallel
+		//(rather than one sweep per feature, and per math operation, while finishing them)
+		std::vector<CCCoreLib::ScalarField*> outputSFs;
+		for (const auto& it : featuresToFinish)
+		{
+			for (const Feature::Shared& feature : it.second)
+			{
+				int sfIndex = corePoints.cloud->getScalarFieldIndexByName(qPrintable(feature->source.name));
+				if (sfIndex >= 0)
+				{
+					outputSFs.push_back(corePoints.cloud->getScalarField(sfIndex));
+				}
+			}
+		}
+		if (!outputSFs.empty())
+		{
+			graph.addStage(	QString("Min/max of %1 scalar field(s)").arg(outputSFs.size()),
+							[outputSFs](const ExecutionContext& stageContext, QString&, CCCoreLib::GenericProgressCallback*)
+							{
+								Feature::ComputeMinAndMax(outputSFs, stageContext);
+								return true;
+							},
+							finishStages);
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		//the point features must not keep the (not materialized) derived fields
+		RestoreDerivedFields(features);
+		errorStr = "Not enough memory";
+		return false;
+	}
+
+	bool success = graph.run(context, errorStr, progressCb);
+	if (graph.stageCount() > 1)
+	{
+		ccLog::Print("[3DMASC] " + graph.report());
+	}
+
+	//display the output of the last scaled feature (in this thread, once all the stages are done)
+	if (success)
+	{
+		for (Feature::Set::const_reverse_iterator it = features.rbegin(); it != features.rend(); ++it)
+		{
+			int sfIndex = ((*it)->scaled() ? corePoints.cloud->getScalarFieldIndexByName(qPrintable((*it)->source.name)) : -1);
+			if (sfIndex >= 0)
+			{
+				corePoints.cloud->setCurrentDisplayedScalarField(sfIndex);
+				break;
+			}
+		}
+	}
+
+	//release the derived fields (the point features read them on the fly again)
+	RestoreDerivedFields(features);
+	derivedFields.clear();
+
+	//attach the new octrees to their cloud
+	for (ccPointCloud* cloud : builtOctreeClouds)
+	{
+		if (octrees[cloud])
+		{
+			cloud->setOctree(octrees[cloud]);
+		}
 	}
 
 	for (const Feature::Shared& feature : features)
 	{
-		//we have to 'finish' the process for scaled features
-		if (feature->scaled() && !feature->finish(corePoints, errorStr))
+		//release the rasters
+		if (feature->getType() == Feature::Type::ContextBasedFeature)
 		{
-			return false;
+			static_cast<ContextBasedFeature*>(feature.data())->groundRaster.clear();
 		}
 	}
 
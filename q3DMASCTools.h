@@ -42,7 +42,7 @@ namespace masc
 
 		static bool LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified);
 
-		static bool LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent = nullptr);
+		static bool LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, NeighborhoodParams* neighborhoodParams = nullptr, QWidget* parent = nullptr);
 
 		static bool LoadFile(	const QString& filename,
 								Tools::NamedClouds* clouds,
@@ -52,12 +52,23 @@ namespace masc
 								masc::CorePoints* corePoints = nullptr, //requires 'clouds'
 								masc::Classifier* classifier = nullptr,
 								TrainParameters* parameters = nullptr,
+								NeighborhoodParams* neighborhoodParams = nullptr, //defaults to 'parameters->neighborhood'
 								QWidget* parent = nullptr);
 
-		static bool SaveClassifier(QString filename, const Feature::Set& features, const QString corePointsRole, const masc::Classifier& classifier, QWidget* parent = nullptr);
+		//! Saves a classifier file
+		/** \param parameters if not null, the training parameters are saved as well (as PARAM_XXX=Y lines)
+		**/
+		static bool SaveClassifier(QString filename, const Feature::Set& features, const QString corePointsRole, const masc::Classifier& classifier, const TrainParameters* parameters = nullptr, QWidget* parent = nullptr);
 
+		//! Computes the (scaled) features on the core points
+		/** \param neighborhoodParams if a target number of neighbors is set, the neighborhoods
+			of the large scales are extracted from subsampled versions of the source clouds
+			\param context threads and chunk size used by the parallel loops
+		**/
         static bool PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& error,
-                                    CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr);
+                                    CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr,
+                                    const NeighborhoodParams& neighborhoodParams = NeighborhoodParams(),
+                                    const ExecutionContext& context = ExecutionContext());
 
 		static bool RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset);
 
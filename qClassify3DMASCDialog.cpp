@@ -113,6 +113,13 @@ Classify3DMASCDialog::Classify3DMASCDialog(ccMainAppInterface* app, bool trainMo
 		label->setText(tr("Trainer file"));
 		warningLabel->setVisible(false);
 		warningLabel->setText("Assign each role to the right cloud, and select the cloud on which to train the classifier");
+		classProbabilitiesCheckBox->setVisible(false);
+		top2ProbabilitiesCheckBox->setVisible(false);
+		threadCountLabel->setVisible(false);
+		threadCountSpinBox->setVisible(false);
+		chunkSizeLabel->setVisible(false);
+		chunkSizeSpinBox->setVisible(false);
+		migrateOutputPagesCheckBox->setVisible(false);
 	}
 
 	onCloudChanged(0);
@@ -131,6 +138,11 @@ void Classify3DMASCDialog::readSettings()
 	settings.beginGroup("3DMASC");
 	bool keepAttributes = settings.value("keepAttributes", false).toBool();
 	this->keepAttributesCheckBox->setChecked(keepAttributes);
+	classProbabilitiesCheckBox->setChecked(settings.value("classProbabilities", false).toBool());
+	top2ProbabilitiesCheckBox->setChecked(settings.value("top2Probabilities", false).toBool());
+	threadCountSpinBox->setValue(settings.value("threadCount", 0).toInt());
+	chunkSizeSpinBox->setValue(settings.value("chunkSize", 0).toInt());
+	migrateOutputPagesCheckBox->setChecked(settings.value("migrateOutputPages", false).toBool());
 }
 
 void Classify3DMASCDialog::writeSettings()
@@ -138,6 +150,11 @@ void Classify3DMASCDialog::writeSettings()
 	QSettings settings;
 	settings.beginGroup("3DMASC");
 	settings.setValue("keepAttributes", keepAttributesCheckBox->isChecked());
+	settings.setValue("classProbabilities", classProbabilitiesCheckBox->isChecked());
+	settings.setValue("top2Probabilities", top2ProbabilitiesCheckBox->isChecked());
+	settings.setValue("threadCount", threadCountSpinBox->value());
+	settings.setValue("chunkSize", chunkSizeSpinBox->value());
+	settings.setValue("migrateOutputPages", migrateOutputPagesCheckBox->isChecked());
 }
 
 void Classify3DMASCDialog::setCloudRoles(const QList<QString>& roles, QString corePointsLabel)
@@ -256,6 +273,15 @@ void Classify3DMASCDialog::getClouds(QMap<QString, ccPointCloud*>& clouds) const
 	}
 }
 
+masc::ExecutionContext Classify3DMASCDialog::getExecutionContext() const
+{
+	masc::ExecutionContext context;
+	context.maxThreadCount = threadCountSpinBox->value();
+	context.chunkSize = chunkSizeSpinBox->value();
+	context.migrateOutputPages = migrateOutputPagesCheckBox->isChecked();
+	return context;
+}
+
 void Classify3DMASCDialog::onCloudChanged(int dummy)
 {
 	if (!cloud1ComboBox->isEnabled())
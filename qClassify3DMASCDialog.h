@@ -22,6 +22,9 @@
 
 #include <ui_Classify3DMASCDialog.h>
 
+//Local
+#include "ExecutionContext.h"
+
 class ccMainAppInterface;
 class ccPointCloud;
 
@@ -47,6 +50,9 @@ public:
 	//! Returns the selected point clouds
 	void getClouds(QMap<QString, ccPointCloud*>& clouds) const;
 
+	//! Returns the execution context (threads, etc.)
+	masc::ExecutionContext getExecutionContext() const;
+
 protected slots:
 
 	void onCloudChanged(int);
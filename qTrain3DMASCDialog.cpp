@@ -34,12 +34,17 @@
 #include <iostream>
 
 static const int FeatureImportanceColumn = 1;
+static const int FeaturePermutationImportanceColumn = 2;
+static const int FeatureStatusColumn = 3;
 
 Train3DMASCDialog::Train3DMASCDialog(QWidget* parent/*=nullptr*/)
 	: QDialog(parent)
 	, Ui::Train3DMASCDialog()
 	, classifierSaved(false)
 	, saveRequested(false)
+	, featureSelectionRequested(false)
+	, hyperParameterSearchRequested(false)
+	, crossValidationRequested(false)
 	, traceFileConfigured(false)
 	, m_traceFile(nullptr)
 	, run(0)
@@ -54,6 +59,10 @@ Train3DMASCDialog::Train3DMASCDialog(QWidget* parent/*=nullptr*/)
 
 	connect(closePushButton, SIGNAL(clicked()), this, SLOT(onClose()));
 	connect(savePushButton, SIGNAL(clicked()), this, SLOT(onSave()));
+	connect(modelComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(onModelTypeChanged(int)));
+	connect(featureSelectionPushButton, SIGNAL(clicked()), this, SLOT(onSelectFeatures()));
+	connect(hpSearchPushButton, SIGNAL(clicked()), this, SLOT(onSearchHyperParameters()));
+	connect(cvPushButton, SIGNAL(clicked()), this, SLOT(onCrossValidate()));
 	connect(exportToolButton, SIGNAL(clicked()), this, SLOT(onExportResults()));
 }
 
@@ -76,6 +85,7 @@ void Train3DMASCDialog::readSettings()
 	this->keepAttributesCheckBox->setChecked(keepAttributes);
 	bool saveTrace = settings.value("saveTrace", false).toBool();
 	setCheckBoxSaveTrace(saveTrace);
+	permutationImportanceCheckBox->setChecked(settings.value("permutationImportance", false).toBool());
 }
 
 void Train3DMASCDialog::writeSettings()
@@ -84,6 +94,38 @@ void Train3DMASCDialog::writeSettings()
 	settings.beginGroup("3DMASC");
 	settings.setValue("keepAttributes", keepAttributesCheckBox->isChecked());
 	settings.setValue("saveTrace", checkBox_keepTraces->isChecked());
+	settings.setValue("permutationImportance", permutationImportanceCheckBox->isChecked());
+}
+
+void Train3DMASCDialog::setModelType(masc::ModelType model)
+{
+	modelComboBox->blockSignals(true);
+	modelComboBox->setCurrentIndex(model == masc::ModelType::GradientBoosting ? 1 : 0);
+	modelComboBox->blockSignals(false);
+	learningRateDoubleSpinBox->setEnabled(model == masc::ModelType::GradientBoosting);
+}
+
+masc::ModelType Train3DMASCDialog::getModelType() const
+{
+	return (modelComboBox->currentIndex() == 1 ? masc::ModelType::GradientBoosting : masc::ModelType::RandomForest);
+}
+
+void Train3DMASCDialog::onModelTypeChanged(int index)
+{
+	bool gradientBoosting = (index == 1);
+	learningRateDoubleSpinBox->setEnabled(gradientBoosting);
+
+	//boosted trees are much shallower: switch between the default depths of each model
+	static const int DefaultRandomTreesDepth = 25;
+	static const int DefaultBoostedTreesDepth = 6;
+	if (gradientBoosting && maxDepthSpinBox->value() == DefaultRandomTreesDepth)
+	{
+		maxDepthSpinBox->setValue(DefaultBoostedTreesDepth);
+	}
+	else if (!gradientBoosting && maxDepthSpinBox->value() == DefaultBoostedTreesDepth)
+	{
+		maxDepthSpinBox->setValue(DefaultRandomTreesDepth);
+	}
 }
 
 void Train3DMASCDialog::clearResults()
@@ -104,6 +146,12 @@ int Train3DMASCDialog::addFeature(QString name, float importance, bool isChecked
 	QTableWidgetItem* importanceItem = new QTableWidgetItem(isnan(importance) ? QString() : QString::number(importance));
 	tableWidget->setItem(index, 1, importanceItem);
 
+	QTableWidgetItem* permutationImportanceItem = new QTableWidgetItem();
+	tableWidget->setItem(index, FeaturePermutationImportanceColumn, permutationImportanceItem);
+
+	QTableWidgetItem* statusItem = new QTableWidgetItem(tr("pending"));
+	tableWidget->setItem(index, FeatureStatusColumn, statusItem);
+
 	return index;
 }
 
@@ -163,6 +211,21 @@ bool Train3DMASCDialog::isFeatureSelected(QString featureName) const
 	return false;
 }
 
+void Train3DMASCDialog::setFeatureSelected(QString featureName, bool selected)
+{
+	for (int index = 0; index < tableWidget->rowCount(); ++index)
+	{
+		QTableWidgetItem* item = tableWidget->item(index, 0);
+		if (item->text() == featureName)
+		{
+			item->setCheckState(selected ? Qt::Checked : Qt::Unchecked);
+			return;
+		}
+	}
+
+	assert(false);
+}
+
 void Train3DMASCDialog::sortByFeatureImportance()
 {
 	tableWidget->sortByColumn(FeatureImportanceColumn, Qt::DescendingOrder);
@@ -183,6 +246,36 @@ void Train3DMASCDialog::setFeatureImportance(QString featureName, float importan
 	assert(false);
 }
 
+void Train3DMASCDialog::setFeaturePermutationImportance(QString featureName, float importance)
+{
+	for (int index = 0; index < tableWidget->rowCount(); ++index)
+	{
+		if (tableWidget->item(index, 0)->text() == featureName)
+		{
+			QTableWidgetItem* item = tableWidget->item(index, FeaturePermutationImportanceColumn);
+			item->setText(isnan(importance) ? QString() : QString::number(importance, 'f', 6));
+			return;
+		}
+	}
+
+	assert(false);
+}
+
+void Train3DMASCDialog::setFeatureReady(QString featureName, bool ready)
+{
+	for (int index = 0; index < tableWidget->rowCount(); ++index)
+	{
+		if (tableWidget->item(index, 0)->text() == featureName)
+		{
+			QTableWidgetItem* item = tableWidget->item(index, FeatureStatusColumn);
+			item->setText(ready ? tr("ready") : tr("pending"));
+			return;
+		}
+	}
+
+	assert(false);
+}
+
 void Train3DMASCDialog::onClose()
 {
 	if (!classifierSaved && QMessageBox::question(this, "Classifier not saved", "Classifier not saved. Do you confirm you want to close the tool?", QMessageBox::Yes, QMessageBox::No) == QMessageBox::No)
@@ -197,6 +290,78 @@ void Train3DMASCDialog::onSave()
 	accept();
 }
 
+void Train3DMASCDialog::onSelectFeatures()
+{
+	featureSelectionRequested = true;
+	accept();
+}
+
+void Train3DMASCDialog::onSearchHyperParameters()
+{
+	hyperParameterSearchRequested = true;
+	accept();
+}
+
+void Train3DMASCDialog::onCrossValidate()
+{
+	crossValidationRequested = true;
+	accept();
+}
+
+//! Reads a list of integer values (separated by spaces), all greater than or equal to 'minValue'
+static bool ReadValues(const QString& text, std::vector<int>& values, int minValue)
+{
+	values.clear();
+	QString simplified = text.simplified();
+	if (simplified.isEmpty())
+		return false;
+
+	for (const QString& token : simplified.split(' '))
+	{
+		bool ok = false;
+		int value = token.toInt(&ok);
+		if (!ok || value < minValue)
+			return false;
+		values.push_back(value);
+	}
+	return !values.empty();
+}
+
+bool Train3DMASCDialog::getHyperParameterSearchParams(masc::HyperParameterSearchParams& params, QString& error) const
+{
+	if (!ReadValues(hpMaxDepthLineEdit->text(), params.maxDepthValues, 1))
+	{
+		error = "Invalid max depth values (positive integers expected)";
+		return false;
+	}
+	if (!ReadValues(hpMaxTreeCountLineEdit->text(), params.maxTreeCountValues, 1))
+	{
+		error = "Invalid max tree count values (positive integers expected)";
+		return false;
+	}
+	if (!ReadValues(hpActiveVarCountLineEdit->text(), params.activeVarCountValues, 0)) //0 = auto
+	{
+		error = "Invalid active var count values";
+		return false;
+	}
+	if (!ReadValues(hpMinSampleCountLineEdit->text(), params.minSampleCountValues, 1))
+	{
+		error = "Invalid min sample count values (positive integers expected)";
+		return false;
+	}
+	if (params.gridSize() > static_cast<double>(masc::HyperParameterSearchParams::MaxGridSize))
+	{
+		error = QString("Too many configurations (%1, max %2)").arg(params.gridSize()).arg(masc::HyperParameterSearchParams::MaxGridSize);
+		return false;
+	}
+
+	params.method = (hpMethodComboBox->currentIndex() == 0 ? masc::HyperParameterSearchParams::GRID_SEARCH : masc::HyperParameterSearchParams::RANDOM_SEARCH);
+	params.randomCandidateCount = hpRandomCandidatesSpinBox->value();
+	params.maxThreadCount = hpThreadCountSpinBox->value();
+
+	return true;
+}
+
 void Train3DMASCDialog::onExportResults(QString filePath/*=""*/)
 {
 	QSettings settings;
@@ -220,12 +385,13 @@ void Train3DMASCDialog::onExportResults(QString filePath/*=""*/)
 	}
 
 	QTextStream stream(&file);
-	stream << "Feature;Importance" << Qt::endl;
+	stream << "Feature;Importance;Permutation importance" << Qt::endl;
 	for (int index = 0; index < tableWidget->rowCount(); ++index)
 	{
 		QString featureName = tableWidget->item(index, 0)->text();
 		QString importance = tableWidget->item(index, FeatureImportanceColumn)->text();
-		stream << featureName << ";" << importance << Qt::endl;
+		QString permutationImportance = tableWidget->item(index, FeaturePermutationImportanceColumn)->text();
+		stream << featureName << ";" << importance << ";" << permutationImportance << Qt::endl;
 	}
 }
 
@@ -25,6 +25,7 @@
 #include <ui_Train3DMASCDialog.h>
 
 #include "confusionmatrix.h"
+#include "q3DMASCModelSelection.h"
 
 //! 3DMASC plugin 'train' dialog
 class Train3DMASCDialog : public QDialog, public Ui::Train3DMASCDialog
@@ -40,6 +41,11 @@ public:
 	void readSettings();
 	void writeSettings();
 
+	//! Sets the classifier model type
+	void setModelType(masc::ModelType model);
+	//! Returns the classifier model type
+	masc::ModelType getModelType() const;
+
 	void clearResults();
 
 	//! Adds a feature (entry) to the results table
@@ -55,10 +61,30 @@ public:
 
 	bool isFeatureSelected(QString featureName) const;
 	void setFeatureImportance(QString featureName, float importance);
+	//! Sets the permutation importance of a feature (NaN = unknown)
+	void setFeaturePermutationImportance(QString featureName, float importance);
+	//! Updates the preparation status of a feature
+	void setFeatureReady(QString featureName, bool ready);
 	void sortByFeatureImportance();
 	
 	inline bool shouldSaveClassifier() const { return saveRequested; }
 
+	//! Returns whether the automatic feature selection has been requested
+	inline bool shouldSelectFeatures() const { return featureSelectionRequested; }
+	inline void setFeatureSelectionDone() { featureSelectionRequested = false; }
+	//! Checks/unchecks a feature
+	void setFeatureSelected(QString featureName, bool selected);
+
+	//! Returns whether the hyperparameter search has been requested
+	inline bool shouldSearchHyperParameters() const { return hyperParameterSearchRequested; }
+	inline void setHyperParameterSearchDone() { hyperParameterSearchRequested = false; }
+	//! Returns the hyperparameter search parameters
+	bool getHyperParameterSearchParams(masc::HyperParameterSearchParams& params, QString& error) const;
+
+	//! Returns whether the cross-validation has been requested
+	inline bool shouldCrossValidate() const { return crossValidationRequested; }
+	inline void setCrossValidationDone() { crossValidationRequested = false; }
+
 	void addConfusionMatrixAndSaveTraces(ConfusionMatrix* ptr);
 	void setInputFilePath(QString filename);
 	void setCheckBoxSaveTrace(bool state);
@@ -73,12 +99,19 @@ protected slots:
 
 	void onClose();
 	void onSave();
+	void onModelTypeChanged(int index);
+	void onSelectFeatures();
+	void onSearchHyperParameters();
+	void onCrossValidate();
 	void onExportResults(QString filePath = "");
 
 protected: //members
 
 	bool classifierSaved;
 	bool saveRequested;
+	bool featureSelectionRequested;
+	bool hyperParameterSearchRequested;
+	bool crossValidationRequested;
 	std::vector<ConfusionMatrix*> toDeleteLater;
 	bool traceFileConfigured;
 	QFile *m_traceFile;